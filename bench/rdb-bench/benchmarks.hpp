@@ -0,0 +1,26 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef BENCH_RDB_BENCH_BENCHMARKS_HPP_
+#define BENCH_RDB_BENCH_BENCHMARKS_HPP_
+
+/* Each of these times some part of answering a query the way it's done now
+against the way it used to be done, and prints the numbers. */
+
+// Reading rows stored as binary JSON against serialized cJSON trees.
+void binary_json_benchmark();
+
+// Building a GROUPEDMAPREDUCE's group table in a hash table against an ordered map.
+void group_benchmark();
+
+// Running filter and mapping bodies compiled against interpreting them for each row.
+void compiled_benchmark();
+
+// Merging updates into rows with cJSON and with json_value_t.
+void json_value_benchmark();
+
+// Parsing and printing a big document with cJSON.
+void cjson_benchmark();
+
+// Parsing and type checking point gets against recognizing them.
+void point_get_benchmark();
+
+#endif  // BENCH_RDB_BENCH_BENCHMARKS_HPP_
@@ -0,0 +1,57 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <string>
+
+#include "containers/archive/string_stream.hpp"
+#include "containers/archive/vector_stream.hpp"
+#include "rdb_protocol/binary_json.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+void binary_json_benchmark() {
+    const int num_rows = 100000;
+
+    scoped_cJSON_t row(cJSON_Parse("{\"id\": 12345, \"name\": \"Some User\", \"email\": \"someone@example.com\", "
+                                   "\"age\": 31, \"active\": true, \"tags\": [\"a\", \"b\", \"c\"], "
+                                   "\"address\": {\"street\": \"1 Main St\", \"city\": \"Anytown\", \"zip\": \"12345\"}}"));
+
+    std::string legacy;
+    {
+        write_message_t wm;
+        wm << *row.get();
+        vector_stream_t stream;
+        guarantee(send_write_message(&stream, &wm) == 0);
+        legacy.assign(stream.vector().begin(), stream.vector().end());
+    }
+    std::string encoded;
+    binary_json_encode(row.get(), &encoded);
+
+    ticks_t start = get_ticks();
+    for (int i = 0; i < num_rows; ++i) {
+        read_string_stream_t stream(legacy);
+        scoped_cJSON_t decoded(cJSON_CreateBlank());
+        guarantee(deserialize(&stream, decoded.get()) == 0);
+    }
+    double legacy_secs = ticks_to_secs(get_ticks() - start);
+
+    start = get_ticks();
+    for (int i = 0; i < num_rows; ++i) {
+        scoped_cJSON_t decoded(binary_json_decode(encoded.data(), encoded.size()));
+    }
+    double decode_secs = ticks_to_secs(get_ticks() - start);
+
+    start = get_ticks();
+    for (int i = 0; i < num_rows; ++i) {
+        binary_json_view_t view(encoded.data(), encoded.size());
+        binary_json_view_t field;
+        guarantee(view.field("age", &field));
+    }
+    double lookup_secs = ticks_to_secs(get_ticks() - start);
+
+    printf("%d rows (%zu bytes serialized, %zu bytes binary):\n", num_rows, legacy.size(), encoded.size());
+    printf("  deserialize cJSON tree:  %.3f s\n", legacy_secs);
+    printf("  decode binary json:      %.3f s\n", decode_secs);
+    printf("  look up one field:       %.3f s\n", lookup_secs);
+}
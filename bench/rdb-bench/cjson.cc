@@ -0,0 +1,45 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <string>
+
+#include "config/args.hpp"
+#include "http/json.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+void cjson_benchmark() {
+    const size_t document_size = 64 * MEGABYTE;
+    const size_t total_size = 2 * GIGABYTE;
+
+    // Rows like the ones the web UI pulls and json_import pushes.
+    std::string document = "[";
+    for (int i = 0; document.size() < document_size; ++i) {
+        if (i != 0) document += ",";
+        document += strprintf("{\"id\":%d,\"name\":\"user number %d\",\"email\":\"user%d@example.com\","
+                              "\"score\":%d,\"bio\":\"%s\",\"tags\":[\"a\",\"b\\n\"]}",
+                              i, i, i, i % 1000, std::string(100 + i % 100, 'z').c_str());
+    }
+    document += "]";
+
+    double parse_secs = 0, print_secs = 0;
+    size_t processed = 0;
+    while (processed < total_size) {
+        ticks_t start = get_ticks();
+        scoped_cJSON_t json(cJSON_Parse(document.c_str()));
+        parse_secs += ticks_to_secs(get_ticks() - start);
+        guarantee(json.get());
+
+        start = get_ticks();
+        std::string printed = json.PrintUnformatted();
+        print_secs += ticks_to_secs(get_ticks() - start);
+        guarantee(printed.size() == document.size());
+        processed += document.size();
+    }
+
+    double mb = static_cast<double>(processed) / MEGABYTE;
+    printf("%.0f MB of JSON:\n", mb);
+    printf("  parse:  %.3f s, %.0f MB/s\n", parse_secs, mb / parse_secs);
+    printf("  print:  %.3f s, %.0f MB/s\n", print_secs, mb / print_secs);
+}
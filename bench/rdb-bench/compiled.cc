@@ -0,0 +1,111 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "rdb_protocol/compiled_term.hpp"
+#include "rdb_protocol/query_language.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+static Term number_term(double d) {
+    Term t;
+    t.set_type(Term::NUMBER);
+    t.set_number(d);
+    return t;
+}
+
+static Term var_term(const std::string &var) {
+    Term t;
+    t.set_type(Term::VAR);
+    t.set_var(var);
+    return t;
+}
+
+static Term call_term(Builtin::BuiltinType type, const Term &arg1, const Term &arg2) {
+    Term t;
+    t.set_type(Term::CALL);
+    t.mutable_call()->mutable_builtin()->set_type(type);
+    *t.mutable_call()->add_args() = arg1;
+    *t.mutable_call()->add_args() = arg2;
+    return t;
+}
+
+static Term getattr_term(const Term &arg, const std::string &attr) {
+    Term t;
+    t.set_type(Term::CALL);
+    t.mutable_call()->mutable_builtin()->set_type(Builtin::GETATTR);
+    t.mutable_call()->mutable_builtin()->set_attr(attr);
+    *t.mutable_call()->add_args() = arg;
+    return t;
+}
+
+static Term compare_term(Builtin::Comparison comparison, const Term &lhs, const Term &rhs) {
+    Term t = call_term(Builtin::COMPARE, lhs, rhs);
+    t.mutable_call()->mutable_builtin()->set_comparison(comparison);
+    return t;
+}
+
+/* `row.age > 30 && row.age < 40 + limit`, with `limit` bound outside. */
+static Term age_predicate() {
+    return call_term(Builtin::ALL,
+                     compare_term(Builtin_Comparison_GT, getattr_term(var_term("row"), "age"), number_term(30)),
+                     compare_term(Builtin_Comparison_LT, getattr_term(var_term("row"), "age"),
+                                  call_term(Builtin::ADD, number_term(40), var_term("limit"))));
+}
+
+/* `let score = row.points * 2 in {"score": score - 1, "name": row.name}`. */
+static Term score_mapping() {
+    Term t;
+    t.set_type(Term::LET);
+    VarTermTuple *bind = t.mutable_let()->add_binds();
+    bind->set_var("score");
+    *bind->mutable_term() = call_term(Builtin::MULTIPLY, getattr_term(var_term("row"), "points"), number_term(2));
+    Term *expr = t.mutable_let()->mutable_expr();
+    expr->set_type(Term::OBJECT);
+    VarTermTuple *score = expr->add_object();
+    score->set_var("score");
+    *score->mutable_term() = call_term(Builtin::SUBTRACT, var_term("score"), number_term(1));
+    VarTermTuple *name = expr->add_object();
+    name->set_var("name");
+    *name->mutable_term() = getattr_term(var_term("row"), "name");
+    return t;
+}
+
+void compiled_benchmark() {
+    const int num_rows = 200000;
+
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > rows;
+    for (int i = 0; i < num_rows; ++i) {
+        rows.push_back(boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_Parse(
+            strprintf("{\"age\": %d, \"points\": %d, \"name\": \"user-%d\"}", i % 80, i % 17, i).c_str()))));
+    }
+
+    scopes_t scopes;
+    scopes.scope.push();
+    scopes.scope.put_in_scope("limit", boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_Parse("5"))));
+
+    const char *names[] = { "age predicate", "score mapping" };
+    Term bodies[] = { age_predicate(), score_mapping() };
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); ++i) {
+        ticks_t start = get_ticks();
+        for (int j = 0; j < num_rows; ++j) {
+            query_language::map_rdb("row", &bodies[i], NULL, scopes, backtrace_t(), rows[j]);
+        }
+        double interpreted_secs = ticks_to_secs(get_ticks() - start);
+
+        start = get_ticks();
+        query_language::compiled_lambda_t compiled("row", bodies[i], scopes, backtrace_t());
+        guarantee(compiled.compiled());
+        for (int j = 0; j < num_rows; ++j) {
+            compiled(rows[j]);
+        }
+        double compiled_secs = ticks_to_secs(get_ticks() - start);
+
+        printf("%s, %d rows:\n", names[i], num_rows);
+        printf("  interpreted:  %.3f s\n", interpreted_secs);
+        printf("  compiled:     %.3f s\n", compiled_secs);
+    }
+}
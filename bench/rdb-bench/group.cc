@@ -0,0 +1,47 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+
+#include "rdb_protocol/protocol.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+typedef rdb_protocol_t::rget_read_response_t::groups_t groups_t;
+
+void group_benchmark() {
+    const int num_rows = 1000000;
+    const int num_groups = 500000;
+
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > keys;
+    for (int i = 0; i < num_rows; ++i) {
+        int g = (i * 7919) % num_groups;
+        keys.push_back(boost::shared_ptr<scoped_cJSON_t>(
+            new scoped_cJSON_t(cJSON_Parse(strprintf("[\"user-%d\", %d]", g, g % 10).c_str()))));
+    }
+
+    ticks_t start = get_ticks();
+    std::map<boost::shared_ptr<scoped_cJSON_t>, int, query_language::shared_scoped_less_t> ordered;
+    for (int i = 0; i < num_rows; ++i) {
+        ++ordered[keys[i]];
+    }
+    double ordered_secs = ticks_to_secs(get_ticks() - start);
+
+    start = get_ticks();
+    groups_t hashed;
+    boost::shared_ptr<scoped_cJSON_t> one(new scoped_cJSON_t(cJSON_Parse("1")));
+    for (int i = 0; i < num_rows; ++i) {
+        groups_t::iterator group = hashed.find(keys[i]);
+        if (group == hashed.end()) {
+            hashed.insert(std::make_pair(keys[i], one));
+        }
+    }
+    double hashed_secs = ticks_to_secs(get_ticks() - start);
+
+    guarantee(ordered.size() == hashed.size());
+    printf("%d rows in %zu groups:\n", num_rows, hashed.size());
+    printf("  ordered map:  %.3f s\n", ordered_secs);
+    printf("  hash table:   %.3f s\n", hashed_secs);
+}
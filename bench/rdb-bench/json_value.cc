@@ -0,0 +1,84 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "config/args.hpp"
+#include "rdb_protocol/binary_json.hpp"
+#include "rdb_protocol/json_value.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+using query_language::json_arena_t;
+using query_language::json_value_t;
+
+/* The number of `malloc()`s cJSON made for `json`. */
+static int count_cjson_allocations(const cJSON *json) {
+    int res = 1;
+    if (json->valuestring) ++res;
+    if (json->string) ++res;
+    for (const cJSON *child = json->child; child; child = child->next) {
+        res += count_cjson_allocations(child);
+    }
+    return res;
+}
+
+void json_value_benchmark() {
+    const int num_rows = 100000;
+    const int num_fields = 20;
+
+    std::vector<cJSON *> rows;
+    std::vector<cJSON *> updates;
+    for (int i = 0; i < num_rows; ++i) {
+        std::string row = strprintf("{\"id\":%d", i);
+        for (int j = 0; j < num_fields; ++j) {
+            row += strprintf(",\"field%d\":\"value %d of row %d\"", j, j, i);
+        }
+        row += "}";
+        rows.push_back(cJSON_Parse(row.c_str()));
+        updates.push_back(cJSON_Parse(strprintf("{\"field%d\":%d}", i % num_fields, i).c_str()));
+    }
+
+    // What an UPDATE does to each row: merge in the new fields, and encode
+    // the result for the disk.
+    int cjson_allocations = 0;
+    size_t cjson_bytes = 0;
+    ticks_t start = get_ticks();
+    for (int i = 0; i < num_rows; ++i) {
+        scoped_cJSON_t merged(cJSON_merge(rows[i], updates[i]));
+        std::string encoded;
+        binary_json_encode(merged.get(), &encoded);
+        cjson_allocations += count_cjson_allocations(merged.get());
+        cjson_bytes += encoded.size();
+    }
+    double cjson_secs = ticks_to_secs(get_ticks() - start);
+
+    // The same with one arena per batch, as `rdb_range_modify()` does it.
+    size_t arena_allocations = 0;
+    size_t arena_bytes = 0;
+    start = get_ticks();
+    for (int i = 0; i < num_rows; i += RDB_RANGE_MODIFY_BATCH_SIZE) {
+        json_arena_t arena;
+        for (int j = i; j < i + RDB_RANGE_MODIFY_BATCH_SIZE && j < num_rows; ++j) {
+            const json_value_t *merged = json_value_t::merge(&arena, json_value_t::from_cjson(&arena, rows[j]),
+                                                             json_value_t::from_cjson(&arena, updates[j]));
+            std::string encoded;
+            binary_json_encode(merged, &encoded);
+            arena_bytes += encoded.size();
+        }
+        arena_allocations += arena.num_chunks();
+    }
+    double arena_secs = ticks_to_secs(get_ticks() - start);
+
+    guarantee(cjson_bytes == arena_bytes);
+    for (int i = 0; i < num_rows; ++i) {
+        cJSON_Delete(rows[i]);
+        cJSON_Delete(updates[i]);
+    }
+
+    printf("%d updates of rows of %d fields:\n", num_rows, num_fields + 1);
+    printf("  cJSON:       %.3f s, %d allocations\n", cjson_secs, cjson_allocations);
+    printf("  json_value:  %.3f s, %zu allocations\n", arena_secs, arena_allocations);
+}
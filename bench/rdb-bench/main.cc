@@ -0,0 +1,58 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+#include <string.h>
+
+#include "benchmarks.hpp"
+
+/* Times the parts of the query path that the unittests only check for
+correctness. Give it the names of the benchmarks to run, or none to run all of
+them. */
+
+struct benchmark_t {
+    const char *name;
+    void (*run)();
+};
+
+const benchmark_t benchmarks[] = {
+    { "binary_json", &binary_json_benchmark },
+    { "group", &group_benchmark },
+    { "compiled", &compiled_benchmark },
+    { "json_value", &json_value_benchmark },
+    { "cjson", &cjson_benchmark },
+    { "point_get", &point_get_benchmark },
+};
+const size_t num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+bool is_benchmark(const char *name) {
+    for (size_t i = 0; i < num_benchmarks; ++i) {
+        if (strcmp(benchmarks[i].name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (!is_benchmark(argv[i])) {
+            fprintf(stderr, "Usage: %s [benchmark...]\nBenchmarks:", argv[0]);
+            for (size_t j = 0; j < num_benchmarks; ++j) {
+                fprintf(stderr, " %s", benchmarks[j].name);
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < num_benchmarks; ++i) {
+        bool run = (argc == 1);
+        for (int j = 1; j < argc; ++j) {
+            run = run || strcmp(benchmarks[i].name, argv[j]) == 0;
+        }
+        if (run) {
+            printf("== %s\n", benchmarks[i].name);
+            benchmarks[i].run();
+        }
+    }
+    return 0;
+}
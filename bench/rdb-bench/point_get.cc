@@ -0,0 +1,60 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "rdb_protocol/query_language.hpp"
+#include "utils.hpp"
+
+#include "benchmarks.hpp"
+
+static void make_point_get(Term *t, const std::string &table_name, double key) {
+    t->set_type(Term::GETBYKEY);
+    Term::GetByKey *get = t->mutable_get_by_key();
+    get->mutable_table_ref()->set_db_name("test");
+    get->mutable_table_ref()->set_table_name(table_name);
+    get->set_attrname("id");
+    get->mutable_key()->set_type(Term::NUMBER);
+    get->mutable_key()->set_number(key);
+}
+
+/* What answering a point get costs before it gets to the table: parsing and
+type checking the query the usual way against parsing it and recognizing it. */
+void point_get_benchmark() {
+    const int num_queries = 1000000;
+
+    std::vector<std::string> queries;
+    for (int i = 0; i < 1000; ++i) {
+        Query q;
+        q.set_type(Query::READ);
+        q.set_token(i);
+        make_point_get(q.mutable_read_query()->mutable_term(), "foo", i);
+        queries.push_back(q.SerializeAsString());
+    }
+
+    ticks_t start = get_ticks();
+    for (int i = 0; i < num_queries; ++i) {
+        const std::string &serialized = queries[i % queries.size()];
+        Query q;
+        guarantee(q.ParseFromString(serialized));
+        query_language::type_checking_environment_t type_environment;
+        bool is_deterministic;
+        query_language::check_query_type(&q, &type_environment, &is_deterministic, query_language::backtrace_t());
+    }
+    double checked_secs = ticks_to_secs(get_ticks() - start);
+
+    start = get_ticks();
+    for (int i = 0; i < num_queries; ++i) {
+        const std::string &serialized = queries[i % queries.size()];
+        Query q;
+        guarantee(q.ParseFromString(serialized));
+        std::vector<Term::GetByKey *> gets;
+        guarantee(query_language::get_point_gets(q.mutable_read_query()->mutable_term(), &gets));
+    }
+    double recognized_secs = ticks_to_secs(get_ticks() - start);
+
+    printf("%d point gets:\n", num_queries);
+    printf("  parse and type check:  %.3f us each\n", checked_secs * 1e6 / num_queries);
+    printf("  parse and recognize:   %.3f us each\n", recognized_secs * 1e6 / num_queries);
+}
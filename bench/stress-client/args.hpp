@@ -232,6 +232,7 @@ void list_protocols() {
     // I'll just cheat here.
     printf("rethinkdb");
     printf("sockmemcached,");
+    printf("binmemcached,");
 #ifdef USE_MYSQL
     printf("mysql,");
 #endif
@@ -466,7 +467,8 @@ void parse(config_t *config, int argc, char *argv[]) {
     //validation:
     bool only_sockmemcached = true;
     for(int i = 0; i < config->servers.size(); i++) {
-        if(config->servers[i].protocol != protocol_sockmemcached) {
+        if(config->servers[i].protocol != protocol_sockmemcached &&
+           config->servers[i].protocol != protocol_binmemcached) {
             only_sockmemcached = false;
             break;
         }
@@ -481,7 +483,7 @@ void parse(config_t *config, int argc, char *argv[]) {
             config->op_ratios.verifies > 0 ||
             !only_sockmemcached)
         {
-            fprintf(stderr, "Pipelining can only be used with read operations on a sockmemcached protocol.\n");
+            fprintf(stderr, "Pipelining can only be used with read operations on a sockmemcached or binmemcached protocol.\n");
             usage(argv[0]);
         }
     }
@@ -1,6 +1,7 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
 #include "protocol.hpp"
 #include "protocols/memcached_sock_protocol.hpp"
+#include "protocols/memcached_bin_protocol.hpp"
 #ifdef USE_LIBMEMCACHED
 #  include "protocols/memcached_protocol.hpp"
 #endif
@@ -16,6 +17,8 @@ protocol_t *server_t::connect() {
         return new rethinkdb_protocol_t(host);
     case protocol_sockmemcached:
         return new memcached_sock_protocol_t(host);
+    case protocol_binmemcached:
+        return new memcached_bin_protocol_t(host);
 #ifdef USE_MYSQL
     case protocol_mysql:
         return new mysql_protocol_t(host);
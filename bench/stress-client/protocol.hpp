@@ -60,6 +60,7 @@ public:
 enum protocol_enum_t {
     protocol_rethinkdb,
     protocol_sockmemcached,
+    protocol_binmemcached,
 #ifdef USE_MYSQL
     protocol_mysql,
 #endif
@@ -79,6 +80,8 @@ struct server_t {
             return protocol_rethinkdb;
         } else if (strcmp(name, "sockmemcached") == 0) {
             return protocol_sockmemcached;
+        } else if (strcmp(name, "binmemcached") == 0) {
+            return protocol_binmemcached;
 #ifdef USE_MYSQL
         } else if (strcmp(name, "mysql") == 0) {
             return protocol_mysql;
@@ -115,6 +118,8 @@ struct server_t {
             printf("rethinkdb");
         } else if (protocol == protocol_sockmemcached) {
             printf("sockmemcached");
+        } else if (protocol == protocol_binmemcached) {
+            printf("binmemcached");
 #ifdef USE_MYSQL
         } else if (protocol == protocol_mysql) {
             printf("mysql");
@@ -0,0 +1,314 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef __STRESS_CLIENT_PROTOCOLS_MEMCACHED_BIN_PROTOCOL_HPP__
+#define __STRESS_CLIENT_PROTOCOLS_MEMCACHED_BIN_PROTOCOL_HPP__
+
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <map>
+#include "protocol.hpp"
+
+/* `memcached_bin_protocol_t` speaks the memcached binary protocol. Multi-key
+reads are sent as a run of quiet "getkq" requests followed by a "noop"; the
+server only answers the keys it found and then the "noop", so the client knows
+the batch is complete without the server having to send a reply per miss. */
+
+#define BIN_MC_HEADER_SIZE 24
+
+#define BIN_MC_REQUEST_MAGIC 0x80
+#define BIN_MC_RESPONSE_MAGIC 0x81
+
+#define BIN_MC_OP_SET 0x01
+#define BIN_MC_OP_DELETE 0x04
+#define BIN_MC_OP_NOOP 0x0a
+#define BIN_MC_OP_GETKQ 0x0d
+#define BIN_MC_OP_APPEND 0x0e
+#define BIN_MC_OP_PREPEND 0x0f
+
+#define BIN_MC_STATUS_OK 0x0000
+#define BIN_MC_STATUS_KEY_NOT_FOUND 0x0001
+#define BIN_MC_STATUS_NOT_STORED 0x0005
+
+struct memcached_bin_protocol_t : public protocol_t {
+    memcached_bin_protocol_t(const char *conn_str)
+        : outstanding_reads(0), sockfd(-1)
+    {
+        // init the socket
+        sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0) {
+            fprintf(stderr, "Could not create socket\n");
+            exit(-1);
+        }
+
+        // Parse the host string
+        char _host[MAX_HOST];
+        strncpy(_host, conn_str, MAX_HOST);
+
+        int port;
+        if (char *_port = strchr(_host, ':')) {
+            *_port = '\0';
+            _port++;
+            port = atoi(_port);
+            if (port == 0) {
+                fprintf(stderr, "Cannot parse port string: \"%s\".\n", _port);
+                exit(-1);
+            }
+        } else {
+            fprintf(stderr, "Please use host string of the form host:port.\n");
+            exit(-1);
+        }
+
+        // Setup the host/port data structures
+        struct sockaddr_in sin;
+        struct hostent *host = gethostbyname(_host);
+        if (!host) {
+            herror("Could not gethostbyname()");
+            exit(-1);
+        }
+        memcpy(&sin.sin_addr.s_addr, host->h_addr, host->h_length);
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+
+        // Connect to server
+        int res = ::connect(sockfd, (struct sockaddr *)&sin, sizeof(sin));
+        if (res < 0) {
+            int err = errno;
+            fprintf(stderr, "Could not connect to server (%d)\n", err);
+            exit(-1);
+        }
+    }
+
+    virtual ~memcached_bin_protocol_t() {
+        if (sockfd != -1) {
+            int res = close(sockfd);
+            if (res != 0) {
+                fprintf(stderr, "Could not close socket\n");
+                exit(-1);
+            }
+        }
+    }
+
+    virtual void remove(const char *key, size_t key_size) {
+        assert(!exist_outstanding_pipeline_reads());
+        send_buffer.clear();
+        append_request(BIN_MC_OP_DELETE, key, key_size, NULL, 0, NULL, 0);
+        send_command();
+
+        uint16_t status = read_response(NULL);
+        if (status != BIN_MC_STATUS_OK && status != BIN_MC_STATUS_KEY_NOT_FOUND) {
+            throw protocol_error_t("Unexpected status for delete: " + status_string(status));
+        }
+    }
+
+    virtual void update(const char *key, size_t key_size,
+                        const char *value, size_t value_size) {
+        assert(!exist_outstanding_pipeline_reads());
+        insert(key, key_size, value, value_size);
+    }
+
+    virtual void insert(const char *key, size_t key_size,
+                        const char *value, size_t value_size) {
+        assert(!exist_outstanding_pipeline_reads());
+        // Flags and expiration time, both zero
+        char extras[8];
+        memset(extras, 0, sizeof(extras));
+
+        send_buffer.clear();
+        append_request(BIN_MC_OP_SET, key, key_size, value, value_size, extras, sizeof(extras));
+        send_command();
+
+        uint16_t status = read_response(NULL);
+        if (status != BIN_MC_STATUS_OK) {
+            throw protocol_error_t("Unexpected status for set: " + status_string(status));
+        }
+    }
+
+    virtual void read(payload_t *keys, int count, payload_t *values = NULL) {
+        assert(!exist_outstanding_pipeline_reads());
+        enqueue_read(keys, count, values);
+        dequeue_read(keys, count, values);
+    }
+
+    int outstanding_reads;
+
+    /* add a read to the pipeline */
+    void enqueue_read(payload_t *keys, int count, payload_t *values = NULL) {
+        send_buffer.clear();
+        for (int i = 0; i < count; i++) {
+            append_request(BIN_MC_OP_GETKQ, keys[i].first, keys[i].second, NULL, 0, NULL, 0);
+        }
+        append_request(BIN_MC_OP_NOOP, NULL, 0, NULL, 0, NULL, 0);
+        send_command();
+        outstanding_reads++;
+    }
+
+    bool dequeue_read_maybe(payload_t *keys, int count, payload_t *values = NULL) {
+        dequeue_read(keys, count, values);
+        return true;
+    }
+
+    /* Wait until the oldest batch of pipelined reads has been returned */
+    void dequeue_read(payload_t *keys, int count, payload_t *values = NULL) {
+        std::map<std::string, std::string> found;
+        for (;;) {
+            response_t response;
+            uint16_t status = read_response(&response);
+            if (response.opcode == BIN_MC_OP_NOOP) {
+                break;
+            }
+            if (status != BIN_MC_STATUS_OK) {
+                throw protocol_error_t("Unexpected status for get: " + status_string(status));
+            }
+            if (values) {
+                found[response.key] = response.value;
+            }
+        }
+        outstanding_reads--;
+
+        if (values) {
+            for (int i = 0; i < count; i++) {
+                const std::string &value = found[std::string(keys[i].first, keys[i].second)];
+                if (value != std::string(values[i].first, values[i].second)) {
+                    fprintf(stderr, "Got unexpected value: %s instead of %s\n", value.c_str(), values[i].first);
+                }
+            }
+        }
+    }
+
+    bool exist_outstanding_pipeline_reads() {
+        return outstanding_reads != 0;
+    }
+
+    virtual void range_read(char* lkey, size_t lkey_size, char* rkey, size_t rkey_size, int count_limit, payload_t *values = NULL) {
+        throw protocol_error_t("Range reads are not part of the memcached binary protocol.");
+    }
+
+    virtual void append(const char *key, size_t key_size,
+                        const char *value, size_t value_size) {
+        append_prepend(BIN_MC_OP_APPEND, key, key_size, value, value_size);
+    }
+
+    virtual void prepend(const char *key, size_t key_size,
+                          const char *value, size_t value_size) {
+        append_prepend(BIN_MC_OP_PREPEND, key, key_size, value, value_size);
+    }
+
+private:
+    struct response_t {
+        uint8_t opcode;
+        std::string key;
+        std::string value;
+    };
+
+    void append_prepend(uint8_t opcode, const char *key, size_t key_size,
+                        const char *value, size_t value_size) {
+        assert(!exist_outstanding_pipeline_reads());
+        send_buffer.clear();
+        append_request(opcode, key, key_size, value, value_size, NULL, 0);
+        send_command();
+
+        uint16_t status = read_response(NULL);
+        if (status != BIN_MC_STATUS_OK && status != BIN_MC_STATUS_NOT_STORED) {
+            throw protocol_error_t("Unexpected status for append/prepend: " + status_string(status));
+        }
+    }
+
+    void append_request(uint8_t opcode, const char *key, size_t key_size,
+                        const char *value, size_t value_size,
+                        const char *extras, size_t extras_size) {
+        uint32_t body_size = extras_size + key_size + value_size;
+
+        char header[BIN_MC_HEADER_SIZE];
+        memset(header, 0, sizeof(header));
+        header[0] = BIN_MC_REQUEST_MAGIC;
+        header[1] = opcode;
+        uint16_t net_key_size = htons(key_size);
+        memcpy(header + 2, &net_key_size, 2);
+        header[4] = extras_size;
+        uint32_t net_body_size = htonl(body_size);
+        memcpy(header + 8, &net_body_size, 4);
+
+        send_buffer.insert(send_buffer.end(), header, header + sizeof(header));
+        if (extras_size) send_buffer.insert(send_buffer.end(), extras, extras + extras_size);
+        if (key_size) send_buffer.insert(send_buffer.end(), key, key + key_size);
+        if (value_size) send_buffer.insert(send_buffer.end(), value, value + value_size);
+    }
+
+    /* Reads one response packet and returns its status. The key and value are
+    only copied out if `out` is non-NULL. */
+    uint16_t read_response(response_t *out) {
+        char header[BIN_MC_HEADER_SIZE];
+        recv_exactly(header, sizeof(header));
+        if (static_cast<uint8_t>(header[0]) != BIN_MC_RESPONSE_MAGIC) {
+            throw protocol_error_t("Bad magic byte in binary response.");
+        }
+
+        uint16_t key_size, status;
+        uint32_t body_size;
+        memcpy(&key_size, header + 2, 2);
+        memcpy(&status, header + 6, 2);
+        memcpy(&body_size, header + 8, 4);
+        key_size = ntohs(key_size);
+        status = ntohs(status);
+        body_size = ntohl(body_size);
+        uint8_t extras_size = header[4];
+
+        if (body_size < extras_size + key_size) {
+            throw protocol_error_t("Malformed binary response.");
+        }
+
+        recv_buffer.resize(body_size);
+        if (body_size) recv_exactly(recv_buffer.data(), body_size);
+
+        if (out) {
+            out->opcode = header[1];
+            const char *key = recv_buffer.data() + extras_size;
+            out->key.assign(key, key_size);
+            out->value.assign(key + key_size, body_size - extras_size - key_size);
+        }
+        return status;
+    }
+
+    static std::string status_string(uint16_t status) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "0x%04x", status);
+        return buf;
+    }
+
+    void recv_exactly(char *buf, size_t size) {
+        while (size > 0) {
+            ssize_t res = recv(sockfd, buf, size, 0);
+            if (res <= 0) {
+                perror("Unable to read from socket");
+                exit(-1);
+            }
+            buf += res;
+            size -= res;
+        }
+    }
+
+    void send_command() {
+        size_t count = 0;
+        while (count < send_buffer.size()) {
+            ssize_t res = write(sockfd, send_buffer.data() + count, send_buffer.size() - count);
+            if (res < 0) {
+                fprintf(stderr, "Could not send command (%d)\n", errno);
+                exit(-1);
+            }
+            count += res;
+        }
+    }
+
+private:
+    int sockfd;
+    std::vector<char> send_buffer;
+    std::vector<char> recv_buffer;
+};
+
+#endif  // __STRESS_CLIENT_PROTOCOLS_MEMCACHED_BIN_PROTOCOL_HPP__
@@ -153,6 +153,55 @@ class TableList(MetaQueryInner):
             printer.simple_string(repr(self.db_expr.db_name), ["db_name"])
             )
 
+def _table_string(table):
+    res = ""
+    if table.db_expr:
+        res += "db(%r)." % table.db_expr.db_name
+    res += "table(%r)" % table.table_name
+    return res
+
+class IndexCreate(MetaQueryInner):
+    def __init__(self, table, attr_name):
+        assert isinstance(table, query.Table)
+        assert isinstance(attr_name, str)
+        self.table = table
+        self.attr_name = attr_name
+    def _write_meta_query(self, parent, opts):
+        parent.type = p.MetaQuery.CREATE_INDEX
+        self.table._write_ref_ast(parent.create_index.table_ref, opts)
+        parent.create_index.attrname = self.attr_name
+    def pretty_print(self, printer):
+        return "%s.index_create(%s)" % (
+            printer.simple_string(_table_string(self.table), ["table_ref"]),
+            printer.simple_string(repr(self.attr_name), ["attrname"])
+            )
+
+class IndexDrop(MetaQueryInner):
+    def __init__(self, table, attr_name):
+        assert isinstance(table, query.Table)
+        assert isinstance(attr_name, str)
+        self.table = table
+        self.attr_name = attr_name
+    def _write_meta_query(self, parent, opts):
+        parent.type = p.MetaQuery.DROP_INDEX
+        self.table._write_ref_ast(parent.drop_index.table_ref, opts)
+        parent.drop_index.attrname = self.attr_name
+    def pretty_print(self, printer):
+        return "%s.index_drop(%s)" % (
+            printer.simple_string(_table_string(self.table), ["table_ref"]),
+            printer.simple_string(repr(self.attr_name), ["attrname"])
+            )
+
+class IndexList(MetaQueryInner):
+    def __init__(self, table):
+        assert isinstance(table, query.Table)
+        self.table = table
+    def _write_meta_query(self, parent, opts):
+        parent.type = p.MetaQuery.LIST_INDEXES
+        self.table._write_ref_ast(parent.list_indexes, opts)
+    def pretty_print(self, printer):
+        return "%s.index_list()" % printer.simple_string(_table_string(self.table), [])
+
 #################
 # WRITE QUERIES #
 #################
@@ -1657,6 +1657,42 @@ class Table(MultiRowSelection):
         """
         return RowSelection(internal.Get(self, key, attr_name))
 
+    def index_create(self, attr_name):
+        """Create a secondary index on `attr_name`. Ranges and equality
+        filters on an indexed attribute only read the matching rows, and
+        ordering a range by its attribute doesn't need a sort.
+
+        Only rows whose value for `attr_name` is a number or a string are
+        indexed.
+
+        :param attr_name: the attribute to index
+        :type attr_name: str
+        :rtype: :class:`MetaQuery`
+
+        >>> q = table('users').index_create('age')
+        """
+        return MetaQuery(internal.IndexCreate(self, attr_name))
+
+    def index_drop(self, attr_name):
+        """Drop the secondary index on `attr_name`.
+
+        :param attr_name: the indexed attribute
+        :type attr_name: str
+        :rtype: :class:`MetaQuery`
+
+        >>> q = table('users').index_drop('age')
+        """
+        return MetaQuery(internal.IndexDrop(self, attr_name))
+
+    def index_list(self):
+        """List the attributes that have a secondary index.
+
+        :rtype: :class:`MetaQuery`
+
+        >>> q = table('users').index_list() # e.g. ['age']
+        """
+        return MetaQuery(internal.IndexList(self))
+
     def _write_ref_ast(self, parent, opts):
         if self.db_expr:
             parent.db_name = self.db_expr.db_name
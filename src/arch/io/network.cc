@@ -35,6 +35,7 @@ linux_tcp_conn_t::linux_tcp_conn_t(const ip_address_t &host, int port, signal_t
         sock(socket(AF_INET, SOCK_STREAM, 0)),
         event_watcher(new linux_event_watcher_t(sock.get(), this)),
         read_in_progress(false), write_in_progress(false),
+        read_buffer_start(0), read_buffer_end(0), read_size(IO_BUFFER_SIZE),
         write_handler(this),
         write_queue_limiter(WRITE_QUEUE_MAX_SIZE),
         write_coro_pool(1, &write_queue, &write_handler),
@@ -91,6 +92,7 @@ linux_tcp_conn_t::linux_tcp_conn_t(fd_t s) :
     sock(s),
     event_watcher(new linux_event_watcher_t(sock.get(), this)),
     read_in_progress(false), write_in_progress(false),
+    read_buffer_start(0), read_buffer_end(0), read_size(IO_BUFFER_SIZE),
     write_handler(this),
     write_queue_limiter(WRITE_QUEUE_MAX_SIZE),
     write_coro_pool(1, &write_queue, &write_handler),
@@ -137,12 +139,59 @@ void linux_tcp_conn_t::release_write_queue_op(write_queue_op_t *op) {
     unused_write_queue_ops.push_front(op);
 }
 
+size_t linux_tcp_conn_t::consume_read_buffer(void *buf, size_t size) {
+    size_t bytes = std::min(read_buffer_bytes(), size);
+    memcpy(buf, read_buffer_data(), bytes);
+    pop_read_buffer(bytes);
+    return bytes;
+}
+
+void linux_tcp_conn_t::pop_read_buffer(size_t size) {
+    rassert(size <= read_buffer_bytes());
+    read_buffer_start += size;
+    if (read_buffer_start == read_buffer_end) {
+        /* Nothing left, so we can start over at the front for free. */
+        read_buffer_start = read_buffer_end = 0;
+    }
+}
+
+void linux_tcp_conn_t::reserve_read_buffer(size_t size) {
+    if (read_buffer.size() - read_buffer_end >= size) {
+        return;
+    }
+    size_t unconsumed = read_buffer_bytes();
+    if (read_buffer_start > 0) {
+        /* Reclaim the space taken up by bytes that were already popped. */
+        memmove(read_buffer.data(), read_buffer_data(), unconsumed);
+        read_buffer_start = 0;
+        read_buffer_end = unconsumed;
+    }
+    if (read_buffer.size() - read_buffer_end < size) {
+        read_buffer.resize(std::max(read_buffer.size() * 2, read_buffer_end + size));
+    }
+}
+
+void linux_tcp_conn_t::adapt_read_size(size_t asked, size_t got) {
+    if (got == asked && read_size < MAX_READ_SIZE) {
+        read_size *= 2;
+    } else if (got < asked / 4 && read_size > IO_BUFFER_SIZE) {
+        read_size /= 2;
+    }
+}
+
 size_t linux_tcp_conn_t::read_internal(void *buffer, size_t size) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    return readv_internal(&iov, 1);
+}
+
+size_t linux_tcp_conn_t::readv_internal(struct iovec *iov, int iovcnt) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
     assert_thread();
     rassert(!read_closed.is_pulsed());
 
     while (true) {
-        ssize_t res = ::read(sock.get(), buffer, size);
+        ssize_t res = ::readv(sock.get(), iov, iovcnt);
 
         if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             /* There's no data available right now, so we must wait for a notification from the
@@ -180,19 +229,38 @@ size_t linux_tcp_conn_t::read_internal(void *buffer, size_t size) THROWS_ONLY(tc
     }
 }
 
+size_t linux_tcp_conn_t::read_into_and_buffer(void *buf, size_t size) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
+    rassert(read_buffer_bytes() == 0);
+    reserve_read_buffer(read_size);
+
+    struct iovec iov[2];
+    iov[0].iov_base = buf;
+    iov[0].iov_len = size;
+    iov[1].iov_base = read_buffer.data() + read_buffer_end;
+    iov[1].iov_len = read_size;
+    size_t asked = read_size;
+    size_t delta = readv_internal(iov, 2);
+
+    if (delta <= size) {
+        return delta;
+    } else {
+        /* The caller's buffer is full; the rest went into `read_buffer`. */
+        read_buffer_end += delta - size;
+        adapt_read_size(asked, delta - size);
+        return size;
+    }
+}
+
 size_t linux_tcp_conn_t::read_some(void *buf, size_t size, signal_t *closer) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
     rassert(size > 0);
     read_op_wrapper_t sentry(this, closer);
 
-    if (read_buffer.size()) {
+    if (read_buffer_bytes()) {
         /* Return the data from the peek buffer */
-        size_t read_buffer_bytes = std::min(read_buffer.size(), size);
-        memcpy(buf, read_buffer.data(), read_buffer_bytes);
-        read_buffer.erase(read_buffer.begin(), read_buffer.begin() + read_buffer_bytes);
-        return read_buffer_bytes;
+        return consume_read_buffer(buf, size);
     } else {
         /* Go to the kernel _once_. */
-        return read_internal(buf, size);
+        return read_into_and_buffer(buf, size);
     }
 }
 
@@ -200,15 +268,15 @@ void linux_tcp_conn_t::read(void *buf, size_t size, signal_t *closer) THROWS_ONL
     read_op_wrapper_t sentry(this, closer);
 
     /* First, consume any data in the peek buffer */
-    int read_buffer_bytes = std::min(read_buffer.size(), size);
-    memcpy(buf, read_buffer.data(), read_buffer_bytes);
-    read_buffer.erase(read_buffer.begin(), read_buffer.begin() + read_buffer_bytes);
-    buf = reinterpret_cast<void *>(reinterpret_cast<char *>(buf) + read_buffer_bytes);
-    size -= read_buffer_bytes;
+    size_t buffered_bytes = consume_read_buffer(buf, size);
+    buf = reinterpret_cast<void *>(reinterpret_cast<char *>(buf) + buffered_bytes);
+    size -= buffered_bytes;
 
-    /* Now go to the kernel for any more data that we need */
+    /* Now go to the kernel for any more data that we need. Anything that
+    arrives after the end of this read gets picked up by `read_buffer` in the
+    same syscall. */
     while (size > 0) {
-        size_t delta = read_internal(buf, size);
+        size_t delta = read_into_and_buffer(buf, size);
         rassert(delta <= size);
         buf = reinterpret_cast<void *>(reinterpret_cast<char *>(buf) + delta);
         size -= delta;
@@ -218,11 +286,11 @@ void linux_tcp_conn_t::read(void *buf, size_t size, signal_t *closer) THROWS_ONL
 void linux_tcp_conn_t::read_more_buffered(signal_t *closer) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
     read_op_wrapper_t sentry(this, closer);
 
-    size_t old_size = read_buffer.size();
-    read_buffer.resize(old_size + IO_BUFFER_SIZE);
-    size_t delta = read_internal(read_buffer.data() + old_size, IO_BUFFER_SIZE);
-
-    read_buffer.resize(old_size + delta);
+    reserve_read_buffer(read_size);
+    size_t asked = read_buffer.size() - read_buffer_end;
+    size_t delta = read_internal(read_buffer.data() + read_buffer_end, asked);
+    read_buffer_end += delta;
+    adapt_read_size(asked, delta);
 }
 
 const_charslice linux_tcp_conn_t::peek() const THROWS_ONLY(tcp_conn_read_closed_exc_t) {
@@ -230,14 +298,14 @@ const_charslice linux_tcp_conn_t::peek() const THROWS_ONLY(tcp_conn_read_closed_
     rassert(!read_in_progress);   // Is there a read already in progress?
     if (read_closed.is_pulsed()) throw tcp_conn_read_closed_exc_t();
 
-    return const_charslice(read_buffer.data(), read_buffer.data() + read_buffer.size());
+    return const_charslice(read_buffer_data(), read_buffer_data() + read_buffer_bytes());
 }
 
 const_charslice linux_tcp_conn_t::peek(size_t size, signal_t *closer) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
-    while (read_buffer.size() < size) {
+    while (read_buffer_bytes() < size) {
         read_more_buffered(closer);
     }
-    return const_charslice(read_buffer.data(), read_buffer.data() + size);
+    return const_charslice(read_buffer_data(), read_buffer_data() + size);
 }
 
 void linux_tcp_conn_t::pop(size_t len, signal_t *closer) THROWS_ONLY(tcp_conn_read_closed_exc_t) {
@@ -246,7 +314,7 @@ void linux_tcp_conn_t::pop(size_t len, signal_t *closer) THROWS_ONLY(tcp_conn_re
     if (read_closed.is_pulsed()) throw tcp_conn_read_closed_exc_t();
 
     peek(len, closer);
-    read_buffer.erase(read_buffer.begin(), read_buffer.begin() + len);  // INEFFICIENT
+    pop_read_buffer(len);
 }
 
 void linux_tcp_conn_t::shutdown_read() {
@@ -5,6 +5,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -223,13 +224,51 @@ private:
     /* These are pulsed if and only if the read/write end of the connection has been closed. */
     cond_t read_closed, write_closed;
 
-    /* Holds data that we read from the socket but hasn't been consumed yet */
+    /* Holds data that we read from the socket but hasn't been consumed yet.
+    The unconsumed bytes are `read_buffer[read_buffer_start, read_buffer_end)`;
+    everything after `read_buffer_end` is free space for the next read. Popping
+    just advances `read_buffer_start`; the unconsumed bytes only get moved back
+    to the front when we need the space at the end, so each byte is copied at
+    most once no matter how many small requests are pipelined behind it. */
     std::vector<char> read_buffer;
+    size_t read_buffer_start, read_buffer_end;
+
+    /* How much we ask the kernel for when we fill `read_buffer`. It grows while
+    the kernel keeps filling our reads and shrinks when it doesn't, so a busy
+    pipelined connection takes fewer syscalls and an idle one stays small. */
+    size_t read_size;
+    static const size_t MAX_READ_SIZE = 64 * KILOBYTE;
+
+    size_t read_buffer_bytes() const { return read_buffer_end - read_buffer_start; }
+    const char *read_buffer_data() const { return read_buffer.data() + read_buffer_start; }
+
+    /* Copies up to `size` bytes out of `read_buffer` and consumes them.
+    Returns the number of bytes copied. */
+    size_t consume_read_buffer(void *buf, size_t size);
+    void pop_read_buffer(size_t size);
+
+    /* Makes sure there are at least `size` free bytes after `read_buffer_end`,
+    compacting or growing `read_buffer` as necessary. */
+    void reserve_read_buffer(size_t size);
+
+    /* Adjusts `read_size` after the kernel gave us `got` bytes when we asked
+    for `asked`. */
+    void adapt_read_size(size_t asked, size_t got);
 
     /* Reads up to the given number of bytes, but not necessarily that many. Simple wrapper around
     ::read(). Returns the number of bytes read or throws tcp_conn_read_closed_exc_t. Bypasses read_buffer. */
     size_t read_internal(void *buffer, size_t size) THROWS_ONLY(tcp_conn_read_closed_exc_t);
 
+    /* Like `read_internal()`, but scatters the data over `iov` with a single
+    call to ::readv(). */
+    size_t readv_internal(struct iovec *iov, int iovcnt) THROWS_ONLY(tcp_conn_read_closed_exc_t);
+
+    /* Reads at least one and at most `size` bytes directly into `buf` and, in
+    the same syscall, whatever else the kernel has ready into the free space of
+    `read_buffer`. Returns the number of bytes written to `buf`. `read_buffer`
+    must be empty. */
+    size_t read_into_and_buffer(void *buf, size_t size) THROWS_ONLY(tcp_conn_read_closed_exc_t);
+
     static const size_t WRITE_QUEUE_MAX_SIZE = 128 * KILOBYTE;
     static const size_t WRITE_CHUNK_SIZE = 8 * KILOBYTE;
 
@@ -301,19 +340,6 @@ private:
     `size` bytes from `buffer` to the socket. */
     void perform_write(const void *buffer, size_t size);
 
-    /* memcpy up to n bytes from read_buffer into dest. Returns the number of bytes
-    copied. Then pop_read_buffer() can be used to remove the fetched bytes from the read buffer.
-    */
-    // TODO ! Recover that to make pop() fast again
-    //size_t memcpy_from_read_buffer(void *buf, const size_t n);
-    //void pop_read_buffer(const size_t n);
-
-    /* To make pop() more efficient, we only actually erase part of the read_buffer
-    when POP_THRESHOLD bytes can be popped of. Before that point, we accumulate
-    the length of popped bytes in popped_bytes. */
-    static const size_t POP_THRESHOLD = 1024;
-    size_t popped_bytes;
-
     scoped_ptr_t<auto_drainer_t> drainer;
 };
 
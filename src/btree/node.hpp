@@ -49,6 +49,12 @@ struct btree_superblock_t {
 
     char metainfo_blob[METAINFO_BLOB_MAXREFLEN];
 
+    // This comes after the metainfo blob so that superblocks written before
+    // there were secondary indexes keep their layout.  In those it's zero,
+    // which is SUPERBLOCK_ID and so can't be a sindex block; it reads as
+    // NULL_BLOCK_ID (see real_superblock_t::get_sindex_block_id()).
+    block_id_t sindex_block;
+
     static const block_magic_t expected_magic;
 };
 
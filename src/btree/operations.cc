@@ -40,6 +40,18 @@ void real_superblock_t::set_stat_block_id(const block_id_t new_stat_block) {
     sb_buf_.set_data(const_cast<block_id_t *>(&(static_cast<const btree_superblock_t *>(sb_buf_.get_data_read())->stat_block)), &new_stat_block, sizeof(new_stat_block));
 }
 
+block_id_t real_superblock_t::get_sindex_block_id() const {
+    rassert(sb_buf_.is_acquired());
+    block_id_t sindex_block = reinterpret_cast<const btree_superblock_t *>(sb_buf_.get_data_read())->sindex_block;
+    // Superblocks from before secondary indexes were zeroed past the metainfo blob.
+    return sindex_block == SUPERBLOCK_ID ? NULL_BLOCK_ID : sindex_block;
+}
+
+void real_superblock_t::set_sindex_block_id(const block_id_t new_sindex_block) {
+    rassert(sb_buf_.is_acquired());
+    sb_buf_.set_data(const_cast<block_id_t *>(&(static_cast<const btree_superblock_t *>(sb_buf_.get_data_read())->sindex_block)), &new_sindex_block, sizeof(new_sindex_block));
+}
+
 void real_superblock_t::set_eviction_priority(eviction_priority_t eviction_priority) {
     rassert(sb_buf_.is_acquired());
     sb_buf_.set_eviction_priority(eviction_priority);
@@ -31,6 +31,9 @@ public:
     virtual block_id_t get_stat_block_id() const = 0;
     virtual void set_stat_block_id(block_id_t new_stat_block) = 0;
 
+    virtual block_id_t get_sindex_block_id() const = 0;
+    virtual void set_sindex_block_id(block_id_t new_sindex_block) = 0;
+
     virtual void set_eviction_priority(eviction_priority_t eviction_priority) = 0;
     virtual eviction_priority_t get_eviction_priority() = 0;
 
@@ -53,6 +56,9 @@ public:
     block_id_t get_stat_block_id() const;
     void set_stat_block_id(block_id_t new_stat_block);
 
+    block_id_t get_sindex_block_id() const;
+    void set_sindex_block_id(block_id_t new_sindex_block);
+
     void set_eviction_priority(eviction_priority_t eviction_priority);
     eviction_priority_t get_eviction_priority();
 
@@ -91,6 +97,14 @@ public:
         crash("Not implemented\n");
     }
 
+    block_id_t get_sindex_block_id() const {
+        crash("Not implemented\n");
+    }
+
+    void set_sindex_block_id(block_id_t) {
+        crash("Not implemented\n");
+    }
+
     void set_eviction_priority(UNUSED eviction_priority_t eviction_priority) {
         // TODO Actually support the setting and getting of eviction priority in a virtual superblock.
     }
@@ -0,0 +1,109 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "btree/secondary_operations.hpp"
+
+#include "btree/node.hpp"
+#include "btree/operations.hpp"
+#include "buffer_cache/blob.hpp"
+#include "buffer_cache/buffer_cache.hpp"
+#include "containers/archive/buffer_group_stream.hpp"
+#include "containers/archive/stl_types.hpp"
+#include "containers/archive/vector_stream.hpp"
+
+const block_magic_t btree_sindex_block_t::expected_magic = { { 's', 'i', 'n', 'd' } };
+
+void ensure_sindex_block(transaction_t *txn, superblock_t *superblock) {
+    if (superblock->get_sindex_block_id() == NULL_BLOCK_ID) {
+        buf_lock_t sindex_block(txn);
+        btree_sindex_block_t *data = static_cast<btree_sindex_block_t *>(sindex_block.get_data_major_write());
+        bzero(data, txn->get_cache()->get_block_size().value());
+
+        // data->sindex_blob has been properly zeroed.
+
+        data->magic = btree_sindex_block_t::expected_magic;
+        superblock->set_sindex_block_id(sindex_block.get_block_id());
+    }
+}
+
+void get_secondary_indexes(transaction_t *txn, buf_lock_t *sindex_block, std::map<std::string, secondary_index_t> *sindexes_out) {
+    const btree_sindex_block_t *data = static_cast<const btree_sindex_block_t *>(sindex_block->get_data_read());
+    rassert(data->magic == btree_sindex_block_t::expected_magic);
+
+    // The const cast is okay because we access the data with rwi_read
+    // and don't write to the blob.
+    blob_t blob(const_cast<char *>(data->sindex_blob), btree_sindex_block_t::SINDEX_BLOB_MAXREFLEN);
+
+    sindexes_out->clear();
+    if (blob.valuesize() == 0) {
+        return;
+    }
+
+    blob_acq_t acq;
+    buffer_group_t group;
+    blob.expose_all(txn, rwi_read, &group, &acq);
+
+    buffer_group_read_stream_t read_stream(const_view(&group));
+    int res = deserialize(&read_stream, sindexes_out);
+    guarantee_err(res == 0, "corruption detected in the sindex block\n");
+}
+
+static void set_secondary_indexes(transaction_t *txn, buf_lock_t *sindex_block, const std::map<std::string, secondary_index_t> &sindexes) {
+    btree_sindex_block_t *data = static_cast<btree_sindex_block_t *>(sindex_block->get_data_major_write());
+    rassert(data->magic == btree_sindex_block_t::expected_magic);
+
+    blob_t blob(data->sindex_blob, btree_sindex_block_t::SINDEX_BLOB_MAXREFLEN);
+    blob.clear(txn);
+
+    write_message_t wm;
+    wm << sindexes;
+    vector_stream_t stream;
+    int res = send_write_message(&stream, &wm);
+    guarantee_err(res == 0, "Serialization of the sindex map failed... this shouldn't happen.\n");
+
+    blob.append_region(txn, stream.vector().size());
+    std::string sered_data(stream.vector().begin(), stream.vector().end());
+    blob.write_from_string(sered_data, txn, 0);
+}
+
+bool get_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id, secondary_index_t *sindex_out) {
+    std::map<std::string, secondary_index_t> sindexes;
+    get_secondary_indexes(txn, sindex_block, &sindexes);
+
+    std::map<std::string, secondary_index_t>::iterator it = sindexes.find(id);
+    if (it == sindexes.end()) {
+        return false;
+    }
+    *sindex_out = it->second;
+    return true;
+}
+
+void set_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id, const secondary_index_t &sindex) {
+    std::map<std::string, secondary_index_t> sindexes;
+    get_secondary_indexes(txn, sindex_block, &sindexes);
+
+    sindexes[id] = sindex;
+    set_secondary_indexes(txn, sindex_block, sindexes);
+}
+
+bool delete_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id) {
+    std::map<std::string, secondary_index_t> sindexes;
+    get_secondary_indexes(txn, sindex_block, &sindexes);
+
+    if (sindexes.erase(id) == 0) {
+        return false;
+    }
+    set_secondary_indexes(txn, sindex_block, sindexes);
+    return true;
+}
+
+block_id_t create_secondary_index_superblock(transaction_t *txn) {
+    buf_lock_t superblock(txn);
+    btree_superblock_t *sb = static_cast<btree_superblock_t *>(superblock.get_data_major_write());
+    bzero(sb, txn->get_cache()->get_block_size().value());
+
+    sb->magic = btree_superblock_t::expected_magic;
+    sb->root_block = NULL_BLOCK_ID;
+    sb->stat_block = NULL_BLOCK_ID;
+    sb->sindex_block = NULL_BLOCK_ID;
+
+    return superblock.get_block_id();
+}
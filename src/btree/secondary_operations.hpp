@@ -0,0 +1,61 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef BTREE_SECONDARY_OPERATIONS_HPP_
+#define BTREE_SECONDARY_OPERATIONS_HPP_
+
+#include <map>
+#include <string>
+
+#include "buffer_cache/types.hpp"
+#include "rpc/serialize_macros.hpp"
+#include "serializer/types.hpp"
+
+class superblock_t;
+
+/* Secondary indexes are extra btrees that live in the same cache as the
+primary btree. The superblock points to the sindex block, which holds a blob
+mapping each index's name to the superblock of its btree. The btree layer
+doesn't know what's stored in an index; whatever the protocol needs in order
+to maintain it goes in `opaque_definition`.
+
+Anybody using an index holds the sindex block (in `rwi_read` mode) for as long
+as they use it. Creating and dropping indexes acquires it in `rwi_write` mode,
+so an index can't be dropped out from under a read or a write. */
+
+//Note: This struct is stored directly on disk.  Changing it invalidates old data.
+struct btree_sindex_block_t {
+    block_magic_t magic;
+
+    static const int SINDEX_BLOB_MAXREFLEN = 1500;
+
+    char sindex_blob[SINDEX_BLOB_MAXREFLEN];
+
+    static const block_magic_t expected_magic;
+};
+
+struct secondary_index_t {
+    secondary_index_t() : superblock(NULL_BLOCK_ID) { }
+
+    /* The superblock of the index's btree. It's an ordinary
+    `btree_superblock_t`, so `real_superblock_t` works on it. */
+    block_id_t superblock;
+
+    std::string opaque_definition;
+
+    RDB_MAKE_ME_SERIALIZABLE_2(superblock, opaque_definition);
+};
+
+/* Creates the sindex block for the superblock if it doesn't already have one. */
+void ensure_sindex_block(transaction_t *txn, superblock_t *superblock);
+
+void get_secondary_indexes(transaction_t *txn, buf_lock_t *sindex_block, std::map<std::string, secondary_index_t> *sindexes_out);
+
+bool get_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id, secondary_index_t *sindex_out);
+
+void set_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id, const secondary_index_t &sindex);
+
+bool delete_secondary_index(transaction_t *txn, buf_lock_t *sindex_block, const std::string &id);
+
+/* Allocates and initializes the superblock of an empty index btree. */
+block_id_t create_secondary_index_superblock(transaction_t *txn);
+
+#endif  // BTREE_SECONDARY_OPERATIONS_HPP_
@@ -156,7 +156,9 @@ bool run_json_import(extproc::spawner_t::info_t *spawner_info, peer_address_set_
                                       NULL,
                                       semilattice_manager_cluster.get_root_view(),
                                       &directory_read_manager,
-                                      machine_id);
+                                      machine_id,
+                                      NULL,
+                                      "");
 
     namespace_repo_t<rdb_protocol_t> rdb_namespace_repo(&mailbox_manager,
         directory_read_manager.get_root_view()->subview(
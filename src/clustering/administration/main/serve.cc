@@ -163,7 +163,9 @@ bool do_serve(
                                           NULL,
                                           semilattice_manager_cluster.get_root_view(),
                                           &directory_read_manager,
-                                          machine_id);
+                                          machine_id,
+                                          i_am_a_server ? io_backender : NULL,
+                                          filepath);
 
         namespace_repo_t<rdb_protocol_t> rdb_namespace_repo(&mailbox_manager,
             directory_read_manager.get_root_view()->subview(
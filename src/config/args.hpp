@@ -164,6 +164,55 @@
 // Values larger than this will be streamed in a get operation
 #define MAX_BUFFERED_GET_SIZE                     MAX_VALUE_SIZE // streaming is too slow for now, so we disable it completely
 
+// An ORDERBY keeps at most this many bytes of rows in memory; beyond that it
+// sorts them in runs on disk and merges the runs
+#define RDB_SORT_MEMORY_BUDGET                    (64 * MEGABYTE)
+
+// An ORDERBY under a SLICE that stops within this many rows is sorted on the
+// shards, each of which sends back its first rows in a single response; a
+// longer one is sorted here, within RDB_SORT_MEMORY_BUDGET
+#define RDB_SORT_PUSHDOWN_LIMIT                   1000
+
+// A DISTINCT keeps at most this many bytes of rows in its hash table; beyond
+// that it partitions the rows it hasn't seen yet into files on disk
+#define RDB_HASH_MEMORY_BUDGET                    (64 * MEGABYTE)
+
+// A table scan reads up to this many batches ahead of the client, as long as
+// they take up no more than this many bytes
+#define RDB_PREFETCH_DEPTH                        2
+#define RDB_PREFETCH_MEMORY_BUDGET                (16 * MEGABYTE)
+
+// Javascript mappings and predicates are sent this many rows at a time
+#define RDB_JS_BATCH_SIZE                         100
+
+// Each javascript worker process keeps up to this many compiled scripts, so
+// that the same javascript isn't compiled again for every query
+#define JS_SCRIPT_CACHE_SIZE                      1000
+
+// An INSERT sends rows to the shards this many at a time, with up to this many
+// batches in flight
+#define RDB_INSERT_BATCH_SIZE                     500
+#define RDB_INSERT_WINDOW                         4
+
+// UPDATE, MUTATE and DELETE on a view have each shard look at this many rows
+// in a write transaction, so the shard's other writes get in between
+#define RDB_RANGE_MODIFY_BATCH_SIZE               100
+
+// The read queries that ask for it get their results remembered, in this many
+// bytes of results over all threads, until a table they read changes
+#define RDB_QUERY_CACHE_MEMORY_BUDGET             (64 * MEGABYTE)
+
+// The streams a connection has open are held to this many bytes of rows, and
+// the open streams of all connections together to this many; the least
+// recently used ones are closed to make room
+#define RDB_STREAM_CACHE_MEMORY_BUDGET            (64 * MEGABYTE)
+#define RDB_STREAM_CACHE_GLOBAL_MEMORY_BUDGET     (1024 * MEGABYTE)
+
+// Which attributes of a table have a secondary index is remembered for this
+// long, so that an index created or dropped through another server gets
+// noticed
+#define RDB_SINDEX_CACHE_TIMEOUT_MS               1000
+
 // If a single connection sends this many 'noreply' commands, the next command will
 // have to wait until the first one finishes
 #define MAX_CONCURRENT_QUERIES_PER_CONNECTION     500
@@ -6,6 +6,7 @@
 #include <boost/make_shared.hpp>
 #include <boost/optional.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/variant.hpp>
 
 #include "containers/archive/archive.hpp"
@@ -249,4 +250,37 @@ FAIL:
     return res;
 }
 
+template <class K, class V, class H, class P>
+write_message_t &operator<<(write_message_t &msg, const boost::unordered_map<K, V, H, P> &x) {
+    uint64_t sz = x.size();
+    msg << sz;
+    for (typename boost::unordered_map<K, V, H, P>::const_iterator it = x.begin(); it != x.end(); ++it) {
+        msg << it->first;
+        msg << it->second;
+    }
+    return msg;
+}
+
+template <class K, class V, class H, class P>
+MUST_USE archive_result_t deserialize(read_stream_t *s, boost::unordered_map<K, V, H, P> *x) {
+    x->clear();
+
+    uint64_t sz;
+    archive_result_t res = deserialize(s, &sz);
+    if (res) { return res; }
+
+    x->reserve(sz);
+    for (uint64_t i = 0; i < sz; ++i) {
+        K k;
+        res = deserialize(s, &k);
+        if (res) { return res; }
+        V v;
+        res = deserialize(s, &v);
+        if (res) { return res; }
+        x->insert(std::make_pair(k, v));
+    }
+
+    return ARCHIVE_SUCCESS;
+}
+
 #endif  // CONTAINERS_ARCHIVE_BOOST_TYPES_HPP_
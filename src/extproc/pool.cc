@@ -12,11 +12,21 @@ const pool_group_t::config_t pool_group_t::DEFAULTS;
 
 pool_group_t::pool_group_t(spawner_t::info_t *info, const config_t &config)
     : spawner_(info), config_(config),
+      stats_membership_(&get_global_perfmon_collection(), &stats_, "extproc"),
+      pm_queue_wait_(secs_to_ticks(1), false),
+      pm_job_duration_(secs_to_ticks(1), true),
+      pm_members_(&stats_,
+                  &pm_workers_, "workers",
+                  &pm_queue_length_, "queue_length",
+                  &pm_queue_wait_, "queue_wait",
+                  &pm_job_duration_, "job_duration",
+                  NULLPTR),
       pool_maker_(this)
 {
     // Check config for sanity
     guarantee(config_.max_workers >= config_.min_workers &&
-              config_.max_workers > 0);
+              config_.max_workers > 0 &&
+              config_.idle_timeout_ms > 0);
 }
 
 
@@ -24,7 +34,8 @@ pool_group_t::pool_group_t(spawner_t::info_t *info, const config_t &config)
 pool_t::pool_t(pool_group_t *group)
     : group_(group),
       num_spawning_workers_(0),
-      worker_semaphore_(group_->config_.max_workers)
+      worker_semaphore_(group_->config_.max_workers),
+      idle_timer_(group_->config_.idle_timeout_ms, this)
 {
     // Spawn initial worker pool.
     repair_invariants();
@@ -57,7 +68,10 @@ pool_t::worker_t *pool_t::acquire_worker() {
     // This blocks if `config()->max_workers` workers are currently in use. We
     // unlock the semaphore in disconnect(), once we're done using the worker
     // process.
+    ticks_t queued = get_ticks();
+    ++group_->pm_queue_length_;
     worker_semaphore_.co_lock();
+    --group_->pm_queue_length_;
 
     // An `if` would suffice here in place of a `while`. However, this is only
     // because spawn_workers() performs no blocking/yielding operations between
@@ -71,10 +85,15 @@ pool_t::worker_t *pool_t::acquire_worker() {
     }
     guarantee(!idle_workers_.empty()); // sanity
 
-    // Grab an idle worker, move it to the busy list, assign it to `handle`.
-    worker_t *worker = idle_workers_.head();
+    // Grab the most recently used idle worker, so that the ones we don't need
+    // stay idle long enough for on_ring() to shut them down. Move it to the
+    // busy list, assign it to `handle`.
+    worker_t *worker = idle_workers_.tail();
     idle_workers_.remove(worker);
     busy_workers_.push_back(worker);
+
+    worker->since_ = get_ticks();
+    group_->pm_queue_wait_.record(ticks_to_secs(worker->since_ - queued));
     return worker;
 }
 
@@ -91,7 +110,12 @@ void pool_t::release_worker(worker_t *worker) THROWS_NOTHING {
         unreachable();
     }
 
-    // Move it from the busy list to the idle list.
+    ticks_t now = get_ticks();
+    group_->pm_job_duration_.record(ticks_to_secs(now - worker->since_));
+    worker->since_ = now;
+
+    // Move it from the busy list to the idle list. The idle list stays ordered
+    // by how long each worker has been idle, longest first.
     busy_workers_.remove(worker);
     idle_workers_.push_back(worker);
 
@@ -126,6 +150,7 @@ void pool_t::detach_worker(worker_t *worker) {
 void pool_t::cleanup_detached_worker(worker_t *worker) {
     rassert(worker && worker->pool_ == this && !worker->attached_);
     delete worker;
+    --group_->pm_workers_;
     repair_invariants();
 }
 
@@ -175,6 +200,7 @@ void pool_t::spawn_workers(int num) {
         // We've successfully spawned one worker.
         guarantee(num_spawning_workers_ > 0); // sanity
         --num_spawning_workers_;
+        ++group_->pm_workers_;
         idle_workers_.push_back(worker);
     }
 }
@@ -186,6 +212,22 @@ void pool_t::end_worker(workers_t *list, worker_t *worker) {
     list->remove(worker);
     guarantee_err(0 ==  kill(worker->pid_, SIGKILL), "could not kill worker");
     delete worker;
+    --group_->pm_workers_;
+}
+
+void pool_t::on_ring() {
+    assert_thread();
+
+    // Idle workers are ordered longest-idle first, so we can stop at the first
+    // one that hasn't timed out.
+    ticks_t now = get_ticks();
+    ticks_t timeout = secs_to_ticks(config()->idle_timeout_ms / 1000.0);
+    worker_t *worker;
+    while (num_workers() > config()->min_workers &&
+           (worker = idle_workers_.head()) &&
+           now - worker->since_ >= timeout) {
+        end_worker(&idle_workers_, worker);
+    }
 }
 
 
@@ -193,7 +235,7 @@ void pool_t::end_worker(workers_t *list, worker_t *worker) {
 pool_t::worker_t::worker_t(pool_t *pool, pid_t pid, scoped_fd_t *fd)
     : unix_socket_stream_t(fd),
       pool_(pool), pid_(pid),
-      attached_(true)
+      attached_(true), since_(get_ticks())
 {
     guarantee(pid > 1 && fd != NULL); // sanity
 }
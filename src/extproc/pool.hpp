@@ -6,6 +6,7 @@
 
 #include "errors.hpp"
 
+#include "arch/timing.hpp"
 #include "concurrency/one_per_thread.hpp"
 #include "concurrency/semaphore.hpp"
 #include "concurrency/signal.hpp"
@@ -14,6 +15,7 @@
 #include "containers/intrusive_list.hpp"
 #include "extproc/job.hpp"
 #include "extproc/spawner.hpp"
+#include "perfmon/perfmon.hpp"
 
 namespace extproc {
 
@@ -28,13 +30,20 @@ class pool_group_t
 
   public:
     static const int DEFAULT_MIN_WORKERS = 2;
-    static const int DEFAULT_MAX_WORKERS = 2;
+    static const int DEFAULT_MAX_WORKERS = 4;
+    static const int DEFAULT_IDLE_TIMEOUT_MS = 60 * 1000;
 
+    // Each pool keeps `min_workers` workers around. When a job comes along
+    // and they're all busy, it spawns another rather than make the job wait,
+    // up to `max_workers`. Workers beyond `min_workers` that sit idle for
+    // about `idle_timeout_ms` are shut down again.
     struct config_t {
         config_t()
-            : min_workers(DEFAULT_MIN_WORKERS), max_workers(DEFAULT_MAX_WORKERS) {}
+            : min_workers(DEFAULT_MIN_WORKERS), max_workers(DEFAULT_MAX_WORKERS),
+              idle_timeout_ms(DEFAULT_IDLE_TIMEOUT_MS) {}
         int min_workers;        // >= 0
         int max_workers;        // >= min_workers, > 0
+        int idle_timeout_ms;    // > 0
     };
 
     static const config_t DEFAULTS;
@@ -46,12 +55,22 @@ class pool_group_t
   private:
     spawner_t spawner_;
     config_t config_;
+
+    // Stats for all the pools together, under "extproc" in the global
+    // collection.
+    perfmon_collection_t stats_;
+    perfmon_membership_t stats_membership_;
+    perfmon_counter_t pm_workers_, pm_queue_length_;
+    perfmon_sampler_t pm_queue_wait_, pm_job_duration_;
+    perfmon_multi_membership_t pm_members_;
+
     one_per_thread_t<pool_t> pool_maker_;
 };
 
 // A per-thread worker pool.
 class pool_t :
-        public home_thread_mixin_debug_only_t
+        public home_thread_mixin_debug_only_t,
+        private repeating_timer_callback_t
 {
     friend class job_handle_t;
 
@@ -59,6 +78,11 @@ class pool_t :
     explicit pool_t(pool_group_t *group);
     ~pool_t();
 
+    // The workers that are running or being spawned.
+    int num_workers() {
+        return idle_workers_.size() + busy_workers_.size() + num_spawning_workers_;
+    }
+
   private:
     pool_group_t::config_t *config() { return &group_->config_; }
     spawner_t *spawner() { return &group_->spawner_; }
@@ -86,6 +110,10 @@ class pool_t :
         pid_t pid_;
         bool attached_;
 
+        // When it was last released (if it's idle) or acquired (if it's
+        // busy).
+        ticks_t since_;
+
       private:
         DISABLE_COPYING(worker_t);
     };
@@ -124,9 +152,8 @@ class pool_t :
     void spawn_workers(int n);
     void end_worker(workers_t *list, worker_t *worker);
 
-    int num_workers() {
-        return idle_workers_.size() + busy_workers_.size() + num_spawning_workers_;
-    }
+    // Shuts down workers we don't need that have been idle too long.
+    virtual void on_ring();
 
   private:
     pool_group_t *group_;
@@ -143,6 +170,8 @@ class pool_t :
     // for a worker to become available when we already have
     // config_->max_workers workers running.
     semaphore_t worker_semaphore_;
+
+    repeating_timer_t idle_timer_;
 };
 
 // A handle to a running job.
@@ -31,9 +31,18 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include <stdint.h>
 #include "http/json/cJSON.hpp"
 #include "errors.hpp"
 
+/* Strings are scanned 16 bytes at a time where we can. Valgrind doesn't know
+   that aligned loads past the end of a string are safe, so it gets the scalar
+   loop. */
+#if defined(__SSE2__) && !defined(VALGRIND)
+#define CJSON_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wunreachable-code"
 #endif
@@ -113,7 +122,8 @@ static const char *parse_number(cJSON *item,const char *num)
                 while (*num>='0' && *num<='9') subscale=(subscale*10)+(*num++ - '0');        /* Number? */
         }
 
-        n=sign*n*pow(10.0,(scale+subscale*signsubscale));        /* number = +/- number.fraction * 10^+/- exponent */
+        if (scale+subscale*signsubscale==0) n=sign*n;        /* pow(10.0,0) is exactly 1; skip the call for integers. */
+        else n=sign*n*pow(10.0,(scale+subscale*signsubscale));        /* number = +/- number.fraction * 10^+/- exponent */
 
         item->valuedouble=n;
         item->valueint=(int)n;
@@ -121,23 +131,47 @@ static const char *parse_number(cJSON *item,const char *num)
         return num;
 }
 
-/* Render the number nicely from the given item into a string. */
-static char *print_number(cJSON *item)
+/* Find the first character at or after str that ends a run of characters that
+   can be copied as they are: the NUL, a '"' or a '\\', and when printing
+   (control!=0) any character below 32, which has to be escaped. */
+static inline int is_run_end(unsigned char c,int control) {return c=='\"' || c=='\\' || c==0 || (control && c<32);}
+static const char *scan_run(const char *str,int control)
 {
-        char *str;
-        double d=item->valuedouble;
-        guarantee(isfinite(d));
-        if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
+#ifdef CJSON_SSE2
+        /* An aligned load never crosses into the next page, so reading past the
+           NUL is harmless. */
+        while ((uintptr_t)str&15) {if (is_run_end(*str,control)) return str; str++;}
+        const __m128i quote=_mm_set1_epi8('\"'),backslash=_mm_set1_epi8('\\'),zero=_mm_setzero_si128(),max_control=_mm_set1_epi8(31);
+        for (;;)
         {
-                str=(char*)cJSON_malloc(21);        /* 2^64+1 can be represented in 21 chars. */
-                if (str) sprintf(str,"%d",item->valueint);  // NOLINT(runtime/printf)
+                __m128i chunk=_mm_load_si128((const __m128i *)str);
+                __m128i ends=_mm_or_si128(_mm_cmpeq_epi8(chunk,quote),_mm_cmpeq_epi8(chunk,backslash));
+                if (control) ends=_mm_or_si128(ends,_mm_cmpeq_epi8(_mm_min_epu8(chunk,max_control),chunk));        /* chunk<=31 */
+                else ends=_mm_or_si128(ends,_mm_cmpeq_epi8(chunk,zero));
+                int mask=_mm_movemask_epi8(ends);
+                if (mask) return str+__builtin_ctz(mask);
+                str+=16;
         }
-        else
+#else
+        while (!is_run_end(*str,control)) str++;
+        return str;
+#endif
+}
+
+/* Parse the four hex digits of a unicode escape. */
+static int parse_hex4(const char *str,unsigned *out)
+{
+        int i;unsigned h=0;
+        for (i=0;i<4;i++)
         {
-                str=(char*)cJSON_malloc(512);        /* This is a correct tradeoff. */
-                if (str) sprintf(str, "%.32g", d);
+                unsigned char c=str[i];h<<=4;
+                if (c>='0' && c<='9') h+=c-'0';
+                else if (c>='a' && c<='f') h+=c-'a'+10;
+                else if (c>='A' && c<='F') h+=c-'A'+10;
+                else return 0;
         }
-        return str;
+        *out=h;
+        return 1;
 }
 
 /* Parse the input text into an unescaped cstring, and populate item. */
@@ -147,18 +181,24 @@ static const char *parse_string(cJSON *item,const char *str)
         const char *ptr=str+1;char *ptr2;char *out;int len=0;unsigned uc,uc2;
         if (*str!='\"') {ep=str;return 0;}        /* not a string! */
 
-        while (*ptr!='\"' && *ptr && ++len) if (*ptr++ == '\\') ptr++;        /* Skip escaped quotes. */
+        for (;;)        /* Skip escaped quotes. */
+        {
+                ptr=scan_run(ptr,0);
+                if (*ptr!='\\') break;
+                if (*++ptr) ptr++;
+        }
 
-        out=(char*)cJSON_malloc(len+1);        /* This is how long we need for the string, roughly. */
+        len=ptr-(str+1);
+        out=(char*)cJSON_malloc(len+1);        /* Unescaping never makes the string longer. */
         if (!out) return 0;
 
         ptr=str+1;ptr2=out;
         while (*ptr!='\"' && *ptr)
         {
-                if (*ptr!='\\') *ptr2++=*ptr++;
+                if (*ptr!='\\') {const char *run=ptr;ptr=scan_run(ptr,0);memcpy(ptr2,run,ptr-run);ptr2+=ptr-run;}
                 else
                 {
-                        ptr++;
+                        if (!*++ptr) break;        /* a trailing backslash escapes nothing. */
                         switch (*ptr)
                         {
                                 case 'b': *ptr2++='\b';        break;
@@ -167,14 +207,16 @@ static const char *parse_string(cJSON *item,const char *str)
                                 case 'r': *ptr2++='\r';        break;
                                 case 't': *ptr2++='\t';        break;
                                 case 'u':         /* transcode utf16 to utf8. */
-                                        sscanf(ptr+1,"%4x",&uc);ptr+=4;        /* get the unicode char. */
+                                        if (!parse_hex4(ptr+1,&uc)) {cJSON_free(out);ep=str;return 0;}        /* a short escape would run past the string. */
+                                        ptr+=4;        /* get the unicode char. */
 
                                         if ((uc>=0xDC00 && uc<=0xDFFF) || uc==0)        break;        // check for invalid.
 
                                         if (uc>=0xD800 && uc<=0xDBFF)        // UTF16 surrogate pairs.
                                         {
                                                 if (ptr[1]!='\\' || ptr[2]!='u')        break;        // missing second-half of surrogate.
-                                                sscanf(ptr+3,"%4x",&uc2);ptr+=6;
+                                                if (!parse_hex4(ptr+3,&uc2)) {cJSON_free(out);ep=str;return 0;}
+                                                ptr+=6;
                                                 if (uc2<0xDC00 || uc2>0xDFFF)                break;        // invalid second-half of surrogate.
                                                 uc=0x10000 | ((uc&0x3FF)<<10) | (uc2&0x3FF);
                                         }
@@ -202,51 +244,78 @@ static const char *parse_string(cJSON *item,const char *str)
         return ptr;
 }
 
-/* Render the cstring provided to an escaped version that can be printed. */
-static char *print_string_ptr(const char *str)
+/* Everything is printed into one growing buffer, rather than each value into
+   its own string that its parent then copies. */
+typedef struct {char *buffer;size_t length,size;} printbuffer;
+
+/* Make room for needed more characters and the NUL. */
+static int ensure(printbuffer *p,size_t needed)
 {
-        const char *ptr;char *ptr2,*out;int len=0;unsigned char token;
+        char *grown;size_t size;
+        if (p->length+needed+1<=p->size) return 1;
+        size=p->size*2;if (size<p->length+needed+1) size=p->length+needed+1;
+        grown=(char*)realloc(p->buffer,size);
+        if (!grown) return 0;
+        p->buffer=grown;p->size=size;
+        return 1;
+}
+static int print_raw(printbuffer *p,const char *str,size_t len) {if (!ensure(p,len)) return 0;memcpy(p->buffer+p->length,str,len);p->length+=len;return 1;}
+static int print_char(printbuffer *p,char c) {if (!ensure(p,1)) return 0;p->buffer[p->length++]=c;return 1;}
+static int print_tabs(printbuffer *p,int n) {if (n<=0) return 1;if (!ensure(p,n)) return 0;memset(p->buffer+p->length,'\t',n);p->length+=n;return 1;}
 
-        if (!str) return cJSON_strdup("");
-        ptr=str;while ((token=*ptr) && ++len) {if (strchr("\"\\\b\f\n\r\t",token)) len++; else if (token<32) len+=5;ptr++;}
+/* Render the number nicely from the given item into a string. */
+static int print_number(cJSON *item,printbuffer *p)
+{
+        double d=item->valuedouble;int len;
+        guarantee(isfinite(d));
+        if (!ensure(p,64)) return 0;        /* "%.32g" needs at most 40. */
+        if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
+                len=sprintf(p->buffer+p->length,"%d",item->valueint);  // NOLINT(runtime/printf)
+        else
+                len=sprintf(p->buffer+p->length,"%.32g",d);  // NOLINT(runtime/printf)
+        p->length+=len;
+        return 1;
+}
 
-        out=(char*)cJSON_malloc(len+3);
-        if (!out) return 0;
+/* What follows the backslash when a control character is escaped. */
+static const char control_escapes[32] = {
+        'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+        'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u'
+};
+static const char hex_digits[17] = "0123456789abcdef";
 
-        ptr2=out;ptr=str;
-        *ptr2++='\"';
-        while (*ptr)
+/* Render the cstring provided to an escaped version that can be printed. */
+static int print_string_ptr(const char *str,printbuffer *p)
+{
+        if (!str) return 1;
+        if (!print_char(p,'\"')) return 0;
+        for (;;)
         {
-                if ((unsigned char)*ptr>31 && *ptr!='\"' && *ptr!='\\') *ptr2++=*ptr++;
-                else
+                const char *run=str;unsigned char token;char *ptr2;
+                str=scan_run(str,1);
+                if (!print_raw(p,run,str-run)) return 0;
+                if (!(token=*str++)) break;
+                if (!ensure(p,6)) return 0;
+                ptr2=p->buffer+p->length;
+                *ptr2++='\\';
+                if (token=='\"' || token=='\\') *ptr2++=token;
+                else if ((*ptr2++=control_escapes[token])=='u')
                 {
-                        *ptr2++='\\';
-                        switch (token=*ptr++)
-                        {
-                                case '\\':        *ptr2++='\\';        break;
-                                case '\"':        *ptr2++='\"';        break;
-                                case '\b':        *ptr2++='b';        break;
-                                case '\f':        *ptr2++='f';        break;
-                                case '\n':        *ptr2++='n';        break;
-                                case '\r':        *ptr2++='r';        break;
-                                case '\t':        *ptr2++='t';        break;
-                                default: sprintf(ptr2,"u%04x",token);ptr2+=5;        break;        /* escape and print */  // NOLINT(runtime/printf)
-                        }
+                        *ptr2++='0';*ptr2++='0';*ptr2++=hex_digits[token>>4];*ptr2++=hex_digits[token&15];
                 }
+                p->length=ptr2-p->buffer;
         }
-        *ptr2++='\"';*ptr2++=0;
-        return out;
+        return print_char(p,'\"');
 }
-/* Invote print_string_ptr (which is useful) on an item. */
-static char *print_string(cJSON *item)        {return print_string_ptr(item->valuestring);}
 
 /* Predeclare these prototypes. */
 static const char *parse_value(cJSON *item,const char *value);
 static char *print_value(cJSON *item,int depth,int fmt);
+static int print_value_to(cJSON *item,int depth,int fmt,printbuffer *p);
 static const char *parse_array(cJSON *item,const char *value);
-static char *print_array(cJSON *item,int depth,int fmt);
+static int print_array(cJSON *item,int depth,int fmt,printbuffer *p);
 static const char *parse_object(cJSON *item,const char *value);
-static char *print_object(cJSON *item,int depth,int fmt);
+static int print_object(cJSON *item,int depth,int fmt,printbuffer *p);
 
 /* Utility to jump whitespace and cr/lf */
 static const char *skip(const char *in) {while (in && *in && (unsigned char)*in<=32) in++; return in;}
@@ -284,20 +353,28 @@ static const char *parse_value(cJSON *item,const char *value)
 /* Render a value to text. */
 static char *print_value(cJSON *item,int depth,int fmt)
 {
-        char *out=0;
+        printbuffer p;
         if (!item) return 0;
+        p.length=0;p.size=256;
+        if (!(p.buffer=(char*)cJSON_malloc(p.size))) return 0;
+        if (!print_value_to(item,depth,fmt,&p)) {cJSON_free(p.buffer);return 0;}
+        p.buffer[p.length]=0;
+        return p.buffer;
+}
+
+static int print_value_to(cJSON *item,int depth,int fmt,printbuffer *p)
+{
         switch ((item->type)&255)
         {
-                case cJSON_NULL:        out=cJSON_strdup("null");        break;
-                case cJSON_False:        out=cJSON_strdup("false");break;
-                case cJSON_True:        out=cJSON_strdup("true"); break;
-                case cJSON_Number:        out=print_number(item);break;
-                case cJSON_String:        out=print_string(item);break;
-                case cJSON_Array:        out=print_array(item,depth,fmt);break;
-                case cJSON_Object:        out=print_object(item,depth,fmt);break;
-        default: break;
+                case cJSON_NULL:        return print_raw(p,"null",4);
+                case cJSON_False:        return print_raw(p,"false",5);
+                case cJSON_True:        return print_raw(p,"true",4);
+                case cJSON_Number:        return print_number(item,p);
+                case cJSON_String:        return print_string_ptr(item->valuestring,p);
+                case cJSON_Array:        return print_array(item,depth,fmt,p);
+                case cJSON_Object:        return print_object(item,depth,fmt,p);
+        default: return 0;
         }
-        return out;
 }
 
 /* Build an array from input text. */
@@ -329,54 +406,16 @@ static const char *parse_array(cJSON *item,const char *value)
 }
 
 /* Render an array to text */
-static char *print_array(cJSON *item,int depth,int fmt)
+static int print_array(cJSON *item,int depth,int fmt,printbuffer *p)
 {
-        char **entries;
-        char *out=0,*ptr,*ret;int len=5;
-        cJSON *child=item->child;
-        int numentries=0,i=0,fail=0;
-
-        /* How many entries in the array? */
-        while (child) numentries++,child=child->next;
-        /* Allocate an array to hold the values for each */
-        entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-        if (!entries) return 0;
-        memset(entries,0,numentries*sizeof(char*));
-        /* Retrieve all the results: */
-        child=item->child;
-        while (child && !fail)
-        {
-                ret=print_value(child,depth+1,fmt);
-                entries[i++]=ret;
-                if (ret) len+=strlen(ret)+2+(fmt?1:0); else fail=1;
-                child=child->next;
-        }
-
-        /* If we didn't fail, try to malloc the output string */
-        if (!fail) out=(char*)cJSON_malloc(len);
-        /* If that fails, we fail. */
-        if (!out) fail=1;
-
-        /* Handle failure. */
-        if (fail)
-        {
-                for (i=0;i<numentries;i++) if (entries[i]) cJSON_free(entries[i]);
-                cJSON_free(entries);
-                return 0;
-        }
-
-        /* Compose the output array. */
-        *out='[';
-        ptr=out+1;*ptr=0;
-        for (i=0;i<numentries;i++)
+        cJSON *child;
+        if (!print_char(p,'[')) return 0;
+        for (child=item->child;child;child=child->next)
         {
-                strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
-                if (i!=numentries-1) {*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;}
-                cJSON_free(entries[i]);
+                if (!print_value_to(child,depth+1,fmt,p)) return 0;
+                if (child->next && !print_raw(p,", ",fmt?2:1)) return 0;
         }
-        cJSON_free(entries);
-        *ptr++=']';*ptr++=0;
-        return out;
+        return print_char(p,']');
 }
 
 /* Build an object from the text. */
@@ -416,61 +455,22 @@ static const char *parse_object(cJSON *item,const char *value)
 }
 
 /* Render an object to text. */
-static char *print_object(cJSON *item,int depth,int fmt)
+static int print_object(cJSON *item,int depth,int fmt,printbuffer *p)
 {
-        char **entries=0,**names=0;
-        char *out=0,*ptr,*ret,*str;int len=7,i=0,j;
-        cJSON *child=item->child;
-        int numentries=0,fail=0;
-        /* Count the number of entries. */
-        while (child) numentries++,child=child->next;
-        /* Allocate space for the names and the objects */
-        entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-        if (!entries) return 0;
-        names=(char**)cJSON_malloc(numentries*sizeof(char*));
-        if (!names) {cJSON_free(entries);return 0;}
-        memset(entries,0,sizeof(char*)*numentries);
-        memset(names,0,sizeof(char*)*numentries);
-
-        /* Collect all the results into our arrays: */
-        child=item->child;depth++;if (fmt) len+=depth;
-        while (child)
-        {
-                names[i]=str=print_string_ptr(child->string);
-                entries[i++]=ret=print_value(child,depth,fmt);
-                if (str && ret) len+=strlen(ret)+strlen(str)+2+(fmt?2+depth:0); else fail=1;
-                child=child->next;
-        }
-
-        /* Try to allocate the output string */
-        if (!fail) out=(char*)cJSON_malloc(len);
-        if (!out) fail=1;
-
-        /* Handle failure */
-        if (fail)
-        {
-                for (i=0;i<numentries;i++) {if (names[i]) cJSON_free(names[i]);if (entries[i]) cJSON_free(entries[i]);}
-                cJSON_free(names);cJSON_free(entries);
-                return 0;
-        }
-
-        /* Compose the output: */
-        *out='{';ptr=out+1;if (fmt)*ptr++='\n';*ptr=0;
-        for (i=0;i<numentries;i++)
+        cJSON *child;
+        depth++;
+        if (!print_raw(p,"{\n",fmt?2:1)) return 0;
+        for (child=item->child;child;child=child->next)
         {
-                if (fmt) for (j=0;j<depth;j++) *ptr++='\t';
-                strcpy(ptr,names[i]);ptr+=strlen(names[i]);
-                *ptr++=':';if (fmt) *ptr++='\t';
-                strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
-                if (i!=numentries-1) *ptr++=',';
-                if (fmt) *ptr++='\n';*ptr=0;
-                cJSON_free(names[i]);cJSON_free(entries[i]);
+                if (fmt && !print_tabs(p,depth)) return 0;
+                if (!print_string_ptr(child->string,p)) return 0;
+                if (!print_raw(p,":\t",fmt?2:1)) return 0;
+                if (!print_value_to(child,depth,fmt,p)) return 0;
+                if (child->next && !print_char(p,',')) return 0;
+                if (fmt && !print_char(p,'\n')) return 0;
         }
-
-        cJSON_free(names);cJSON_free(entries);
-        if (fmt) for (i=0;i<depth-1;i++) *ptr++='\t';
-        *ptr++='}';*ptr++=0;
-        return out;
+        if (fmt && !print_tabs(p,depth-1)) return 0;
+        return print_char(p,'}');
 }
 
 /* Get Array size/item / object item. */
@@ -1,6 +1,9 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
 #include "memcached/memcached_btree/get.hpp"
 
+#include <utility>
+#include <vector>
+
 #include "btree/internal_node.hpp"
 #include "btree/leaf_node.hpp"
 #include "btree/operations.hpp"
@@ -28,3 +31,80 @@ get_result_t memcached_get(const store_key_t &store_key, btree_slice_t *slice, e
     return get_result_t(dp, value->mcflags(), 0);
 }
 
+
+/* Looks up `keys[begin, end)` in the subtree rooted at `buf`. Rather than
+holding `buf` while it reads the whole subtree, it lets go of it as soon as it
+has the first child, so writers only wait for the path it's on. That's only
+safe because multi-gets run in a snapshotted transaction: the other children
+`buf` pointed to are still there when it gets to them. */
+void multi_get_from_subtree(value_sizer_t<memcached_value_t> *sizer, buf_lock_t *buf,
+                            const std::vector<store_key_t> &keys, size_t begin, size_t end,
+                            btree_slice_t *slice, exptime_t effective_time, transaction_t *txn,
+                            multi_get_result_t *result) {
+#ifndef NDEBUG
+    node::validate(sizer, reinterpret_cast<const node_t *>(buf->get_data_read()));
+#endif  // NDEBUG
+
+    const node_t *node = reinterpret_cast<const node_t *>(buf->get_data_read());
+    if (node::is_internal(node)) {
+        const internal_node_t *internal = reinterpret_cast<const internal_node_t *>(node);
+
+        /* The keys are sorted, so the keys that belong to the same child are
+        next to each other. Each group is the child and where its keys end. */
+        std::vector<std::pair<block_id_t, size_t> > groups;
+        for (size_t i = begin; i < end; ) {
+            block_id_t child_id = internal_node::lookup(internal, keys[i].btree_key());
+            rassert(child_id != NULL_BLOCK_ID && child_id != SUPERBLOCK_ID);
+            size_t group_end = i + 1;
+            while (group_end < end && internal_node::lookup(internal, keys[group_end].btree_key()) == child_id) {
+                ++group_end;
+            }
+            groups.push_back(std::make_pair(child_id, group_end));
+            i = group_end;
+        }
+
+        eviction_priority_t child_priority = incr_priority(buf->get_eviction_priority());
+        size_t i = begin;
+        for (size_t g = 0; g < groups.size(); ++g) {
+            buf_lock_t child(txn, groups[g].first, rwi_read);
+            child.set_eviction_priority(child_priority);
+            buf->release_if_acquired();
+            multi_get_from_subtree(sizer, &child, keys, i, groups[g].second, slice, effective_time, txn, result);
+            i = groups[g].second;
+        }
+    } else {
+        const leaf_node_t *leaf = reinterpret_cast<const leaf_node_t *>(node);
+        scoped_malloc_t<memcached_value_t> value(sizer->max_possible_size());
+        for (size_t i = begin; i < end; ++i) {
+            slice->stats.pm_keys_read.record();
+            if (leaf::lookup(sizer, leaf, keys[i].btree_key(), value.get()) && !value->expired(effective_time)) {
+                result->pairs.push_back(key_with_data_buffer_t(keys[i], value->mcflags(), value_to_data_buffer(value.get(), txn)));
+            }
+        }
+        buf->release();
+    }
+}
+
+multi_get_result_t memcached_multi_get(const std::vector<store_key_t> &keys, btree_slice_t *slice, exptime_t effective_time, transaction_t *txn, superblock_t *superblock) {
+    multi_get_result_t result;
+
+    block_id_t root_id = superblock->get_root_block_id();
+    rassert(root_id != SUPERBLOCK_ID);
+
+    if (keys.empty() || root_id == NULL_BLOCK_ID) {
+        // Either there's nothing to look up or the tree is empty.
+        superblock->release();
+        return result;
+    }
+
+    value_sizer_t<memcached_value_t> sizer(txn->get_cache()->get_block_size());
+
+    buf_lock_t root(txn, root_id, rwi_read);
+    root.set_eviction_priority(slice->root_eviction_priority);
+
+    superblock->release();
+
+    multi_get_from_subtree(&sizer, &root, keys, 0, keys.size(), slice, effective_time, txn, &result);
+
+    return result;
+}
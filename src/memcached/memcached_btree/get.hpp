@@ -2,6 +2,8 @@
 #ifndef MEMCACHED_MEMCACHED_BTREE_GET_HPP_
 #define MEMCACHED_MEMCACHED_BTREE_GET_HPP_
 
+#include <vector>
+
 #include "buffer_cache/types.hpp"
 #include "memcached/queries.hpp"
 
@@ -10,4 +12,8 @@ class superblock_t;
 
 get_result_t memcached_get(const store_key_t &key, btree_slice_t *slice, exptime_t effective_time, transaction_t *txn, superblock_t *superblock);
 
+/* Looks up all of `keys`, which must be sorted, in a single descent of the
+btree: a node on the path to several of the keys is only acquired once. */
+multi_get_result_t memcached_multi_get(const std::vector<store_key_t> &keys, btree_slice_t *slice, exptime_t effective_time, transaction_t *txn, superblock_t *superblock);
+
 #endif // MEMCACHED_MEMCACHED_BTREE_GET_HPP_
@@ -9,8 +9,10 @@
 #include <stdarg.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <set>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include "errors.hpp"
@@ -188,6 +190,14 @@ struct txt_memcached_handler_t : public home_thread_mixin_debug_only_t {
             throw memcached_interface_t::no_more_data_exc_t();
         }
     }
+
+    char peek_byte() THROWS_ONLY(memcached_interface_t::no_more_data_exc_t) {
+        try {
+            return interface->peek_byte(interruptor);
+        } catch (interrupted_exc_t) {
+            throw memcached_interface_t::no_more_data_exc_t();
+        }
+    }
 };
 
 class pipeliner_t {
@@ -260,6 +270,17 @@ public:
         pipeliner_->requests_out_sem.unlock();
     }
 
+    /* Like `end_write()`, but for operations that didn't write anything (such
+    as quiet binary-protocol requests that succeeded), so there is nothing to
+    flush. */
+    void end_write_without_output() {
+        guarantee(state_ == has_begun_write);
+        DEBUG_ONLY_CODE(state_ = has_ended_write);
+
+        mutex_acq_.reset();
+        pipeliner_->requests_out_sem.unlock();
+    }
+
 private:
     pipeliner_t *pipeliner_;
     mutex_t::acq_t mutex_acq_;
@@ -302,6 +323,48 @@ void do_one_get(txt_memcached_handler_t *rh, bool with_cas, get_t *gets, int i,
     }
 }
 
+bool key_with_data_buffer_key_less(const key_with_data_buffer_t &pair, const store_key_t &key) {
+    return pair.key < key;
+}
+
+/* Looks up all of `gets` with a single `multi_get_query_t`, which the
+namespace interface splits into one read per shard instead of one read per
+key. */
+void do_multi_get(txt_memcached_handler_t *rh, std::vector<get_t> *gets, order_token_t token) {
+    std::vector<store_key_t> keys;
+    keys.reserve(gets->size());
+    for (size_t i = 0; i < gets->size(); ++i) {
+        keys.push_back((*gets)[i].key);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    try {
+        multi_get_query_t multi_get_query(keys);
+        memcached_protocol_t::read_t read(multi_get_query, time(NULL));
+        memcached_protocol_t::read_response_t response;
+        rh->nsi->read(read, &response, token, rh->interruptor);
+        const multi_get_result_t &result = boost::get<multi_get_result_t>(response.result);
+
+        for (size_t i = 0; i < gets->size(); ++i) {
+            get_t *get = &(*gets)[i];
+            std::vector<key_with_data_buffer_t>::const_iterator it =
+                std::lower_bound(result.pairs.begin(), result.pairs.end(), get->key, &key_with_data_buffer_key_less);
+            if (it != result.pairs.end() && it->key == get->key) {
+                get->res = get_result_t(it->value_provider, it->mcflags, 0);
+            }
+            get->ok = true;
+        }
+    } catch (cannot_perform_query_exc_t e) {
+        for (size_t i = 0; i < gets->size(); ++i) {
+            (*gets)[i].error_message = e.what();
+            (*gets)[i].ok = false;
+        }
+    } catch (interrupted_exc_t) {
+        /* do nothing */
+    }
+}
+
 void do_get(txt_memcached_handler_t *rh, pipeliner_t *pipeliner, bool with_cas, int argc, char **argv, order_token_t token) {
     // We should already be spawned within a coroutine.
     pipeliner_acq_t pipeliner_acq(pipeliner);
@@ -337,8 +400,13 @@ void do_get(txt_memcached_handler_t *rh, pipeliner_t *pipeliner, bool with_cas,
 
     block_pm_duration get_timer(&rh->stats->pm_cmd_get);
 
-    /* Now that we're sure they're all valid, send off the requests */
-    pmap(gets.size(), boost::bind(&do_one_get, rh, with_cas, gets.data(), _1, token));
+    /* Now that we're sure they're all valid, send off the requests. A "gets"
+    is a write per key, but plain multi-key "get"s go out as one batched read. */
+    if (with_cas || gets.size() == 1) {
+        pmap(gets.size(), boost::bind(&do_one_get, rh, with_cas, gets.data(), _1, token));
+    } else {
+        do_multi_get(rh, &gets, token);
+    }
 
     if (rh->interruptor->is_pulsed()) {
         pipeliner_acq.begin_write();
@@ -576,6 +644,27 @@ struct storage_metadata_t {
         : mcflags(_mcflags), exptime(_exptime), unique(_unique) { }
 };
 
+// This is protocol.txt, verbatim:
+// Some commands involve a client sending some kind of expiration time
+// (relative to an item or to an operation requested by the client) to
+// the server. In all such cases, the actual value sent may either be
+// Unix time (number of seconds since January 1, 1970, as a 32-bit
+// value), or a number of seconds starting from current time. In the
+// latter case, this number of seconds may not exceed 60*60*24*30 (number
+// of seconds in 30 days); if the number sent by a client is larger than
+// that, the server will consider it to be real Unix time value rather
+// than an offset from current time.
+static exptime_t absolute_exptime(exptime_t exptime) {
+    if (exptime <= 60*60*24*30 && exptime > 0) {
+        // If 60*60*24*30 < exptime <= time(NULL), that's fine, the
+        // btree code needs to handle that case gracefully anyway
+        // (since the clock can tick in the middle of an insert
+        // anyway...).  We have tests in expiration.py.
+        exptime += time(NULL);
+    }
+    return exptime;
+}
+
 void run_storage_command(txt_memcached_handler_t *rh,
                          pipeliner_acq_t *pipeliner_acq_raw,
                          storage_command_t sc,
@@ -770,23 +859,7 @@ void do_storage(txt_memcached_handler_t *rh, pipeliner_t *pipeliner, storage_com
         return;
     }
 
-    // This is protocol.txt, verbatim:
-    // Some commands involve a client sending some kind of expiration time
-    // (relative to an item or to an operation requested by the client) to
-    // the server. In all such cases, the actual value sent may either be
-    // Unix time (number of seconds since January 1, 1970, as a 32-bit
-    // value), or a number of seconds starting from current time. In the
-    // latter case, this number of seconds may not exceed 60*60*24*30 (number
-    // of seconds in 30 days); if the number sent by a client is larger than
-    // that, the server will consider it to be real Unix time value rather
-    // than an offset from current time.
-    if (exptime <= 60*60*24*30 && exptime > 0) {
-        // If 60*60*24*30 < exptime <= time(NULL), that's fine, the
-        // btree code needs to handle that case gracefully anyway
-        // (since the clock can tick in the middle of an insert
-        // anyway...).  We have tests in expiration.py.
-        exptime += time(NULL);
-    }
+    exptime = absolute_exptime(exptime);
 
     /* Now parse the value length */
     size_t value_size = strtou64_strict(argv[4], &invalid_char, 10);
@@ -1063,7 +1136,7 @@ void do_delete(txt_memcached_handler_t *rh, pipeliner_t *pipeliner, int argc, ch
 
 /* "stats" command */
 
-void format_stats(const perfmon_result_t *stats, const std::string& name, const std::set<std::string>& names_to_match, std::vector<std::string> *result) {
+void collect_stats(const perfmon_result_t *stats, const std::string& name, const std::set<std::string>& names_to_match, std::vector<std::pair<std::string, std::string> > *result) {
     // `switch` is used instead of `if` with `is_map` and `is_string` checks
     // because that way the compiler guarantees us an error message if someone
     // adds another type of `perfmon_results_t` and forgets to change this code
@@ -1072,13 +1145,13 @@ void format_stats(const perfmon_result_t *stats, const std::string& name, const
              // This is not super-efficient (better to only scan for the stats
              // that match the name), but we don't care right now
             if (names_to_match.empty() || names_to_match.count(name) != 0) {
-                result->push_back(strprintf("STAT %s %s\r\n", name.c_str(), stats->get_string()->c_str()));
+                result->push_back(std::make_pair(name, *stats->get_string()));
             }
             break;
         case perfmon_result_t::type_map:
             for (perfmon_result_t::const_iterator i = stats->begin(); i != stats->end(); i++) {
                 std::string sub_name(name.empty() ? i->first : name + "." + i->first);
-                format_stats(i->second, sub_name, names_to_match, result);
+                collect_stats(i->second, sub_name, names_to_match, result);
             }
             break;
         default:
@@ -1096,10 +1169,645 @@ void memcached_stats(int argc, char **argv, std::vector<std::string> *stat_respo
     }
 
     scoped_ptr_t<perfmon_result_t> stats(perfmon_get_stats());
-    format_stats(stats.get(), std::string(), names_to_match, stat_response_lines);
+    std::vector<std::pair<std::string, std::string> > stat_values;
+    collect_stats(stats.get(), std::string(), names_to_match, &stat_values);
+    for (std::vector<std::pair<std::string, std::string> >::const_iterator it = stat_values.begin(); it != stat_values.end(); ++it) {
+        stat_response_lines->push_back(strprintf("STAT %s %s\r\n", it->first.c_str(), it->second.c_str()));
+    }
     stat_response_lines->push_back(end_marker);
 }
 
+/* Memcached binary protocol
+
+Every binary request and response starts with a fixed 24-byte header, which is
+followed by the extras, the key, and the value, in that order. Binary requests
+go through the same `pipeliner_t` as text commands: they run concurrently, but
+their responses are sent in the order the requests arrived. Quiet requests
+("getq", "setq", and so on) only produce a response when there's something the
+client couldn't infer on its own--a hit for a get, a failure for everything
+else--so a client can send a batch of them followed by a "noop" and read back
+only the interesting responses. */
+
+static const uint8_t binary_request_magic = 0x80;
+static const uint8_t binary_response_magic = 0x81;
+static const size_t binary_header_size = 24;
+
+enum binary_opcode_t {
+    binary_op_get = 0x00,
+    binary_op_set = 0x01,
+    binary_op_add = 0x02,
+    binary_op_replace = 0x03,
+    binary_op_delete = 0x04,
+    binary_op_increment = 0x05,
+    binary_op_decrement = 0x06,
+    binary_op_quit = 0x07,
+    binary_op_getq = 0x09,
+    binary_op_noop = 0x0a,
+    binary_op_version = 0x0b,
+    binary_op_getk = 0x0c,
+    binary_op_getkq = 0x0d,
+    binary_op_append = 0x0e,
+    binary_op_prepend = 0x0f,
+    binary_op_stat = 0x10,
+    binary_op_setq = 0x11,
+    binary_op_addq = 0x12,
+    binary_op_replaceq = 0x13,
+    binary_op_deleteq = 0x14,
+    binary_op_incrementq = 0x15,
+    binary_op_decrementq = 0x16,
+    binary_op_quitq = 0x17,
+    binary_op_appendq = 0x19,
+    binary_op_prependq = 0x1a
+};
+
+enum binary_status_t {
+    binary_status_ok = 0x0000,
+    binary_status_key_not_found = 0x0001,
+    binary_status_key_exists = 0x0002,
+    binary_status_value_too_large = 0x0003,
+    binary_status_invalid_arguments = 0x0004,
+    binary_status_not_stored = 0x0005,
+    binary_status_non_numeric = 0x0006,
+    binary_status_unknown_command = 0x0081,
+    binary_status_internal_error = 0x0084
+};
+
+/* All multi-byte fields of the binary protocol are big-endian. */
+
+static uint16_t decode_binary_uint16(const char *p) {
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(p);
+    return (static_cast<uint16_t>(b[0]) << 8) | b[1];
+}
+
+static uint32_t decode_binary_uint32(const char *p) {
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(p);
+    return (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16) |
+           (static_cast<uint32_t>(b[2]) << 8) | b[3];
+}
+
+static uint64_t decode_binary_uint64(const char *p) {
+    return (static_cast<uint64_t>(decode_binary_uint32(p)) << 32) | decode_binary_uint32(p + 4);
+}
+
+static void encode_binary_uint16(uint16_t x, char *p) {
+    p[0] = x >> 8;
+    p[1] = x;
+}
+
+static void encode_binary_uint32(uint32_t x, char *p) {
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static void encode_binary_uint64(uint64_t x, char *p) {
+    encode_binary_uint32(x >> 32, p);
+    encode_binary_uint32(x, p + 4);
+}
+
+struct binary_request_t {
+    /* `opcode` is what the client sent; `command` is the same operation with
+    the quiet and key-returning variants folded into their base opcode. */
+    uint8_t opcode;
+    uint8_t command;
+    bool quiet;
+    bool include_key;
+
+    uint32_t opaque;
+    cas_t cas;
+    std::vector<char> extras;
+    store_key_t key;
+    intrusive_ptr_t<data_buffer_t> value;
+};
+
+struct binary_response_t {
+    binary_response_t() : status(binary_status_ok), cas(0) { }
+
+    void set_error(uint16_t _status, const std::string &message) {
+        status = _status;
+        body = message;
+        extras.clear();
+        value.reset();
+    }
+
+    uint16_t status;
+    cas_t cas;
+    std::string extras;
+
+    /* The body of the response is `body` followed by `value`; only gets
+    produce a `value`, everything else uses `body`. */
+    std::string body;
+    intrusive_ptr_t<data_buffer_t> value;
+};
+
+static bool classify_binary_opcode(binary_request_t *req) {
+    req->quiet = false;
+    req->include_key = false;
+    switch (req->opcode) {
+    case binary_op_getkq:
+        req->quiet = true;
+        // fall through
+    case binary_op_getk:
+        req->include_key = true;
+        req->command = binary_op_get;
+        return true;
+    case binary_op_getq: req->quiet = true; req->command = binary_op_get; return true;
+    case binary_op_setq: req->quiet = true; req->command = binary_op_set; return true;
+    case binary_op_addq: req->quiet = true; req->command = binary_op_add; return true;
+    case binary_op_replaceq: req->quiet = true; req->command = binary_op_replace; return true;
+    case binary_op_deleteq: req->quiet = true; req->command = binary_op_delete; return true;
+    case binary_op_incrementq: req->quiet = true; req->command = binary_op_increment; return true;
+    case binary_op_decrementq: req->quiet = true; req->command = binary_op_decrement; return true;
+    case binary_op_quitq: req->quiet = true; req->command = binary_op_quit; return true;
+    case binary_op_appendq: req->quiet = true; req->command = binary_op_append; return true;
+    case binary_op_prependq: req->quiet = true; req->command = binary_op_prepend; return true;
+    case binary_op_get:
+    case binary_op_set:
+    case binary_op_add:
+    case binary_op_replace:
+    case binary_op_delete:
+    case binary_op_increment:
+    case binary_op_decrement:
+    case binary_op_quit:
+    case binary_op_noop:
+    case binary_op_version:
+    case binary_op_append:
+    case binary_op_prepend:
+    case binary_op_stat:
+        req->command = req->opcode;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Reads and throws away `size` bytes of input, a piece at a time, so that a
+value we won't store doesn't have to fit in memory first. */
+static void skip_binary_value(txt_memcached_handler_t *rh, size_t size) THROWS_ONLY(memcached_interface_t::no_more_data_exc_t) {
+    std::vector<char> buffer(std::min<size_t>(size, 64 * KILOBYTE));
+    while (size > 0) {
+        size_t chunk = std::min(size, buffer.size());
+        rh->read(buffer.data(), chunk);
+        size -= chunk;
+    }
+}
+
+/* Checks that the request carries the extras, key and value its command
+expects. Returns `NULL` if it does, or an error message if it doesn't. */
+static const char *check_binary_request(const binary_request_t &req, size_t key_size) {
+    size_t extras_size;
+    bool wants_key, allows_value;
+    switch (req.command) {
+    case binary_op_get:
+    case binary_op_delete:
+        extras_size = 0; wants_key = true; allows_value = false;
+        break;
+    case binary_op_set:
+    case binary_op_add:
+    case binary_op_replace:
+        extras_size = 8; wants_key = true; allows_value = true;
+        break;
+    case binary_op_append:
+    case binary_op_prepend:
+        extras_size = 0; wants_key = true; allows_value = true;
+        break;
+    case binary_op_increment:
+    case binary_op_decrement:
+        extras_size = 20; wants_key = true; allows_value = false;
+        break;
+    case binary_op_stat:
+        // The key is optional; it names the statistic to return.
+        return req.extras.empty() && req.value->size() == 0 ? NULL : "Invalid arguments";
+    case binary_op_quit:
+    case binary_op_noop:
+    case binary_op_version:
+        extras_size = 0; wants_key = false; allows_value = false;
+        break;
+    default:
+        unreachable();
+    }
+
+    if (req.extras.size() != extras_size ||
+        (!allows_value && req.value->size() != 0) ||
+        (wants_key ? key_size == 0 : key_size != 0)) {
+        return "Invalid arguments";
+    }
+    if (key_size > MAX_KEY_SIZE) {
+        return "Key too long";
+    }
+    return NULL;
+}
+
+/* Quiet gets suppress misses; every other quiet command suppresses success. */
+static bool binary_response_is_suppressed(const binary_request_t &req, const binary_response_t &res) {
+    if (!req.quiet) {
+        return false;
+    } else if (req.command == binary_op_get) {
+        return res.status == binary_status_key_not_found;
+    } else {
+        return res.status == binary_status_ok;
+    }
+}
+
+static void write_binary_response(txt_memcached_handler_t *rh, const binary_request_t &req,
+                                  const char *key, size_t key_size,
+                                  const binary_response_t &res) THROWS_NOTHING {
+    size_t value_size = res.value ? res.value->size() : 0;
+
+    char header[binary_header_size];
+    header[0] = binary_response_magic;
+    header[1] = req.opcode;
+    encode_binary_uint16(key_size, header + 2);
+    header[4] = res.extras.size();
+    header[5] = 0;
+    encode_binary_uint16(res.status, header + 6);
+    encode_binary_uint32(res.extras.size() + key_size + res.body.size() + value_size, header + 8);
+    encode_binary_uint32(req.opaque, header + 12);
+    encode_binary_uint64(res.cas, header + 16);
+
+    rh->write(header, binary_header_size);
+    rh->write(res.extras.data(), res.extras.size());
+    rh->write(key, key_size);
+    rh->write(res.body.data(), res.body.size());
+    if (res.value) {
+        rh->write_from_data_provider(res.value.get());
+    }
+}
+
+static void write_binary_response(txt_memcached_handler_t *rh, const binary_request_t &req,
+                                  const binary_response_t &res) THROWS_NOTHING {
+    if (req.include_key) {
+        write_binary_response(rh, req, reinterpret_cast<const char *>(req.key.contents()), req.key.size(), res);
+    } else {
+        write_binary_response(rh, req, NULL, 0, res);
+    }
+}
+
+/* Writes a response to a request that is handled in the parsing coroutine
+itself rather than being spawned off. */
+static void write_binary_response_inline(txt_memcached_handler_t *rh, pipeliner_t *pipeliner,
+                                         const binary_request_t &req, const binary_response_t &res) {
+    pipeliner_acq_t pipeliner_acq(pipeliner);
+    pipeliner_acq.done_argparsing();
+    pipeliner_acq.begin_write();
+    if (binary_response_is_suppressed(req, res)) {
+        pipeliner_acq.end_write_without_output();
+    } else {
+        write_binary_response(rh, req, res);
+        pipeliner_acq.end_write();
+    }
+}
+
+void run_binary_get(txt_memcached_handler_t *rh, const binary_request_t &req, order_token_t token, binary_response_t *res) {
+    block_pm_duration get_timer(&rh->stats->pm_cmd_get);
+
+    get_query_t get_query(req.key);
+    memcached_protocol_t::read_t read(get_query, time(NULL));
+    memcached_protocol_t::read_response_t response;
+    rh->nsi->read(read, &response, token, rh->interruptor);
+    const get_result_t &get_res = boost::get<get_result_t>(response.result);
+
+    if (!get_res.value) {
+        res->set_error(binary_status_key_not_found, "Not found");
+        return;
+    }
+    char flags[4];
+    encode_binary_uint32(get_res.flags, flags);
+    res->extras.assign(flags, sizeof(flags));
+    res->cas = get_res.cas;
+    res->value = get_res.value;
+}
+
+void run_binary_storage(txt_memcached_handler_t *rh, const binary_request_t &req, order_token_t token, binary_response_t *res) {
+    block_pm_duration set_timer(&rh->stats->pm_cmd_set);
+
+    mcflags_t mcflags = decode_binary_uint32(req.extras.data());
+    exptime_t exptime = absolute_exptime(decode_binary_uint32(req.extras.data() + 4));
+
+    /* A nonzero CAS in the header turns a set or replace into a "cas". */
+    bool check_cas = req.cas != 0 && req.command != binary_op_add;
+
+    add_policy_t add_policy;
+    replace_policy_t replace_policy;
+    if (check_cas) {
+        add_policy = add_policy_no;
+        replace_policy = replace_policy_if_cas_matches;
+    } else {
+        switch (req.command) {
+        case binary_op_set:
+            add_policy = add_policy_yes;
+            replace_policy = replace_policy_yes;
+            break;
+        case binary_op_add:
+            add_policy = add_policy_yes;
+            replace_policy = replace_policy_no;
+            break;
+        case binary_op_replace:
+            add_policy = add_policy_no;
+            replace_policy = replace_policy_yes;
+            break;
+        default: unreachable();
+        }
+    }
+
+    sarc_mutation_t sarc_mutation(req.key, req.value, mcflags, exptime,
+        add_policy, replace_policy, check_cas ? req.cas : NO_CAS_SUPPLIED);
+    memcached_protocol_t::write_t write(sarc_mutation, rh->generate_cas(), time(NULL));
+    memcached_protocol_t::write_response_t result;
+    rh->nsi->write(write, &result, token, rh->interruptor);
+
+    switch (boost::get<set_result_t>(result.result)) {
+    case sr_stored:
+        break;
+    case sr_didnt_add:
+        res->set_error(binary_status_key_not_found, "Not found");
+        break;
+    case sr_didnt_replace:
+        res->set_error(binary_status_key_exists, "Data exists for key.");
+        break;
+    case sr_too_large:
+        res->set_error(binary_status_value_too_large, "Too large.");
+        break;
+    default: unreachable();
+    }
+}
+
+void run_binary_append_prepend(txt_memcached_handler_t *rh, const binary_request_t &req, order_token_t token, binary_response_t *res) {
+    block_pm_duration set_timer(&rh->stats->pm_cmd_set);
+
+    append_prepend_mutation_t append_prepend_mutation(
+        req.command == binary_op_append ? append_prepend_APPEND : append_prepend_PREPEND,
+        req.key, req.value);
+    memcached_protocol_t::write_t write(append_prepend_mutation, rh->generate_cas(), time(NULL));
+    memcached_protocol_t::write_response_t result;
+    rh->nsi->write(write, &result, token, rh->interruptor);
+
+    switch (boost::get<append_prepend_result_t>(result.result)) {
+    case apr_success:
+        break;
+    case apr_not_found:
+        res->set_error(binary_status_not_stored, "Not stored.");
+        break;
+    case apr_too_large:
+        res->set_error(binary_status_value_too_large, "Too large.");
+        break;
+    default: unreachable();
+    }
+}
+
+void run_binary_delete(txt_memcached_handler_t *rh, const binary_request_t &req, order_token_t token, binary_response_t *res) {
+    block_pm_duration set_timer(&rh->stats->pm_cmd_set);
+
+    delete_mutation_t delete_mutation(req.key, false);
+    memcached_protocol_t::write_t write(delete_mutation, INVALID_CAS, time(NULL));
+    memcached_protocol_t::write_response_t result;
+    rh->nsi->write(write, &result, token, rh->interruptor);
+
+    switch (boost::get<delete_result_t>(result.result)) {
+    case dr_deleted:
+        break;
+    case dr_not_found:
+        res->set_error(binary_status_key_not_found, "Not found");
+        break;
+    default: unreachable();
+    }
+}
+
+/* The binary protocol's initial value and expiration time for increments of
+missing keys are ignored: like the text protocol, we never create the key. */
+void run_binary_incr_decr(txt_memcached_handler_t *rh, const binary_request_t &req, order_token_t token, binary_response_t *res) {
+    block_pm_duration set_timer(&rh->stats->pm_cmd_set);
+
+    incr_decr_mutation_t incr_decr_mutation(
+        req.command == binary_op_increment ? incr_decr_INCR : incr_decr_DECR,
+        req.key, decode_binary_uint64(req.extras.data()));
+    memcached_protocol_t::write_t write(incr_decr_mutation, rh->generate_cas(), time(NULL));
+    memcached_protocol_t::write_response_t result;
+    rh->nsi->write(write, &result, token, rh->interruptor);
+
+    incr_decr_result_t incr_decr_res = boost::get<incr_decr_result_t>(result.result);
+    switch (incr_decr_res.res) {
+    case incr_decr_result_t::idr_success: {
+        char new_value[8];
+        encode_binary_uint64(incr_decr_res.new_value, new_value);
+        res->body.assign(new_value, sizeof(new_value));
+        break;
+    }
+    case incr_decr_result_t::idr_not_found:
+        res->set_error(binary_status_key_not_found, "Not found");
+        break;
+    case incr_decr_result_t::idr_not_numeric:
+        res->set_error(binary_status_non_numeric, "Non-numeric server-side value for incr or decr");
+        break;
+    default: unreachable();
+    }
+}
+
+void run_binary_request(txt_memcached_handler_t *rh, pipeliner_acq_t *pipeliner_acq_raw, binary_request_t *req_raw, order_token_t token) {
+    scoped_ptr_t<pipeliner_acq_t> pipeliner_acq(pipeliner_acq_raw);
+    scoped_ptr_t<binary_request_t> req(req_raw);
+
+    binary_response_t res;
+    std::string error_message;
+    bool ok;
+
+    try {
+        switch (req->command) {
+        case binary_op_get:
+            run_binary_get(rh, *req.get(), token, &res);
+            break;
+        case binary_op_set:
+        case binary_op_add:
+        case binary_op_replace:
+            run_binary_storage(rh, *req.get(), token, &res);
+            break;
+        case binary_op_append:
+        case binary_op_prepend:
+            run_binary_append_prepend(rh, *req.get(), token, &res);
+            break;
+        case binary_op_delete:
+            run_binary_delete(rh, *req.get(), token, &res);
+            break;
+        case binary_op_increment:
+        case binary_op_decrement:
+            run_binary_incr_decr(rh, *req.get(), token, &res);
+            break;
+        default: unreachable();
+        }
+        ok = true;
+    } catch (cannot_perform_query_exc_t e) {
+        error_message = e.what();
+        ok = false;
+    } catch (interrupted_exc_t) {
+        pipeliner_acq->begin_write();
+        pipeliner_acq->end_write_without_output();
+        return;
+    }
+
+    if (!ok) {
+        res.set_error(binary_status_internal_error, error_message);
+    }
+
+    pipeliner_acq->begin_write();
+    if (binary_response_is_suppressed(*req.get(), res)) {
+        pipeliner_acq->end_write_without_output();
+    } else {
+        write_binary_response(rh, *req.get(), res);
+        pipeliner_acq->end_write();
+    }
+}
+
+void handle_binary_memcache(txt_memcached_handler_t *rh) {
+    /* As with the text protocol, requests must be performed in the order that
+    we parse them. */
+    order_source_t order_source;
+
+    pipeliner_t pipeliner(rh);
+
+    /* Declared outside the while-loop so it doesn't repeatedly reallocate its buffer */
+    std::vector<char> key_buffer;
+
+    while (pipeliner.lock_argparsing(), !rh->interruptor->is_pulsed()) {
+        block_pm_duration read_timer(&rh->stats->pm_conns_reading);
+
+        char header[binary_header_size];
+        try {
+            rh->read(header, binary_header_size);
+        } catch (memcached_interface_t::no_more_data_exc_t) {
+            break;
+        }
+
+        uint16_t key_size = decode_binary_uint16(header + 2);
+        uint8_t extras_size = header[4];
+        uint32_t body_size = decode_binary_uint32(header + 8);
+
+        /* We can't resynchronize with a client that sends garbage headers, so
+        we hang up on it. */
+        if (static_cast<uint8_t>(header[0]) != binary_request_magic ||
+            body_size < static_cast<uint32_t>(extras_size) + key_size) {
+            logERR("Aborting memcached connection %p because of a malformed binary request header",
+                   coro_t::self());
+            break;
+        }
+        // Check for signed 32 bit max value for Memcached compatibility...
+        size_t value_size = body_size - extras_size - key_size;
+        if (value_size >= (1u << 31) - 1) {
+            logERR("Aborting memcached connection %p because of a %zu-byte binary request value",
+                   coro_t::self(), value_size);
+            break;
+        }
+
+        scoped_ptr_t<binary_request_t> req(new binary_request_t);
+        req->opcode = header[1];
+        req->opaque = decode_binary_uint32(header + 12);
+        req->cas = decode_binary_uint64(header + 16);
+        req->extras.resize(extras_size);
+        key_buffer.resize(key_size);
+        /* A value that's too large to store is read past rather than into a
+        buffer, so a client can't make us allocate whatever the header says. */
+        bool value_too_large = value_size > MAX_VALUE_SIZE;
+        if (!value_too_large) {
+            req->value = data_buffer_t::create(value_size);
+        }
+        try {
+            if (extras_size > 0) rh->read(req->extras.data(), extras_size);
+            if (key_size > 0) rh->read(key_buffer.data(), key_size);
+            if (value_too_large) {
+                skip_binary_value(rh, value_size);
+            } else if (value_size > 0) {
+                rh->read(req->value->buf(), value_size);
+            }
+        } catch (memcached_interface_t::no_more_data_exc_t) {
+            break;
+        }
+        read_timer.end();
+
+        block_pm_duration action_timer(&rh->stats->pm_conns_acting);
+
+        if (!classify_binary_opcode(req.get())) {
+            binary_response_t res;
+            res.set_error(binary_status_unknown_command, "Unknown command");
+            write_binary_response_inline(rh, &pipeliner, *req.get(), res);
+            continue;
+        }
+        if (value_too_large) {
+            binary_response_t res;
+            res.set_error(binary_status_value_too_large, "Too large.");
+            write_binary_response_inline(rh, &pipeliner, *req.get(), res);
+            continue;
+        }
+        if (const char *message = check_binary_request(*req.get(), key_size)) {
+            binary_response_t res;
+            res.set_error(binary_status_invalid_arguments, message);
+            write_binary_response_inline(rh, &pipeliner, *req.get(), res);
+            continue;
+        }
+        req->key = store_key_t(key_size, reinterpret_cast<const uint8_t *>(key_buffer.data()));
+
+        if (req->command == binary_op_quit) {
+            write_binary_response_inline(rh, &pipeliner, *req.get(), binary_response_t());
+            break;
+        } else if (req->command == binary_op_noop) {
+            write_binary_response_inline(rh, &pipeliner, *req.get(), binary_response_t());
+        } else if (req->command == binary_op_version) {
+            binary_response_t res;
+            res.body = RETHINKDB_VERSION;
+            write_binary_response_inline(rh, &pipeliner, *req.get(), res);
+        } else if (req->command == binary_op_stat) {
+            pipeliner_acq_t pipeliner_acq(&pipeliner);
+
+            std::set<std::string> names_to_match;
+            if (key_size > 0) {
+                names_to_match.insert(std::string(key_buffer.data(), key_size));
+            }
+            scoped_ptr_t<perfmon_result_t> stats(perfmon_get_stats());
+            std::vector<std::pair<std::string, std::string> > stat_values;
+            collect_stats(stats.get(), std::string(), names_to_match, &stat_values);
+
+            /* Each statistic is its own response, with the name as the key;
+            a response with an empty key ends the list. */
+            pipeliner_acq.done_argparsing();
+            pipeliner_acq.begin_write();
+            for (std::vector<std::pair<std::string, std::string> >::const_iterator it = stat_values.begin(); it != stat_values.end(); ++it) {
+                binary_response_t res;
+                res.body = it->second;
+                write_binary_response(rh, *req.get(), it->first.data(), it->first.size(), res);
+            }
+            write_binary_response(rh, *req.get(), NULL, 0, binary_response_t());
+            pipeliner_acq.end_write();
+        } else {
+            if (req->command == binary_op_get) {
+                rh->stats->pm_get_key_size.record(key_size);
+            } else if (req->command == binary_op_delete) {
+                rh->stats->pm_delete_key_size.record(key_size);
+            } else {
+                rh->stats->pm_storage_key_size.record(key_size);
+                if (req->command != binary_op_increment && req->command != binary_op_decrement) {
+                    rh->stats->pm_storage_value_size.record(value_size);
+                }
+            }
+
+            order_token_t token = order_source.check_in("handle_binary_memcache");
+            if (req->command == binary_op_get) {
+                token = token.with_read_mode();
+            }
+
+            scoped_ptr_t<pipeliner_acq_t> pipeliner_acq(new pipeliner_acq_t(&pipeliner));
+            pipeliner_acq->done_argparsing();
+            coro_t::spawn_now_dangerously(boost::bind(&run_binary_request, rh, pipeliner_acq.release(), req.release(), token));
+        }
+
+        action_timer.end();
+    }
+
+    // Make sure anything that would be running has finished.
+    pipeliner_acq_t pipeliner_acq(&pipeliner);
+    pipeliner_acq.done_argparsing();
+    pipeliner_acq.begin_write();
+    pipeliner_acq.end_write();
+}
+
 /* Handle memcached, takes a txt_memcached_handler_t and handles the memcached commands that come in on it */
 void handle_memcache(memcached_interface_t *interface,
         namespace_interface_t<memcached_protocol_t> *nsi,
@@ -1112,6 +1820,21 @@ void handle_memcache(memcached_interface_t *interface,
     context around. */
     txt_memcached_handler_t rh(interface, nsi, max_concurrent_queries_per_connection, stats, interruptor);
 
+    /* Binary-protocol requests always start with the request magic byte, which
+    can never begin a text command. */
+    char first_byte;
+    try {
+        first_byte = rh.peek_byte();
+    } catch (memcached_interface_t::no_more_data_exc_t) {
+        logDBG("Closed memcached stream: %p", coro_t::self());
+        return;
+    }
+    if (static_cast<uint8_t>(first_byte) == binary_request_magic) {
+        handle_binary_memcache(&rh);
+        logDBG("Closed memcached stream: %p", coro_t::self());
+        return;
+    }
+
     /* The commands from each individual memcached handler must be performed in the order
     that the handler parses them. This `order_source_t` is used to guarantee that. */
     order_source_t order_source;
@@ -11,7 +11,8 @@
 /* `handle_memcache()` handles memcache queries from the given `memcached_interface_t`,
 sending the results to the same `memcached_interface_t`, until either SIGINT is sent to
 the server or `memcache_interface_t::read()` or `memcache_interface_t::read_line()`
-throws `no_more_data_exc_t`.
+throws `no_more_data_exc_t`. Both the text protocol and the binary protocol are
+supported; which one a connection speaks is decided by its first byte.
 
 See `memcache/file.hpp` and `memcache/tcp_conn.hpp` for premade functions to handle
 memcache traffic from either a file or a TCP connection. */
@@ -31,6 +32,9 @@ struct memcached_interface_t {
     };
     virtual void read(void *, size_t, signal_t *interruptor) = 0;
     virtual void read_line(std::vector<char> *, signal_t *interruptor) = 0;
+    /* Returns the next byte of input without consuming it. `handle_memcache()`
+    uses this to tell binary-protocol clients from text-protocol clients. */
+    virtual char peek_byte(signal_t *interruptor) = 0;
 
     virtual ~memcached_interface_t() { }
 };
@@ -82,6 +82,8 @@ RDB_IMPL_SERIALIZABLE_3(distribution_get_query_t, max_depth, result_limit, regio
 RDB_IMPL_SERIALIZABLE_3(get_result_t, value, flags, cas);
 RDB_IMPL_SERIALIZABLE_3(key_with_data_buffer_t, key, mcflags, value_provider);
 RDB_IMPL_SERIALIZABLE_2(rget_result_t, pairs, truncated);
+RDB_IMPL_SERIALIZABLE_1(multi_get_query_t, keys);
+RDB_IMPL_SERIALIZABLE_1(multi_get_result_t, pairs);
 RDB_IMPL_SERIALIZABLE_2(distribution_result_t, region, key_counts);
 RDB_IMPL_SERIALIZABLE_1(get_cas_mutation_t, key);
 RDB_IMPL_SERIALIZABLE_7(sarc_mutation_t, key, data, flags, exptime, add_policy, replace_policy, old_cas);
@@ -107,6 +109,25 @@ region_t monokey_region(const store_key_t &k) {
     return region_t(h, h + 1, key_range_t(key_range_t::closed, k, key_range_t::closed, k));
 }
 
+/* The smallest region containing all of `keys`, which must be sorted. */
+region_t multikey_region(const std::vector<store_key_t> &keys) {
+    if (keys.empty()) {
+        return region_t::empty();
+    }
+    uint64_t beg = HASH_REGION_HASH_SIZE, end = 0;
+    for (std::vector<store_key_t>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        uint64_t h = hash_region_hasher(it->contents(), it->size());
+        beg = std::min(beg, h);
+        end = std::max(end, h + 1);
+    }
+    return region_t(beg, end, key_range_t(key_range_t::closed, keys.front(), key_range_t::closed, keys.back()));
+}
+
+bool region_contains_key(const region_t &region, const store_key_t &key) {
+    uint64_t h = hash_region_hasher(key.contents(), key.size());
+    return region.beg <= h && h < region.end && region.inner.contains_key(key);
+}
+
 /* `read_t::get_region()` */
 
 /* Wrap all our local types in anonymous namespaces so the linker doesn't
@@ -123,6 +144,9 @@ struct read_get_region_visitor_t : public boost::static_visitor<region_t> {
     region_t operator()(distribution_get_query_t dst_get) {
         return dst_get.region;
     }
+    region_t operator()(const multi_get_query_t &multi_get) {
+        return multikey_region(multi_get.keys);
+    }
 };
 
 }   /* anonymous namespace */
@@ -157,6 +181,17 @@ struct read_shard_visitor_t : public boost::static_visitor<read_t> {
         distribution_get.region = region;
         return read_t(distribution_get, effective_time);
     }
+    read_t operator()(const multi_get_query_t &multi_get) {
+        /* Each shard only gets the keys it owns, so the store can look them
+        all up in one pass over its btree. */
+        multi_get_query_t sharded;
+        for (std::vector<store_key_t>::const_iterator it = multi_get.keys.begin(); it != multi_get.keys.end(); ++it) {
+            if (region_contains_key(region, *it)) {
+                sharded.keys.push_back(*it);
+            }
+        }
+        return read_t(sharded, effective_time);
+    }
 };
 
 }   /* anonymous namespace */
@@ -242,6 +277,20 @@ struct read_unshard_visitor_t : public boost::static_visitor<read_response_t> {
         return read_response_t(result);
     }
 
+    read_response_t operator()(UNUSED const multi_get_query_t &multi_get) {
+        multi_get_result_t result;
+        for (size_t i = 0; i < count; ++i) {
+            const multi_get_result_t *bit = boost::get<multi_get_result_t>(&bits[i].result);
+            guarantee(bit, "Bad boost::get\n");
+            result.pairs.insert(result.pairs.end(), bit->pairs.begin(), bit->pairs.end());
+        }
+
+        /* Every key lives on exactly one shard, so this never sees equal keys. */
+        std::sort(result.pairs.begin(), result.pairs.end(), key_with_data_buffer_less_t());
+
+        return read_response_t(result);
+    }
+
     read_response_t operator()(distribution_get_query_t dget) {
         // TODO: do this without copying so much and/or without dynamic memory
         // Sort results by region
@@ -457,6 +506,11 @@ struct read_visitor_t : public boost::static_visitor<read_response_t> {
             memcached_get(get.key, btree, effective_time, txn, superblock));
     }
 
+    read_response_t operator()(const multi_get_query_t& multi_get) {
+        return read_response_t(
+            memcached_multi_get(multi_get.keys, btree, effective_time, txn, superblock));
+    }
+
     read_response_t operator()(const rget_query_t& rget) {
         return read_response_t(
             memcached_rget_slice(btree, rget.region.inner, rget.maximum, effective_time, txn, superblock));
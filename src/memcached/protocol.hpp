@@ -37,6 +37,8 @@ RDB_DECLARE_SERIALIZABLE(distribution_get_query_t);
 RDB_DECLARE_SERIALIZABLE(get_result_t);
 RDB_DECLARE_SERIALIZABLE(key_with_data_buffer_t);
 RDB_DECLARE_SERIALIZABLE(rget_result_t);
+RDB_DECLARE_SERIALIZABLE(multi_get_query_t);
+RDB_DECLARE_SERIALIZABLE(multi_get_result_t);
 RDB_DECLARE_SERIALIZABLE(distribution_result_t);
 RDB_DECLARE_SERIALIZABLE(get_cas_mutation_t);
 RDB_DECLARE_SERIALIZABLE(sarc_mutation_t);
@@ -58,7 +60,7 @@ public:
     struct context_t { };
 
     struct read_response_t {
-        typedef boost::variant<get_result_t, rget_result_t, distribution_result_t> result_t;
+        typedef boost::variant<get_result_t, rget_result_t, distribution_result_t, multi_get_result_t> result_t;
 
         read_response_t() { }
         read_response_t(const read_response_t& r) : result(r.result) { }
@@ -68,7 +70,7 @@ public:
     };
 
     struct read_t {
-        typedef boost::variant<get_query_t, rget_query_t, distribution_get_query_t> query_t;
+        typedef boost::variant<get_query_t, rget_query_t, distribution_get_query_t, multi_get_query_t> query_t;
 
         region_t get_region() const THROWS_NOTHING;
         read_t shard(const region_t &region) const THROWS_NOTHING;
@@ -78,7 +80,9 @@ public:
         read_t(const read_t& r) : query(r.query), effective_time(r.effective_time) { }
         read_t(const query_t& q, exptime_t et) : query(q), effective_time(et) { }
 
-        bool use_snapshot() const { return false; }
+        // A multi-get lets go of each node of the btree once it has found
+        // the children it needs, which is only safe in a snapshot.
+        bool use_snapshot() const { return boost::get<multi_get_query_t>(&query); }
 
         query_t query;
         exptime_t effective_time;
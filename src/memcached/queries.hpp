@@ -78,6 +78,21 @@ struct rget_result_t {
     bool truncated;
 };
 
+/* `multi_get` looks up several keys with a single read. `keys` must be sorted
+and free of duplicates. The result only has entries for the keys that were
+found, sorted by key. */
+
+struct multi_get_query_t {
+    std::vector<store_key_t> keys;
+
+    multi_get_query_t() { }
+    explicit multi_get_query_t(const std::vector<store_key_t> &keys_) : keys(keys_) { }
+};
+
+struct multi_get_result_t {
+    std::vector<key_with_data_buffer_t> pairs;
+};
+
 /* `distribution_get` */
 struct distribution_get_query_t {
     distribution_get_query_t()
@@ -88,6 +88,14 @@ struct tcp_conn_memcached_interface_t : public memcached_interface_t, public hom
             throw no_more_data_exc_t();
         }
     }
+
+    char peek_byte(signal_t *interruptor) {
+        try {
+            return *conn->peek(1, interruptor).beg;
+        } catch(tcp_conn_read_closed_exc_t) {
+            throw no_more_data_exc_t();
+        }
+    }
 };
 
 void serve_memcache(tcp_conn_t *conn, namespace_interface_t<memcached_protocol_t> *nsi, memcached_stats_t *stats, signal_t *interruptor) {
@@ -1,8 +1,11 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
 #include "mock/unittest_utils.hpp"
 
+#include <dirent.h>
 #include <stdlib.h>
 
+#include <string>
+
 #include "errors.hpp"
 #include <boost/bind.hpp>
 
@@ -25,6 +28,25 @@ temp_file_t::~temp_file_t() {
     unlink(filename.data());
 }
 
+temp_directory_t::temp_directory_t(const char *tmpl) {
+    size_t len = strlen(tmpl);
+    dirname.init(len + 1);
+    memcpy(dirname.data(), tmpl, len+1);
+    guarantee_err(mkdtemp(dirname.data()) != NULL, "Couldn't create a temporary directory");
+}
+
+temp_directory_t::~temp_directory_t() {
+    DIR *dir = opendir(dirname.data());
+    guarantee_err(dir != NULL, "Couldn't open a temporary directory");
+    while (struct dirent *entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            unlink((std::string(dirname.data()) + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(dirname.data());
+}
+
 void let_stuff_happen() {
 #ifdef VALGRIND
     nap(2000);
@@ -22,6 +22,20 @@ private:
     DISABLE_COPYING(temp_file_t);
 };
 
+/* A directory made with `mkdtemp()`, which is removed along with whatever was
+left in it. */
+class temp_directory_t {
+public:
+    explicit temp_directory_t(const char *tmpl);
+    const char *name() { return dirname.data(); }
+    ~temp_directory_t();
+
+private:
+    scoped_array_t<char> dirname;
+
+    DISABLE_COPYING(temp_directory_t);
+};
+
 void let_stuff_happen();
 
 int randport();
@@ -7,12 +7,16 @@
 
 #include "errors.hpp"
 #include <boost/function.hpp>
+#include <boost/optional.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 
 #include "arch/arch.hpp"
 #include "concurrency/auto_drainer.hpp"
 #include "concurrency/cross_thread_signal.hpp"
+#include "concurrency/mutex.hpp"
+#include "concurrency/rwi_lock.hpp"
+#include "concurrency/semaphore.hpp"
 #include "containers/archive/archive.hpp"
 #include "http/http.hpp"
 
@@ -22,6 +26,12 @@ enum protob_server_callback_mode_t {
     CORO_UNORDERED //a coroutine is spawned for each request and responses are sent back as they are completed
 };
 
+/* In the coroutine modes, requests for which the `is_barrier` function passed
+to `protob_server_t` returns true don't start until every earlier request on the
+same connection has finished, and no later request starts until they finish.
+That's how a client that pipelines a write and then a read gets to see its own
+write. If no function is given, no request is a barrier. */
+
 template<class context_t>
 class http_conn_cache_t : public repeating_timer_callback_t {
 public:
@@ -89,22 +99,59 @@ template <class request_t, class response_t, class context_t>
 class protob_server_t : public http_app_t {
 public:
     // TODO: Function pointers?  Really?
-    protob_server_t(int port, boost::function<response_t(request_t *, context_t *)> _f, response_t (*_on_unparsable_query)(request_t *, std::string), protob_server_callback_mode_t _cb_mode = CORO_ORDERED);
+    protob_server_t(int port, boost::function<response_t(request_t *, context_t *)> _f, response_t (*_on_unparsable_query)(request_t *, std::string), protob_server_callback_mode_t _cb_mode = CORO_ORDERED,
+                    boost::function<bool(const request_t &)> _is_barrier = boost::function<bool(const request_t &)>());
     ~protob_server_t();
     static const int32_t magic_number;
 
     int get_port() const;
 private:
 
+    /* State shared by the coroutines serving one connection in the
+    `CORO_ORDERED` and `CORO_UNORDERED` modes. */
+    struct coro_conn_state_t {
+        coro_conn_state_t(tcp_conn_t *_conn, context_t *_ctx, signal_t *_closer) :
+            conn(_conn), ctx(_ctx), closer(_closer),
+            in_flight(MAX_CONCURRENT_REQUESTS_PER_CONN) { }
+        tcp_conn_t *conn;
+        context_t *ctx;
+        signal_t *closer;
+        /* Only one coroutine at a time may write to `conn`. */
+        mutex_t send_mutex;
+        /* Caps how many requests from one connection run at once. */
+        semaphore_t in_flight;
+        /* Held for read by ordinary requests and for write by barriers. */
+        rwi_lock_t barrier_lock;
+    };
+
     void handle_conn(const scoped_ptr_t<tcp_conn_descriptor_t> &nconn, auto_drainer_t::lock_t);
     void send(const response_t &, tcp_conn_t *conn, signal_t *closer) THROWS_ONLY(tcp_conn_write_closed_exc_t);
 
+    /* One request waiting to be run in the coroutine modes. In
+    `CORO_ORDERED` mode, `prev_sent` is pulsed once the previous request's
+    response is out, and we pulse `this_sent` once ours is; in
+    `CORO_UNORDERED` mode, both are empty. */
+    struct coro_request_t {
+        request_t request;
+        boost::optional<response_t> forced_response;
+        boost::shared_ptr<cond_t> prev_sent, this_sent;
+    };
+
+    /* Runs one request in its own coroutine. The request's locks on `state`
+    have already been acquired; this releases them. */
+    void handle_request_coro(boost::shared_ptr<coro_request_t> req,
+                             coro_conn_state_t *state,
+                             auto_drainer_t::lock_t conn_keepalive);
+
     // For HTTP server
     http_res_t handle(const http_req_t &);
 
     boost::function<response_t(request_t *, context_t *)> f;
     response_t (*on_unparsable_query)(request_t *, std::string);
     protob_server_callback_mode_t cb_mode;
+    boost::function<bool(const request_t &)> is_barrier;
+
+    static const int MAX_CONCURRENT_REQUESTS_PER_CONN = 64;
 
     /* WARNING: The order here is fragile. */
     cond_t main_shutting_down_cond;
@@ -11,16 +11,20 @@
 
 #include "arch/arch.hpp"
 #include "concurrency/cross_thread_signal.hpp"
+#include "concurrency/wait_any.hpp"
+#include "containers/object_buffer.hpp"
 #include "db_thread_info.hpp"
 
 template <class request_t, class response_t, class context_t>
 protob_server_t<request_t, response_t, context_t>::protob_server_t(
     int port, boost::function<response_t(request_t *, context_t *)> _f,
     response_t (*_on_unparsable_query)(request_t *, std::string),
-    protob_server_callback_mode_t _cb_mode)
+    protob_server_callback_mode_t _cb_mode,
+    boost::function<bool(const request_t &)> _is_barrier)
     : f(_f),
       on_unparsable_query(_on_unparsable_query),
       cb_mode(_cb_mode),
+      is_barrier(_is_barrier),
       shutting_down_conds(get_num_threads()),
       pulse_sdc_on_shutdown(&main_shutting_down_cond),
       next_thread(0) {
@@ -69,9 +73,28 @@ void protob_server_t<request_t, response_t, context_t>::handle_conn(const scoped
         return;
     }
 
+    /* In the coroutine modes, requests keep running while we read the next
+    ones, so they can't each have their own interruptor; they share one that
+    lasts as long as the connection. */
+    linux_event_watcher_t *ew = conn->get_event_watcher();
+    object_buffer_t<linux_event_watcher_t::watch_t> conn_interrupted;
+    object_buffer_t<wait_any_t> conn_interruptor;
+    if (cb_mode != INLINE) {
+        conn_interrupted.create(ew, poll_event_rdhup);
+        conn_interruptor.create(conn_interrupted.get(), shutdown_signal());
+        ctx.interruptor = conn_interruptor.get();
+    }
+    coro_conn_state_t coro_state(conn.get(), &ctx, &ct_keepalive);
+    boost::shared_ptr<cond_t> last_sent(new cond_t);
+    last_sent->pulse();
+
+    /* Must be destroyed before anything the request coroutines use. */
+    auto_drainer_t conn_drainer;
+
     //TODO figure out how to do this with less copying
     for (;;) {
-        request_t request;
+        boost::shared_ptr<coro_request_t> coro_request(new coro_request_t);
+        request_t *request = &coro_request->request;
         bool force_response = false;
         response_t forced_response;
         std::string err;
@@ -86,16 +109,16 @@ void protob_server_t<request_t, response_t, context_t>::handle_conn(const scoped
                 scoped_array_t<char> data(size);
                 conn->read(data.data(), size, &ct_keepalive);
 
-                bool res = request.ParseFromArray(data.data(), size);
+                bool res = request->ParseFromArray(data.data(), size);
                 if (!res) {
                     err = "Client is buggy (failed to deserialize protobuf).";
-                    forced_response = on_unparsable_query(&request, err);
+                    forced_response = on_unparsable_query(request, err);
                     force_response = true;
                 }
             }
         } catch (tcp_conn_read_closed_exc_t &) {
-            //TODO need to figure out what blocks us up here in non inline cb
-            //mode
+            /* In the coroutine modes, `conn_drainer` waits for the requests
+            that are still running to send their responses. */
             return;
         }
 
@@ -105,31 +128,73 @@ void protob_server_t<request_t, response_t, context_t>::handle_conn(const scoped
                     if (force_response) {
                         send(forced_response, conn.get(), &ct_keepalive);
                     } else {
-                        linux_event_watcher_t *ew = conn->get_event_watcher();
-                        linux_event_watcher_t::watch_t conn_interrupted(ew, poll_event_rdhup);
-                        wait_any_t interruptor(&conn_interrupted, shutdown_signal());
+                        linux_event_watcher_t::watch_t request_interrupted(ew, poll_event_rdhup);
+                        wait_any_t interruptor(&request_interrupted, shutdown_signal());
                         ctx.interruptor = &interruptor;
-                        send(f(&request, &ctx), conn.get(), &ct_keepalive);
+                        send(f(request, &ctx), conn.get(), &ct_keepalive);
                     }
                     break;
                 case CORO_ORDERED:
-                    crash("unimplemented");
-                    break;
-                case CORO_UNORDERED:
-                    crash("unimplemented");
-                    break;
+                case CORO_UNORDERED: {
+                    /* Get in line in the order requests arrived, so a barrier
+                    sees exactly the requests that came before it. This blocks
+                    reading further requests while a barrier waits, and while
+                    too many requests are already running. */
+                    bool barrier = !force_response && is_barrier && is_barrier(*request);
+                    coro_state.barrier_lock.co_lock(barrier ? rwi_write : rwi_read);
+                    coro_state.in_flight.co_lock();
+
+                    if (force_response) {
+                        coro_request->forced_response = forced_response;
+                    }
+                    if (cb_mode == CORO_ORDERED) {
+                        coro_request->prev_sent = last_sent;
+                        coro_request->this_sent.reset(new cond_t);
+                        last_sent = coro_request->this_sent;
+                    }
+                    coro_t::spawn_now_dangerously(boost::bind(
+                        &protob_server_t<request_t, response_t, context_t>::handle_request_coro, this,
+                        coro_request, &coro_state, auto_drainer_t::lock_t(&conn_drainer)));
+                } break;
                 default:
                     crash("unreachable");
                     break;
             }
         } catch (tcp_conn_write_closed_exc_t &) {
-            //TODO need to figure out what blocks us up here in non inline cb
-            //mode
             return;
         }
     }
 }
 
+template <class request_t, class response_t, class context_t>
+void protob_server_t<request_t, response_t, context_t>::handle_request_coro(
+        boost::shared_ptr<coro_request_t> req,
+        coro_conn_state_t *state,
+        UNUSED auto_drainer_t::lock_t conn_keepalive) {
+    response_t response = req->forced_response ? *req->forced_response : f(&req->request, state->ctx);
+
+    state->in_flight.unlock();
+    state->barrier_lock.unlock();
+
+    if (req->prev_sent) {
+        /* `CORO_ORDERED`: wait for our turn. */
+        req->prev_sent->wait_lazily_unordered();
+    }
+    try {
+        mutex_t::acq_t send_acq(&state->send_mutex);
+        send(response, state->conn, state->closer);
+    } catch (tcp_conn_write_closed_exc_t &) {
+        /* The client went away; nobody is waiting for the response. Closing
+        the read half stops `handle_conn()` from accepting more requests. */
+        if (state->conn->is_read_open()) {
+            state->conn->shutdown_read();
+        }
+    }
+    if (req->this_sent) {
+        req->this_sent->pulse();
+    }
+}
+
 template <class request_t, class response_t, class context_t>
 void protob_server_t<request_t, response_t, context_t>::send(const response_t &res, tcp_conn_t *conn, signal_t *closer) THROWS_ONLY(tcp_conn_write_closed_exc_t) {
     int size = res.ByteSize();
@@ -188,9 +253,13 @@ http_res_t protob_server_t<request_t, response_t, context_t>::handle(const http_
         request_t request;
         bool parseSucceeded = request.ParseFromArray(data, req_size);
 
+        /* Every HTTP request already gets its own coroutine from the HTTP
+        server, so all the callback modes behave the same here. */
         response_t response;
         switch(cb_mode) {
-        case INLINE: {
+        case INLINE:
+        case CORO_ORDERED:
+        case CORO_UNORDERED: {
             boost::shared_ptr<typename http_conn_cache_t<context_t>::http_conn_t> conn =
                 http_conn_cache.find(conn_id);
             if (!parseSucceeded) {
@@ -204,9 +273,6 @@ http_res_t protob_server_t<request_t, response_t, context_t>::handle(const http_
                 response = f(&request, ctx);
             }
         } break;
-        case CORO_ORDERED:
-        case CORO_UNORDERED:
-            crash("unimplemented");
         default:
             crash("unreachable");
             break;
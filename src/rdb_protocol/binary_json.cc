@@ -0,0 +1,466 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/binary_json.hpp"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "errors.hpp"
+
+namespace {
+
+/* The tag, then the size of the rest of the value, then the count. */
+const size_t CONTAINER_HEADER_SIZE = 1 + 2 * sizeof(uint32_t);
+
+void append_uint32(std::string *out, uint32_t x) {
+    out->append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+void write_uint32(std::string *out, size_t pos, uint32_t x) {
+    memcpy(&(*out)[pos], &x, sizeof(x));
+}
+
+uint32_t read_uint32(const char *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/* Orders field names the way `cJSON_GetObjectItem()` matches them, i.e.
+ignoring case. */
+int name_cmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t n = std::min(a_len, b_len);
+    for (size_t i = 0; i < n; ++i) {
+        int ca = tolower(static_cast<unsigned char>(a[i]));
+        int cb = tolower(static_cast<unsigned char>(b[i]));
+        if (ca != cb) {
+            return ca - cb;
+        }
+    }
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+struct field_ref_t {
+    const char *name;
+    size_t name_len;
+    uint32_t offset;
+};
+
+bool field_ref_less(const field_ref_t &a, const field_ref_t &b) {
+    return name_cmp(a.name, a.name_len, b.name, b.name_len) < 0;
+}
+
+/* Fills in the offset table of an object, which is sorted by field name, and
+the size of an array or object whose elements have all been written. */
+void finish_container(int type, size_t size_pos, size_t table_pos, std::vector<field_ref_t> *fields, std::string *out) {
+    if (type == cJSON_Object) {
+        // A stable sort keeps duplicate names in document order, so lookups
+        // find the same field that `cJSON_GetObjectItem()` would.
+        std::stable_sort(fields->begin(), fields->end(), &field_ref_less);
+        for (size_t i = 0; i < fields->size(); ++i) {
+            write_uint32(out, table_pos + i * sizeof(uint32_t), (*fields)[i].offset);
+        }
+    }
+
+    guarantee(out->size() - (size_pos + sizeof(uint32_t)) <= UINT32_MAX);
+    write_uint32(out, size_pos, out->size() - (size_pos + sizeof(uint32_t)));
+}
+
+void encode_value(const cJSON *json, std::string *out) {
+    int type = json->type & 255;
+    out->push_back(static_cast<char>(type));
+
+    switch (type) {
+    case cJSON_False:
+    case cJSON_True:
+    case cJSON_NULL:
+        break;
+    case cJSON_Number:
+        out->append(reinterpret_cast<const char *>(&json->valuedouble), sizeof(json->valuedouble));
+        break;
+    case cJSON_String: {
+        guarantee(json->valuestring);
+        size_t len = strlen(json->valuestring);
+        append_uint32(out, len);
+        out->append(json->valuestring, len);
+    } break;
+    case cJSON_Array:
+    case cJSON_Object: {
+        size_t size_pos = out->size();
+        append_uint32(out, 0);
+        uint32_t count = cJSON_GetArraySize(json);
+        append_uint32(out, count);
+        size_t table_pos = out->size();
+        out->append(count * sizeof(uint32_t), '\0');
+        size_t data_pos = out->size();
+
+        std::vector<field_ref_t> fields;
+        fields.reserve(type == cJSON_Object ? count : 0);
+        uint32_t i = 0;
+        for (const cJSON *hd = json->child; hd; hd = hd->next, ++i) {
+            uint32_t offset = out->size() - data_pos;
+            if (type == cJSON_Object) {
+                guarantee(hd->string);
+                field_ref_t ref;
+                ref.name = hd->string;
+                ref.name_len = strlen(hd->string);
+                ref.offset = offset;
+                fields.push_back(ref);
+                append_uint32(out, ref.name_len);
+                out->append(ref.name, ref.name_len);
+            } else {
+                write_uint32(out, table_pos + i * sizeof(uint32_t), offset);
+            }
+            encode_value(hd, out);
+        }
+        guarantee(i == count);
+        finish_container(type, size_pos, table_pos, &fields, out);
+    } break;
+    default:
+        unreachable();
+    }
+}
+
+void encode_value(const query_language::json_value_t *json, std::string *out) {
+    int type = json->type();
+    out->push_back(static_cast<char>(type));
+
+    switch (type) {
+    case cJSON_False:
+    case cJSON_True:
+    case cJSON_NULL:
+        break;
+    case cJSON_Number: {
+        double d = json->as_number();
+        out->append(reinterpret_cast<const char *>(&d), sizeof(d));
+    } break;
+    case cJSON_String:
+        append_uint32(out, json->string_size());
+        out->append(json->as_string(), json->string_size());
+        break;
+    case cJSON_Array:
+    case cJSON_Object: {
+        size_t size_pos = out->size();
+        append_uint32(out, 0);
+        uint32_t count = json->size();
+        append_uint32(out, count);
+        size_t table_pos = out->size();
+        out->append(count * sizeof(uint32_t), '\0');
+        size_t data_pos = out->size();
+
+        std::vector<field_ref_t> fields;
+        fields.reserve(type == cJSON_Object ? count : 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t offset = out->size() - data_pos;
+            if (type == cJSON_Object) {
+                field_ref_t ref;
+                ref.name = json->name(i);
+                ref.name_len = strlen(ref.name);
+                ref.offset = offset;
+                fields.push_back(ref);
+                append_uint32(out, ref.name_len);
+                out->append(ref.name, ref.name_len);
+            } else {
+                write_uint32(out, table_pos + i * sizeof(uint32_t), offset);
+            }
+            encode_value(json->get(i), out);
+        }
+        finish_container(type, size_pos, table_pos, &fields, out);
+    } break;
+    default:
+        unreachable();
+    }
+}
+
+/* Links `item` in after `*tail`, or as the first child of `parent`. */
+void append_child(cJSON *parent, cJSON **tail, cJSON *item) {
+    if (*tail) {
+        (*tail)->next = item;
+        item->prev = *tail;
+    } else {
+        parent->child = item;
+    }
+    *tail = item;
+}
+
+char *copy_string(const char *data, size_t len) {
+    char *res = static_cast<char *>(malloc(len + 1));
+    guarantee(res);
+    memcpy(res, data, len);
+    res[len] = '\0';
+    return res;
+}
+
+}  // namespace
+
+void binary_json_encode(const cJSON *json, std::string *out) {
+    out->push_back(BINARY_JSON_MAGIC);
+    out->push_back(BINARY_JSON_VERSION);
+    encode_value(json, out);
+}
+
+void binary_json_encode(const query_language::json_value_t *json, std::string *out) {
+    out->push_back(BINARY_JSON_MAGIC);
+    out->push_back(BINARY_JSON_VERSION);
+    encode_value(json, out);
+}
+
+bool binary_json_is_encoded(const char *data, size_t size) {
+    return size > 2 && data[0] == BINARY_JSON_MAGIC && data[1] == BINARY_JSON_VERSION;
+}
+
+binary_json_view_t::binary_json_view_t(const char *data, size_t size) {
+    guarantee(binary_json_is_encoded(data, size));
+    *this = at(data + 2, data + size);
+}
+
+binary_json_view_t binary_json_view_t::at(const char *data, const char *end) {
+    guarantee(data < end, "corruption detected in a binary json value\n");
+
+    size_t size;
+    switch (static_cast<unsigned char>(*data)) {
+    case cJSON_False:
+    case cJSON_True:
+    case cJSON_NULL:
+        size = 1;
+        break;
+    case cJSON_Number:
+        size = 1 + sizeof(double);
+        break;
+    case cJSON_String:
+        guarantee(end - data >= static_cast<ptrdiff_t>(1 + sizeof(uint32_t)), "corruption detected in a binary json value\n");
+        size = 1 + sizeof(uint32_t) + read_uint32(data + 1);
+        break;
+    case cJSON_Array:
+    case cJSON_Object:
+        guarantee(end - data >= static_cast<ptrdiff_t>(CONTAINER_HEADER_SIZE), "corruption detected in a binary json value\n");
+        size = 1 + sizeof(uint32_t) + read_uint32(data + 1);
+        guarantee(size >= CONTAINER_HEADER_SIZE + read_uint32(data + 1 + sizeof(uint32_t)) * sizeof(uint32_t),
+                  "corruption detected in a binary json value\n");
+        break;
+    default:
+        crash("corruption detected in a binary json value\n");
+    }
+    guarantee(size <= static_cast<size_t>(end - data), "corruption detected in a binary json value\n");
+
+    binary_json_view_t res;
+    res.data_ = data;
+    res.size_ = size;
+    return res;
+}
+
+double binary_json_view_t::number() const {
+    guarantee(type() == cJSON_Number);
+    double res;
+    memcpy(&res, data_ + 1, sizeof(res));
+    return res;
+}
+
+std::string binary_json_view_t::str() const {
+    guarantee(type() == cJSON_String);
+    return std::string(data_ + 1 + sizeof(uint32_t), read_uint32(data_ + 1));
+}
+
+size_t binary_json_view_t::count() const {
+    guarantee(type() == cJSON_Array || type() == cJSON_Object);
+    return read_uint32(data_ + 1 + sizeof(uint32_t));
+}
+
+uint32_t binary_json_view_t::offset(size_t i) const {
+    return read_uint32(data_ + CONTAINER_HEADER_SIZE + i * sizeof(uint32_t));
+}
+
+const char *binary_json_view_t::contents() const {
+    return data_ + CONTAINER_HEADER_SIZE + count() * sizeof(uint32_t);
+}
+
+binary_json_view_t binary_json_view_t::element(size_t i) const {
+    guarantee(type() == cJSON_Array);
+    guarantee(i < count());
+    return at(contents() + offset(i), data_ + size_);
+}
+
+bool binary_json_view_t::field(const char *name, binary_json_view_t *out) const {
+    guarantee(type() == cJSON_Object);
+    const char *end = data_ + size_;
+    size_t name_len = strlen(name);
+
+    // Find the first field whose name isn't less than `name`.
+    size_t lo = 0, hi = count();
+    const char *found = NULL;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *entry = contents() + offset(mid);
+        guarantee(entry + sizeof(uint32_t) <= end, "corruption detected in a binary json value\n");
+        uint32_t len = read_uint32(entry);
+        guarantee(len <= static_cast<size_t>(end - entry - sizeof(uint32_t)), "corruption detected in a binary json value\n");
+        int cmp = name_cmp(entry + sizeof(uint32_t), len, name, name_len);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            if (cmp == 0) {
+                found = entry;
+            }
+            hi = mid;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+    *out = at(found + sizeof(uint32_t) + read_uint32(found), end);
+    return true;
+}
+
+cJSON *binary_json_view_t::to_cJSON() const {
+    switch (type()) {
+    case cJSON_False:
+        return cJSON_CreateFalse();
+    case cJSON_True:
+        return cJSON_CreateTrue();
+    case cJSON_NULL:
+        return cJSON_CreateNull();
+    case cJSON_Number:
+        return cJSON_CreateNumber(number());
+    case cJSON_String: {
+        cJSON *res = cJSON_CreateBlank();
+        res->type = cJSON_String;
+        res->valuestring = copy_string(data_ + 1 + sizeof(uint32_t), read_uint32(data_ + 1));
+        return res;
+    }
+    case cJSON_Array:
+    case cJSON_Object: {
+        // Walk the data rather than the offset table so that the fields of an
+        // object come out in document order.
+        bool is_object = (type() == cJSON_Object);
+        cJSON *res = is_object ? cJSON_CreateObject() : cJSON_CreateArray();
+        cJSON *tail = NULL;
+        const char *end = data_ + size_;
+        const char *p = contents();
+        for (size_t i = 0, n = count(); i < n; ++i) {
+            const char *name = NULL;
+            uint32_t name_len = 0;
+            if (is_object) {
+                guarantee(p + sizeof(uint32_t) <= end, "corruption detected in a binary json value\n");
+                name_len = read_uint32(p);
+                name = p + sizeof(uint32_t);
+                guarantee(name_len <= static_cast<size_t>(end - name), "corruption detected in a binary json value\n");
+                p = name + name_len;
+            }
+            binary_json_view_t child = at(p, end);
+            cJSON *item = child.to_cJSON();
+            if (is_object) {
+                item->string = copy_string(name, name_len);
+            }
+            append_child(res, &tail, item);
+            p += child.size_;
+        }
+        return res;
+    }
+    default:
+        unreachable();
+    }
+}
+
+cJSON *binary_json_decode(const char *data, size_t size) {
+    return binary_json_view_t(data, size).to_cJSON();
+}
+
+cJSON *binary_json_project(binary_json_source_t *source, const std::set<std::string> &fields) {
+    size_t total = source->size();
+    char header[2 + CONTAINER_HEADER_SIZE];
+    if (total < sizeof(header)) {
+        return NULL;
+    }
+    source->read(0, sizeof(header), header);
+    if (!binary_json_is_encoded(header, total) || header[2] != cJSON_Object) {
+        return NULL;
+    }
+
+    uint32_t count = read_uint32(header + 2 + 1 + sizeof(uint32_t));
+    size_t table_pos = sizeof(header);
+    guarantee(table_pos + count * sizeof(uint32_t) <= total, "corruption detected in a binary json value\n");
+    std::vector<char> table(fields.empty() ? 0 : count * sizeof(uint32_t));
+    if (!table.empty()) {
+        source->read(table_pos, table.size(), table.data());
+    }
+    size_t data_pos = table_pos + count * sizeof(uint32_t);
+
+    cJSON *res = cJSON_CreateObject();
+    cJSON *tail = NULL;
+    std::string name;
+    for (std::set<std::string>::const_iterator it = fields.begin(); it != fields.end(); ++it) {
+        // Find the first field whose name isn't less than `*it`.
+        size_t lo = 0, hi = count;
+        size_t found_pos = 0;
+        bool found = false;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            size_t entry_pos = data_pos + read_uint32(table.data() + mid * sizeof(uint32_t));
+            char len_buf[sizeof(uint32_t)];
+            guarantee(entry_pos + sizeof(len_buf) <= total, "corruption detected in a binary json value\n");
+            source->read(entry_pos, sizeof(len_buf), len_buf);
+            uint32_t len = read_uint32(len_buf);
+            guarantee(len <= total - entry_pos - sizeof(len_buf), "corruption detected in a binary json value\n");
+            name.resize(len);
+            if (len != 0) {
+                source->read(entry_pos + sizeof(len_buf), len, &name[0]);
+            }
+            int cmp = name_cmp(name.data(), len, it->data(), it->size());
+            if (cmp < 0) {
+                lo = mid + 1;
+            } else {
+                if (cmp == 0) {
+                    found = true;
+                    found_pos = entry_pos;
+                }
+                hi = mid;
+            }
+        }
+        if (!found) {
+            continue;
+        }
+
+        // Read the field's name, then just enough of the value to learn its
+        // size, then the value.
+        char len_buf[sizeof(uint32_t)];
+        source->read(found_pos, sizeof(len_buf), len_buf);
+        uint32_t name_len = read_uint32(len_buf);
+        name.resize(name_len);
+        if (name_len != 0) {
+            source->read(found_pos + sizeof(len_buf), name_len, &name[0]);
+        }
+        size_t value_pos = found_pos + sizeof(len_buf) + name_len;
+        guarantee(value_pos < total, "corruption detected in a binary json value\n");
+        char value_header[1 + sizeof(uint32_t)];
+        size_t header_size = std::min(sizeof(value_header), total - value_pos);
+        source->read(value_pos, header_size, value_header);
+        size_t value_size;
+        switch (static_cast<unsigned char>(value_header[0])) {
+        case cJSON_False:
+        case cJSON_True:
+        case cJSON_NULL:
+            value_size = 1;
+            break;
+        case cJSON_Number:
+            value_size = 1 + sizeof(double);
+            break;
+        default:
+            guarantee(header_size == sizeof(value_header), "corruption detected in a binary json value\n");
+            value_size = 1 + sizeof(uint32_t) + read_uint32(value_header + 1);
+            break;
+        }
+        guarantee(value_size <= total - value_pos, "corruption detected in a binary json value\n");
+        std::vector<char> value(value_size);
+        source->read(value_pos, value_size, value.data());
+
+        cJSON *item = binary_json_view_t::at(value.data(), value.data() + value.size()).to_cJSON();
+        item->string = copy_string(name.data(), name.size());
+        append_child(res, &tail, item);
+    }
+    return res;
+}
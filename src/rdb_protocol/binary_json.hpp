@@ -0,0 +1,112 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_BINARY_JSON_HPP_
+#define RDB_PROTOCOL_BINARY_JSON_HPP_
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+
+#include "http/json.hpp"
+#include "rdb_protocol/json_value.hpp"
+
+/* `binary_json` is the format that rows are stored in on disk. Unlike the
+serialization of a cJSON tree that's used on the wire, it can be read in place:
+every value knows its own size, arrays have a table of element offsets, and
+objects have a table of field offsets sorted by field name, so a single field
+can be found with a binary search and without building the rest of the
+document.
+
+An encoded document is a two-byte header (`BINARY_JSON_MAGIC`, then
+`BINARY_JSON_VERSION`) followed by one value. A value is a tag byte, which is
+the cJSON type, followed by:
+
+  - false, true, null: nothing.
+  - number: the double.
+  - string: its length (uint32_t), then its bytes.
+  - array: the size of the rest of the value (uint32_t), the number of
+    elements (uint32_t), each element's offset from the start of the data
+    (uint32_t), then the elements.
+  - object: the same as an array, except that the offsets point to fields,
+    are sorted by field name, and each field is the name's length (uint32_t),
+    the name, then the value.
+
+Integers and doubles are in host byte order, like the rest of our on-disk
+formats. The fields of an object stay in their original order in the data, so
+decoding gives back the same document.
+
+Rows written before this format existed are serialized cJSON trees, which
+start with the four-byte cJSON type, so their first byte is never
+`BINARY_JSON_MAGIC`. Readers check `binary_json_is_encoded()` and fall back to
+the old format, and rows are rewritten in the new format the next time they
+are written. */
+
+#define BINARY_JSON_MAGIC '\xb1'
+#define BINARY_JSON_VERSION '\x01'
+
+/* Appends the encoding of `json`, including the header, to `*out`. */
+void binary_json_encode(const cJSON *json, std::string *out);
+void binary_json_encode(const query_language::json_value_t *json, std::string *out);
+
+bool binary_json_is_encoded(const char *data, size_t size);
+
+/* Something that an encoded document can be read from a piece at a time. */
+class binary_json_source_t {
+public:
+    virtual size_t size() = 0;
+    virtual void read(size_t offset, size_t size, char *out) = 0;
+
+protected:
+    virtual ~binary_json_source_t() { }
+};
+
+class binary_json_view_t {
+public:
+    binary_json_view_t() : data_(NULL), size_(0) { }
+
+    /* `data` is a whole encoded document, including the header. The view
+    doesn't copy it, so it has to outlive the view and anything obtained from
+    it. */
+    binary_json_view_t(const char *data, size_t size);
+
+    int type() const { return static_cast<unsigned char>(*data_); }
+
+    double number() const;
+    std::string str() const;
+
+    /* The number of elements of an array or fields of an object. */
+    size_t count() const;
+
+    binary_json_view_t element(size_t i) const;
+
+    /* Finds a field of an object. Like `cJSON_GetObjectItem()`, the name is
+    case insensitive and the first matching field wins. */
+    bool field(const char *name, binary_json_view_t *out) const;
+
+    /* Builds the cJSON tree for this value. The caller owns it. */
+    cJSON *to_cJSON() const;
+
+private:
+    friend cJSON *binary_json_project(binary_json_source_t *source, const std::set<std::string> &fields);
+
+    /* Makes a view of the value that starts at `data`, which must end at or
+    before `end`. */
+    static binary_json_view_t at(const char *data, const char *end);
+
+    uint32_t offset(size_t i) const;
+    const char *contents() const;
+
+    const char *data_;
+    size_t size_;
+};
+
+/* Decodes a whole document into a cJSON tree. The caller owns it. */
+cJSON *binary_json_decode(const char *data, size_t size);
+
+/* Builds an object holding only the listed top-level fields of the document in
+`source`, reading just the header, the offset table and the bytes of the
+fields it looks at. Returns NULL if the source doesn't hold an encoded object,
+in which case the caller has to decode the whole thing. */
+cJSON *binary_json_project(binary_json_source_t *source, const std::set<std::string> &fields);
+
+#endif  // RDB_PROTOCOL_BINARY_JSON_HPP_
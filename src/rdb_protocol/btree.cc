@@ -1,5 +1,8 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "errors.hpp"
@@ -11,10 +14,14 @@
 #include "btree/erase_range.hpp"
 #include "btree/get_distribution.hpp"
 #include "btree/operations.hpp"
+#include "btree/parallel_traversal.hpp"
+#include "btree/secondary_operations.hpp"
+#include "btree/superblock.hpp"
 #include "buffer_cache/blob.hpp"
 #include "containers/archive/buffer_group_stream.hpp"
 #include "containers/archive/vector_stream.hpp"
 #include "containers/scoped.hpp"
+#include "rdb_protocol/binary_json.hpp"
 #include "rdb_protocol/btree.hpp"
 #include "rdb_protocol/environment.hpp"
 #include "rdb_protocol/query_language.hpp"
@@ -84,18 +91,92 @@ block_magic_t value_sizer_t<rdb_value_t>::btree_leaf_magic() const {
 
 block_size_t value_sizer_t<rdb_value_t>::block_size() const { return block_size_; }
 
-boost::shared_ptr<scoped_cJSON_t> get_data(const rdb_value_t *value, transaction_t *txn) {
-    blob_t blob(const_cast<rdb_value_t *>(value)->value_ref(), blob::btree_maxreflen);
+/* Exposes the contents of a value's blob as one contiguous range of bytes.
+Values that fit in a single buffer are read in place; bigger ones are copied. */
+class exposed_value_t {
+public:
+    exposed_value_t(const rdb_value_t *value, transaction_t *txn)
+        : blob(const_cast<rdb_value_t *>(value)->value_ref(), blob::btree_maxreflen) {
+        blob.expose_all(txn, rwi_read, &buffer_group, &acq_group);
+        size_ = buffer_group.get_size();
+        if (buffer_group.num_buffers() == 1) {
+            data_ = static_cast<const char *>(buffer_group.get_buffer(0).data);
+        } else {
+            copy.reserve(size_);
+            for (size_t i = 0; i < buffer_group.num_buffers(); ++i) {
+                buffer_group_t::buffer_t buf = buffer_group.get_buffer(i);
+                copy.append(static_cast<const char *>(buf.data), buf.size);
+            }
+            data_ = copy.data();
+        }
+    }
 
-    boost::shared_ptr<scoped_cJSON_t> data;
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    const const_buffer_group_t *buffers() const { return const_view(&buffer_group); }
+
+private:
+    blob_t blob;
+    blob_acq_t acq_group;
+    buffer_group_t buffer_group;
+    std::string copy;
+    const char *data_;
+    size_t size_;
+
+    DISABLE_COPYING(exposed_value_t);
+};
+
+/* Reads pieces of a value's blob, so that only the blocks that hold them get
+loaded. */
+class blob_json_source_t : public binary_json_source_t {
+public:
+    blob_json_source_t(const rdb_value_t *value, transaction_t *_txn)
+        : blob(const_cast<rdb_value_t *>(value)->value_ref(), blob::btree_maxreflen), txn(_txn) { }
+
+    size_t size() { return blob.valuesize(); }
+
+    void read(size_t offset, size_t size, char *out) {
+        blob_acq_t acq_group;
+        buffer_group_t buffer_group;
+        blob.expose_region(txn, rwi_read, offset, size, &buffer_group, &acq_group);
+        buffer_group_t out_group;
+        out_group.add_buffer(size, out);
+        buffer_group_copy_data(&out_group, const_view(&buffer_group));
+    }
+
+private:
+    blob_t blob;
+    transaction_t *txn;
+
+    DISABLE_COPYING(blob_json_source_t);
+};
+
+template <class T>
+void get_value_data(const rdb_value_t *value, transaction_t *txn, T *data_out) {
+    blob_t blob(const_cast<rdb_value_t *>(value)->value_ref(), blob::btree_maxreflen);
 
     blob_acq_t acq_group;
     buffer_group_t buffer_group;
     blob.expose_all(txn, rwi_read, &buffer_group, &acq_group);
     buffer_group_read_stream_t read_stream(const_view(&buffer_group));
-    int res = deserialize(&read_stream, &data);
+    int res = deserialize(&read_stream, data_out);
     guarantee_err(res == 0, "corruption detected... this should probably be an exception\n");
+}
+
+/* Rows are stored in the `binary_json` format. Rows written by older versions
+are serialized cJSON trees; they're still read, and get converted the next
+time they're written. */
+boost::shared_ptr<scoped_cJSON_t> get_data(const rdb_value_t *value, transaction_t *txn) {
+    exposed_value_t exposed(value, txn);
+    if (binary_json_is_encoded(exposed.data(), exposed.size())) {
+        return boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(binary_json_decode(exposed.data(), exposed.size())));
+    }
 
+    boost::shared_ptr<scoped_cJSON_t> data;
+    buffer_group_read_stream_t read_stream(exposed.buffers());
+    int res = deserialize(&read_stream, &data);
+    guarantee_err(res == 0, "corruption detected... this should probably be an exception\n");
     return data;
 }
 
@@ -103,14 +184,93 @@ bool btree_value_fits(block_size_t bs, int data_length, const rdb_value_t *value
     return blob::ref_fits(bs, data_length, value->value_ref(), blob::btree_maxreflen);
 }
 
-void rdb_get(const store_key_t &store_key, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock, point_read_response_t *response) {
+void rdb_get(const store_key_t &store_key, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+             query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+             point_read_response_t *response) {
     keyvalue_location_t<rdb_value_t> kv_location;
     find_keyvalue_location_for_read(txn, superblock, store_key.btree_key(), &kv_location, slice->root_eviction_priority, &slice->stats);
 
     if (!kv_location.value.has()) {
         response->data.reset(new scoped_cJSON_t(cJSON_CreateNull()));
-    } else {
-        response->data = get_data(kv_location.value.get(), txn);
+        return;
+    }
+
+    boost::shared_ptr<scoped_cJSON_t> row = get_data(kv_location.value.get(), txn);
+    if (transform.empty()) {
+        response->data = row;
+        return;
+    }
+
+    // We let go of the leaf before running the transform, which might have to
+    // wait for a javascript worker.
+    kv_location.buf.release_if_acquired();
+
+    std::vector<json_list_t> data;
+    try {
+        query_language::transform_rows(transform, std::vector<boost::shared_ptr<scoped_cJSON_t> >(1, row), &data, env);
+        response->transformed = std::vector<boost::shared_ptr<scoped_cJSON_t> >(data[0].begin(), data[0].end());
+    } catch (const query_language::runtime_exc_t &e) {
+        response->transformed = e;
+    }
+    response->data.reset(new scoped_cJSON_t(cJSON_CreateNull()));
+}
+
+void rdb_multi_get(const std::vector<store_key_t> &keys, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                   query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+                   multi_point_read_response_t *response) {
+    if (keys.empty()) {
+        superblock->release();
+        return;
+    }
+
+    // Each lookup releases the superblock once; the last one really does. The
+    // rows are all read before the transform runs, since it might have to wait
+    // for a javascript worker.
+    refcount_superblock_t refcount_superblock(superblock, keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        point_read_response_t row;
+        rdb_get(keys[i], slice, txn, &refcount_superblock, env, rdb_protocol_details::transform_t(), &row);
+        response->rows.push_back(std::make_pair(keys[i], row));
+    }
+    if (transform.empty()) {
+        return;
+    }
+
+    std::vector<size_t> present;
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > rows;
+    for (size_t i = 0; i < response->rows.size(); ++i) {
+        point_read_response_t *row = &response->rows[i].second;
+        if (row->data->type() != cJSON_NULL) {
+            present.push_back(i);
+            rows.push_back(row->data);
+        }
+        row->data.reset(new scoped_cJSON_t(cJSON_CreateNull()));
+    }
+    if (rows.empty()) {
+        return;
+    }
+
+    // The rows are transformed together. If that throws, we can't tell which
+    // row it threw for, so we go through them again one at a time, and only
+    // the ones that throw on their own get an error.
+    std::vector<json_list_t> data;
+    try {
+        query_language::transform_rows(transform, rows, &data, env);
+    } catch (const query_language::runtime_exc_t &) {
+        for (size_t i = 0; i < present.size(); ++i) {
+            point_read_response_t *row = &response->rows[present[i]].second;
+            try {
+                std::vector<json_list_t> row_data;
+                query_language::transform_rows(transform, std::vector<boost::shared_ptr<scoped_cJSON_t> >(1, rows[i]), &row_data, env);
+                row->transformed = std::vector<boost::shared_ptr<scoped_cJSON_t> >(row_data[0].begin(), row_data[0].end());
+            } catch (const query_language::runtime_exc_t &e) {
+                row->transformed = e;
+            }
+        }
+        return;
+    }
+    for (size_t i = 0; i < present.size(); ++i) {
+        response->rows[present[i]].second.transformed = std::vector<boost::shared_ptr<scoped_cJSON_t> >(data[i].begin(), data[i].end());
     }
 }
 
@@ -124,13 +284,28 @@ void kv_location_delete(keyvalue_location_t<rdb_value_t> *kv_location, const sto
     apply_keyvalue_change(txn, kv_location, key.btree_key(), timestamp, false, &null_cb, &slice->root_eviction_priority);
 }
 
-void kv_location_set(keyvalue_location_t<rdb_value_t> *kv_location, const store_key_t &key,
-                     boost::shared_ptr<scoped_cJSON_t> data,
-                     btree_slice_t *slice, repli_timestamp_t timestamp, transaction_t *txn) {
+void kv_location_set_bytes(keyvalue_location_t<rdb_value_t> *kv_location, const store_key_t &key,
+                           const std::string &sered_data,
+                           btree_slice_t *slice, repli_timestamp_t timestamp, transaction_t *txn) {
 
     scoped_malloc_t<rdb_value_t> new_value(MAX_RDB_VALUE_SIZE);
     bzero(new_value.get(), MAX_RDB_VALUE_SIZE);
 
+    blob_t blob(new_value->value_ref(), blob::btree_maxreflen);
+    blob.append_region(txn, sered_data.size());
+    blob.write_from_string(sered_data, txn, 0);
+
+    // Actually update the leaf, if needed.
+    kv_location->value.reinterpret_swap(new_value);
+    null_key_modification_callback_t<rdb_value_t> null_cb;
+    apply_keyvalue_change(txn, kv_location, key.btree_key(), timestamp, false, &null_cb, &slice->root_eviction_priority);
+    //                                                                  ^^^^^ That means the key isn't expired.
+}
+
+template <class T>
+void kv_location_set_data(keyvalue_location_t<rdb_value_t> *kv_location, const store_key_t &key,
+                          const T &data,
+                          btree_slice_t *slice, repli_timestamp_t timestamp, transaction_t *txn) {
     //TODO unnecessary copies they must go away.
     write_message_t wm;
     wm << data;
@@ -138,40 +313,235 @@ void kv_location_set(keyvalue_location_t<rdb_value_t> *kv_location, const store_
     int res = send_write_message(&stream, &wm);
     guarantee_err(res == 0, "Serialization for json data failed... this shouldn't happen.\n");
 
-    blob_t blob(new_value->value_ref(), blob::btree_maxreflen);
-
-    //TODO more copies, good lord
-    blob.append_region(txn, stream.vector().size());
     std::string sered_data(stream.vector().begin(), stream.vector().end());
-    blob.write_from_string(sered_data, txn, 0);
+    kv_location_set_bytes(kv_location, key, sered_data, slice, timestamp, txn);
+}
 
-    // Actually update the leaf, if needed.
-    kv_location->value.reinterpret_swap(new_value);
-    null_key_modification_callback_t<rdb_value_t> null_cb;
-    apply_keyvalue_change(txn, kv_location, key.btree_key(), timestamp, false, &null_cb, &slice->root_eviction_priority);
-    //                                                                  ^^^^^ That means the key isn't expired.
+void kv_location_set(keyvalue_location_t<rdb_value_t> *kv_location, const store_key_t &key,
+                     boost::shared_ptr<scoped_cJSON_t> data,
+                     btree_slice_t *slice, repli_timestamp_t timestamp, transaction_t *txn) {
+    std::string sered_data;
+    binary_json_encode(data->get(), &sered_data);
+    kv_location_set_bytes(kv_location, key, sered_data, slice, timestamp, txn);
 }
 
+/* The rows in one entry of a secondary index, as (primary key, row) pairs.
+They're kept in order of the indexed attribute, then the primary key. */
+typedef std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > sindex_bucket_t;
+
+/* Computes the index key of a row from its primary key and the indexed
+attribute, and the encoding of the attribute itself. Returns false if the row
+isn't in the index. */
+bool get_sindex_key_for_attr(const store_key_t &primary_key, cJSON *attr,
+                             store_key_t *key_out, std::string *encoded_attr_out) {
+    if (!attr || (attr->type != cJSON_Number && attr->type != cJSON_String)) {
+        return false;
+    }
+
+    *encoded_attr_out = cJSON_print_lexicographic(attr);
+    std::string key = *encoded_attr_out;
+    key += '\0';
+    key.append(reinterpret_cast<const char *>(primary_key.contents()), primary_key.size());
+    if (key.size() > MAX_KEY_SIZE) {
+        key.resize(MAX_KEY_SIZE);
+    }
+    *key_out = store_key_t(key);
+    return true;
+}
+
+/* The same, but finds the attribute in `row`. */
+bool get_sindex_key(const std::string &attrname, const store_key_t &primary_key, cJSON *row,
+                    store_key_t *key_out, std::string *encoded_attr_out) {
+    if (row->type != cJSON_Object) {
+        return false;
+    }
+    return get_sindex_key_for_attr(primary_key, cJSON_GetObjectItem(row, attrname.c_str()), key_out, encoded_attr_out);
+}
+
+/* Replaces the row with primary key `primary_key` in the index entry at `key`
+with `row`, or just removes it if `row` is empty. */
+void sindex_bucket_update(btree_slice_t *slice, transaction_t *txn, block_id_t sindex_superblock_id,
+                          const std::string &attrname, const store_key_t &key,
+                          const store_key_t &primary_key, const boost::shared_ptr<scoped_cJSON_t> &row,
+                          repli_timestamp_t timestamp) {
+    buf_lock_t sindex_superblock_buf(txn, sindex_superblock_id, rwi_write, buffer_cache_order_mode_ignore);
+    real_superblock_t sindex_superblock(&sindex_superblock_buf);
+
+    keyvalue_location_t<rdb_value_t> kv_location;
+    find_keyvalue_location_for_write(txn, &sindex_superblock, key.btree_key(), &kv_location,
+                                     &slice->root_eviction_priority, &slice->stats);
+
+    sindex_bucket_t bucket;
+    if (kv_location.value.has()) {
+        get_value_data(kv_location.value.get(), txn, &bucket);
+        for (sindex_bucket_t::iterator it = bucket.begin(); it != bucket.end(); ++it) {
+            if (it->first == primary_key) {
+                bucket.erase(it);
+                break;
+            }
+        }
+    }
+
+    if (row) {
+        std::string encoded_attr = cJSON_print_lexicographic(row->GetObjectItem(attrname.c_str()));
+        sindex_bucket_t::iterator it = bucket.begin();
+        for (; it != bucket.end(); ++it) {
+            std::string other = cJSON_print_lexicographic(it->second->GetObjectItem(attrname.c_str()));
+            if (encoded_attr < other || (encoded_attr == other && primary_key < it->first)) {
+                break;
+            }
+        }
+        bucket.insert(it, std::make_pair(primary_key, row));
+    }
+
+    if (bucket.empty()) {
+        if (kv_location.value.has()) {
+            kv_location_delete(&kv_location, key, slice, timestamp, txn);
+        }
+    } else {
+        if (kv_location.value.has()) {
+            blob_t blob(kv_location.value->value_ref(), blob::btree_maxreflen);
+            blob.clear(txn);
+        }
+        kv_location_set_data(&kv_location, key, bucket, slice, timestamp, txn);
+    }
+}
+
+/* Index btrees are never backfilled, so the timestamps of changes that don't
+come from a timestamped write don't matter. */
+#define SINDEX_UNTIMESTAMPED_CHANGE repli_timestamp_t::distant_past
+
+/* Holds on to the sindex block, if the table has one, for the duration of an
+operation on the primary btree, and keeps the indexes in sync with the rows the
+operation changes. It has to be constructed before the operation releases the
+superblock. */
+class rdb_sindex_access_t {
+public:
+    rdb_sindex_access_t(transaction_t *txn, superblock_t *superblock) {
+        block_id_t sindex_block_id = superblock->get_sindex_block_id();
+        if (sindex_block_id != NULL_BLOCK_ID) {
+            buf_lock_t tmp(txn, sindex_block_id, rwi_read, buffer_cache_order_mode_ignore);
+            sindex_block.swap(tmp);
+            get_secondary_indexes(txn, &sindex_block, &sindexes);
+        }
+    }
+
+    bool empty() const {
+        return sindexes.empty();
+    }
+
+    /* Either row may be empty, meaning the row didn't or doesn't exist. */
+    void update_row(btree_slice_t *slice, transaction_t *txn, const store_key_t &primary_key,
+                    const boost::shared_ptr<scoped_cJSON_t> &old_row, const boost::shared_ptr<scoped_cJSON_t> &new_row,
+                    repli_timestamp_t timestamp) {
+        for (sindex_map_t::iterator it = sindexes.begin(); it != sindexes.end(); ++it) {
+            update_index_entry(slice, txn, it->first, it->second.superblock, primary_key, old_row, new_row, timestamp);
+        }
+    }
+
+    /* For when the primary btree only hands us the stored value: each index
+    knows which attribute is the primary key. Only the primary key and the
+    indexed attributes are read out of the row. */
+    void remove_row(btree_slice_t *slice, transaction_t *txn, const rdb_value_t *value) {
+        std::vector<std::pair<sindex_map_t::iterator, std::pair<store_key_t, store_key_t> > > entries;
+        {
+            exposed_value_t exposed(value, txn);
+            if (!binary_json_is_encoded(exposed.data(), exposed.size())) {
+                boost::shared_ptr<scoped_cJSON_t> row;
+                buffer_group_read_stream_t read_stream(exposed.buffers());
+                int res = deserialize(&read_stream, &row);
+                guarantee_err(res == 0, "corruption detected... this should probably be an exception\n");
+                for (sindex_map_t::iterator it = sindexes.begin(); it != sindexes.end(); ++it) {
+                    cJSON *primary_key_json = row->GetObjectItem(it->second.opaque_definition.c_str());
+                    guarantee(primary_key_json);
+                    store_key_t primary_key(cJSON_print_lexicographic(primary_key_json));
+                    store_key_t key;
+                    std::string encoded_attr;
+                    if (get_sindex_key(it->first, primary_key, row->get(), &key, &encoded_attr)) {
+                        entries.push_back(std::make_pair(it, std::make_pair(key, primary_key)));
+                    }
+                }
+            } else {
+                binary_json_view_t row(exposed.data(), exposed.size());
+                guarantee(row.type() == cJSON_Object);
+                for (sindex_map_t::iterator it = sindexes.begin(); it != sindexes.end(); ++it) {
+                    binary_json_view_t primary_key_view, attr_view;
+                    guarantee(row.field(it->second.opaque_definition.c_str(), &primary_key_view));
+                    if (!row.field(it->first.c_str(), &attr_view)) {
+                        continue;
+                    }
+                    scoped_cJSON_t primary_key_json(primary_key_view.to_cJSON());
+                    scoped_cJSON_t attr(attr_view.to_cJSON());
+                    store_key_t primary_key(cJSON_print_lexicographic(primary_key_json.get()));
+                    store_key_t key;
+                    std::string encoded_attr;
+                    if (get_sindex_key_for_attr(primary_key, attr.get(), &key, &encoded_attr)) {
+                        entries.push_back(std::make_pair(it, std::make_pair(key, primary_key)));
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            sindex_bucket_update(slice, txn, entries[i].first->second.superblock, entries[i].first->first,
+                                 entries[i].second.first, entries[i].second.second,
+                                 boost::shared_ptr<scoped_cJSON_t>(), SINDEX_UNTIMESTAMPED_CHANGE);
+        }
+    }
+
+private:
+    typedef std::map<std::string, secondary_index_t> sindex_map_t;
+
+    static void update_index_entry(btree_slice_t *slice, transaction_t *txn,
+                                   const std::string &attrname, block_id_t sindex_superblock_id,
+                                   const store_key_t &primary_key,
+                                   const boost::shared_ptr<scoped_cJSON_t> &old_row,
+                                   const boost::shared_ptr<scoped_cJSON_t> &new_row,
+                                   repli_timestamp_t timestamp) {
+        store_key_t old_key, new_key;
+        std::string old_attr, new_attr;
+        bool in_old = old_row && get_sindex_key(attrname, primary_key, old_row->get(), &old_key, &old_attr);
+        bool in_new = new_row && get_sindex_key(attrname, primary_key, new_row->get(), &new_key, &new_attr);
+
+        if (in_old && !(in_new && old_key == new_key)) {
+            sindex_bucket_update(slice, txn, sindex_superblock_id, attrname, old_key, primary_key,
+                                 boost::shared_ptr<scoped_cJSON_t>(), timestamp);
+        }
+        if (in_new) {
+            sindex_bucket_update(slice, txn, sindex_superblock_id, attrname, new_key, primary_key,
+                                 new_row, timestamp);
+        }
+    }
+
+    buf_lock_t sindex_block;
+    sindex_map_t sindexes;
+
+    DISABLE_COPYING(rdb_sindex_access_t);
+};
+
 void rdb_modify(const std::string &primary_key, const store_key_t &key, point_modify_ns::op_t op,
                 query_language::runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
-                const Mapping &mapping,
+                const Mapping &mapping, query_language::json_arena_t *arena,
                 btree_slice_t *slice, repli_timestamp_t timestamp,
                 transaction_t *txn, superblock_t *superblock, point_modify_response_t *response) {
     try {
+        rdb_sindex_access_t sindexes(txn, superblock);
         keyvalue_location_t<rdb_value_t> kv_location;
         find_keyvalue_location_for_write(txn, superblock, key.btree_key(), &kv_location,
                                          &slice->root_eviction_priority, &slice->stats);
-        boost::shared_ptr<scoped_cJSON_t> lhs;
+        boost::shared_ptr<scoped_cJSON_t> lhs, old_row;
         if (!kv_location.value.has()) {
             lhs.reset(new scoped_cJSON_t(cJSON_CreateNull()));
         } else {
             lhs = get_data(kv_location.value.get(), txn);
             guarantee(lhs->GetObjectItem(primary_key.c_str()));
+            old_row = lhs;
         }
         boost::shared_ptr<scoped_cJSON_t> new_row;
+        const query_language::json_value_t *merged = NULL;
         std::string new_key;
         point_modify_ns::result_t res = query_language::calculate_modify(
-            lhs, primary_key, op, mapping, env, scopes, backtrace, &new_row, &new_key);
+            lhs, primary_key, op, mapping, env, scopes, backtrace, arena, &new_row, &merged, &new_key);
         switch(res) {
         case point_modify_ns::INSERTED:
             if (new_key != key_to_unescaped_str(key)) {
@@ -180,11 +550,24 @@ void rdb_modify(const std::string &primary_key, const store_key_t &key, point_mo
             }
             //FALLTHROUGH
         case point_modify_ns::MODIFIED: {
-            guarantee(new_row);
-            kv_location_set(&kv_location, key, new_row, slice, timestamp, txn);
+            if (merged) {
+                // The merged row goes straight to disk; the indexes, if there
+                // are any, still need it as cJSON.
+                std::string sered_data;
+                binary_json_encode(merged, &sered_data);
+                kv_location_set_bytes(&kv_location, key, sered_data, slice, timestamp, txn);
+                if (!sindexes.empty()) {
+                    new_row.reset(new scoped_cJSON_t(merged->to_cjson()));
+                }
+            } else {
+                guarantee(new_row);
+                kv_location_set(&kv_location, key, new_row, slice, timestamp, txn);
+            }
+            sindexes.update_row(slice, txn, key, old_row, new_row, timestamp);
         } break;
         case point_modify_ns::DELETED: {
             kv_location_delete(&kv_location, key, slice, timestamp, txn);
+            sindexes.update_row(slice, txn, key, old_row, boost::shared_ptr<scoped_cJSON_t>(), timestamp);
         } break;
         case point_modify_ns::SKIPPED: break;
         case point_modify_ns::NOP: break;
@@ -198,19 +581,161 @@ void rdb_modify(const std::string &primary_key, const store_key_t &key, point_mo
     }
 }
 
+/* Finds the keys of the rows in a range that pass the filters in a transform.
+The rows are filtered `RDB_JS_BATCH_SIZE` at a time, so javascript predicates
+see them in batches, and it stops after `RDB_RANGE_MODIFY_BATCH_SIZE` rows. */
+class rdb_range_modify_traversal_callback_t : public depth_first_traversal_callback_t {
+public:
+    rdb_range_modify_traversal_callback_t(transaction_t *_txn, query_language::runtime_environment_t *_env,
+                                          const rdb_protocol_details::transform_t &_transform)
+        : txn(_txn), env(_env), transform(_transform), compiled_transform(_transform), num_considered(0) { }
+
+    bool handle_pair(const btree_key_t *key, const void *value) {
+        if (transform.empty()) {
+            keys.push_back(store_key_t(key));
+        } else {
+            pending_keys.push_back(store_key_t(key));
+            pending_rows.push_back(get_data(static_cast<const rdb_value_t *>(value), txn));
+            if (pending_rows.size() >= RDB_JS_BATCH_SIZE) {
+                flush_rows();
+            }
+        }
+        if (++num_considered >= RDB_RANGE_MODIFY_BATCH_SIZE) {
+            last_key = store_key_t(key);
+            return false;
+        }
+        return !error;
+    }
+
+    /* Filters the rows that are still waiting. */
+    void flush_rows() {
+        if (error || pending_rows.empty()) {
+            return;
+        }
+        try {
+            std::vector<json_list_t> data;
+            query_language::transform_rows(compiled_transform, pending_rows, &data, env);
+            for (size_t i = 0; i < pending_keys.size(); ++i) {
+                if (!data[i].empty()) {
+                    keys.push_back(pending_keys[i]);
+                }
+            }
+        } catch (const query_language::runtime_exc_t &e) {
+            error = e;
+        }
+        pending_keys.clear();
+        pending_rows.clear();
+    }
+
+    std::vector<store_key_t> keys;
+    boost::optional<query_language::runtime_exc_t> error;
+    // Set if the traversal stopped before the end of the range.
+    boost::optional<store_key_t> last_key;
+
+private:
+    transaction_t *txn;
+    query_language::runtime_environment_t *env;
+    rdb_protocol_details::transform_t transform;
+    query_language::compiled_transform_t compiled_transform;
+    int num_considered;
+
+    std::vector<store_key_t> pending_keys;
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > pending_rows;
+};
+
+void rdb_range_modify(const std::string &primary_key, const key_range_t &range,
+                      const rdb_protocol_details::transform_t &transform, range_modify_ns::op_t op,
+                      query_language::runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
+                      const boost::optional<Mapping> &mapping,
+                      btree_slice_t *slice, repli_timestamp_t timestamp,
+                      transaction_t *txn, superblock_t *superblock, range_modify_response_t *response,
+                      boost::optional<store_key_t> *last_key_out) {
+    // The traversal releases the superblock once, and the writes after it
+    // release it once between them.
+    refcount_superblock_t refcount_superblock(superblock, 2);
+    rdb_range_modify_traversal_callback_t callback(txn, env, transform);
+    btree_depth_first_traversal(slice, txn, &refcount_superblock, range, &callback);
+    callback.flush_rows();
+    *last_key_out = callback.last_key;
+
+    if (callback.error) {
+        response->exc = callback.error;
+        refcount_superblock.release();
+        return;
+    }
+    if (callback.keys.empty()) {
+        refcount_superblock.release();
+        return;
+    }
+
+    refcount_superblock_t write_superblock(&refcount_superblock, callback.keys.size());
+    // The rows that an UPDATE writes are built here, and all freed together
+    // once the batch is done.
+    query_language::json_arena_t arena;
+    for (size_t i = 0; i < callback.keys.size(); ++i) {
+        const store_key_t &key = callback.keys[i];
+        if (op == range_modify_ns::DELETE) {
+            point_delete_response_t res;
+            rdb_delete(key, slice, timestamp, txn, &write_superblock, &res);
+            response->deleted += (res.result == DELETED);
+            continue;
+        }
+
+        guarantee(mapping);
+        point_modify_response_t res;
+        point_modify_ns::op_t point_op = (op == range_modify_ns::UPDATE ? point_modify_ns::UPDATE : point_modify_ns::MUTATE);
+        rdb_modify(primary_key, key, point_op, env, scopes, backtrace, *mapping, &arena, slice, timestamp, txn, &write_superblock, &res);
+        switch (res.result) {
+        case point_modify_ns::INSERTED: //fallthrough
+        case point_modify_ns::MODIFIED: response->modified += 1; break;
+        case point_modify_ns::SKIPPED: response->skipped += 1; break;
+        case point_modify_ns::NOP: //fallthrough
+        case point_modify_ns::DELETED: response->deleted += 1; break;
+        case point_modify_ns::ERROR:
+            response->errors += 1;
+            if (!response->first_error) response->first_error = res.exc;
+            break;
+        default: unreachable();
+        }
+    }
+}
+
 void rdb_set(const store_key_t &key, boost::shared_ptr<scoped_cJSON_t> data, bool overwrite,
              btree_slice_t *slice, repli_timestamp_t timestamp,
              transaction_t *txn, superblock_t *superblock, point_write_response_t *response) {
     //block_size_t block_size = slice->cache()->get_block_size();
+    rdb_sindex_access_t sindexes(txn, superblock);
     keyvalue_location_t<rdb_value_t> kv_location;
     find_keyvalue_location_for_write(txn, superblock, key.btree_key(), &kv_location, &slice->root_eviction_priority, &slice->stats);
     bool had_value = kv_location.value.has();
     if (overwrite || !had_value) {
+        boost::shared_ptr<scoped_cJSON_t> old_row;
+        if (had_value && !sindexes.empty()) {
+            old_row = get_data(kv_location.value.get(), txn);
+        }
         kv_location_set(&kv_location, key, data, slice, timestamp, txn);
+        sindexes.update_row(slice, txn, key, old_row, data, timestamp);
     }
     response->result = (had_value ? DUPLICATE : STORED);
 }
 
+void rdb_batched_set(const std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > &rows, bool overwrite,
+                     btree_slice_t *slice, repli_timestamp_t timestamp,
+                     transaction_t *txn, superblock_t *superblock, batched_insert_response_t *response) {
+    if (rows.empty()) {
+        superblock->release();
+        return;
+    }
+
+    // Each write releases the superblock once; the last one really does.
+    refcount_superblock_t refcount_superblock(superblock, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        point_write_response_t res;
+        rdb_set(rows[i].first, rows[i].second, overwrite, slice, timestamp, txn, &refcount_superblock, &res);
+        response->results.push_back(std::make_pair(rows[i].first, res.result));
+    }
+}
+
 class agnostic_rdb_backfill_callback_t : public agnostic_backfill_callback_t {
 public:
     agnostic_rdb_backfill_callback_t(rdb_backfill_callback_t *cb, const key_range_t &kr) : cb_(cb), kr_(kr) { }
@@ -252,10 +777,18 @@ void rdb_backfill(btree_slice_t *slice, const key_range_t& key_range,
 
 void rdb_delete(const store_key_t &key, btree_slice_t *slice, repli_timestamp_t timestamp,
                 transaction_t *txn, superblock_t *superblock, point_delete_response_t *response) {
+    rdb_sindex_access_t sindexes(txn, superblock);
     keyvalue_location_t<rdb_value_t> kv_location;
     find_keyvalue_location_for_write(txn, superblock, key.btree_key(), &kv_location, &slice->root_eviction_priority, &slice->stats);
     bool exists = kv_location.value.has();
-    if (exists) kv_location_delete(&kv_location, key, slice, timestamp, txn);
+    if (exists) {
+        boost::shared_ptr<scoped_cJSON_t> old_row;
+        if (!sindexes.empty()) {
+            old_row = get_data(kv_location.value.get(), txn);
+        }
+        kv_location_delete(&kv_location, key, slice, timestamp, txn);
+        sindexes.update_row(slice, txn, key, old_row, boost::shared_ptr<scoped_cJSON_t>(), timestamp);
+    }
     response->result = (exists ? DELETED : MISSING);
 }
 
@@ -267,12 +800,21 @@ void rdb_erase_range(btree_slice_t *slice, key_tester_t *tester,
     value_sizer_t<rdb_value_t> rdb_sizer(slice->cache()->get_block_size());
     value_sizer_t<void> *sizer = &rdb_sizer;
 
+    rdb_sindex_access_t sindexes(txn, superblock);
+
     struct : public value_deleter_t {
         void delete_value(transaction_t *_txn, void *_value) {
+            if (!sindexes->empty()) {
+                sindexes->remove_row(slice, _txn, static_cast<rdb_value_t *>(_value));
+            }
             blob_t blob(static_cast<rdb_value_t *>(_value)->value_ref(), blob::btree_maxreflen);
             blob.clear(_txn);
         }
+        btree_slice_t *slice;
+        rdb_sindex_access_t *sindexes;
     } deleter;
+    deleter.slice = slice;
+    deleter.sindexes = &sindexes;
 
     btree_erase_range_generic(sizer, slice, tester, &deleter,
         left_key_supplied ? left_key_exclusive.btree_key() : NULL,
@@ -306,14 +848,24 @@ public:
     rdb_rget_depth_first_traversal_callback_t(transaction_t *txn, query_language::runtime_environment_t *_env,
                                               const rdb_protocol_details::transform_t &_transform,
                                               boost::optional<rdb_protocol_details::terminal_t> _terminal,
+                                              const boost::optional<rdb_protocol_details::sorting_t> &sorting,
                                               const key_range_t &range,
                                               rget_read_response_t *_response)
         : bad_init(false), transaction(txn), response(_response), cumulative_size(0),
-          env(_env), transform(_transform), terminal(_terminal)
+          env(_env), transform(_transform), compiled_transform(_transform), terminal(_terminal),
+          project(false), reload_full_rows(false),
+          batch_rows(query_language::transform_has_javascript(_transform)), sort_limit(0)
     {
+        if (sorting && !terminal) {
+            ordering.reset(query_language::ordering_t(sorting->order, sorting->backtrace));
+            sort_limit = sorting->limit;
+        }
+
         try {
             response->last_considered_key = range.left;
 
+            init_projection();
+
             if (terminal) {
                 boost::apply_visitor(query_language::terminal_initializer_visitor_t(&response->result, env, terminal->scopes, terminal->backtrace), terminal->variant);
             }
@@ -333,72 +885,511 @@ public:
             }
 
             const rdb_value_t *rdb_value = reinterpret_cast<const rdb_value_t *>(value);
+            handle_rows(key, rdb_value);
 
-            json_list_t data;
-            data.push_back(get_data(rdb_value, transaction));
-
-            //Apply transforms to the data
-            typedef rdb_protocol_details::transform_t::iterator tit_t;
-            for (tit_t it  = transform.begin();
-                       it != transform.end();
-                       ++it) {
-                json_list_t tmp;
-
-                for (json_list_t::iterator jt  = data.begin();
-                                           jt != data.end();
-                                           ++jt) {
-                    boost::apply_visitor(query_language::transform_visitor_t(*jt, &tmp, env, it->scopes, it->backtrace), it->variant);
+            return terminal || ordering || cumulative_size < rget_max_chunk_size;
+        } catch(const query_language::runtime_exc_t &e) {
+            /* Evaluation threw so we're not going to be accepting any more requests. */
+            response->result = e;
+            return false;
+        }
+    }
+
+    virtual void handle_rows(const btree_key_t *key, const rdb_value_t *value) {
+        if (project) {
+            blob_json_source_t source(value, transaction);
+            cJSON *projected = binary_json_project(&source, projected_attrs);
+            if (projected) {
+                boost::shared_ptr<scoped_cJSON_t> projected_row(new scoped_cJSON_t(projected));
+                if (!reload_full_rows) {
+                    handle_row(key, projected_row);
+                    return;
+                }
+                // Reloading only happens when there's no javascript to batch.
+                guarantee(!batch_rows);
+                json_list_t data;
+                transform_row(projected_row, &data);
+                if (!data.empty()) {
+                    // Only filters ran, so every row that's left is the
+                    // projection of this row.
+                    boost::shared_ptr<scoped_cJSON_t> row = get_data(value, transaction);
+                    for (json_list_t::iterator it = data.begin(); it != data.end(); ++it) {
+                        *it = row;
+                    }
                 }
-                data.clear();
-                data.splice(data.begin(), tmp);
+                emit_rows(key, &data);
+                return;
             }
+        }
+        handle_row(key, get_data(value, transaction));
+    }
 
-            if (!terminal) {
-                typedef rget_read_response_t::stream_t stream_t;
-                stream_t *stream = boost::get<stream_t>(&response->result);
-                guarantee(stream);
-                for (json_list_t::iterator it =  data.begin();
-                                           it != data.end();
-                                           ++it) {
-                    stream->push_back(std::make_pair(key, *it));
-                    cumulative_size += estimate_rget_response_size(*it);
+    void handle_row(const btree_key_t *key, const boost::shared_ptr<scoped_cJSON_t> &row) {
+        if (batch_rows) {
+            pending_rows.push_back(std::make_pair(store_key_t(key), row));
+            if (pending_rows.size() >= RDB_JS_BATCH_SIZE) {
+                flush_rows();
+            }
+        } else {
+            json_list_t data;
+            transform_row(row, &data);
+            emit_rows(key, &data);
+        }
+    }
+
+    void transform_row(const boost::shared_ptr<scoped_cJSON_t> &row, json_list_t *data_out) {
+        std::vector<json_list_t> data;
+        query_language::transform_rows(compiled_transform, std::vector<boost::shared_ptr<scoped_cJSON_t> >(1, row), &data, env);
+        data_out->swap(data[0]);
+    }
+
+    /* Transforms the rows `handle_row()` has been holding on to, all at once. */
+    void flush_rows() {
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > rows;
+        for (size_t i = 0; i < pending_rows.size(); ++i) {
+            rows.push_back(pending_rows[i].second);
+        }
+        std::vector<json_list_t> data;
+        query_language::transform_rows(compiled_transform, rows, &data, env);
+        for (size_t i = 0; i < pending_rows.size(); ++i) {
+            emit_rows(pending_rows[i].first.btree_key(), &data[i]);
+        }
+        pending_rows.clear();
+    }
+
+    void emit_rows(const btree_key_t *key, json_list_t *data_in) {
+        json_list_t &data = *data_in;
+        if (ordering) {
+            keyed_row_less_t less(&*ordering);
+            for (json_list_t::iterator it = data.begin(); it != data.end(); ++it) {
+                if (sorted_rows.empty()) {
+                    // Even a single row has to be one the ordering can handle.
+                    (*ordering)(*it, *it);
                 }
+                sorted_rows.push_back(std::make_pair(store_key_t(key), *it));
+                std::push_heap(sorted_rows.begin(), sorted_rows.end(), less);
+                if (sorted_rows.size() > sort_limit) {
+                    std::pop_heap(sorted_rows.begin(), sorted_rows.end(), less);
+                    sorted_rows.pop_back();
+                }
+            }
+        } else if (!terminal) {
+            typedef rget_read_response_t::stream_t stream_t;
+            stream_t *stream = boost::get<stream_t>(&response->result);
+            guarantee(stream);
+            for (json_list_t::iterator it =  data.begin();
+                                       it != data.end();
+                                       ++it) {
+                stream->push_back(std::make_pair(key, *it));
+                cumulative_size += estimate_rget_response_size(*it);
+            }
+        } else {
+            for (json_list_t::iterator jt  = data.begin();
+                                       jt != data.end();
+                                       ++jt) {
+                boost::apply_visitor(query_language::terminal_visitor_t(*jt, env, terminal->scopes, terminal->backtrace, &response->result), terminal->variant);
+            }
+        }
+    }
 
-                return cumulative_size < rget_max_chunk_size;
+    virtual ~rdb_rget_depth_first_traversal_callback_t() { }
+
+    /* Fills in the response once the traversal is over. */
+    void finish() {
+        if (callback_succeeded() && !pending_rows.empty()) {
+            try {
+                flush_rows();
+            } catch (const query_language::runtime_exc_t &e) {
+                response->result = e;
+            }
+        }
+
+        if (callback_succeeded() && ordering) {
+            typedef rget_read_response_t::stream_t stream_t;
+            stream_t *stream = boost::get<stream_t>(&response->result);
+            guarantee(stream);
+            try {
+                std::sort_heap(sorted_rows.begin(), sorted_rows.end(), keyed_row_less_t(&*ordering));
+                stream->assign(sorted_rows.begin(), sorted_rows.end());
+            } catch (const query_language::runtime_exc_t &e) {
+                response->result = e;
+            }
+            response->truncated = false;
+        } else if (cumulative_size >= rget_max_chunk_size) {
+            response->truncated = true;
+        } else {
+            response->truncated = false;
+        }
+    }
+
+    bool callback_succeeded() {
+        return !boost::get<query_language::runtime_exc_t>(&response->result);
+    }
+
+    /* Orders rows by the sorting, then by key. */
+    class keyed_row_less_t {
+    public:
+        explicit keyed_row_less_t(const query_language::ordering_t *_ordering) : ordering(_ordering) { }
+        bool operator()(const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > &x,
+                        const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > &y) const {
+            if ((*ordering)(x.second, y.second)) {
+                return true;
+            } else if ((*ordering)(y.second, x.second)) {
+                return false;
             } else {
-                for (json_list_t::iterator jt  = data.begin();
-                                           jt != data.end();
-                                           ++jt) {
-                    boost::apply_visitor(query_language::terminal_visitor_t(*jt, env, terminal->scopes, terminal->backtrace, &response->result), terminal->variant);
+                return x.first < y.first;
+            }
+        }
+    private:
+        const query_language::ordering_t *ordering;
+    };
+
+    /* Works out which top-level attributes of a row the transforms and the
+    terminal can look at. If it's a few, `handle_rows()` reads just those out
+    of the blob, and the rest of the row (which may be in blocks of its own)
+    never gets loaded. Only what's applied to the row itself matters: the
+    filters and ranges, up to and including the first mapping. If nothing maps
+    the row and there's no terminal, the rows that pass the filters are read
+    in full. */
+    void init_projection() {
+        std::set<std::string> attrs;
+        bool mapped = false;
+        typedef rdb_protocol_details::transform_t::iterator tit_t;
+        for (tit_t it = transform.begin(); it != transform.end() && !mapped; ++it) {
+            if (const Builtin_Filter *filter = boost::get<Builtin_Filter>(&it->variant)) {
+                if (!query_language::collect_row_attrs(filter->predicate().body(), filter->predicate().arg(), &attrs)) {
+                    return;
                 }
-                return true;
+            } else if (const Builtin_Range *range = boost::get<Builtin_Range>(&it->variant)) {
+                attrs.insert(range->attrname());
+            } else if (const Mapping *mapping = boost::get<Mapping>(&it->variant)) {
+                if (!query_language::collect_row_attrs(mapping->body(), mapping->arg(), &attrs)) {
+                    return;
+                }
+                mapped = true;
+            } else if (const Builtin_ConcatMap *concatmap = boost::get<Builtin_ConcatMap>(&it->variant)) {
+                if (!query_language::collect_row_attrs(concatmap->mapping().body(), concatmap->mapping().arg(), &attrs)) {
+                    return;
+                }
+                mapped = true;
+            } else {
+                unreachable();
             }
-        } catch(const query_language::runtime_exc_t &e) {
-            /* Evaluation threw so we're not going to be accepting any more requests. */
-            response->result = e;
-            return false;
         }
+
+        bool reload = false;
+        if (!mapped) {
+            if (!terminal) {
+                reload = true;
+            } else if (boost::get<rdb_protocol_details::Length>(&terminal->variant)) {
+                // Counting needs nothing from the row.
+            } else if (const Builtin_GroupedMapReduce *gmr = boost::get<Builtin_GroupedMapReduce>(&terminal->variant)) {
+                if (!query_language::collect_row_attrs(gmr->group_mapping().body(), gmr->group_mapping().arg(), &attrs) ||
+                    !query_language::collect_row_attrs(gmr->value_mapping().body(), gmr->value_mapping().arg(), &attrs)) {
+                    return;
+                }
+            } else {
+                // Reductions and for-each get the whole row.
+                return;
+            }
+        }
+
+        if (reload && transform.empty()) {
+            // Every row would be read in full anyway.
+            return;
+        }
+
+        project = true;
+        reload_full_rows = reload;
+        projected_attrs.swap(attrs);
     }
+
     bool bad_init;
     transaction_t *transaction;
     rget_read_response_t *response;
     size_t cumulative_size;
     query_language::runtime_environment_t *env;
     rdb_protocol_details::transform_t transform;
+    // Compiled once, for all the rows the traversal sees.
+    query_language::compiled_transform_t compiled_transform;
     boost::optional<rdb_protocol_details::terminal_t> terminal;
+
+    /* Set by `init_projection()`. */
+    bool project;
+    bool reload_full_rows;
+    std::set<std::string> projected_attrs;
+
+    /* If the transform runs javascript, rows are held back and transformed
+    `RDB_JS_BATCH_SIZE` at a time, and `pending_rows` has the ones waiting. */
+    bool batch_rows;
+    std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > pending_rows;
+
+    /* If the read is sorted, the first `sort_limit` rows so far, in a heap
+    whose top is the last of them. */
+    boost::optional<query_language::ordering_t> ordering;
+    size_t sort_limit;
+    std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > sorted_rows;
 };
 
 void rdb_rget_slice(btree_slice_t *slice, const key_range_t &range,
                     transaction_t *txn, superblock_t *superblock,
                     query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
-                    boost::optional<rdb_protocol_details::terminal_t> terminal, rget_read_response_t *response) {
-    rdb_rget_depth_first_traversal_callback_t callback(txn, env, transform, terminal, range, response);
+                    boost::optional<rdb_protocol_details::terminal_t> terminal,
+                    const boost::optional<rdb_protocol_details::sorting_t> &sorting, rget_read_response_t *response) {
+    rdb_rget_depth_first_traversal_callback_t callback(txn, env, transform, terminal, sorting, range, response);
     btree_depth_first_traversal(slice, txn, superblock, range, &callback);
+    callback.finish();
+}
 
-    if (callback.cumulative_size >= rget_max_chunk_size) {
-        response->truncated = true;
-    } else {
+/* Index entries hold whole rows, but a row is only returned if it's in the
+range of the read (the index key could have been truncated) and in the region
+of the read (the index covers every row in the store). An entry is always
+handled in its entirety, so that a truncated read can pick up right after the
+last index key it considered. */
+class rdb_rget_secondary_traversal_callback_t : public rdb_rget_depth_first_traversal_callback_t {
+public:
+    rdb_rget_secondary_traversal_callback_t(transaction_t *txn, query_language::runtime_environment_t *_env,
+                                            const rdb_protocol_details::transform_t &_transform,
+                                            boost::optional<rdb_protocol_details::terminal_t> _terminal,
+                                            const boost::optional<rdb_protocol_details::sorting_t> &_sorting,
+                                            const rdb_protocol_details::sindex_range_t &_sindex_range,
+                                            const rdb_protocol_t::region_t &_region,
+                                            rget_read_response_t *_response)
+        : rdb_rget_depth_first_traversal_callback_t(txn, _env, _transform, _terminal, _sorting, _sindex_range.index_range, _response),
+          sindex_range(_sindex_range), region(_region) { }
+
+    void handle_rows(const btree_key_t *key, const rdb_value_t *value) {
+        sindex_bucket_t bucket;
+        get_value_data(value, transaction, &bucket);
+
+        for (sindex_bucket_t::iterator it = bucket.begin(); it != bucket.end(); ++it) {
+            const store_key_t &primary_key = it->first;
+            uint64_t hash = hash_region_hasher(primary_key.contents(), primary_key.size());
+            if (hash < region.beg || hash >= region.end || !region.inner.contains_key(primary_key)) {
+                continue;
+            }
+            cJSON *attr = it->second->GetObjectItem(sindex_range.attrname.c_str());
+            guarantee(attr);
+            if (sindex_range.contains(cJSON_print_lexicographic(attr))) {
+                handle_row(key, it->second);
+            }
+        }
+    }
+
+private:
+    const rdb_protocol_details::sindex_range_t &sindex_range;
+    rdb_protocol_t::region_t region;
+};
+
+void rdb_rget_secondary_slice(btree_slice_t *slice, const rdb_protocol_details::sindex_range_t &sindex_range,
+                              const rdb_protocol_t::region_t &region,
+                              transaction_t *txn, superblock_t *superblock,
+                              query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+                              boost::optional<rdb_protocol_details::terminal_t> terminal,
+                              const boost::optional<rdb_protocol_details::sorting_t> &sorting, rget_read_response_t *response) {
+    /* We hold the sindex block until we're done, so that the index can't be
+    dropped while we read it. */
+    buf_lock_t sindex_block;
+    secondary_index_t sindex;
+    bool found = false;
+    if (superblock->get_sindex_block_id() != NULL_BLOCK_ID) {
+        buf_lock_t tmp(txn, superblock->get_sindex_block_id(), rwi_read, buffer_cache_order_mode_ignore);
+        sindex_block.swap(tmp);
+        found = get_secondary_index(txn, &sindex_block, sindex_range.attrname, &sindex);
+    }
+    superblock->release();
+
+    if (!found) {
+        response->result = query_language::runtime_exc_t(strprintf("There is no index on attribute %s.",
+                                                                   sindex_range.attrname.c_str()),
+                                                         backtrace_t());
         response->truncated = false;
+        response->last_considered_key = sindex_range.index_range.left;
+        return;
+    }
+
+    buf_lock_t sindex_superblock_buf(txn, sindex.superblock, rwi_read, buffer_cache_order_mode_ignore);
+    real_superblock_t sindex_superblock(&sindex_superblock_buf);
+
+    rdb_rget_secondary_traversal_callback_t callback(txn, env, transform, terminal, sorting, sindex_range, region, response);
+    btree_depth_first_traversal(slice, txn, &sindex_superblock, sindex_range.index_range, &callback);
+    callback.finish();
+}
+
+/* Fills a new index from the rows already in the primary btree. */
+class sindex_populate_helper_t : public btree_traversal_helper_t {
+public:
+    sindex_populate_helper_t(btree_slice_t *_slice, const std::string &_attrname, block_id_t _sindex_superblock)
+        : slice(_slice), attrname(_attrname), sindex_superblock(_sindex_superblock) { }
+
+    void process_a_leaf(transaction_t *txn, buf_lock_t *leaf_node_buf,
+                        UNUSED const btree_key_t *left_exclusive_or_null,
+                        UNUSED const btree_key_t *right_inclusive_or_null,
+                        UNUSED int *population_change_out,
+                        UNUSED signal_t *interruptor) THROWS_ONLY(interrupted_exc_t) {
+        const leaf_node_t *node = reinterpret_cast<const leaf_node_t *>(leaf_node_buf->get_data_read());
+
+        for (leaf::live_iter_t iter = leaf::iter_for_whole_leaf(node); /* no test */; iter.step(node)) {
+            const btree_key_t *k = iter.get_key(node);
+            if (!k) {
+                break;
+            }
+
+            store_key_t primary_key(k);
+            boost::shared_ptr<scoped_cJSON_t> row = get_data(static_cast<const rdb_value_t *>(iter.get_value(node)), txn);
+            store_key_t key;
+            std::string encoded_attr;
+            if (get_sindex_key(attrname, primary_key, row->get(), &key, &encoded_attr)) {
+                sindex_bucket_update(slice, txn, sindex_superblock, attrname, key, primary_key, row, SINDEX_UNTIMESTAMPED_CHANGE);
+            }
+        }
+    }
+
+    void postprocess_internal_node(UNUSED buf_lock_t *internal_node_buf) { }
+
+    void filter_interesting_children(UNUSED transaction_t *txn, ranged_block_ids_t *ids_source, interesting_children_callback_t *cb) {
+        for (int i = 0, e = ids_source->num_block_ids(); i < e; ++i) {
+            cb->receive_interesting_child(i);
+        }
+        cb->no_more_interesting_children();
+    }
+
+    access_t btree_superblock_mode() { return rwi_read; }
+    access_t btree_node_mode() { return rwi_read; }
+
+private:
+    btree_slice_t *slice;
+    std::string attrname;
+    block_id_t sindex_superblock;
+
+    DISABLE_COPYING(sindex_populate_helper_t);
+};
+
+/* Frees every block of an index btree, along with the rows in it. */
+class sindex_clear_helper_t : public btree_traversal_helper_t {
+public:
+    explicit sindex_clear_helper_t(block_size_t block_size) : sizer(block_size) { }
+
+    void process_a_leaf(transaction_t *txn, buf_lock_t *leaf_node_buf,
+                        UNUSED const btree_key_t *left_exclusive_or_null,
+                        UNUSED const btree_key_t *right_inclusive_or_null,
+                        int *population_change_out,
+                        UNUSED signal_t *interruptor) THROWS_ONLY(interrupted_exc_t) {
+        const leaf_node_t *node = reinterpret_cast<const leaf_node_t *>(leaf_node_buf->get_data_read());
+        scoped_malloc_t<rdb_value_t> value(sizer.max_possible_size());
+
+        for (leaf::live_iter_t iter = leaf::iter_for_whole_leaf(node); /* no test */; iter.step(node)) {
+            if (!iter.get_key(node)) {
+                break;
+            }
+            // The leaf is about to go away, so we clear a copy of the blob reference.
+            memcpy(value.get(), iter.get_value(node), sizer.size(iter.get_value(node)));
+            blob_t blob(value->value_ref(), blob::btree_maxreflen);
+            blob.clear(txn);
+            (*population_change_out)--;
+        }
+
+        leaf_node_buf->mark_deleted();
+    }
+
+    void postprocess_internal_node(buf_lock_t *internal_node_buf) {
+        internal_node_buf->mark_deleted();
+    }
+
+    void filter_interesting_children(UNUSED transaction_t *txn, ranged_block_ids_t *ids_source, interesting_children_callback_t *cb) {
+        for (int i = 0, e = ids_source->num_block_ids(); i < e; ++i) {
+            cb->receive_interesting_child(i);
+        }
+        cb->no_more_interesting_children();
+    }
+
+    access_t btree_superblock_mode() { return rwi_write; }
+    access_t btree_node_mode() { return rwi_write; }
+
+private:
+    value_sizer_t<rdb_value_t> sizer;
+
+    DISABLE_COPYING(sindex_clear_helper_t);
+};
+
+bool rdb_sindex_create(const std::string &attrname, const std::string &primary_key,
+                       btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                       signal_t *interruptor) THROWS_ONLY(interrupted_exc_t) {
+    ensure_sindex_block(txn, superblock);
+    buf_lock_t sindex_block(txn, superblock->get_sindex_block_id(), rwi_write, buffer_cache_order_mode_ignore);
+
+    secondary_index_t sindex;
+    if (get_secondary_index(txn, &sindex_block, attrname, &sindex)) {
+        return false;
+    }
+    sindex.superblock = create_secondary_index_superblock(txn);
+    sindex.opaque_definition = primary_key;
+    set_secondary_index(txn, &sindex_block, attrname, sindex);
+
+    sindex_populate_helper_t helper(slice, attrname, sindex.superblock);
+    btree_parallel_traversal(txn, superblock, slice, &helper, interruptor);
+    return true;
+}
+
+bool rdb_sindex_drop(const std::string &attrname,
+                     btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                     signal_t *interruptor) THROWS_ONLY(interrupted_exc_t) {
+    if (superblock->get_sindex_block_id() == NULL_BLOCK_ID) {
+        return false;
+    }
+    buf_lock_t sindex_block(txn, superblock->get_sindex_block_id(), rwi_write, buffer_cache_order_mode_ignore);
+    superblock->release();
+
+    secondary_index_t sindex;
+    if (!get_secondary_index(txn, &sindex_block, attrname, &sindex)) {
+        return false;
+    }
+    delete_secondary_index(txn, &sindex_block, attrname);
+
+    {
+        buf_lock_t sindex_superblock_buf(txn, sindex.superblock, rwi_write, buffer_cache_order_mode_ignore);
+        real_superblock_t sindex_superblock(&sindex_superblock_buf);
+        sindex_clear_helper_t helper(slice->cache()->get_block_size());
+        btree_parallel_traversal(txn, &sindex_superblock, slice, &helper, interruptor);
+    }
+
+    buf_lock_t sindex_superblock_buf(txn, sindex.superblock, rwi_write, buffer_cache_order_mode_ignore);
+    block_id_t stat_block_id = static_cast<const btree_superblock_t *>(sindex_superblock_buf.get_data_read())->stat_block;
+    if (stat_block_id != NULL_BLOCK_ID) {
+        buf_lock_t stat_block(txn, stat_block_id, rwi_write, buffer_cache_order_mode_ignore);
+        stat_block.mark_deleted();
+    }
+    sindex_superblock_buf.mark_deleted();
+    return true;
+}
+
+void rdb_sindex_list(transaction_t *txn, superblock_t *superblock, std::vector<std::string> *attrnames_out) {
+    attrnames_out->clear();
+    if (superblock->get_sindex_block_id() == NULL_BLOCK_ID) {
+        return;
+    }
+    buf_lock_t sindex_block(txn, superblock->get_sindex_block_id(), rwi_read, buffer_cache_order_mode_ignore);
+    superblock->release();
+
+    std::map<std::string, secondary_index_t> sindexes;
+    get_secondary_indexes(txn, &sindex_block, &sindexes);
+    for (std::map<std::string, secondary_index_t>::iterator it = sindexes.begin(); it != sindexes.end(); ++it) {
+        attrnames_out->push_back(it->first);
+    }
+}
+
+void rdb_get_metainfo(transaction_t *txn, superblock_t *superblock,
+                      std::map<std::string, std::string> *metainfo_out) {
+    // The store always hands its reads the real superblock, which is where
+    // the metainfo lives.
+    real_superblock_t *real_superblock = static_cast<real_superblock_t *>(superblock);
+    std::vector<std::pair<std::vector<char>, std::vector<char> > > kv_pairs;
+    get_superblock_metainfo(txn, real_superblock->get(), &kv_pairs);
+    superblock->release();
+    metainfo_out->clear();
+    for (size_t i = 0; i < kv_pairs.size(); ++i) {
+        (*metainfo_out)[std::string(kv_pairs[i].first.begin(), kv_pairs[i].first.end())]
+            = std::string(kv_pairs[i].second.begin(), kv_pairs[i].second.end());
     }
 }
 
@@ -2,6 +2,7 @@
 #ifndef RDB_PROTOCOL_BTREE_HPP_
 #define RDB_PROTOCOL_BTREE_HPP_
 
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -19,6 +20,7 @@ typedef rdb_protocol_t::read_response_t read_response_t;
 
 typedef rdb_protocol_t::point_read_t point_read_t;
 typedef rdb_protocol_t::point_read_response_t point_read_response_t;
+typedef rdb_protocol_t::multi_point_read_response_t multi_point_read_response_t;
 
 typedef rdb_protocol_t::rget_read_t rget_read_t;
 typedef rdb_protocol_t::rget_read_response_t rget_read_response_t;
@@ -26,19 +28,25 @@ typedef rdb_protocol_t::rget_read_response_t rget_read_response_t;
 typedef rdb_protocol_t::distribution_read_t distribution_read_t;
 typedef rdb_protocol_t::distribution_read_response_t distribution_read_response_t;
 
+typedef rdb_protocol_t::sindex_list_t sindex_list_t;
+typedef rdb_protocol_t::sindex_list_response_t sindex_list_response_t;
+
 typedef rdb_protocol_t::write_t write_t;
 typedef rdb_protocol_t::write_response_t write_response_t;
 
 typedef rdb_protocol_t::point_write_t point_write_t;
 typedef rdb_protocol_t::point_write_response_t point_write_response_t;
+typedef rdb_protocol_t::batched_insert_response_t batched_insert_response_t;
 
 typedef rdb_protocol_t::point_modify_t point_modify_t;
 typedef rdb_protocol_t::point_modify_response_t point_modify_response_t;
+typedef rdb_protocol_t::range_modify_response_t range_modify_response_t;
 
 typedef rdb_protocol_t::point_delete_t point_delete_t;
 typedef rdb_protocol_t::point_delete_response_t point_delete_response_t;
 
 namespace query_language {
+    class json_arena_t;
     class runtime_environment_t;
 } //namespace query_language
 
@@ -76,18 +84,48 @@ private:
     DISABLE_COPYING(value_sizer_t<rdb_value_t>);
 };
 
-void rdb_get(const store_key_t &key, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock, point_read_response_t *response);
-
+/* If `transform` isn't empty and the row is there, the response holds what
+`transform` turns it into instead of the row. */
+void rdb_get(const store_key_t &key, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+             query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+             point_read_response_t *response);
+
+/* `rdb_get()` for each of `keys`, except that `transform` runs once over all
+the rows, after the superblock has been released. If it throws, every row that
+was there gets the error. */
+void rdb_multi_get(const std::vector<store_key_t> &keys, btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                   query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+                   multi_point_read_response_t *response);
+
+/* An UPDATE builds the new row in `arena`, which a batch of modifies can
+share. */
 void rdb_modify(const std::string &primary_key, const store_key_t &key, const point_modify_ns::op_t op,
                 query_language::runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
-                const Mapping &mapping,
+                const Mapping &mapping, query_language::json_arena_t *arena,
                 btree_slice_t *slice, repli_timestamp_t timestamp,
                 transaction_t *txn, superblock_t *superblock, point_modify_response_t *response);
 
+/* Updates, mutates or deletes the rows in `range` that pass the filters in
+`transform`, the way `rdb_modify()` and `rdb_delete()` would one at a time. It
+only looks at the first `RDB_RANGE_MODIFY_BATCH_SIZE` rows; if it stops before
+the end of `range`, `*last_key_out` is the last key it looked at. */
+void rdb_range_modify(const std::string &primary_key, const key_range_t &range,
+                      const rdb_protocol_details::transform_t &transform, range_modify_ns::op_t op,
+                      query_language::runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
+                      const boost::optional<Mapping> &mapping,
+                      btree_slice_t *slice, repli_timestamp_t timestamp,
+                      transaction_t *txn, superblock_t *superblock, range_modify_response_t *response,
+                      boost::optional<store_key_t> *last_key_out);
+
 void rdb_set(const store_key_t &key, boost::shared_ptr<scoped_cJSON_t> data, bool overwrite,
              btree_slice_t *slice, repli_timestamp_t timestamp,
              transaction_t *txn, superblock_t *superblock, point_write_response_t *response);
 
+/* `rdb_set()` for each of `rows`, in order. */
+void rdb_batched_set(const std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > &rows, bool overwrite,
+                     btree_slice_t *slice, repli_timestamp_t timestamp,
+                     transaction_t *txn, superblock_t *superblock, batched_insert_response_t *response);
+
 
 class rdb_backfill_callback_t {
 public:
@@ -123,9 +161,52 @@ struct rget_response_t {
 void rdb_rget_slice(btree_slice_t *slice, const key_range_t &range,
                     transaction_t *txn, superblock_t *superblock,
                     query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
-                    boost::optional<rdb_protocol_details::terminal_t> terminal, rget_read_response_t *response);
+                    boost::optional<rdb_protocol_details::terminal_t> terminal,
+                    const boost::optional<rdb_protocol_details::sorting_t> &sorting, rget_read_response_t *response);
 
 void rdb_distribution_get(btree_slice_t *slice, int max_depth, const store_key_t &left_key,
                           transaction_t *txn, superblock_t *superblock, distribution_read_response_t *response);
 
+/* SECONDARY INDEXES */
+
+/* A secondary index on an attribute is a btree keyed by the attribute's
+`cJSON_print_lexicographic()` encoding, then a NUL, then the row's primary key,
+truncated to `MAX_KEY_SIZE`. Each entry holds the rows themselves, so reading
+the index never goes back to the primary btree. An entry only holds more than
+one row when truncation makes two rows' keys collide. Rows where the attribute
+is missing or isn't a number or a string aren't in the index.
+
+`rdb_set()`, `rdb_modify()`, `rdb_delete()` and `rdb_erase_range()` keep every
+index up to date in the same transaction as the primary btree. */
+
+/* Like `rdb_rget_slice()`, but reads the rows in `sindex_range` of the index
+on `sindex_range.attrname`, in index order, skipping the ones outside of
+`region`. Keys in the response are index keys. */
+void rdb_rget_secondary_slice(btree_slice_t *slice, const rdb_protocol_details::sindex_range_t &sindex_range,
+                              const rdb_protocol_t::region_t &region,
+                              transaction_t *txn, superblock_t *superblock,
+                              query_language::runtime_environment_t *env, const rdb_protocol_details::transform_t &transform,
+                              boost::optional<rdb_protocol_details::terminal_t> terminal,
+                              const boost::optional<rdb_protocol_details::sorting_t> &sorting, rget_read_response_t *response);
+
+/* Returns false if there's already an index on `attrname`. The index is filled
+from every row of the shard in this one transaction, which holds the sindex
+block for writing until it's done. Writes to the shard need the sindex block
+too, so none of them can be missed, but they all wait for the build: creating an
+index on a big table stalls its writes for as long as it takes to read it. */
+bool rdb_sindex_create(const std::string &attrname, const std::string &primary_key,
+                       btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                       signal_t *interruptor) THROWS_ONLY(interrupted_exc_t);
+
+/* Returns false if there's no index on `attrname`. */
+bool rdb_sindex_drop(const std::string &attrname,
+                     btree_slice_t *slice, transaction_t *txn, superblock_t *superblock,
+                     signal_t *interruptor) THROWS_ONLY(interrupted_exc_t);
+
+void rdb_sindex_list(transaction_t *txn, superblock_t *superblock, std::vector<std::string> *attrnames_out);
+
+/* Reads the store's metainfo, which a write always changes. */
+void rdb_get_metainfo(transaction_t *txn, superblock_t *superblock,
+                      std::map<std::string, std::string> *metainfo_out);
+
 #endif /* RDB_PROTOCOL_BTREE_HPP_ */
@@ -0,0 +1,717 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/compiled_term.hpp"
+
+#include <math.h>
+
+#include <utility>
+
+#include "rdb_protocol/query_language.hpp"
+#include "rdb_protocol/rdb_protocol_json.hpp"
+
+namespace query_language {
+
+typedef std::vector<boost::shared_ptr<scoped_cJSON_t> > frame_t;
+
+class compiled_node_t {
+public:
+    /* `constant` is whether the node's value doesn't depend on the frame. */
+    explicit compiled_node_t(bool _constant) : constant(_constant) { }
+    virtual ~compiled_node_t() { }
+
+    virtual boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const = 0;
+
+    const bool constant;
+};
+
+typedef boost::shared_ptr<compiled_node_t> node_ptr_t;
+
+static bool all_constant(const std::vector<node_ptr_t> &nodes) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i]->constant) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void require_object(const boost::shared_ptr<scoped_cJSON_t> &data, const backtrace_t &backtrace) {
+    if (data->type() != cJSON_Object) {
+        throw runtime_exc_t("Data: \n" + data->Print() + "\nmust be an object", backtrace);
+    }
+}
+
+static boost::shared_ptr<scoped_cJSON_t> eval_and_check(const node_ptr_t &node, frame_t *frame, const backtrace_t &backtrace, int type, const std::string &msg) {
+    boost::shared_ptr<scoped_cJSON_t> res = node->eval(frame);
+    if (res->type() != type) {
+        throw runtime_exc_t(msg, backtrace);
+    }
+    return res;
+}
+
+class constant_node_t : public compiled_node_t {
+public:
+    explicit constant_node_t(const boost::shared_ptr<scoped_cJSON_t> &_value) : compiled_node_t(true), value(_value) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(UNUSED frame_t *frame) const { return value; }
+    boost::shared_ptr<scoped_cJSON_t> value;
+};
+
+class error_node_t : public compiled_node_t {
+public:
+    error_node_t(const std::string &_msg, const backtrace_t &_backtrace) : compiled_node_t(true), msg(_msg), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(UNUSED frame_t *frame) const {
+        throw runtime_exc_t(msg, backtrace);
+    }
+private:
+    std::string msg;
+    backtrace_t backtrace;
+};
+
+class slot_node_t : public compiled_node_t {
+public:
+    explicit slot_node_t(size_t _slot) : compiled_node_t(false), slot(_slot) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const { return (*frame)[slot]; }
+private:
+    size_t slot;
+};
+
+class let_node_t : public compiled_node_t {
+public:
+    let_node_t(const std::vector<std::pair<size_t, node_ptr_t> > &_binds, const node_ptr_t &_expr)
+        : compiled_node_t(false), binds(_binds), expr(_expr) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        for (size_t i = 0; i < binds.size(); ++i) {
+            (*frame)[binds[i].first] = binds[i].second->eval(frame);
+        }
+        return expr->eval(frame);
+    }
+private:
+    std::vector<std::pair<size_t, node_ptr_t> > binds;
+    node_ptr_t expr;
+};
+
+class if_node_t : public compiled_node_t {
+public:
+    if_node_t(const node_ptr_t &_test, const node_ptr_t &_true_branch, const node_ptr_t &_false_branch, const backtrace_t &_backtrace)
+        : compiled_node_t(_test->constant && _true_branch->constant && _false_branch->constant),
+          test(_test), true_branch(_true_branch), false_branch(_false_branch), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> res = test->eval(frame);
+        if (res->type() == cJSON_True) {
+            return true_branch->eval(frame);
+        } else if (res->type() == cJSON_False) {
+            return false_branch->eval(frame);
+        } else {
+            throw runtime_exc_t("The IF test must evaluate to a boolean.", backtrace.with("test"));
+        }
+    }
+private:
+    node_ptr_t test, true_branch, false_branch;
+    backtrace_t backtrace;
+};
+
+class array_node_t : public compiled_node_t {
+public:
+    explicit array_node_t(const std::vector<node_ptr_t> &_elems) : compiled_node_t(all_constant(_elems)), elems(_elems) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(cJSON_CreateArray()));
+        for (size_t i = 0; i < elems.size(); ++i) {
+            res->AddItemToArray(elems[i]->eval(frame)->DeepCopy());
+        }
+        return res;
+    }
+private:
+    std::vector<node_ptr_t> elems;
+};
+
+class object_node_t : public compiled_node_t {
+public:
+    object_node_t(const std::vector<std::string> &_names, const std::vector<node_ptr_t> &_values)
+        : compiled_node_t(all_constant(_values)), names(_names), values(_values) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(cJSON_CreateObject()));
+        for (size_t i = 0; i < values.size(); ++i) {
+            res->AddItemToObject(names[i].c_str(), values[i]->eval(frame)->DeepCopy());
+        }
+        return res;
+    }
+private:
+    std::vector<std::string> names;
+    std::vector<node_ptr_t> values;
+};
+
+/* Unlike `eval_call_as_json()`, doesn't flip its argument in place, since the
+argument might be the row or a constant. */
+class not_node_t : public compiled_node_t {
+public:
+    not_node_t(const node_ptr_t &_arg, const backtrace_t &_backtrace) : compiled_node_t(_arg->constant), arg(_arg), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> data = arg->eval(frame);
+        if (data->type() == cJSON_False) {
+            return shared_scoped_json(cJSON_CreateTrue());
+        } else if (data->type() == cJSON_True) {
+            return shared_scoped_json(cJSON_CreateFalse());
+        } else {
+            throw runtime_exc_t("Not can only be called on a boolean", backtrace.with("arg:0"));
+        }
+    }
+private:
+    node_ptr_t arg;
+    backtrace_t backtrace;
+};
+
+class getattr_node_t : public compiled_node_t {
+public:
+    getattr_node_t(const node_ptr_t &_arg, const std::string &_attr, const backtrace_t &_backtrace)
+        : compiled_node_t(_arg->constant), arg(_arg), attr(_attr), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> data = arg->eval(frame);
+        require_object(data, backtrace.with("arg:0"));
+        cJSON *value = data->GetObjectItem(attr.c_str());
+        if (!value) {
+            throw runtime_exc_t("Object:\n" + data->Print() +"\nis missing attribute \"" + attr + "\"", backtrace.with("attr"));
+        }
+        return shared_scoped_json(cJSON_DeepCopy(value));
+    }
+private:
+    node_ptr_t arg;
+    std::string attr;
+    backtrace_t backtrace;
+};
+
+class hasattr_node_t : public compiled_node_t {
+public:
+    hasattr_node_t(const node_ptr_t &_arg, const std::string &_attr, const backtrace_t &_backtrace)
+        : compiled_node_t(_arg->constant), arg(_arg), attr(_attr), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> data = arg->eval(frame);
+        require_object(data, backtrace.with("arg:0"));
+        return shared_scoped_json(cJSON_CreateBool(data->GetObjectItem(attr.c_str()) != NULL));
+    }
+private:
+    node_ptr_t arg;
+    std::string attr;
+    backtrace_t backtrace;
+};
+
+class pickattrs_node_t : public compiled_node_t {
+public:
+    pickattrs_node_t(const node_ptr_t &_arg, const std::vector<std::string> &_attrs, const backtrace_t &_backtrace)
+        : compiled_node_t(_arg->constant), arg(_arg), attrs(_attrs), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> data = arg->eval(frame);
+        require_object(data, backtrace.with("arg:0"));
+        boost::shared_ptr<scoped_cJSON_t> res = shared_scoped_json(cJSON_CreateObject());
+        for (size_t i = 0; i < attrs.size(); ++i) {
+            cJSON *item = data->GetObjectItem(attrs[i].c_str());
+            if (!item) {
+                throw runtime_exc_t("Attempting to pick missing attribute " + attrs[i] + " from data:\n" + data->Print(), backtrace.with(strprintf("attrs:%zu", i)));
+            }
+            res->AddItemToObject(item->string, cJSON_DeepCopy(item));
+        }
+        return res;
+    }
+private:
+    node_ptr_t arg;
+    std::vector<std::string> attrs;
+    backtrace_t backtrace;
+};
+
+class without_node_t : public compiled_node_t {
+public:
+    without_node_t(const node_ptr_t &_arg, const std::vector<std::string> &_attrs, const backtrace_t &_backtrace)
+        : compiled_node_t(_arg->constant), arg(_arg), attrs(_attrs), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        boost::shared_ptr<scoped_cJSON_t> data = arg->eval(frame);
+        require_object(data, backtrace.with("arg:0"));
+        boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(data->DeepCopy()));
+        for (size_t i = 0; i < attrs.size(); ++i) {
+            res->DeleteItemFromObject(attrs[i].c_str());
+        }
+        return res;
+    }
+private:
+    node_ptr_t arg;
+    std::vector<std::string> attrs;
+    backtrace_t backtrace;
+};
+
+/* The arguments of a call, with the backtrace each is evaluated under. */
+class call_args_t {
+public:
+    call_args_t() { }
+    void push_back(const node_ptr_t &node, const backtrace_t &backtrace) {
+        nodes.push_back(node);
+        backtraces.push_back(backtrace);
+    }
+    size_t size() const { return nodes.size(); }
+
+    std::vector<node_ptr_t> nodes;
+    std::vector<backtrace_t> backtraces;
+};
+
+class add_node_t : public compiled_node_t {
+public:
+    add_node_t(const call_args_t &_args, const backtrace_t &_backtrace)
+        : compiled_node_t(all_constant(_args.nodes)), args(_args), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        if (args.size() == 0) {
+            return shared_scoped_json(cJSON_CreateNull());
+        }
+        boost::shared_ptr<scoped_cJSON_t> arg = args.nodes[0]->eval(frame);
+        if (arg->type() == cJSON_Number) {
+            double result = arg->get()->valuedouble;
+            for (size_t i = 1; i < args.size(); ++i) {
+                result += eval_and_check(args.nodes[i], frame, args.backtraces[i], cJSON_Number, "Cannot ADD numbers to non-numbers")->get()->valuedouble;
+            }
+            return shared_scoped_json(safe_cJSON_CreateNumber(result, backtrace));
+        } else if (arg->type() == cJSON_Array) {
+            boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(arg->DeepCopy()));
+            for (size_t i = 1; i < args.size(); ++i) {
+                boost::shared_ptr<scoped_cJSON_t> arg2 = eval_and_check(args.nodes[i], frame, args.backtraces[i], cJSON_Array, "Cannot ADD arrays to non-arrays");
+                for (int j = 0; j < arg2->GetArraySize(); ++j) {
+                    res->AddItemToArray(cJSON_DeepCopy(arg2->GetArrayItem(j)));
+                }
+            }
+            return res;
+        } else {
+            throw runtime_exc_t("Can only ADD numbers with numbers and arrays with arrays", backtrace.with("arg:0"));
+        }
+    }
+private:
+    call_args_t args;
+    backtrace_t backtrace;
+};
+
+/* SUBTRACT, MULTIPLY, DIVIDE and MODULO. */
+class arithmetic_node_t : public compiled_node_t {
+public:
+    arithmetic_node_t(Builtin::BuiltinType _op, const call_args_t &_args, const backtrace_t &_backtrace)
+        : compiled_node_t(all_constant(_args.nodes)), op(_op), args(_args), backtrace(_backtrace) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        double result;
+        if (op == Builtin::SUBTRACT || op == Builtin::DIVIDE) {
+            result = 0.0;
+            const char *msg = op == Builtin::SUBTRACT ? "All operands to SUBTRACT must be numbers." : "All operands to DIVIDE must be numbers.";
+            if (args.size() > 0) {
+                double first = eval_and_check(args.nodes[0], frame, args.backtraces[0], cJSON_Number, msg)->get()->valuedouble;
+                if (args.size() == 1) {
+                    // (- x) is negate, (/ x) is reciprocal
+                    result = op == Builtin::SUBTRACT ? -first : 1.0 / first;
+                } else {
+                    result = first;
+                }
+                for (size_t i = 1; i < args.size(); ++i) {
+                    double val = eval_and_check(args.nodes[i], frame, args.backtraces[i], cJSON_Number, msg)->get()->valuedouble;
+                    if (op == Builtin::SUBTRACT) {
+                        result -= val;
+                    } else {
+                        result /= val;
+                    }
+                }
+            }
+        } else if (op == Builtin::MULTIPLY) {
+            result = 1.0;
+            for (size_t i = 0; i < args.size(); ++i) {
+                result *= eval_and_check(args.nodes[i], frame, args.backtraces[i], cJSON_Number, "All operands of MULTIPLY must be numbers.")->get()->valuedouble;
+            }
+        } else {
+            guarantee(op == Builtin::MODULO);
+            boost::shared_ptr<scoped_cJSON_t> lhs = eval_and_check(args.nodes[0], frame, args.backtraces[0], cJSON_Number, "First operand of MOD must be a number."),
+                                              rhs = eval_and_check(args.nodes[1], frame, args.backtraces[1], cJSON_Number, "Second operand of MOD must be a number.");
+            result = fmod(lhs->get()->valuedouble, rhs->get()->valuedouble);
+        }
+        return shared_scoped_json(safe_cJSON_CreateNumber(result, backtrace));
+    }
+private:
+    Builtin::BuiltinType op;
+    call_args_t args;
+    backtrace_t backtrace;
+};
+
+class compare_node_t : public compiled_node_t {
+public:
+    compare_node_t(Builtin::Comparison _comparison, const call_args_t &_args)
+        : compiled_node_t(all_constant(_args.nodes)), comparison(_comparison), args(_args) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        bool result = true;
+        boost::shared_ptr<scoped_cJSON_t> lhs = args.nodes[0]->eval(frame);
+        for (size_t i = 1; i < args.size() && result; ++i) {
+            boost::shared_ptr<scoped_cJSON_t> rhs = args.nodes[i]->eval(frame);
+            int res = lhs->type() == cJSON_NULL && rhs->type() == cJSON_NULL ? 0 :
+                cJSON_cmp(lhs->get(), rhs->get(), args.backtraces[i]);
+            switch (comparison) {
+            case Builtin_Comparison_EQ: result = (res == 0); break;
+            case Builtin_Comparison_NE: result = (res != 0); break;
+            case Builtin_Comparison_LT: result = (res < 0); break;
+            case Builtin_Comparison_LE: result = (res <= 0); break;
+            case Builtin_Comparison_GT: result = (res > 0); break;
+            case Builtin_Comparison_GE: result = (res >= 0); break;
+            default: crash("Unknown comparison operator.");
+            }
+            lhs = rhs;
+        }
+        return shared_scoped_json(cJSON_CreateBool(result));
+    }
+private:
+    Builtin::Comparison comparison;
+    call_args_t args;
+};
+
+/* ALL and ANY. */
+class connective_node_t : public compiled_node_t {
+public:
+    connective_node_t(bool _any, const call_args_t &_args)
+        : compiled_node_t(all_constant(_args.nodes)), any(_any), args(_args) { }
+    boost::shared_ptr<scoped_cJSON_t> eval(frame_t *frame) const {
+        for (size_t i = 0; i < args.size(); ++i) {
+            boost::shared_ptr<scoped_cJSON_t> arg = args.nodes[i]->eval(frame);
+            if (arg->type() != cJSON_False && arg->type() != cJSON_True) {
+                throw runtime_exc_t(any ? "All operands to ANY must be booleans." : "All operands to ALL must be booleans.", args.backtraces[i]);
+            }
+            if ((arg->type() == cJSON_True) == any) {
+                return shared_scoped_json(cJSON_CreateBool(any));
+            }
+        }
+        return shared_scoped_json(cJSON_CreateBool(!any));
+    }
+private:
+    bool any;
+    call_args_t args;
+};
+
+/* Turns terms into nodes. `compile()` returns an empty pointer for a term it
+can't compile, and whatever contains that term can't be compiled either. */
+class term_compiler_t {
+public:
+    term_compiler_t(const std::string &_arg, const scopes_t &_scopes)
+        : num_slots(1), arg(_arg), scopes(_scopes) { }
+
+    node_ptr_t compile(const Term &t, const backtrace_t &backtrace, bool *shares_constant_out);
+
+    size_t num_slots;
+
+private:
+    node_ptr_t compile_call(const Term::Call &c, const backtrace_t &backtrace);
+    bool compile_args(const Term::Call &c, const backtrace_t &backtrace, call_args_t *args_out);
+    node_ptr_t compile_var(const std::string &name, bool *shares_constant_out);
+
+    /* Evaluates a node that doesn't depend on the row now, unless it throws,
+    in which case it's left to throw for each row like the interpreter's. */
+    static node_ptr_t fold(const node_ptr_t &node);
+
+    std::string arg;
+    scopes_t scopes;
+
+    struct bound_var_t {
+        std::string name;
+        node_ptr_t node;
+        bool shares_constant;
+    };
+    // The variables bound by the LETs we're inside of, innermost last.
+    std::vector<bound_var_t> bound;
+};
+
+node_ptr_t term_compiler_t::fold(const node_ptr_t &node) {
+    if (!node || !node->constant || dynamic_cast<constant_node_t *>(node.get())) {
+        return node;
+    }
+    frame_t empty;
+    try {
+        return node_ptr_t(new constant_node_t(node->eval(&empty)));
+    } catch (const runtime_exc_t &) {
+        return node;
+    }
+}
+
+node_ptr_t term_compiler_t::compile_var(const std::string &name, bool *shares_constant_out) {
+    for (size_t i = bound.size(); i-- > 0;) {
+        if (bound[i].name == name) {
+            *shares_constant_out = bound[i].shares_constant;
+            return bound[i].node;
+        }
+    }
+    if (name == arg) {
+        return node_ptr_t(new slot_node_t(0));
+    }
+    if (scopes.scope.is_in_scope(name)) {
+        *shares_constant_out = true;
+        return node_ptr_t(new constant_node_t(scopes.scope.get(name)));
+    }
+    return node_ptr_t();
+}
+
+node_ptr_t term_compiler_t::compile(const Term &t, const backtrace_t &backtrace, bool *shares_constant_out) {
+    *shares_constant_out = false;
+    node_ptr_t res;
+    switch (t.type()) {
+    case Term::IMPLICIT_VAR:
+        return node_ptr_t(new slot_node_t(0));
+    case Term::VAR:
+        return compile_var(t.var(), shares_constant_out);
+    case Term::LET: {
+        size_t num_bound = bound.size();
+        std::vector<std::pair<size_t, node_ptr_t> > binds;
+        for (int i = 0; i < t.let().binds_size(); ++i) {
+            bound_var_t var;
+            var.name = t.let().binds(i).var();
+            var.node = fold(compile(t.let().binds(i).term(), backtrace.with(strprintf("bind:%s", var.name.c_str())), &var.shares_constant));
+            if (!var.node) {
+                bound.resize(num_bound);
+                return node_ptr_t();
+            }
+            if (!dynamic_cast<constant_node_t *>(var.node.get())) {
+                // It has to be worked out for each row.
+                binds.push_back(std::make_pair(num_slots, var.node));
+                var.node = node_ptr_t(new slot_node_t(num_slots));
+                ++num_slots;
+            } else {
+                var.shares_constant = true;
+            }
+            bound.push_back(var);
+        }
+        node_ptr_t expr = compile(t.let().expr(), backtrace.with("expr"), shares_constant_out);
+        bound.resize(num_bound);
+        if (!expr || binds.empty()) {
+            return expr;
+        }
+        res.reset(new let_node_t(binds, expr));
+    } break;
+    case Term::CALL:
+        res = compile_call(t.call(), backtrace);
+        break;
+    case Term::IF: {
+        bool true_shares, false_shares, test_shares;
+        node_ptr_t test = compile(t.if_().test(), backtrace.with("test"), &test_shares),
+            true_branch = compile(t.if_().true_branch(), backtrace.with("true"), &true_shares),
+            false_branch = compile(t.if_().false_branch(), backtrace.with("false"), &false_shares);
+        if (!test || !true_branch || !false_branch) {
+            return node_ptr_t();
+        }
+        *shares_constant_out = true_shares || false_shares;
+        res.reset(new if_node_t(test, true_branch, false_branch, backtrace));
+    } break;
+    case Term::ERROR:
+        return node_ptr_t(new error_node_t(t.error(), backtrace));
+    case Term::NUMBER:
+        if (!isfinite(t.number())) {
+            return node_ptr_t(new error_node_t(strprintf("Illegal numeric value %e.", t.number()), backtrace));
+        }
+        res.reset(new constant_node_t(shared_scoped_json(safe_cJSON_CreateNumber(t.number(), backtrace))));
+        break;
+    case Term::STRING:
+        res.reset(new constant_node_t(shared_scoped_json(cJSON_CreateString(t.valuestring().c_str()))));
+        break;
+    case Term::JSON: {
+        boost::shared_ptr<scoped_cJSON_t> json = shared_scoped_json(cJSON_Parse(t.jsonstring().c_str()));
+        if (!json->get()) {
+            return node_ptr_t(new error_node_t(strprintf("Malformed JSON: %s", t.jsonstring().c_str()), backtrace));
+        }
+        res.reset(new constant_node_t(json));
+    } break;
+    case Term::BOOL:
+        res.reset(new constant_node_t(shared_scoped_json(cJSON_CreateBool(t.valuebool()))));
+        break;
+    case Term::JSON_NULL:
+        res.reset(new constant_node_t(shared_scoped_json(cJSON_CreateNull())));
+        break;
+    case Term::ARRAY: {
+        std::vector<node_ptr_t> elems;
+        for (int i = 0; i < t.array_size(); ++i) {
+            bool unused;
+            elems.push_back(compile(t.array(i), backtrace.with(strprintf("elem:%d", i)), &unused));
+            if (!elems.back()) {
+                return node_ptr_t();
+            }
+        }
+        res.reset(new array_node_t(elems));
+    } break;
+    case Term::OBJECT: {
+        std::vector<std::string> names;
+        std::vector<node_ptr_t> values;
+        for (int i = 0; i < t.object_size(); ++i) {
+            bool unused;
+            names.push_back(t.object(i).var());
+            values.push_back(compile(t.object(i).term(), backtrace.with(strprintf("key:%s", names.back().c_str())), &unused));
+            if (!values.back()) {
+                return node_ptr_t();
+            }
+        }
+        res.reset(new object_node_t(names, values));
+    } break;
+    case Term::GETBYKEY:
+    case Term::TABLE:
+    case Term::JAVASCRIPT:
+        return node_ptr_t();
+    default:
+        unreachable();
+    }
+    if (!res) {
+        return res;
+    }
+    res = fold(res);
+    if (dynamic_cast<constant_node_t *>(res.get())) {
+        *shares_constant_out = true;
+    }
+    return res;
+}
+
+bool term_compiler_t::compile_args(const Term::Call &c, const backtrace_t &backtrace, call_args_t *args_out) {
+    for (int i = 0; i < c.args_size(); ++i) {
+        backtrace_t arg_backtrace = backtrace.with(strprintf("arg:%d", i));
+        bool unused;
+        node_ptr_t node = compile(c.args(i), arg_backtrace, &unused);
+        if (!node) {
+            return false;
+        }
+        args_out->push_back(node, arg_backtrace);
+    }
+    return true;
+}
+
+node_ptr_t term_compiler_t::compile_call(const Term::Call &c, const backtrace_t &backtrace) {
+    const Builtin &b = c.builtin();
+    call_args_t args;
+    switch (b.type()) {
+    case Builtin::IMPLICIT_GETATTR:
+    case Builtin::IMPLICIT_HASATTR:
+    case Builtin::IMPLICIT_PICKATTRS:
+    case Builtin::IMPLICIT_WITHOUT:
+        args.push_back(node_ptr_t(new slot_node_t(0)), backtrace.with("arg:0"));
+        break;
+    case Builtin::NOT:
+    case Builtin::GETATTR:
+    case Builtin::HASATTR:
+    case Builtin::PICKATTRS:
+    case Builtin::WITHOUT:
+    case Builtin::ADD:
+    case Builtin::SUBTRACT:
+    case Builtin::MULTIPLY:
+    case Builtin::DIVIDE:
+    case Builtin::MODULO:
+    case Builtin::COMPARE:
+    case Builtin::ALL:
+    case Builtin::ANY:
+        if (!compile_args(c, backtrace, &args)) {
+            return node_ptr_t();
+        }
+        break;
+    case Builtin::MAPMERGE:
+    case Builtin::ARRAYAPPEND:
+    case Builtin::SLICE:
+    case Builtin::FILTER:
+    case Builtin::MAP:
+    case Builtin::CONCATMAP:
+    case Builtin::ORDERBY:
+    case Builtin::DISTINCT:
+    case Builtin::LENGTH:
+    case Builtin::UNION:
+    case Builtin::NTH:
+    case Builtin::STREAMTOARRAY:
+    case Builtin::ARRAYTOSTREAM:
+    case Builtin::REDUCE:
+    case Builtin::GROUPEDMAPREDUCE:
+    case Builtin::RANGE:
+        // Streams, tables and the less common builtins are left to the
+        // interpreter.
+        return node_ptr_t();
+    default:
+        unreachable();
+    }
+
+    std::vector<std::string> attrs(b.attrs().begin(), b.attrs().end());
+    switch (b.type()) {
+    case Builtin::NOT:
+        return node_ptr_t(new not_node_t(args.nodes[0], backtrace));
+    case Builtin::GETATTR:
+    case Builtin::IMPLICIT_GETATTR:
+        return node_ptr_t(new getattr_node_t(args.nodes[0], b.attr(), backtrace));
+    case Builtin::HASATTR:
+    case Builtin::IMPLICIT_HASATTR:
+        return node_ptr_t(new hasattr_node_t(args.nodes[0], b.attr(), backtrace));
+    case Builtin::PICKATTRS:
+    case Builtin::IMPLICIT_PICKATTRS:
+        return node_ptr_t(new pickattrs_node_t(args.nodes[0], attrs, backtrace));
+    case Builtin::WITHOUT:
+    case Builtin::IMPLICIT_WITHOUT:
+        return node_ptr_t(new without_node_t(args.nodes[0], attrs, backtrace));
+    case Builtin::ADD:
+        return node_ptr_t(new add_node_t(args, backtrace));
+    case Builtin::SUBTRACT:
+    case Builtin::MULTIPLY:
+    case Builtin::DIVIDE:
+    case Builtin::MODULO:
+        return node_ptr_t(new arithmetic_node_t(b.type(), args, backtrace));
+    case Builtin::COMPARE:
+        return node_ptr_t(new compare_node_t(b.comparison(), args));
+    case Builtin::ALL:
+    case Builtin::ANY:
+        return node_ptr_t(new connective_node_t(b.type() == Builtin::ANY, args));
+    case Builtin::MAPMERGE:
+    case Builtin::ARRAYAPPEND:
+    case Builtin::SLICE:
+    case Builtin::FILTER:
+    case Builtin::MAP:
+    case Builtin::CONCATMAP:
+    case Builtin::ORDERBY:
+    case Builtin::DISTINCT:
+    case Builtin::LENGTH:
+    case Builtin::UNION:
+    case Builtin::NTH:
+    case Builtin::STREAMTOARRAY:
+    case Builtin::ARRAYTOSTREAM:
+    case Builtin::REDUCE:
+    case Builtin::GROUPEDMAPREDUCE:
+    case Builtin::RANGE:
+    default:
+        unreachable();
+    }
+}
+
+compiled_lambda_t::compiled_lambda_t(const std::string &arg, const Term &body, const scopes_t &scopes, const backtrace_t &backtrace)
+    : num_slots(0), root_shares_constant(false) {
+    term_compiler_t compiler(arg, scopes);
+    root = compiler.compile(body, backtrace, &root_shares_constant);
+    num_slots = compiler.num_slots;
+}
+
+boost::shared_ptr<scoped_cJSON_t> compiled_lambda_t::operator()(const boost::shared_ptr<scoped_cJSON_t> &row) const THROWS_ONLY(runtime_exc_t) {
+    rassert(root);
+    frame_t frame(num_slots);
+    frame[0] = row;
+    boost::shared_ptr<scoped_cJSON_t> res = root->eval(&frame);
+    if (root_shares_constant) {
+        return shared_scoped_json(res->DeepCopy());
+    }
+    return res;
+}
+
+compiled_transform_t::compiled_transform_t(const rdb_protocol_details::transform_t &_transform)
+    : transform(_transform) {
+    for (rdb_protocol_details::transform_t::const_iterator it = transform.begin(); it != transform.end(); ++it) {
+        const std::string *arg = NULL;
+        const Term *body = NULL;
+        if (const Builtin_Filter *filter = boost::get<Builtin_Filter>(&it->variant)) {
+            arg = &filter->predicate().arg();
+            body = &filter->predicate().body();
+        } else if (const Mapping *mapping = boost::get<Mapping>(&it->variant)) {
+            arg = &mapping->arg();
+            body = &mapping->body();
+        }
+
+        boost::shared_ptr<compiled_lambda_t> step;
+        if (body) {
+            step.reset(new compiled_lambda_t(*arg, *body, it->scopes, it->backtrace));
+            if (!step->compiled()) {
+                step.reset();
+            }
+        }
+        steps.push_back(step);
+    }
+}
+
+const compiled_lambda_t *compiled_transform_t::get_step(size_t i) const {
+    rassert(i < steps.size());
+    return steps[i].get();
+}
+
+}  // namespace query_language
@@ -0,0 +1,68 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_COMPILED_TERM_HPP_
+#define RDB_PROTOCOL_COMPILED_TERM_HPP_
+
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include <boost/shared_ptr.hpp>
+
+#include "http/json.hpp"
+#include "rdb_protocol/backtrace.hpp"
+#include "rdb_protocol/exceptions.hpp"
+#include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/query_language.pb.h"
+
+namespace query_language {
+
+class compiled_node_t;
+
+/* The body of a mapping or predicate, worked over once so that running it on
+row after row doesn't have to look anything up. The row is slot 0 of a frame
+and each variable bound by a LET in the body gets a slot of its own; variables
+bound outside the body are replaced by their values; each builtin becomes a
+node that does just that builtin; and whatever doesn't depend on the row is
+evaluated up front. The results and the errors are the same as
+`eval_term_as_json()`'s.
+
+Only the terms that are cheap and common in predicates and mappings get
+compiled. If the body has anything else in it (a table, a stream, javascript,
+...), `compiled()` is false and the body has to be interpreted. */
+class compiled_lambda_t {
+public:
+    compiled_lambda_t(const std::string &arg, const Term &body, const scopes_t &scopes, const backtrace_t &backtrace);
+
+    bool compiled() const { return root.get() != NULL; }
+
+    /* Evaluates the body with `row` bound to the argument (and the implicit
+    variable). */
+    boost::shared_ptr<scoped_cJSON_t> operator()(const boost::shared_ptr<scoped_cJSON_t> &row) const THROWS_ONLY(runtime_exc_t);
+
+private:
+    boost::shared_ptr<compiled_node_t> root;
+    size_t num_slots;
+    // Whether `root` can return one of the values worked out up front, which
+    // the caller mustn't get to change.
+    bool root_shares_constant;
+};
+
+/* A transform with the body of each filter and mapping compiled. */
+class compiled_transform_t {
+public:
+    explicit compiled_transform_t(const rdb_protocol_details::transform_t &_transform);
+
+    const rdb_protocol_details::transform_t &get_transform() const { return transform; }
+
+    /* The compiled body of the `i`th step of the transform, or `NULL` if it
+    has to be interpreted. */
+    const compiled_lambda_t *get_step(size_t i) const;
+
+private:
+    rdb_protocol_details::transform_t transform;
+    std::vector<boost::shared_ptr<compiled_lambda_t> > steps;
+};
+
+}  // namespace query_language
+
+#endif  // RDB_PROTOCOL_COMPILED_TERM_HPP_
@@ -3,6 +3,7 @@
 #define RDB_PROTOCOL_ENVIRONMENT_HPP_
 
 #include <map>
+#include <string>
 
 #include "clustering/administration/database_metadata.hpp"
 #include "clustering/administration/metadata.hpp"
@@ -11,6 +12,8 @@
 #include "rdb_protocol/protocol.hpp"
 #include "rdb_protocol/stream.hpp"
 
+class sindex_cache_t;
+
 namespace query_language {
 
 class runtime_environment_t {
@@ -27,7 +30,9 @@ public:
         directory_read_manager_t<cluster_directory_metadata_t> *_directory_read_manager,
         boost::shared_ptr<js::runner_t> _js_runner,
         signal_t *_interruptor,
-        uuid_t _this_machine)
+        uuid_t _this_machine,
+        io_backender_t *_io_backender,
+        const std::string &_temp_directory)
         : pool(_pool_group->get()),
           ns_repo(_ns_repo),
           namespaces_semilattice_metadata(_namespaces_semilattice_metadata),
@@ -36,7 +41,14 @@ public:
           directory_read_manager(_directory_read_manager),
           js_runner(_js_runner),
           interruptor(_interruptor),
-          this_machine(_this_machine) {
+          this_machine(_this_machine),
+          io_backender(_io_backender),
+          temp_directory(_temp_directory),
+          sort_memory_budget(RDB_SORT_MEMORY_BUDGET),
+          hash_memory_budget(RDB_HASH_MEMORY_BUDGET),
+          prefetch_depth(RDB_PREFETCH_DEPTH),
+          prefetch_memory_budget(RDB_PREFETCH_MEMORY_BUDGET),
+          sindex_cache(NULL) {
         guarantee(js_runner);
     }
 
@@ -51,7 +63,9 @@ public:
             _semilattice_metadata,
         boost::shared_ptr<js::runner_t> _js_runner,
         signal_t *_interruptor,
-        uuid_t _this_machine)
+        uuid_t _this_machine,
+        io_backender_t *_io_backender,
+        const std::string &_temp_directory)
         : pool(_pool_group->get()),
           ns_repo(_ns_repo),
           namespaces_semilattice_metadata(_namespaces_semilattice_metadata),
@@ -60,7 +74,14 @@ public:
           directory_read_manager(NULL),
           js_runner(_js_runner),
           interruptor(_interruptor),
-          this_machine(_this_machine) {
+          this_machine(_this_machine),
+          io_backender(_io_backender),
+          temp_directory(_temp_directory),
+          sort_memory_budget(RDB_SORT_MEMORY_BUDGET),
+          hash_memory_budget(RDB_HASH_MEMORY_BUDGET),
+          prefetch_depth(RDB_PREFETCH_DEPTH),
+          prefetch_memory_budget(RDB_PREFETCH_MEMORY_BUDGET),
+          sindex_cache(NULL) {
         guarantee(js_runner);
     }
 
@@ -99,6 +120,21 @@ public:
     signal_t *interruptor;
     uuid_t this_machine;
 
+    // For spilling big sorts and DISTINCTs to disk; see
+    // `rdb_protocol_t::context_t`.
+    io_backender_t *io_backender;
+    std::string temp_directory;
+    size_t sort_memory_budget;
+    size_t hash_memory_budget;
+
+    // How far table scans read ahead; see `batched_rget_stream_t`.
+    int prefetch_depth;
+    size_t prefetch_memory_budget;
+
+    // Which attributes have a secondary index, if the query server keeps
+    // track; if it's NULL, every query that could use one asks the table.
+    sindex_cache_t *sindex_cache;
+
 private:
     DISABLE_COPYING(runtime_environment_t);
 };
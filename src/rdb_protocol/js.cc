@@ -5,6 +5,7 @@
 #include "utils.hpp"
 #include <boost/optional.hpp>
 
+#include "config/args.hpp"
 #include "containers/scoped.hpp"
 #include "rdb_protocol/jsimpl.hpp"
 #include "rdb_protocol/rdb_protocol_json.hpp"
@@ -101,7 +102,7 @@ void env_t::forget(id_t id) {
 
 
 // ---------- runner_t ----------
-runner_t::runner_t() : running_task_(false) { }
+runner_t::runner_t() : running_task_(false), num_script_cache_hits_(0) { }
 
 const runner_t::req_config_t *runner_t::default_req_config() {
     static req_config_t config;
@@ -119,6 +120,10 @@ runner_t::~runner_t() {
 }
 
 void runner_t::begin(extproc::pool_t *pool) {
+    // Acquiring a worker can block, and someone else might begin meanwhile.
+    mutex_t::acq_t acq(&task_mutex_);
+    if (connected()) return;
+
     // TODO(rntz): might eventually want to handle external process failure
     int res = extproc::job_handle_t::begin(pool, job_t());
     guarantee(0 == res);
@@ -147,7 +152,7 @@ void runner_t::job_t::run_job(control_t *control, UNUSED void *extra) {
 
 // ----- runner_t::run_task_t -----
 runner_t::run_task_t::run_task_t(runner_t *runner, const req_config_t *config, const task_t &task)
-    : runner_(runner)
+    : runner_(runner), task_acq_(&runner->task_mutex_)
 {
     guarantee(!runner_->running_task_);
     runner_->running_task_ = true;
@@ -195,6 +200,14 @@ void runner_t::release_id(id_t id) {
     run_task_t(this, default_req_config(), release_task_t(id));
 
     used_ids_.erase(it);
+
+    typedef std::map<std::pair<std::vector<std::string>, std::string>, id_t>::iterator compiled_it_t;
+    for (compiled_it_t jt = compiled_.begin(); jt != compiled_.end(); ++jt) {
+        if (jt->second == id) {
+            compiled_.erase(jt);
+            break;
+        }
+    }
 }
 
 // ----- compile() -----
@@ -255,22 +268,49 @@ struct compile_task_t : auto_task_t<compile_task_t> {
                 endsz);
     }
 
-    v8::Handle<v8::Function> mkFunc(std::string *errmsg) {
+    // Scripts compiled by this worker process, by source, so that a query
+    // that runs the same javascript as an earlier one, from any runner,
+    // doesn't compile it again. `v8::Script::New()` makes scripts that aren't
+    // tied to a context, so each compile still runs the script in its own
+    // fresh context and gets a function with its own global object.
+    typedef std::map<std::string, v8::Persistent<v8::Script> > script_cache_t;
+    static script_cache_t *script_cache() {
+        static script_cache_t cache;
+        return &cache;
+    }
+
+    v8::Handle<v8::Function> mkFunc(bool *cache_hit, std::string *errmsg) {
         v8::Handle<v8::Function> result; // initially empty
 
         // Compile & run script to get a function.
         scoped_array_t<char> srcbuf;
         mkFuncSrc(&srcbuf);
-        // TODO(rntz): use an "external resource" to avoid copy?
-        v8::Handle<v8::String> src = v8::String::New(srcbuf.data(), srcbuf.size());
+        std::string key(srcbuf.data(), srcbuf.size());
 
         v8::TryCatch try_catch;
 
-        v8::Handle<v8::Script> script = v8::Script::Compile(src);
-        if (script.IsEmpty()) {
-            *errmsg = "compiling function definition failed";
-            append_caught_error(errmsg, try_catch);
-            return result;
+        v8::Handle<v8::Script> script;
+        script_cache_t *cache = script_cache();
+        script_cache_t::iterator it = cache->find(key);
+        if (it != cache->end()) {
+            script = it->second;
+            *cache_hit = true;
+        } else {
+            // TODO(rntz): use an "external resource" to avoid copy?
+            v8::Handle<v8::String> src = v8::String::New(srcbuf.data(), srcbuf.size());
+            script = v8::Script::New(src);
+            if (script.IsEmpty()) {
+                *errmsg = "compiling function definition failed";
+                append_caught_error(errmsg, try_catch);
+                return result;
+            }
+            if (cache->size() >= JS_SCRIPT_CACHE_SIZE) {
+                for (it = cache->begin(); it != cache->end(); ++it) {
+                    it->second.Dispose();
+                }
+                cache->clear();
+            }
+            cache->insert(std::make_pair(key, v8::Persistent<v8::Script>::New(script)));
         }
 
         v8::Handle<v8::Value> funcv = script->Run();
@@ -294,13 +334,15 @@ struct compile_task_t : auto_task_t<compile_task_t> {
 
         v8::HandleScope handle_scope;
         // Evaluate the function definition.
-        v8::Handle<v8::Function> func = mkFunc(errmsg);
+        bool cache_hit = false;
+        v8::Handle<v8::Function> func = mkFunc(&cache_hit, errmsg);
         if (!func.IsEmpty()) {
             result = env->rememberValue(func);
         }
 
         write_message_t msg;
         msg << result;
+        msg << cache_hit;
         int sendres = send_write_message(env->control(), &msg);
         guarantee(0 == sendres);
     }
@@ -312,22 +354,65 @@ id_t runner_t::compile(
     std::string *errmsg,
     const req_config_t *config)
 {
+    std::pair<std::vector<std::string>, std::string> key(args, source);
+    std::map<std::pair<std::vector<std::string>, std::string>, id_t>::iterator it = compiled_.find(key);
+    if (it != compiled_.end()) {
+        return it->second;
+    }
+
     id_result_t result;
+    bool cache_hit;
 
     {
         run_task_t run(this, config, compile_task_t(args, source));
         int res = deserialize(&run, &result);
         guarantee(ARCHIVE_SUCCESS == res);
+        res = deserialize(&run, &cache_hit);
+        guarantee(ARCHIVE_SUCCESS == res);
     }
+    num_script_cache_hits_ += cache_hit;
 
     id_visitor_t v(errmsg);
     //TODO: shouldn't we do something if the visitor returns INVALID_ID?
     id_t id = boost::apply_visitor(v, result);
     note_id(id);
+    if (id != INVALID_ID) {
+        compiled_.insert(std::make_pair(key, id));
+    }
     return id;
 }
 
 // ----- call() -----
+static v8::Handle<v8::Value> call_function(v8::Handle<v8::Function> func,
+                                           const boost::optional<boost::shared_ptr<scoped_cJSON_t> > &receiver,
+                                           const std::vector<boost::shared_ptr<scoped_cJSON_t> > &args,
+                                           std::string *errmsg) {
+    v8::TryCatch try_catch;
+    v8::HandleScope scope;
+
+    // Construct receiver object.
+    v8::Handle<v8::Object> obj = receiver ? fromJSON(*receiver.get()->get())->ToObject()
+                                          : v8::Object::New();
+    guarantee(!obj.IsEmpty());
+
+    // Construct arguments.
+    size_t nargs = args.size();
+
+    scoped_array_t<v8::Handle<v8::Value> > handles(nargs);
+    for (size_t i = 0; i < nargs; ++i) {
+        handles[i] = fromJSON(*args[i]->get());
+        guarantee(!handles[i].IsEmpty());
+    }
+
+    // Call function with environment as its receiver.
+    v8::Handle<v8::Value> result = func->Call(obj, nargs, handles.data());
+    if (result.IsEmpty()) {
+        *errmsg = "calling function failed";
+        append_caught_error(errmsg, try_catch);
+    }
+    return scope.Close(result);
+}
+
 struct call_task_t : auto_task_t<call_task_t> {
     call_task_t() {}
     call_task_t(id_t id,
@@ -347,30 +432,7 @@ struct call_task_t : auto_task_t<call_task_t> {
     RDB_MAKE_ME_SERIALIZABLE_3(func_id_, obj_, args_);
 
     v8::Handle<v8::Value> eval(v8::Handle<v8::Function> func, std::string *errmsg) {
-        v8::TryCatch try_catch;
-        v8::HandleScope scope;
-
-        // Construct receiver object.
-        v8::Handle<v8::Object> obj = obj_ ? fromJSON(*obj_.get()->get())->ToObject()
-                                          : v8::Object::New();
-        guarantee(!obj.IsEmpty());
-
-        // Construct arguments.
-        size_t nargs = args_.size();
-
-        scoped_array_t<v8::Handle<v8::Value> > handles(nargs);
-        for (size_t i = 0; i < nargs; ++i) {
-            handles[i] = fromJSON(*args_[i]->get());
-            guarantee(!handles[i].IsEmpty());
-        }
-
-        // Call function with environment as its receiver.
-        v8::Handle<v8::Value> result = func->Call(obj, nargs, handles.data());
-        if (result.IsEmpty()) {
-            *errmsg = "calling function failed";
-            append_caught_error(errmsg, try_catch);
-        }
-        return scope.Close(result);
+        return call_function(func, obj_, args_, errmsg);
     }
 
     void run(env_t *env) {
@@ -418,4 +480,78 @@ boost::shared_ptr<scoped_cJSON_t> runner_t::call(
     return boost::apply_visitor(v, result);
 }
 
+// ----- call_batch() -----
+struct call_batch_task_t : auto_task_t<call_batch_task_t> {
+    call_batch_task_t() {}
+    call_batch_task_t(id_t id, const std::vector<runner_t::call_args_t> &calls)
+        : func_id_(id), objs_(calls.size()), args_(calls.size())
+    {
+        for (size_t i = 0; i < calls.size(); ++i) {
+            if (NULL != calls[i].object.get()) {
+                objs_[i] = calls[i].object;
+                guarantee(calls[i].object->type() == cJSON_Object);
+            }
+            args_[i] = calls[i].args;
+        }
+    }
+
+    id_t func_id_;
+    std::vector<boost::optional<boost::shared_ptr<scoped_cJSON_t> > > objs_;
+    std::vector<std::vector<boost::shared_ptr<scoped_cJSON_t> > > args_;
+    RDB_MAKE_ME_SERIALIZABLE_3(func_id_, objs_, args_);
+
+    void run(env_t *env) {
+        json_vector_result_t result = std::vector<boost::shared_ptr<scoped_cJSON_t> >();
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > *results =
+            boost::get<std::vector<boost::shared_ptr<scoped_cJSON_t> > >(&result);
+
+        v8::HandleScope handle_scope;
+        v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(env->findValue(func_id_));
+        guarantee(!func.IsEmpty());
+
+        std::string errmsg;
+        for (size_t i = 0; i < args_.size(); ++i) {
+            v8::HandleScope call_scope;
+            v8::Handle<v8::Value> value = call_function(func, objs_[i], args_[i], &errmsg);
+            boost::shared_ptr<scoped_cJSON_t> json;
+            if (!value.IsEmpty()) {
+                json = toJSON(value, &errmsg);
+            }
+            if (!json) {
+                result = errmsg;
+                break;
+            }
+            results->push_back(json);
+        }
+
+        write_message_t msg;
+        msg << result;
+        int sendres = send_write_message(env->control(), &msg);
+        guarantee(0 == sendres);
+    }
+};
+
+bool runner_t::call_batch(
+    id_t func_id,
+    const std::vector<call_args_t> &calls,
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out,
+    std::string *errmsg,
+    const req_config_t *config)
+{
+    json_vector_result_t result;
+
+    {
+        run_task_t run(this, config, call_batch_task_t(func_id, calls));
+        int res = deserialize(&run, &result);
+        guarantee(ARCHIVE_SUCCESS == res);
+    }
+
+    json_vector_visitor_t v(results_out, errmsg);
+    if (!boost::apply_visitor(v, result)) {
+        return false;
+    }
+    guarantee(results_out->size() == calls.size());
+    return true;
+}
+
 } // namespace js
@@ -12,6 +12,7 @@
 #include <boost/shared_ptr.hpp>
 
 #include "arch/timing.hpp"      // signal_timer_t
+#include "concurrency/mutex.hpp"
 #include "containers/archive/archive.hpp"
 #include "containers/scoped.hpp"
 #include "extproc/job.hpp"
@@ -72,6 +73,8 @@ class runner_t : private extproc::job_handle_t {
 
     bool connected() { return extproc::job_handle_t::connected(); }
 
+    // Does nothing if we're already connected, so that the coroutines of a
+    // query that get to javascript at the same time can all call it.
     void begin(extproc::pool_t *pool);
     void finish();
     void interrupt();
@@ -105,6 +108,10 @@ class runner_t : private extproc::job_handle_t {
         std::string *errmsg,
         const req_config_t *config = NULL);
 
+    // How many of this runner's compiles found the script already compiled by
+    // the worker, for whichever runner compiled it first.
+    int num_script_cache_hits() const { return num_script_cache_hits_; }
+
     // Calls a previously compiled function.
     boost::shared_ptr<scoped_cJSON_t> call(
         id_t func_id,
@@ -118,6 +125,23 @@ class runner_t : private extproc::job_handle_t {
         std::string *errmsg,
         const req_config_t *config = NULL);
 
+    // The arguments to one call of a function, as for `call`.
+    struct call_args_t {
+        boost::shared_ptr<scoped_cJSON_t> object;
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > args;
+    };
+
+    // Calls a previously compiled function once for each element of `calls`,
+    // all in one round trip. On success, `*results_out` gets one result per
+    // call. On error, returns false and sets `*errmsg`; the calls after the
+    // one that failed aren't made.
+    MUST_USE bool call_batch(
+        id_t func_id,
+        const std::vector<call_args_t> &calls,
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out,
+        std::string *errmsg,
+        const req_config_t *config = NULL);
+
     // TODO (rntz): a way to send streams over to javascript.
     // TODO (rntz): a way to get streams back from javascript.
 
@@ -132,7 +156,8 @@ class runner_t : private extproc::job_handle_t {
 
     class run_task_t : public read_stream_t, public write_stream_t {
       public:
-        // Starts running the given task. We can only run one task at a time.
+        // Starts running the given task. The job can only run one task at a
+        // time, so this waits for any other task to finish first.
         run_task_t(runner_t *runner, const req_config_t *config, const task_t &task);
         // Signals that we are done running this task.
         ~run_task_t();
@@ -142,6 +167,7 @@ class runner_t : private extproc::job_handle_t {
 
       private:
         runner_t *runner_;
+        mutex_t::acq_t task_acq_;
         scoped_ptr_t<signal_timer_t> timer_;
         DISABLE_COPYING(run_task_t);
     };
@@ -157,9 +183,18 @@ class runner_t : private extproc::job_handle_t {
     }
 
   private:
+    // Held by the task that's running; other coroutines wait on it for their
+    // turn.
+    mutex_t task_mutex_;
     // Used only for assertions and guarantees.
     bool running_task_;
     std::set<id_t> used_ids_;
+
+    // The functions we've compiled, by argument names and source, so that
+    // compiling the same function again is free. Across runners, the worker's
+    // script cache saves the compiling but not the round trip.
+    std::map<std::pair<std::vector<std::string>, std::string>, id_t> compiled_;
+    int num_script_cache_hits_;
 };
 
 } // namespace js
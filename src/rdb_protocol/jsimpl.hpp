@@ -6,6 +6,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "errors.hpp"
 #include <boost/variant.hpp>
@@ -93,6 +94,7 @@ struct auto_task_t : extproc::auto_job_t<instance_t, task_t> {};
 // Results we get back from tasks, generally "success or error" variants
 typedef boost::variant<id_t, std::string> id_result_t;
 typedef boost::variant<boost::shared_ptr<scoped_cJSON_t>, std::string> json_result_t;
+typedef boost::variant<std::vector<boost::shared_ptr<scoped_cJSON_t> >, std::string> json_vector_result_t;
 
 // Visitors to extract values from results.
 struct id_visitor_t {
@@ -120,6 +122,22 @@ struct json_visitor_t {
     }
 };
 
+struct json_vector_visitor_t {
+    typedef bool result_type;
+    json_vector_visitor_t(std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out, std::string *errmsg)
+        : results_out_(results_out), errmsg_(errmsg) {}
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out_;
+    std::string *errmsg_;
+    bool operator()(const std::vector<boost::shared_ptr<scoped_cJSON_t> > &r) {
+        *results_out_ = r;
+        return true;
+    }
+    bool operator()(const std::string &msg) {
+        *errmsg_ = msg;
+        return false;
+    }
+};
+
 } // namespace js
 
 #endif // RDB_PROTOCOL_JSIMPL_HPP_
@@ -0,0 +1,445 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/json_value.hpp"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace query_language {
+
+json_arena_t::json_arena_t() : pos(NULL), left(0), bytes(0) { }
+
+json_arena_t::~json_arena_t() {
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        free(chunks[i]);
+    }
+}
+
+void *json_arena_t::allocate(size_t size) {
+    // Everything in a value is at most 8-byte aligned.
+    size = (size + 7) & ~static_cast<size_t>(7);
+    if (size > left) {
+        if (size > chunk_size / 4) {
+            // Big enough that it would waste a lot of a chunk; it gets its own.
+            char *chunk = static_cast<char *>(malloc(size));
+            guarantee(chunk);
+            chunks.push_back(chunk);
+            bytes += size;
+            return chunk;
+        }
+        pos = static_cast<char *>(malloc(chunk_size));
+        guarantee(pos);
+        chunks.push_back(pos);
+        bytes += chunk_size;
+        left = chunk_size;
+    }
+    void *res = pos;
+    pos += size;
+    left -= size;
+    return res;
+}
+
+const char *json_arena_t::copy_string(const char *str, size_t size) {
+    char *res = static_cast<char *>(allocate(size + 1));
+    memcpy(res, str, size);
+    res[size] = '\0';
+    return res;
+}
+
+namespace {
+
+/* `tolower()` in the "C" locale, which is the one we run in, without the
+function call. */
+inline int fold_case(char c) {
+    unsigned char u = c;
+    return u >= 'A' && u <= 'Z' ? u + ('a' - 'A') : u;
+}
+
+/* The same ordering as `cJSON_strcasecmp()`, so the same names match. */
+int compare_names(const char *x, const char *y) {
+    for (; fold_case(*x) == fold_case(*y); ++x, ++y) {
+        if (*x == '\0') {
+            return 0;
+        }
+    }
+    return fold_case(*x) - fold_case(*y);
+}
+
+/* Orders member indexes by name, and members of the same name by position, so
+the first of them comes first. */
+class member_less_t {
+public:
+    explicit member_less_t(const char **_names) : names(_names) { }
+    bool operator()(uint32_t x, uint32_t y) const {
+        int cmp = compare_names(names[x], names[y]);
+        return cmp < 0 || (cmp == 0 && x < y);
+    }
+private:
+    const char **names;
+};
+
+void print_string(const char *str, std::string *out) {
+    out->push_back('"');
+    for (const char *p = str; *p; ++p) {
+        unsigned char c = *p;
+        if (c > 31 && c != '"' && c != '\\') {
+            out->push_back(c);
+            continue;
+        }
+        out->push_back('\\');
+        switch (c) {
+        case '\\': out->push_back('\\'); break;
+        case '"': out->push_back('"'); break;
+        case '\b': out->push_back('b'); break;
+        case '\f': out->push_back('f'); break;
+        case '\n': out->push_back('n'); break;
+        case '\r': out->push_back('r'); break;
+        case '\t': out->push_back('t'); break;
+        default: {
+            char buf[6];
+            snprintf(buf, sizeof(buf), "u%04x", c);
+            out->append(buf);
+        } break;
+        }
+    }
+    out->push_back('"');
+}
+
+}  // anonymous namespace
+
+json_value_t *json_value_t::make(json_arena_t *arena, int type, uint32_t size) {
+    return new (arena->allocate(sizeof(json_value_t))) json_value_t(type, size);
+}
+
+const json_value_t *json_value_t::make_null(json_arena_t *arena) {
+    return make(arena, cJSON_NULL, 0);
+}
+
+const json_value_t *json_value_t::make_bool(json_arena_t *arena, bool b) {
+    return make(arena, b ? cJSON_True : cJSON_False, 0);
+}
+
+const json_value_t *json_value_t::make_number(json_arena_t *arena, double d) {
+    json_value_t *res = make(arena, cJSON_Number, 0);
+    res->number = d;
+    return res;
+}
+
+const json_value_t *json_value_t::make_string(json_arena_t *arena, const char *str, size_t size) {
+    json_value_t *res = make(arena, cJSON_String, size);
+    res->string = arena->copy_string(str, size);
+    return res;
+}
+
+const json_value_t *json_value_t::make_string(json_arena_t *arena, const std::string &str) {
+    return make_string(arena, str.data(), str.size());
+}
+
+const json_value_t *json_value_t::make_array(json_arena_t *arena, const std::vector<const json_value_t *> &items) {
+    json_value_t *res = make(arena, cJSON_Array, items.size());
+    res->items = static_cast<const json_value_t **>(arena->allocate(items.size() * sizeof(json_value_t *)));
+    std::copy(items.begin(), items.end(), res->items);
+    return res;
+}
+
+const json_value_t *json_value_t::make_object(json_arena_t *arena, const std::vector<std::pair<std::string, const json_value_t *> > &members) {
+    json_value_t *res = make(arena, cJSON_Object, members.size());
+    res->items = static_cast<const json_value_t **>(arena->allocate(members.size() * sizeof(json_value_t *)));
+    res->names = static_cast<const char **>(arena->allocate(members.size() * sizeof(char *)));
+    for (size_t i = 0; i < members.size(); ++i) {
+        res->names[i] = arena->copy_string(members[i].first.data(), members[i].first.size());
+        res->items[i] = members[i].second;
+    }
+    res->index_members(arena);
+    return res;
+}
+
+const json_value_t *json_value_t::append(json_arena_t *arena, const json_value_t *array, const json_value_t *item) {
+    guarantee(array->type_ == cJSON_Array);
+    json_value_t *res = make(arena, cJSON_Array, array->size_ + 1);
+    res->items = static_cast<const json_value_t **>(arena->allocate(res->size_ * sizeof(json_value_t *)));
+    std::copy(array->items, array->items + array->size_, res->items);
+    res->items[array->size_] = item;
+    return res;
+}
+
+const json_value_t *json_value_t::set_member(json_arena_t *arena, const json_value_t *object, const char *name, const json_value_t *value) {
+    guarantee(object->type_ == cJSON_Object);
+    const json_value_t *old = object->get(name);
+    uint32_t size = object->size_ + (old ? 0 : 1);
+    json_value_t *res = make(arena, cJSON_Object, size);
+    res->items = static_cast<const json_value_t **>(arena->allocate(size * sizeof(json_value_t *)));
+    res->names = static_cast<const char **>(arena->allocate(size * sizeof(char *)));
+    // The names are shared along with the values.
+    std::copy(object->items, object->items + object->size_, res->items);
+    std::copy(object->names, object->names + object->size_, res->names);
+    if (old) {
+        for (uint32_t i = 0; i < object->size_; ++i) {
+            if (object->items[i] == old && compare_names(object->names[i], name) == 0) {
+                res->items[i] = value;
+                break;
+            }
+        }
+        // Nothing moved, so neither did the index.
+        res->by_name = object->by_name;
+    } else {
+        res->names[object->size_] = arena->copy_string(name, strlen(name));
+        res->items[object->size_] = value;
+        res->index_members(arena);
+    }
+    return res;
+}
+
+const json_value_t *json_value_t::merge(json_arena_t *arena, const json_value_t *lhs, const json_value_t *rhs) {
+    guarantee(lhs->type_ == cJSON_Object);
+    guarantee(rhs->type_ == cJSON_Object);
+    std::vector<bool> removed(lhs->size_ + rhs->size_, false);
+    uint32_t size = lhs->size_ + rhs->size_;
+    for (uint32_t i = 0; i < rhs->size_; ++i) {
+        // The first member of `lhs` with the name that's still there. The
+        // members of the same name are next to each other in the index, in
+        // order.
+        uint32_t lo = 0, hi = lhs->size_;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (compare_names(lhs->names[lhs->by_name[mid]], rhs->names[i]) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        bool found = false;
+        for (; lo < lhs->size_ && compare_names(lhs->names[lhs->by_name[lo]], rhs->names[i]) == 0; ++lo) {
+            if (!removed[lhs->by_name[lo]]) {
+                removed[lhs->by_name[lo]] = true;
+                found = true;
+                break;
+            }
+        }
+        // Otherwise it replaces an earlier member of `rhs` with the same
+        // name, which only happens if `rhs` has duplicates.
+        for (uint32_t j = 0; !found && j < i; ++j) {
+            if (!removed[lhs->size_ + j] && compare_names(rhs->names[j], rhs->names[i]) == 0) {
+                removed[lhs->size_ + j] = true;
+                found = true;
+            }
+        }
+        size -= found;
+    }
+
+    json_value_t *res = make(arena, cJSON_Object, size);
+    res->items = static_cast<const json_value_t **>(arena->allocate(size * sizeof(json_value_t *)));
+    res->names = static_cast<const char **>(arena->allocate(size * sizeof(char *)));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < lhs->size_ + rhs->size_; ++i) {
+        if (removed[i]) {
+            continue;
+        }
+        const json_value_t *from = i < lhs->size_ ? lhs : rhs;
+        uint32_t j = i < lhs->size_ ? i : i - lhs->size_;
+        res->names[n] = from->names[j];
+        res->items[n] = from->items[j];
+        ++n;
+    }
+    guarantee(n == size);
+    res->index_members(arena);
+    return res;
+}
+
+void json_value_t::index_members(json_arena_t *arena) {
+    by_name = static_cast<uint32_t *>(arena->allocate(size_ * sizeof(uint32_t)));
+    for (uint32_t i = 0; i < size_; ++i) {
+        by_name[i] = i;
+    }
+    std::sort(by_name, by_name + size_, member_less_t(names));
+}
+
+const json_value_t *json_value_t::from_cjson(json_arena_t *arena, const cJSON *json) {
+    switch (json->type & 255) {
+    case cJSON_NULL:
+        return make_null(arena);
+    case cJSON_False:
+        return make_bool(arena, false);
+    case cJSON_True:
+        return make_bool(arena, true);
+    case cJSON_Number:
+        return make_number(arena, json->valuedouble);
+    case cJSON_String:
+        return make_string(arena, json->valuestring, strlen(json->valuestring));
+    case cJSON_Array:
+    case cJSON_Object: {
+        int type = json->type & 255;
+        uint32_t size = cJSON_GetArraySize(json);
+        json_value_t *res = make(arena, type, size);
+        res->items = static_cast<const json_value_t **>(arena->allocate(size * sizeof(json_value_t *)));
+        if (type == cJSON_Object) {
+            res->names = static_cast<const char **>(arena->allocate(size * sizeof(char *)));
+        }
+        uint32_t i = 0;
+        for (const cJSON *child = json->child; child; child = child->next, ++i) {
+            res->items[i] = from_cjson(arena, child);
+            if (type == cJSON_Object) {
+                res->names[i] = arena->copy_string(child->string, strlen(child->string));
+            }
+        }
+        if (type == cJSON_Object) {
+            res->index_members(arena);
+        }
+        return res;
+    }
+    default:
+        unreachable();
+    }
+}
+
+cJSON *json_value_t::to_cjson() const {
+    switch (type_) {
+    case cJSON_NULL:
+        return cJSON_CreateNull();
+    case cJSON_False:
+        return cJSON_CreateFalse();
+    case cJSON_True:
+        return cJSON_CreateTrue();
+    case cJSON_Number:
+        return cJSON_CreateNumber(number);
+    case cJSON_String:
+        return cJSON_CreateString(string);
+    case cJSON_Array: {
+        cJSON *res = cJSON_CreateArray();
+        for (uint32_t i = 0; i < size_; ++i) {
+            cJSON_AddItemToArray(res, items[i]->to_cjson());
+        }
+        return res;
+    }
+    case cJSON_Object: {
+        cJSON *res = cJSON_CreateObject();
+        for (uint32_t i = 0; i < size_; ++i) {
+            cJSON_AddItemToObject(res, names[i], items[i]->to_cjson());
+        }
+        return res;
+    }
+    default:
+        unreachable();
+    }
+}
+
+bool json_value_t::as_bool() const {
+    guarantee(type_ == cJSON_True || type_ == cJSON_False);
+    return type_ == cJSON_True;
+}
+
+double json_value_t::as_number() const {
+    guarantee(type_ == cJSON_Number);
+    return number;
+}
+
+const char *json_value_t::as_string() const {
+    guarantee(type_ == cJSON_String);
+    return string;
+}
+
+size_t json_value_t::string_size() const {
+    guarantee(type_ == cJSON_String);
+    return size_;
+}
+
+size_t json_value_t::size() const {
+    guarantee(type_ == cJSON_Array || type_ == cJSON_Object);
+    return size_;
+}
+
+const json_value_t *json_value_t::get(size_t i) const {
+    guarantee(type_ == cJSON_Array || type_ == cJSON_Object);
+    guarantee(i < size_);
+    return items[i];
+}
+
+const char *json_value_t::name(size_t i) const {
+    guarantee(type_ == cJSON_Object);
+    guarantee(i < size_);
+    return names[i];
+}
+
+const json_value_t *json_value_t::get(const char *name) const {
+    guarantee(type_ == cJSON_Object);
+    // The first member whose name isn't less than `name`.
+    uint32_t lo = 0, hi = size_;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compare_names(names[by_name[mid]], name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < size_ && compare_names(names[by_name[lo]], name) == 0) {
+        return items[by_name[lo]];
+    }
+    return NULL;
+}
+
+std::string json_value_t::print_unformatted() const {
+    std::string res;
+    print(&res);
+    return res;
+}
+
+void json_value_t::print(std::string *out) const {
+    switch (type_) {
+    case cJSON_NULL:
+        out->append("null");
+        break;
+    case cJSON_False:
+        out->append("false");
+        break;
+    case cJSON_True:
+        out->append("true");
+        break;
+    case cJSON_Number: {
+        guarantee(isfinite(number));
+        char buf[64];
+        // Like cJSON, integers that fit in an `int` print as integers.
+        if (number <= INT_MAX && number >= INT_MIN
+            && fabs(static_cast<double>(static_cast<int>(number)) - number) <= DBL_EPSILON) {
+            snprintf(buf, sizeof(buf), "%d", static_cast<int>(number));
+        } else {
+            snprintf(buf, sizeof(buf), "%.32g", number);
+        }
+        out->append(buf);
+    } break;
+    case cJSON_String:
+        print_string(string, out);
+        break;
+    case cJSON_Array:
+        out->push_back('[');
+        for (uint32_t i = 0; i < size_; ++i) {
+            if (i != 0) {
+                out->push_back(',');
+            }
+            items[i]->print(out);
+        }
+        out->push_back(']');
+        break;
+    case cJSON_Object:
+        out->push_back('{');
+        for (uint32_t i = 0; i < size_; ++i) {
+            if (i != 0) {
+                out->push_back(',');
+            }
+            print_string(names[i], out);
+            out->push_back(':');
+            items[i]->print(out);
+        }
+        out->push_back('}');
+        break;
+    default:
+        unreachable();
+    }
+}
+
+}  // namespace query_language
@@ -0,0 +1,118 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_JSON_VALUE_HPP_
+#define RDB_PROTOCOL_JSON_VALUE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include "config/args.hpp"
+#include "http/json.hpp"
+
+namespace query_language {
+
+/* Hands out memory for JSON values from big chunks, and frees it all at once
+when it's destroyed, instead of a `malloc()` and a `free()` for every node and
+string the way cJSON does it. One of these lives as long as the batch of rows
+or the query whose values it holds. */
+class json_arena_t {
+public:
+    static const size_t chunk_size = 64 * KILOBYTE;
+
+    json_arena_t();
+    ~json_arena_t();
+
+    /* The memory is aligned for any of the types a JSON value is made of. */
+    void *allocate(size_t size);
+    const char *copy_string(const char *str, size_t size);
+
+    // How many times the arena has called `malloc()`, and for how many bytes.
+    size_t num_chunks() const { return chunks.size(); }
+    size_t bytes_allocated() const { return bytes; }
+
+private:
+    std::vector<char *> chunks;
+    char *pos;
+    size_t left;
+    size_t bytes;
+
+    DISABLE_COPYING(json_arena_t);
+};
+
+/* A JSON value that lives in an arena and never changes once it's made. A
+"changed" copy of an array or object shares everything that didn't change with
+the original, so nothing is ever deep copied. The members of an object stay in
+the order they were added (they print in that order, as in cJSON), and also
+have an index sorted by name, so looking one up takes O(log n) instead of
+cJSON's O(n).
+
+`type()` gives the same codes as cJSON, and names are looked up without regard
+to case like `cJSON_GetObjectItem()` does, so code that uses cJSON can move to
+these a piece at a time, converting at the edges with `from_cjson()` and
+`to_cjson()`. */
+class json_value_t {
+public:
+    static const json_value_t *make_null(json_arena_t *arena);
+    static const json_value_t *make_bool(json_arena_t *arena, bool b);
+    static const json_value_t *make_number(json_arena_t *arena, double d);
+    static const json_value_t *make_string(json_arena_t *arena, const char *str, size_t size);
+    static const json_value_t *make_string(json_arena_t *arena, const std::string &str);
+    static const json_value_t *make_array(json_arena_t *arena, const std::vector<const json_value_t *> &items);
+    static const json_value_t *make_object(json_arena_t *arena, const std::vector<std::pair<std::string, const json_value_t *> > &members);
+
+    /* Copies of `array` with `item` on the end, and of `object` with `value`
+    under `name`, replacing the first member of that name if there is one. */
+    static const json_value_t *append(json_arena_t *arena, const json_value_t *array, const json_value_t *item);
+    static const json_value_t *set_member(json_arena_t *arena, const json_value_t *object, const char *name, const json_value_t *value);
+
+    /* The same object as `cJSON_merge(lhs, rhs)`: each member of `rhs` replaces
+    the first member of `lhs` with that name, if there is one, and goes on the
+    end. Only the tables of the new object are allocated; the names and values
+    are shared with `lhs` and `rhs`. */
+    static const json_value_t *merge(json_arena_t *arena, const json_value_t *lhs, const json_value_t *rhs);
+
+    static const json_value_t *from_cjson(json_arena_t *arena, const cJSON *json);
+    cJSON *to_cjson() const;
+
+    int type() const { return type_; }
+
+    bool as_bool() const;
+    double as_number() const;
+    const char *as_string() const;
+    size_t string_size() const;
+
+    // The number of items of an array or members of an object.
+    size_t size() const;
+    // The `i`th item of an array, or the value of the `i`th member of an object.
+    const json_value_t *get(size_t i) const;
+    // The name of the `i`th member of an object.
+    const char *name(size_t i) const;
+    // The value of the first member named `name`, or NULL.
+    const json_value_t *get(const char *name) const;
+
+    /* The same text as `cJSON_PrintUnformatted()`. */
+    std::string print_unformatted() const;
+
+private:
+    json_value_t(int _type, uint32_t _size)
+        : type_(_type), size_(_size), number(0), string(NULL), items(NULL), names(NULL), by_name(NULL) { }
+
+    static json_value_t *make(json_arena_t *arena, int type, uint32_t size);
+    // Sorts the members of an object by name into `by_name`.
+    void index_members(json_arena_t *arena);
+    void print(std::string *out) const;
+
+    int type_;
+    uint32_t size_;
+    double number;
+    const char *string;
+    const json_value_t **items;
+    const char **names;
+    uint32_t *by_name;
+};
+
+}  // namespace query_language
+
+#endif  // RDB_PROTOCOL_JSON_VALUE_HPP_
@@ -10,10 +10,17 @@
 #include "rpc/semilattice/view/field.hpp"
 #include "query_measure.hpp"
 
+/* Reads run concurrently with each other; anything that changes data or the
+state of a stream has to wait for everything before it on the connection. */
+static bool is_barrier_query(const Query &q) {
+    return q.type() != Query::READ;
+}
+
 query_server_t::query_server_t(int port, rdb_protocol_t::context_t *_ctx) :
     server(port, boost::bind(&query_server_t::handle, this, _1, _2),
-           &on_unparsable_query, INLINE),
-    ctx(_ctx), parser_id(generate_uuid()), thread_counters(0)
+           &on_unparsable_query, CORO_ORDERED, &is_barrier_query),
+    ctx(_ctx), parser_id(generate_uuid()), thread_counters(0),
+    query_cache(RDB_QUERY_CACHE_MEMORY_BUDGET), point_get_cache(_ctx), sindex_cache(_ctx)
 { }
 
 http_app_t *query_server_t::get_http_app() {
@@ -62,30 +69,64 @@ Response query_server_t::handle(Query *q, context_t *query_context) {
     try {
         TICKVAR(qt_E);
 
-        query_language::check_query_type(
-            q, &type_environment, &is_deterministic, root_backtrace);
-
-        TICKVAR(qt_F);
-
         boost::shared_ptr<js::runner_t> js_runner = boost::make_shared<js::runner_t>();
         int thread = get_thread_id();
 
-        TICKVAR(qt_G);
-
         query_language::runtime_environment_t runtime_environment(
             ctx->pool_group, ctx->ns_repo,
             ctx->cross_thread_namespace_watchables[thread]->get_watchable(),
             ctx->cross_thread_database_watchables[thread]->get_watchable(),
             ctx->semilattice_metadata,
             ctx->directory_read_manager,
-            js_runner, interruptor, ctx->machine_id);
+            js_runner, interruptor, ctx->machine_id,
+            ctx->io_backender, ctx->temp_directory);
+        runtime_environment.sindex_cache = &sindex_cache;
+
+        TICKVAR(qt_F);
+
+        // Point gets are most of what key-value style clients send, so they
+        // skip type checking and evaluation once we know their table.
+        if (query_language::execute_point_get(q, &runtime_environment, &point_get_cache, root_backtrace, &res)) {
+            return res;
+        }
+
+        TICKVAR(qt_G);
+
+        query_language::check_query_type(
+            q, &type_environment, &is_deterministic, root_backtrace);
 
         TICKVAR(qt_H);
 
+        // A cached response is good for as long as the tables the query
+        // reads are at the versions they were at when it was computed.
+        std::vector<TableRef> tables;
+        query_cache_t::versions_t table_versions;
+        bool use_cache = query_cache_t::is_cacheable(*q, &tables);
+        if (use_cache) {
+            try {
+                for (size_t i = 0; i < tables.size(); ++i) {
+                    table_versions.push_back(query_language::read_table_version(
+                        query_language::eval_table_ref(&tables[i], &runtime_environment, root_backtrace),
+                        &runtime_environment, tables[i].use_outdated(), root_backtrace));
+                }
+            } catch (const query_language::runtime_exc_t &) {
+                // Running the query reports the problem, with a better
+                // backtrace.
+                use_cache = false;
+            }
+        }
+        if (use_cache && query_cache.get(*q, table_versions, &res)) {
+            return res;
+        }
+
         //[execute_query] will set the status code unless it throws
         execute_query(q, &runtime_environment, &res, scopes_t(),
                       root_backtrace, stream_cache);
 
+        if (use_cache) {
+            query_cache.put(*q, table_versions, res);
+        }
+
         TICKVAR(qt_I);
 
         // logRQM("QUERY_MEASURE: A %ld B %ld C %ld D %ld E %ld F %ld G %ld H %ld I",
@@ -14,8 +14,11 @@
 #include "extproc/pool.hpp"
 #include "protob/protob.hpp"
 #include "protocol_api.hpp"
+#include "rdb_protocol/point_get_cache.hpp"
 #include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/query_cache.hpp"
 #include "rdb_protocol/query_language.hpp"
+#include "rdb_protocol/sindex_cache.hpp"
 
 class query_server_t {
 public:
@@ -36,6 +39,9 @@ private:
     rdb_protocol_t::context_t *ctx;
     uuid_t parser_id;
     one_per_thread_t<int> thread_counters;
+    query_cache_t query_cache;
+    point_get_cache_t point_get_cache;
+    sindex_cache_t sindex_cache;
 };
 
 Response on_unparsable_query(Query *q, std::string msg);
@@ -0,0 +1,70 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/point_get_cache.hpp"
+
+#include "errors.hpp"
+#include <boost/bind.hpp>
+
+#include "arch/runtime/runtime.hpp"
+#include "concurrency/cross_thread_watchable.hpp"
+
+namespace {
+
+std::pair<std::string, std::string> table_name(const TableRef &table_ref) {
+    return std::make_pair(table_ref.db_name(), table_ref.table_name());
+}
+
+}  // anonymous namespace
+
+point_get_cache_t::point_get_cache_t(rdb_protocol_t::context_t *ctx)
+    : caches(ctx) { }
+
+bool point_get_cache_t::find(const TableRef &table_ref, table_t *table_out) {
+    return caches.get()->find(table_name(table_ref), table_out);
+}
+
+int64_t point_get_cache_t::generation() {
+    return caches.get()->generation();
+}
+
+void point_get_cache_t::insert(const TableRef &table_ref, const table_t &table, int64_t generation) {
+    caches.get()->insert(table_name(table_ref), table, generation);
+}
+
+point_get_cache_t::thread_cache_t::thread_cache_t(rdb_protocol_t::context_t *ctx)
+    : generation_(0),
+      namespaces_subscription(boost::bind(&point_get_cache_t::thread_cache_t::clear, this)),
+      databases_subscription(boost::bind(&point_get_cache_t::thread_cache_t::clear, this)) {
+    int thread = get_thread_id();
+    clone_ptr_t<watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > > > namespaces =
+        ctx->cross_thread_namespace_watchables[thread]->get_watchable();
+    clone_ptr_t<watchable_t<databases_semilattice_metadata_t> > databases =
+        ctx->cross_thread_database_watchables[thread]->get_watchable();
+    {
+        watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > >::freeze_t freeze(namespaces);
+        namespaces_subscription.reset(namespaces, &freeze);
+    }
+    {
+        watchable_t<databases_semilattice_metadata_t>::freeze_t freeze(databases);
+        databases_subscription.reset(databases, &freeze);
+    }
+}
+
+bool point_get_cache_t::thread_cache_t::find(const std::pair<std::string, std::string> &name, table_t *table_out) {
+    std::map<std::pair<std::string, std::string>, table_t>::iterator it = tables.find(name);
+    if (it == tables.end()) {
+        return false;
+    }
+    *table_out = it->second;
+    return true;
+}
+
+void point_get_cache_t::thread_cache_t::insert(const std::pair<std::string, std::string> &name, const table_t &table, int64_t generation) {
+    if (generation == generation_) {
+        tables[name] = table;
+    }
+}
+
+void point_get_cache_t::thread_cache_t::clear() {
+    tables.clear();
+    ++generation_;
+}
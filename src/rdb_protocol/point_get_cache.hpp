@@ -0,0 +1,65 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_POINT_GET_CACHE_HPP_
+#define RDB_PROTOCOL_POINT_GET_CACHE_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "errors.hpp"
+
+#include "clustering/administration/namespace_interface_repository.hpp"
+#include "concurrency/one_per_thread.hpp"
+#include "concurrency/watchable.hpp"
+#include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/query_language.pb.h"
+
+/* Remembers the namespace access and the primary key of the tables that point
+gets have looked in, so a query that's nothing but point gets doesn't have to
+look its table up in the cluster metadata every time. Each thread has entries
+of its own, which it forgets whenever its copy of the namespace or database
+metadata changes. */
+class point_get_cache_t {
+public:
+    struct table_t {
+        namespace_repo_t<rdb_protocol_t>::access_t ns_access;
+        std::string primary_key;
+    };
+
+    explicit point_get_cache_t(rdb_protocol_t::context_t *ctx);
+
+    /* Copies out the entry for the table `table_ref` names, if there is one.
+    (The entry itself may go away while the point get is waiting on it.) */
+    bool find(const TableRef &table_ref, table_t *table_out);
+
+    /* Goes up every time the entries are forgotten. A table looked up while
+    it was `generation` can be remembered with `insert()`, which ignores it if
+    the metadata has changed since. */
+    int64_t generation();
+    void insert(const TableRef &table_ref, const table_t &table, int64_t generation);
+
+private:
+    class thread_cache_t {
+    public:
+        explicit thread_cache_t(rdb_protocol_t::context_t *ctx);
+
+        bool find(const std::pair<std::string, std::string> &name, table_t *table_out);
+        int64_t generation() const { return generation_; }
+        void insert(const std::pair<std::string, std::string> &name, const table_t &table, int64_t generation);
+
+    private:
+        void clear();
+
+        std::map<std::pair<std::string, std::string>, table_t> tables;
+        int64_t generation_;
+
+        watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > >::subscription_t namespaces_subscription;
+        watchable_t<databases_semilattice_metadata_t>::subscription_t databases_subscription;
+
+        DISABLE_COPYING(thread_cache_t);
+    };
+
+    one_per_thread_t<thread_cache_t> caches;
+};
+
+#endif  // RDB_PROTOCOL_POINT_GET_CACHE_HPP_
@@ -1,4 +1,8 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <deque>
+#include <iterator>
+#include <set>
+
 #include "errors.hpp"
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
@@ -18,6 +22,7 @@
 #include "rdb_protocol/btree.hpp"
 #include "rdb_protocol/protocol.hpp"
 #include "rdb_protocol/query_language.hpp"
+#include "rdb_protocol/transform_visitors.hpp"
 #include "rpc/semilattice/view/field.hpp"
 #include "rpc/semilattice/watchable.hpp"
 #include "serializer/config.hpp"
@@ -35,24 +40,45 @@ typedef rdb_protocol_t::read_response_t read_response_t;
 typedef rdb_protocol_t::point_read_t point_read_t;
 typedef rdb_protocol_t::point_read_response_t point_read_response_t;
 
+typedef rdb_protocol_t::multi_point_read_t multi_point_read_t;
+typedef rdb_protocol_t::multi_point_read_response_t multi_point_read_response_t;
+
 typedef rdb_protocol_t::rget_read_t rget_read_t;
 typedef rdb_protocol_t::rget_read_response_t rget_read_response_t;
 
 typedef rdb_protocol_t::distribution_read_t distribution_read_t;
 typedef rdb_protocol_t::distribution_read_response_t distribution_read_response_t;
 
+typedef rdb_protocol_t::sindex_list_t sindex_list_t;
+typedef rdb_protocol_t::sindex_list_response_t sindex_list_response_t;
+
+typedef rdb_protocol_t::version_read_t version_read_t;
+typedef rdb_protocol_t::version_read_response_t version_read_response_t;
+
 typedef rdb_protocol_t::write_t write_t;
 typedef rdb_protocol_t::write_response_t write_response_t;
 
 typedef rdb_protocol_t::point_write_t point_write_t;
 typedef rdb_protocol_t::point_write_response_t point_write_response_t;
 
+typedef rdb_protocol_t::batched_insert_t batched_insert_t;
+typedef rdb_protocol_t::batched_insert_response_t batched_insert_response_t;
+
 typedef rdb_protocol_t::point_modify_t point_modify_t;
 typedef rdb_protocol_t::point_modify_response_t point_modify_response_t;
 
+typedef rdb_protocol_t::range_modify_t range_modify_t;
+typedef rdb_protocol_t::range_modify_response_t range_modify_response_t;
+
 typedef rdb_protocol_t::point_delete_t point_delete_t;
 typedef rdb_protocol_t::point_delete_response_t point_delete_response_t;
 
+typedef rdb_protocol_t::sindex_create_t sindex_create_t;
+typedef rdb_protocol_t::sindex_create_response_t sindex_create_response_t;
+
+typedef rdb_protocol_t::sindex_drop_t sindex_drop_t;
+typedef rdb_protocol_t::sindex_drop_response_t sindex_drop_response_t;
+
 typedef rdb_protocol_t::backfill_chunk_t backfill_chunk_t;
 
 typedef rdb_protocol_t::backfill_progress_t backfill_progress_t;
@@ -70,30 +96,73 @@ RDB_IMPL_PROTOB_SERIALIZABLE(Builtin_Filter);
 RDB_IMPL_PROTOB_SERIALIZABLE(Builtin_Map);
 RDB_IMPL_PROTOB_SERIALIZABLE(Builtin_ConcatMap);
 RDB_IMPL_PROTOB_SERIALIZABLE(Builtin_GroupedMapReduce);
+RDB_IMPL_PROTOB_SERIALIZABLE(Builtin_OrderBy);
 RDB_IMPL_PROTOB_SERIALIZABLE(Mapping);
 RDB_IMPL_PROTOB_SERIALIZABLE(Reduction);
 RDB_IMPL_PROTOB_SERIALIZABLE(WriteQuery_ForEach);
 
+namespace rdb_protocol_details {
+
+sindex_range_t::sindex_range_t(const std::string &_attrname,
+                               const boost::optional<std::string> &_lower,
+                               const boost::optional<std::string> &_upper)
+    : attrname(_attrname), lower(_lower), upper(_upper)
+{
+    /* Index keys are the encoded attribute followed by a NUL and the primary
+    key, so every key for an attribute equal to `*upper` sorts below
+    `*upper + '\x01'`. If that doesn't fit in a key, the bound is a little
+    loose and `contains()` takes care of the difference. */
+    store_key_t left, right;
+    key_range_t::bound_t left_bound = key_range_t::none, right_bound = key_range_t::none;
+    if (lower) {
+        guarantee(lower->size() <= MAX_KEY_SIZE);
+        left = store_key_t(*lower);
+        left_bound = key_range_t::closed;
+    }
+    if (upper) {
+        guarantee(upper->size() <= MAX_KEY_SIZE);
+        if (upper->size() < MAX_KEY_SIZE) {
+            right = store_key_t(*upper + '\x01');
+            right_bound = key_range_t::open;
+        } else {
+            right = store_key_t(*upper);
+            right_bound = key_range_t::closed;
+        }
+    }
+    index_range = key_range_t(left_bound, left, right_bound, right);
+}
+
+bool sindex_range_t::contains(const std::string &encoded_attr) const {
+    return (!lower || *lower <= encoded_attr) && (!upper || encoded_attr <= *upper);
+}
+
+}  // namespace rdb_protocol_details
+
 rdb_protocol_t::context_t::context_t()
     : pool_group(NULL), ns_repo(NULL),
     cross_thread_namespace_watchables(get_num_threads()),
     cross_thread_database_watchables(get_num_threads()),
     directory_read_manager(NULL),
-    signals(get_num_threads())
+    signals(get_num_threads()),
+    io_backender(NULL)
 { }
 
 rdb_protocol_t::context_t::context_t(extproc::pool_group_t *_pool_group,
           namespace_repo_t<rdb_protocol_t> *_ns_repo,
           boost::shared_ptr<semilattice_readwrite_view_t<cluster_semilattice_metadata_t> > _semilattice_metadata,
           directory_read_manager_t<cluster_directory_metadata_t> *_directory_read_manager,
-          machine_id_t _machine_id)
+          machine_id_t _machine_id,
+          io_backender_t *_io_backender,
+          const std::string &_temp_directory)
     : pool_group(_pool_group), ns_repo(_ns_repo),
       cross_thread_namespace_watchables(get_num_threads()),
       cross_thread_database_watchables(get_num_threads()),
       semilattice_metadata(_semilattice_metadata),
       directory_read_manager(_directory_read_manager),
       signals(get_num_threads()),
-      machine_id(_machine_id)
+      machine_id(_machine_id),
+      io_backender(_io_backender),
+      temp_directory(_temp_directory)
 {
     for (int thread = 0; thread < get_num_threads(); ++thread) {
         cross_thread_namespace_watchables[thread].init(new cross_thread_watchable_variable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > >(
@@ -120,12 +189,27 @@ region_t rdb_protocol_t::monokey_region(const store_key_t &k) {
 
 namespace {
 
+/* The smallest key range with all of `keys` in it, in every hash shard. */
+region_t keys_region(const std::vector<store_key_t> &keys) {
+    guarantee(!keys.empty());
+    store_key_t left = keys[0], right = keys[0];
+    for (size_t i = 1; i < keys.size(); ++i) {
+        left = std::min(left, keys[i]);
+        right = std::max(right, keys[i]);
+    }
+    return region_t(key_range_t(key_range_t::closed, left, key_range_t::closed, right));
+}
+
 /* read_t::get_region implementation */
 struct r_get_region_visitor : public boost::static_visitor<region_t> {
     region_t operator()(const point_read_t &pr) const {
         return rdb_protocol_t::monokey_region(pr.key);
     }
 
+    region_t operator()(const multi_point_read_t &mpr) const {
+        return keys_region(mpr.keys);
+    }
+
     region_t operator()(const rget_read_t &rg) const {
         return rg.region;
     }
@@ -133,6 +217,14 @@ struct r_get_region_visitor : public boost::static_visitor<region_t> {
     region_t operator()(const distribution_read_t &dg) const {
         return dg.region;
     }
+
+    region_t operator()(const sindex_list_t &sl) const {
+        return sl.region;
+    }
+
+    region_t operator()(const version_read_t &vr) const {
+        return vr.region;
+    }
 };
 
 }   /* anonymous namespace */
@@ -155,6 +247,17 @@ struct r_shard_visitor : public boost::static_visitor<read_t> {
         return read_t(pr);
     }
 
+    read_t operator()(const multi_point_read_t &mpr) const {
+        multi_point_read_t _mpr;
+        _mpr.transform = mpr.transform;
+        for (size_t i = 0; i < mpr.keys.size(); ++i) {
+            if (region_is_superset(region, rdb_protocol_t::monokey_region(mpr.keys[i]))) {
+                _mpr.keys.push_back(mpr.keys[i]);
+            }
+        }
+        return read_t(_mpr);
+    }
+
     read_t operator()(const rget_read_t &rg) const {
         rassert(region_is_superset(rg.region, region));
         rget_read_t _rg(rg);
@@ -169,6 +272,20 @@ struct r_shard_visitor : public boost::static_visitor<read_t> {
         return read_t(_dg);
     }
 
+    read_t operator()(const sindex_list_t &sl) const {
+        rassert(region_is_superset(sl.region, region));
+        sindex_list_t _sl(sl);
+        _sl.region = region;
+        return read_t(_sl);
+    }
+
+    read_t operator()(const version_read_t &vr) const {
+        rassert(region_is_superset(vr.region, region));
+        version_read_t _vr(vr);
+        _vr.region = region;
+        return read_t(_vr);
+    }
+
     const region_t &region;
 };
 
@@ -187,6 +304,11 @@ bool read_response_cmp(const read_response_t &l, const read_response_t &r) {
     return lr->key_range < rr->key_range;
 }
 
+bool rget_data_cmp(const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> >& a,
+                   const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> >& b) {
+    return a.first < b.first;
+}
+
 /* A visitor to handle this unsharding process for us. */
 
 class distribution_read_response_less_t {
@@ -230,7 +352,9 @@ public:
               ctx->semilattice_metadata,
               boost::make_shared<js::runner_t>(),
               ctx->signals[get_thread_id()].get(),
-              ctx->machine_id)
+              ctx->machine_id,
+              ctx->io_backender,
+              ctx->temp_directory)
     { }
 
     void operator()(const point_read_t &) {
@@ -239,6 +363,25 @@ public:
         *response_out = responses[0];
     }
 
+    void operator()(const multi_point_read_t &mpr) {
+        std::map<store_key_t, const point_read_response_t *> rows;
+        for (size_t i = 0; i < count; ++i) {
+            const multi_point_read_response_t *_mr = boost::get<multi_point_read_response_t>(&responses[i].response);
+            guarantee(_mr);
+            for (size_t j = 0; j < _mr->rows.size(); ++j) {
+                rows[_mr->rows[j].first] = &_mr->rows[j].second;
+            }
+        }
+
+        multi_point_read_response_t res;
+        for (size_t i = 0; i < mpr.keys.size(); ++i) {
+            std::map<store_key_t, const point_read_response_t *>::iterator it = rows.find(mpr.keys[i]);
+            guarantee(it != rows.end());
+            res.rows.push_back(std::make_pair(mpr.keys[i], *it->second));
+        }
+        response_out->response = res;
+    }
+
     void operator()(const rget_read_t &rg) {
         response_out->response = rget_read_response_t();
         rget_read_response_t &rg_response = boost::get<rget_read_response_t>(response_out->response);
@@ -258,7 +401,10 @@ public:
                 }
             }
 
-            if (!rg.terminal) {
+            if (!rg.terminal && rg.sorting) {
+                rg_response.result = stream_t();
+                merge_sorted_streams(*rg.sorting, boost::get<stream_t>(&rg_response.result));
+            } else if (!rg.terminal) {
                 //A vanilla range get
                 rg_response.result = stream_t();
                 stream_t *res_stream = boost::get<stream_t>(&rg_response.result);
@@ -275,81 +421,58 @@ public:
                         rg_response.last_considered_key = _rr->last_considered_key;
                     }
                 }
-            } else if (const Builtin_GroupedMapReduce *gmr = boost::get<Builtin_GroupedMapReduce>(&rg.terminal->variant)) {
-                //GroupedMapreduce
-                rg_response.result = groups_t();
-                groups_t *res_groups = boost::get<groups_t>(&rg_response.result);
-                for(size_t i = 0; i < count; ++i) {
-                    const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
-                    guarantee(_rr);
-
-                    const groups_t *groups = boost::get<groups_t>(&(_rr->result));
-
-                    for (groups_t::const_iterator j = groups->begin(); j != groups->end(); ++j) {
-                        Term base = gmr->reduction().base(),
-                             body = gmr->reduction().body();
 
-                        scopes_t scopes_copy = rg.terminal->scopes;
-                        query_language::new_val_scope_t inner_scope(&scopes_copy.scope);
-                        scopes_copy.scope.put_in_scope(gmr->reduction().var1(),
-                            res_groups->insert(std::make_pair(j->first, eval_term_as_json(&base, &env, rg.terminal->scopes, rg.terminal->backtrace.with("reduction").with("base")))).first->second);
-                        scopes_copy.scope.put_in_scope(gmr->reduction().var2(), j->second);
-                        (*res_groups)[j->first] = eval_term_as_json(&body, &env, scopes_copy, rg.terminal->backtrace.with("reduction").with("body"));
-                    }
+                if (rg.sindex) {
+                    unshard_sindex_stream(rg, res_stream, &rg_response);
                 }
-            } else if (const Reduction *r = boost::get<Reduction>(&rg.terminal->variant)) {
-                //Normal Mapreduce
-                rg_response.result = atom_t();
-                atom_t *res_atom = boost::get<atom_t>(&rg_response.result);
-
-                Term base = r->base();
-                *res_atom = eval_term_as_json(&base, &env, rg.terminal->scopes, rg.terminal->backtrace.with("base"));
-
-                for(size_t i = 0; i < count; ++i) {
-                    const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
-                    guarantee(_rr);
-
-                    const atom_t *atom = boost::get<atom_t>(&(_rr->result));
-
-                    scopes_t scopes_copy = rg.terminal->scopes;
-                    query_language::new_val_scope_t inner_scope(&scopes_copy.scope);
-                    scopes_copy.scope.put_in_scope(r->var1(), *res_atom);
-                    scopes_copy.scope.put_in_scope(r->var2(), *atom);
-                    Term body = r->body();
-                    *res_atom = eval_term_as_json(&body, &env, scopes_copy, rg.terminal->backtrace.with("body"));
-                }
-            } else if (boost::get<rdb_protocol_details::Length>(&rg.terminal->variant)) {
-                rg_response.result = atom_t();
-                length_t *res_length = boost::get<length_t>(&rg_response.result);
-                res_length->length = 0;
-
-                for(size_t i = 0; i < count; ++i) {
-                    const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
-                    guarantee(_rr);
-
-                    const length_t *length = boost::get<length_t>(&(_rr->result));
-                    res_length->length += length->length;
-                }
-            } else if (boost::get<WriteQuery_ForEach>(&rg.terminal->variant)) {
-                rg_response.result = atom_t();
-                inserted_t *res_inserted = boost::get<inserted_t>(&rg_response.result);
-                res_inserted->inserted = 0;
-
-                for(size_t i = 0; i < count; ++i) {
+            } else {
+                // GROUPEDMAPREDUCE, REDUCE, LENGTH or FOREACH.
+                boost::apply_visitor(query_language::terminal_initializer_visitor_t(&rg_response.result, &env, rg.terminal->scopes, rg.terminal->backtrace),
+                                     rg.terminal->variant);
+                for (size_t i = 0; i < count; ++i) {
                     const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
                     guarantee(_rr);
-
-                    const inserted_t *inserted = boost::get<inserted_t>(&(_rr->result));
-                    res_inserted->inserted += inserted->inserted;
+                    boost::apply_visitor(query_language::terminal_merge_visitor_t(_rr->result, &env, rg.terminal->scopes, rg.terminal->backtrace, &rg_response.result),
+                                         rg.terminal->variant);
                 }
-            } else {
-                unreachable();
             }
         } catch (const runtime_exc_t &e) {
             rg_response.result = e;
         }
     }
 
+    void operator()(const sindex_list_t &) {
+        guarantee(count > 0);
+        const sindex_list_response_t *first = boost::get<sindex_list_response_t>(&responses[0].response);
+        guarantee(first);
+        std::set<std::string> attrnames(first->attrnames.begin(), first->attrnames.end());
+
+        for (size_t i = 1; i < count; ++i) {
+            const sindex_list_response_t *result = boost::get<sindex_list_response_t>(&responses[i].response);
+            guarantee(result);
+            std::set<std::string> shard_attrnames(result->attrnames.begin(), result->attrnames.end());
+            std::set<std::string> both;
+            std::set_intersection(attrnames.begin(), attrnames.end(),
+                                  shard_attrnames.begin(), shard_attrnames.end(),
+                                  std::inserter(both, both.end()));
+            attrnames.swap(both);
+        }
+
+        sindex_list_response_t res;
+        res.attrnames.assign(attrnames.begin(), attrnames.end());
+        response_out->response = res;
+    }
+
+    void operator()(const version_read_t &) {
+        version_read_response_t res;
+        for (size_t i = 0; i < count; ++i) {
+            const version_read_response_t *result = boost::get<version_read_response_t>(&responses[i].response);
+            guarantee(result);
+            res.metainfo.insert(result->metainfo.begin(), result->metainfo.end());
+        }
+        response_out->response = res;
+    }
+
     void operator()(const distribution_read_t &dg) {
         // TODO: do this without copying so much and/or without dynamic memory
         // Sort results by region
@@ -413,6 +536,70 @@ public:
     }
 
 private:
+    /* Each shard sent back the first `sorting.limit` of its rows in order, so
+    the first `sorting.limit` rows of all of them are among those. */
+    void merge_sorted_streams(const rdb_protocol_details::sorting_t &sorting, stream_t *res_stream) {
+        query_language::ordering_t ordering(sorting.order, sorting.backtrace);
+
+        std::vector<const stream_t *> streams;
+        for (size_t i = 0; i < count; ++i) {
+            const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
+            guarantee(_rr);
+            const stream_t *stream = boost::get<stream_t>(&(_rr->result));
+            guarantee(stream);
+            streams.push_back(stream);
+        }
+
+        std::vector<size_t> positions(streams.size(), 0);
+        while (res_stream->size() < sorting.limit) {
+            // Ties go to the earliest shard, which keeps the result the same
+            // from one run to the next.
+            size_t best = streams.size();
+            for (size_t i = 0; i < streams.size(); ++i) {
+                if (positions[i] < streams[i]->size() &&
+                    (best == streams.size() || ordering((*streams[i])[positions[i]].second, (*streams[best])[positions[best]].second))) {
+                    best = i;
+                }
+            }
+            if (best == streams.size()) {
+                break;
+            }
+            res_stream->push_back((*streams[best])[positions[best]]);
+            ++positions[best];
+        }
+    }
+
+    /* Each shard returns its part of the index in index order, and stops
+    wherever it ran out of room. We can only vouch for the index keys that
+    every shard got through, so anything past the first place a shard stopped
+    is dropped; the next batch starts over from there. */
+    void unshard_sindex_stream(const rget_read_t &rg, stream_t *res_stream, rget_read_response_t *rg_response) {
+        std::stable_sort(res_stream->begin(), res_stream->end(), rget_data_cmp);
+
+        rg_response->key_range = rg.sindex->index_range;
+        rg_response->last_considered_key = rg.sindex->index_range.left;
+        rg_response->truncated = false;
+        for (size_t i = 0; i < count; ++i) {
+            const rget_read_response_t *_rr = boost::get<rget_read_response_t>(&responses[i].response);
+            guarantee(_rr);
+            if (_rr->truncated) {
+                if (!rg_response->truncated || _rr->last_considered_key < rg_response->last_considered_key) {
+                    rg_response->last_considered_key = _rr->last_considered_key;
+                }
+                rg_response->truncated = true;
+            } else if (!rg_response->truncated && rg_response->last_considered_key < _rr->last_considered_key) {
+                rg_response->last_considered_key = _rr->last_considered_key;
+            }
+        }
+
+        if (rg_response->truncated) {
+            stream_t::iterator cut = std::upper_bound(res_stream->begin(), res_stream->end(),
+                                                      std::make_pair(rg_response->last_considered_key, boost::shared_ptr<scoped_cJSON_t>()),
+                                                      rget_data_cmp);
+            res_stream->erase(cut, res_stream->end());
+        }
+    }
+
     const read_response_t *responses;
     size_t count;
     read_response_t *response_out;
@@ -424,11 +611,6 @@ void read_t::unshard(read_response_t *responses, size_t count, read_response_t *
     boost::apply_visitor(v, read);
 }
 
-bool rget_data_cmp(const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> >& a,
-                   const std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> >& b) {
-    return a.first < b.first;
-}
-
 /* write_t::get_region() implementation */
 
 namespace {
@@ -438,6 +620,14 @@ struct w_get_region_visitor : public boost::static_visitor<region_t> {
         return rdb_protocol_t::monokey_region(pw.key);
     }
 
+    region_t operator()(const batched_insert_t &bi) const {
+        std::vector<store_key_t> keys;
+        for (size_t i = 0; i < bi.rows.size(); ++i) {
+            keys.push_back(bi.rows[i].first);
+        }
+        return keys_region(keys);
+    }
+
     region_t operator()(const point_modify_t &pw) const {
         return rdb_protocol_t::monokey_region(pw.key);
     }
@@ -445,6 +635,18 @@ struct w_get_region_visitor : public boost::static_visitor<region_t> {
     region_t operator()(const point_delete_t &pd) const {
         return rdb_protocol_t::monokey_region(pd.key);
     }
+
+    region_t operator()(const range_modify_t &rm) const {
+        return rm.region;
+    }
+
+    region_t operator()(const sindex_create_t &c) const {
+        return c.region;
+    }
+
+    region_t operator()(const sindex_drop_t &d) const {
+        return d.region;
+    }
 };
 
 }   /* anonymous namespace */
@@ -466,6 +668,15 @@ struct w_shard_visitor : public boost::static_visitor<write_t> {
         rassert(rdb_protocol_t::monokey_region(pw.key) == region);
         return write_t(pw);
     }
+    write_t operator()(const batched_insert_t &bi) const {
+        batched_insert_t _bi(bi.overwrite);
+        for (size_t i = 0; i < bi.rows.size(); ++i) {
+            if (region_is_superset(region, rdb_protocol_t::monokey_region(bi.rows[i].first))) {
+                _bi.rows.push_back(bi.rows[i]);
+            }
+        }
+        return write_t(_bi);
+    }
     write_t operator()(const point_modify_t &pw) const {
         rassert(rdb_protocol_t::monokey_region(pw.key) == region);
         return write_t(pw);
@@ -474,6 +685,24 @@ struct w_shard_visitor : public boost::static_visitor<write_t> {
         rassert(rdb_protocol_t::monokey_region(pd.key) == region);
         return write_t(pd);
     }
+    write_t operator()(const range_modify_t &rm) const {
+        rassert(region_is_superset(rm.region, region));
+        range_modify_t _rm(rm);
+        _rm.region = region;
+        return write_t(_rm);
+    }
+    write_t operator()(const sindex_create_t &c) const {
+        rassert(region_is_superset(c.region, region));
+        sindex_create_t _c(c);
+        _c.region = region;
+        return write_t(_c);
+    }
+    write_t operator()(const sindex_drop_t &d) const {
+        rassert(region_is_superset(d.region, region));
+        sindex_drop_t _d(d);
+        _d.region = region;
+        return write_t(_d);
+    }
     const region_t &region;
 };
 
@@ -483,9 +712,102 @@ write_t write_t::shard(const region_t &region) const THROWS_NOTHING {
     return boost::apply_visitor(w_shard_visitor(region), write);
 }
 
+void range_modify_response_t::add(const range_modify_response_t &other) {
+    modified += other.modified;
+    skipped += other.skipped;
+    deleted += other.deleted;
+    errors += other.errors;
+    if (!first_error) {
+        first_error = other.first_error;
+    }
+    if (!exc) {
+        exc = other.exc;
+    }
+    remaining.insert(remaining.end(), other.remaining.begin(), other.remaining.end());
+}
+
+namespace {
+
+/* Point writes only ever touch one shard. Index creation and deletion touch
+all of them, and only succeed if they succeeded everywhere. */
+struct w_unshard_visitor_t : public boost::static_visitor<void> {
+    w_unshard_visitor_t(const write_response_t *_responses, size_t _count, write_response_t *_response_out)
+        : responses(_responses), count(_count), response_out(_response_out) { }
+
+    void operator()(const point_write_t &) const { one_response(); }
+
+    /* Each shard wrote its rows in order, so the results for rows with the
+    same key come back in the order the rows were in. */
+    void operator()(const batched_insert_t &bi) const {
+        std::map<store_key_t, std::deque<point_write_result_t> > results;
+        for (size_t i = 0; i < count; ++i) {
+            const batched_insert_response_t *res = boost::get<batched_insert_response_t>(&responses[i].response);
+            guarantee(res);
+            for (size_t j = 0; j < res->results.size(); ++j) {
+                results[res->results[j].first].push_back(res->results[j].second);
+            }
+        }
+
+        batched_insert_response_t res;
+        for (size_t i = 0; i < bi.rows.size(); ++i) {
+            std::deque<point_write_result_t> &key_results = results[bi.rows[i].first];
+            guarantee(!key_results.empty());
+            res.results.push_back(std::make_pair(bi.rows[i].first, key_results.front()));
+            key_results.pop_front();
+        }
+        *response_out = write_response_t(res);
+    }
+
+    void operator()(const point_modify_t &) const { one_response(); }
+    void operator()(const point_delete_t &) const { one_response(); }
+
+    /* The counts add up. The error that's reported is the first one from the
+    first shard that had one. */
+    void operator()(const range_modify_t &) const {
+        range_modify_response_t res;
+        for (size_t i = 0; i < count; ++i) {
+            const range_modify_response_t *_res = boost::get<range_modify_response_t>(&responses[i].response);
+            guarantee(_res);
+            res.add(*_res);
+        }
+        *response_out = write_response_t(res);
+    }
+
+    void operator()(const sindex_create_t &) const {
+        *response_out = write_response_t(sindex_create_response_t(all_succeeded<sindex_create_response_t>()));
+    }
+
+    void operator()(const sindex_drop_t &) const {
+        *response_out = write_response_t(sindex_drop_response_t(all_succeeded<sindex_drop_response_t>()));
+    }
+
+private:
+    void one_response() const {
+        guarantee(count == 1);
+        *response_out = responses[0];
+    }
+
+    template <class response_t>
+    bool all_succeeded() const {
+        guarantee(count > 0);
+        bool success = true;
+        for (size_t i = 0; i < count; ++i) {
+            const response_t *res = boost::get<response_t>(&responses[i].response);
+            guarantee(res);
+            success = success && res->success;
+        }
+        return success;
+    }
+
+    const write_response_t *responses;
+    size_t count;
+    write_response_t *response_out;
+};
+
+}   /* anonymous namespace */
+
 void write_t::unshard(const write_response_t *responses, size_t count, write_response_t *response, UNUSED context_t *ctx) const THROWS_NOTHING {
-    guarantee(count == 1);
-    *response = responses[0];
+    boost::apply_visitor(w_unshard_visitor_t(responses, count, response), write);
 }
 
 store_t::store_t(serializer_t *serializer,
@@ -509,13 +831,35 @@ struct read_visitor_t : public boost::static_visitor<void> {
     void operator()(const point_read_t &get) {
         response->response = point_read_response_t();
         point_read_response_t &res = boost::get<point_read_response_t>(response->response);
-        rdb_get(get.key, btree, txn, superblock, &res);
+        rdb_get(get.key, btree, txn, superblock, &env, get.transform, &res);
+    }
+
+    void operator()(const multi_point_read_t &gets) {
+        response->response = multi_point_read_response_t();
+        multi_point_read_response_t &res = boost::get<multi_point_read_response_t>(response->response);
+        rdb_multi_get(gets.keys, btree, txn, superblock, &env, gets.transform, &res);
     }
 
     void operator()(const rget_read_t &rget) {
         response->response = rget_read_response_t();
         rget_read_response_t &res = boost::get<rget_read_response_t>(response->response);
-        rdb_rget_slice(btree, rget.region.inner, txn, superblock, &env, rget.transform, rget.terminal, &res);
+        if (rget.sindex) {
+            rdb_rget_secondary_slice(btree, *rget.sindex, rget.region, txn, superblock, &env, rget.transform, rget.terminal, rget.sorting, &res);
+        } else {
+            rdb_rget_slice(btree, rget.region.inner, txn, superblock, &env, rget.transform, rget.terminal, rget.sorting, &res);
+        }
+    }
+
+    void operator()(const sindex_list_t &) {
+        response->response = sindex_list_response_t();
+        sindex_list_response_t &res = boost::get<sindex_list_response_t>(response->response);
+        rdb_sindex_list(txn, superblock, &res.attrnames);
+    }
+
+    void operator()(const version_read_t &) {
+        response->response = version_read_response_t();
+        version_read_response_t &res = boost::get<version_read_response_t>(response->response);
+        rdb_get_metainfo(txn, superblock, &res.metainfo);
     }
 
     void operator()(const distribution_read_t &dg) {
@@ -558,7 +902,9 @@ struct read_visitor_t : public boost::static_visitor<void> {
             ctx->semilattice_metadata,
             boost::make_shared<js::runner_t>(),
             &interruptor,
-            ctx->machine_id)
+            ctx->machine_id,
+            ctx->io_backender,
+            ctx->temp_directory)
     { }
 
 private:
@@ -592,10 +938,17 @@ struct write_visitor_t : public boost::static_visitor<void> {
         rdb_set(w.key, w.data, w.overwrite, btree, timestamp, txn, superblock, &res);
     }
 
+    void operator()(const batched_insert_t &bi) {
+        response->response = batched_insert_response_t();
+        batched_insert_response_t &res = boost::get<batched_insert_response_t>(response->response);
+        rdb_batched_set(bi.rows, bi.overwrite, btree, timestamp, txn, superblock, &res);
+    }
+
     void operator()(const point_modify_t &m) {
         response->response = point_modify_response_t();
         point_modify_response_t &res = boost::get<point_modify_response_t>(response->response);
-        rdb_modify(m.primary_key, m.key, m.op, &env, m.scopes, m.backtrace, m.mapping, btree, timestamp, txn, superblock, &res);
+        query_language::json_arena_t arena;
+        rdb_modify(m.primary_key, m.key, m.op, &env, m.scopes, m.backtrace, m.mapping, &arena, btree, timestamp, txn, superblock, &res);
     }
 
     void operator()(const point_delete_t &d) {
@@ -604,6 +957,31 @@ struct write_visitor_t : public boost::static_visitor<void> {
         rdb_delete(d.key, btree, timestamp, txn, superblock, &res);
     }
 
+    void operator()(const range_modify_t &rm) {
+        response->response = range_modify_response_t();
+        range_modify_response_t &res = boost::get<range_modify_response_t>(response->response);
+        boost::optional<store_key_t> last_key;
+        rdb_range_modify(rm.primary_key, rm.region.inner, rm.transform, rm.op, &env, rm.scopes, rm.backtrace, rm.mapping,
+                         btree, timestamp, txn, superblock, &res, &last_key);
+        if (last_key && !res.exc) {
+            key_range_t rest = rm.region.inner;
+            rest.left = *last_key;
+            if (rest.left.increment() && !rest.is_empty()) {
+                res.remaining.push_back(region_t(rm.region.beg, rm.region.end, rest));
+            }
+        }
+    }
+
+    void operator()(const sindex_create_t &c) {
+        bool success = rdb_sindex_create(c.attrname, c.primary_key, btree, txn, superblock, &interruptor);
+        response->response = sindex_create_response_t(success);
+    }
+
+    void operator()(const sindex_drop_t &d) {
+        bool success = rdb_sindex_drop(d.attrname, btree, txn, superblock, &interruptor);
+        response->response = sindex_drop_response_t(success);
+    }
+
     write_visitor_t(btree_slice_t *_btree,
                     transaction_t *_txn,
                     superblock_t *_superblock,
@@ -624,7 +1002,9 @@ struct write_visitor_t : public boost::static_visitor<void> {
             ctx->semilattice_metadata,
             boost::make_shared<js::runner_t>(),
             &interruptor,
-            ctx->machine_id)
+            ctx->machine_id,
+            ctx->io_backender,
+            ctx->temp_directory)
     { }
 
 private:
@@ -11,6 +11,7 @@
 
 #include "utils.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/variant.hpp>
 
 #include "backfill_progress.hpp"
@@ -35,11 +36,14 @@
 
 template <class> class cross_thread_watchable_variable_t;
 class cluster_directory_metadata_t;
+class io_backender_t;
 template <class metadata> class directory_read_manager_t;
 
 using query_language::scopes_t;
 using query_language::backtrace_t;
 using query_language::shared_scoped_less_t;
+using query_language::shared_scoped_hash_t;
+using query_language::shared_scoped_equal_t;
 using query_language::runtime_exc_t;
 
 enum point_write_result_t {
@@ -66,10 +70,16 @@ static inline std::string op_name(op_t op) {
 }
 }
 
+namespace range_modify_ns {
+enum op_t { UPDATE, MUTATE, DELETE };
+ARCHIVE_PRIM_MAKE_RANGED_SERIALIZABLE(op_t, int8_t, UPDATE, DELETE);
+}
+
 RDB_DECLARE_SERIALIZABLE(Builtin_Range);
 RDB_DECLARE_SERIALIZABLE(Builtin_Filter);
 RDB_DECLARE_SERIALIZABLE(Builtin_ConcatMap);
 RDB_DECLARE_SERIALIZABLE(Builtin_GroupedMapReduce);
+RDB_DECLARE_SERIALIZABLE(Builtin_OrderBy);
 RDB_DECLARE_SERIALIZABLE(Mapping);
 RDB_DECLARE_SERIALIZABLE(Reduction);
 RDB_DECLARE_SERIALIZABLE(WriteQuery_ForEach);
@@ -105,6 +115,26 @@ struct transform_atom_t {
 
 typedef std::list<transform_atom_t> transform_t;
 
+/* A range of a secondary index. `lower` and `upper` are closed bounds on the
+`cJSON_print_lexicographic()` encoding of the indexed attribute; a missing
+bound is unbounded. `index_range` is the part of the index btree that's left to
+read. It starts out covering the bounds, and `batched_rget_stream_t` moves its
+left edge forward as it pages through the results. */
+struct sindex_range_t {
+    sindex_range_t() { }
+    sindex_range_t(const std::string &_attrname,
+                   const boost::optional<std::string> &_lower,
+                   const boost::optional<std::string> &_upper);
+
+    bool contains(const std::string &encoded_attr) const;
+
+    std::string attrname;
+    boost::optional<std::string> lower, upper;
+    key_range_t index_range;
+
+    RDB_MAKE_ME_SERIALIZABLE_4(attrname, lower, upper, index_range);
+};
+
 /* There's no protocol buffer for Length (because there's not data associated
  * with it but to make things work with the variant we create a nice empty
  * class. */
@@ -127,6 +157,22 @@ struct terminal_t {
     RDB_MAKE_ME_SERIALIZABLE_3(variant, scopes, backtrace);
 };
 
+/* An ORDERBY, and a limit on how many of the rows it puts first are wanted,
+pushed down into an rget. Each shard sorts the rows it reads and sends back
+only the first `limit`, and unsharding merges them, which gives the first
+`limit` rows of the whole sort. */
+struct sorting_t {
+    sorting_t() : limit(0) { }
+    sorting_t(const std::vector<Builtin_OrderBy> &_order, size_t _limit, const backtrace_t &_backtrace)
+        : order(_order), limit(_limit), backtrace(_backtrace) { }
+
+    std::vector<Builtin_OrderBy> order;
+    size_t limit;
+    backtrace_t backtrace;
+
+    RDB_MAKE_ME_SERIALIZABLE_3(order, limit, backtrace);
+};
+
 } // namespace rdb_protocol_details
 
 class cluster_semilattice_metadata_t;
@@ -144,7 +190,9 @@ struct rdb_protocol_t {
                   namespace_repo_t<rdb_protocol_t> *_ns_repo,
                   boost::shared_ptr<semilattice_readwrite_view_t<cluster_semilattice_metadata_t> > _semilattice_metadata,
                   directory_read_manager_t<cluster_directory_metadata_t> *_directory_read_manager,
-                  machine_id_t _machine_id);
+                  machine_id_t _machine_id,
+                  io_backender_t *_io_backender,
+                  const std::string &_temp_directory);
         ~context_t();
 
         extproc::pool_group_t *pool_group;
@@ -159,21 +207,41 @@ struct rdb_protocol_t {
         cond_t interruptor; //TODO figure out where we're going to want to interrupt this from and put this there instead
         scoped_array_t<scoped_ptr_t<cross_thread_signal_t> > signals;
         machine_id_t machine_id;
+
+        /* Where queries write temporary files, such as the runs of a big
+        ORDERBY. If `io_backender` is NULL they keep everything in memory. */
+        io_backender_t *io_backender;
+        std::string temp_directory;
     };
 
     struct point_read_response_t {
+        /* What the transform turned the row into, or the error it threw. */
+        typedef boost::variant<std::vector<boost::shared_ptr<scoped_cJSON_t> >, runtime_exc_t> transformed_t;
+
+        /* The row, or null if there isn't one. If the read had a transform
+        and found the row, this is null and `transformed` is set instead. */
         boost::shared_ptr<scoped_cJSON_t> data;
+        boost::optional<transformed_t> transformed;
+
         point_read_response_t() { }
         explicit point_read_response_t(boost::shared_ptr<scoped_cJSON_t> _data)
             : data(_data)
         { }
 
-        RDB_MAKE_ME_SERIALIZABLE_1(data);
+        RDB_MAKE_ME_SERIALIZABLE_2(data, transformed);
+    };
+
+    struct multi_point_read_response_t {
+        /* One for each of the read's keys, in the same order. */
+        std::vector<std::pair<store_key_t, point_read_response_t> > rows;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(rows);
     };
 
     struct rget_read_response_t {
         typedef std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > stream_t; //Present if there was no terminal
-        typedef std::map<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t>, shared_scoped_less_t> groups_t; //Present if the terminal was a groupedmapreduce
+        typedef boost::unordered_map<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t>,
+                                     shared_scoped_hash_t, shared_scoped_equal_t> groups_t; //Present if the terminal was a groupedmapreduce, in no particular order
         typedef boost::shared_ptr<scoped_cJSON_t> atom_t; //Present if the terminal was a reduction
 
         struct length_t {
@@ -217,9 +285,24 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_2(region, key_counts);
     };
 
+    struct sindex_list_response_t {
+        std::vector<std::string> attrnames;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(attrnames);
+    };
+
+    struct version_read_response_t {
+        // The serialized metainfo of every shard, from region to version.
+        std::map<std::string, std::string> metainfo;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(metainfo);
+    };
+
     struct read_response_t {
     private:
-        typedef boost::variant<point_read_response_t, rget_read_response_t, distribution_read_response_t> _response_t;
+        typedef boost::variant<point_read_response_t, multi_point_read_response_t, rget_read_response_t,
+                               distribution_read_response_t, sindex_list_response_t,
+                               version_read_response_t> _response_t;
     public:
         _response_t response;
 
@@ -230,14 +313,35 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_1(response);
     };
 
+    /* Reads the row with the given key. If there's a transform, the shard
+    applies it to the row (if it's there) and sends back only the result, so
+    that a projection like `GETATTR(GETBYKEY(...))` doesn't have to send the
+    whole row back to the parser. */
     class point_read_t {
     public:
         point_read_t() { }
         explicit point_read_t(const store_key_t& _key) : key(_key) { }
+        point_read_t(const store_key_t& _key, const rdb_protocol_details::transform_t &_transform)
+            : key(_key), transform(_transform) { }
 
         store_key_t key;
+        rdb_protocol_details::transform_t transform;
 
-        RDB_MAKE_ME_SERIALIZABLE_1(key);
+        RDB_MAKE_ME_SERIALIZABLE_2(key, transform);
+    };
+
+    /* Several point reads in one, applying the same transform to each row.
+    Each shard reads the keys it has. */
+    class multi_point_read_t {
+    public:
+        multi_point_read_t() { }
+        multi_point_read_t(const std::vector<store_key_t> &_keys, const rdb_protocol_details::transform_t &_transform)
+            : keys(_keys), transform(_transform) { }
+
+        std::vector<store_key_t> keys;
+        rdb_protocol_details::transform_t transform;
+
+        RDB_MAKE_ME_SERIALIZABLE_2(keys, transform);
     };
 
     class rget_read_t {
@@ -268,7 +372,16 @@ struct rdb_protocol_t {
         rdb_protocol_details::transform_t transform;
         boost::optional<rdb_protocol_details::terminal_t> terminal;
 
-        RDB_MAKE_ME_SERIALIZABLE_3(region, transform, terminal);
+        /* If this is set, the rows come from the secondary index instead of
+        the primary btree, in index order. `region` still restricts which rows
+        are returned. */
+        boost::optional<rdb_protocol_details::sindex_range_t> sindex;
+
+        /* If this is set (and there's no terminal), the response holds the
+        first `sorting->limit` rows in sorted order, and is never truncated. */
+        boost::optional<rdb_protocol_details::sorting_t> sorting;
+
+        RDB_MAKE_ME_SERIALIZABLE_5(region, transform, terminal, sindex, sorting);
     };
 
     class distribution_read_t {
@@ -287,10 +400,33 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_3(max_depth, result_limit, region);
     };
 
+    /* Lists the secondary indexes. A table has an index only if every shard
+    has it, so the unsharded response is the intersection. */
+    class sindex_list_t {
+    public:
+        sindex_list_t() : region(region_t::universe()) { }
+
+        region_t region;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(region);
+    };
+
+    /* Reads the metainfo of every shard. Every write to a shard gives it a
+    new version, so as long as the metainfo is the same, so is the data. */
+    class version_read_t {
+    public:
+        version_read_t() : region(region_t::universe()) { }
+
+        region_t region;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(region);
+    };
+
 
     struct read_t {
     private:
-        typedef boost::variant<point_read_t, rget_read_t, distribution_read_t> _read_t;
+        typedef boost::variant<point_read_t, multi_point_read_t, rget_read_t, distribution_read_t,
+                               sindex_list_t, version_read_t> _read_t;
     public:
         _read_t read;
 
@@ -319,6 +455,13 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_1(result);
     };
 
+    struct batched_insert_response_t {
+        /* One for each of the insert's rows, in the same order. */
+        std::vector<std::pair<store_key_t, point_write_result_t> > results;
+
+        RDB_MAKE_ME_SERIALIZABLE_1(results);
+    };
+
     struct point_delete_response_t {
         point_delete_result_t result;
 
@@ -342,14 +485,56 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_2(result, exc);
     };
 
+    /* What a `range_modify_t` did. Rows that couldn't be modified count as
+    errors, and the first of them threw `first_error`. If the filters threw,
+    nothing more was modified and the error is in `exc`. Each shard only gets
+    through `RDB_RANGE_MODIFY_BATCH_SIZE` rows per write; the parts of the
+    region it didn't get to are in `remaining`. */
+    struct range_modify_response_t {
+        range_modify_response_t() : modified(0), skipped(0), deleted(0), errors(0) { }
+
+        /* Adds up the counts and keeps the first errors. */
+        void add(const range_modify_response_t &other);
+
+        int modified, skipped, deleted, errors;
+        boost::optional<query_language::runtime_exc_t> first_error;
+        boost::optional<query_language::runtime_exc_t> exc;
+        std::vector<region_t> remaining;
+
+        RDB_MAKE_ME_SERIALIZABLE_7(modified, skipped, deleted, errors, first_error, exc, remaining);
+    };
+
+    struct sindex_create_response_t {
+        bool success;
+
+        sindex_create_response_t() : success(false) { }
+        explicit sindex_create_response_t(bool _success) : success(_success) { }
+
+        RDB_MAKE_ME_SERIALIZABLE_1(success);
+    };
+
+    struct sindex_drop_response_t {
+        bool success;
+
+        sindex_drop_response_t() : success(false) { }
+        explicit sindex_drop_response_t(bool _success) : success(_success) { }
+
+        RDB_MAKE_ME_SERIALIZABLE_1(success);
+    };
+
     struct write_response_t {
-        boost::variant<point_write_response_t, point_modify_response_t, point_delete_response_t> response;
+        boost::variant<point_write_response_t, batched_insert_response_t, point_modify_response_t, point_delete_response_t,
+                       range_modify_response_t, sindex_create_response_t, sindex_drop_response_t> response;
 
         write_response_t() { }
         write_response_t(const write_response_t& w) : response(w.response) { }
         explicit write_response_t(const point_write_response_t& w) : response(w) { }
+        explicit write_response_t(const batched_insert_response_t& bi) : response(bi) { }
         explicit write_response_t(const point_modify_response_t& m) : response(m) { }
         explicit write_response_t(const point_delete_response_t& d) : response(d) { }
+        explicit write_response_t(const range_modify_response_t& rm) : response(rm) { }
+        explicit write_response_t(const sindex_create_response_t& c) : response(c) { }
+        explicit write_response_t(const sindex_drop_response_t& d) : response(d) { }
 
         RDB_MAKE_ME_SERIALIZABLE_1(response);
     };
@@ -383,6 +568,19 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_3(key, data, overwrite);
     };
 
+    /* Many point writes in one. Each shard writes the rows it has, in order,
+    in one transaction. */
+    class batched_insert_t {
+    public:
+        batched_insert_t() : overwrite(true) { }
+        explicit batched_insert_t(bool _overwrite) : overwrite(_overwrite) { }
+
+        std::vector<std::pair<store_key_t, boost::shared_ptr<scoped_cJSON_t> > > rows;
+        bool overwrite;
+
+        RDB_MAKE_ME_SERIALIZABLE_2(rows, overwrite);
+    };
+
     class point_delete_t {
     public:
         point_delete_t() { }
@@ -394,8 +592,62 @@ struct rdb_protocol_t {
         RDB_MAKE_ME_SERIALIZABLE_1(key);
     };
 
+    /* Updates, mutates or deletes every row in `region` that passes the
+    filters in `transform`. Each shard finds its rows and modifies them in one
+    transaction, so the rows never leave it. The filters and the mapping are
+    evaluated by every replica, so they have to be deterministic. */
+    class range_modify_t {
+    public:
+        range_modify_t() : region(region_t::universe()) { }
+        range_modify_t(const std::string &_primary_key, const key_range_t &_range,
+                       const rdb_protocol_details::transform_t &_transform, range_modify_ns::op_t _op,
+                       const query_language::scopes_t &_scopes, const backtrace_t &_backtrace,
+                       const boost::optional<Mapping> &_mapping)
+            : primary_key(_primary_key), region(_range), transform(_transform), op(_op),
+              scopes(_scopes), backtrace(_backtrace), mapping(_mapping) { }
+
+        std::string primary_key;
+        region_t region;
+        rdb_protocol_details::transform_t transform;
+        range_modify_ns::op_t op;
+        query_language::scopes_t scopes;
+        backtrace_t backtrace;
+        boost::optional<Mapping> mapping;   // Only for `UPDATE` and `MUTATE`.
+
+        RDB_MAKE_ME_SERIALIZABLE_7(primary_key, region, transform, op, scopes, backtrace, mapping);
+    };
+
+    /* Creates a secondary index on `attrname` and fills it from the rows that
+    are already in the table. `primary_key` is the table's primary key; the
+    index needs it to find the entries of rows that are erased in bulk. */
+    class sindex_create_t {
+    public:
+        sindex_create_t() : region(region_t::universe()) { }
+        sindex_create_t(const std::string &_attrname, const std::string &_primary_key)
+            : attrname(_attrname), primary_key(_primary_key), region(region_t::universe()) { }
+
+        std::string attrname;
+        std::string primary_key;
+        region_t region;
+
+        RDB_MAKE_ME_SERIALIZABLE_3(attrname, primary_key, region);
+    };
+
+    class sindex_drop_t {
+    public:
+        sindex_drop_t() : region(region_t::universe()) { }
+        explicit sindex_drop_t(const std::string &_attrname)
+            : attrname(_attrname), region(region_t::universe()) { }
+
+        std::string attrname;
+        region_t region;
+
+        RDB_MAKE_ME_SERIALIZABLE_2(attrname, region);
+    };
+
     struct write_t {
-        boost::variant<point_write_t, point_delete_t, point_modify_t> write;
+        boost::variant<point_write_t, batched_insert_t, point_delete_t, point_modify_t, range_modify_t,
+                       sindex_create_t, sindex_drop_t> write;
 
         region_t get_region() const THROWS_NOTHING;
         write_t shard(const region_t &region) const THROWS_NOTHING;
@@ -404,8 +656,12 @@ struct rdb_protocol_t {
         write_t() { }
         write_t(const write_t& w) : write(w.write) { }
         explicit write_t(const point_write_t &w) : write(w) { }
+        explicit write_t(const batched_insert_t &bi) : write(bi) { }
         explicit write_t(const point_delete_t &d) : write(d) { }
         explicit write_t(const point_modify_t &m) : write(m) { }
+        explicit write_t(const range_modify_t &rm) : write(rm) { }
+        explicit write_t(const sindex_create_t &c) : write(c) { }
+        explicit write_t(const sindex_drop_t &d) : write(d) { }
 
         RDB_MAKE_ME_SERIALIZABLE_1(write);
     };
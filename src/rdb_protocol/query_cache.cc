@@ -0,0 +1,160 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/query_cache.hpp"
+
+#include "arch/runtime/runtime.hpp"
+
+namespace {
+
+bool same_table(const TableRef &a, const TableRef &b) {
+    return a.db_name() == b.db_name() && a.table_name() == b.table_name()
+        && a.use_outdated() == b.use_outdated();
+}
+
+/* Adds the tables that `m` reads to `tables_out`, and returns false if
+anything else in `m` (that is, javascript) could make its result change. */
+bool collect_tables(const google::protobuf::Message &m, std::vector<TableRef> *tables_out) {
+    if (const Term *t = dynamic_cast<const Term *>(&m)) {
+        if (t->type() == Term::JAVASCRIPT) {
+            return false;
+        }
+    } else if (const TableRef *ref = dynamic_cast<const TableRef *>(&m)) {
+        for (size_t i = 0; i < tables_out->size(); ++i) {
+            if (same_table((*tables_out)[i], *ref)) {
+                return true;
+            }
+        }
+        tables_out->push_back(*ref);
+        return true;
+    }
+
+    const google::protobuf::Reflection *reflection = m.GetReflection();
+    std::vector<const google::protobuf::FieldDescriptor *> fields;
+    reflection->ListFields(m, &fields);
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const google::protobuf::FieldDescriptor *field = fields[i];
+        if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            continue;
+        }
+        if (field->is_repeated()) {
+            for (int j = 0; j < reflection->FieldSize(m, field); ++j) {
+                if (!collect_tables(reflection->GetRepeatedMessage(m, field, j), tables_out)) {
+                    return false;
+                }
+            }
+        } else if (!collect_tables(reflection->GetMessage(m, field), tables_out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t versions_size(const query_cache_t::versions_t &versions) {
+    size_t size = 0;
+    for (size_t i = 0; i < versions.size(); ++i) {
+        for (std::map<std::string, std::string>::const_iterator it = versions[i].begin();
+             it != versions[i].end(); ++it) {
+            size += it->first.size() + it->second.size();
+        }
+    }
+    return size;
+}
+
+}  // anonymous namespace
+
+query_cache_t::query_cache_t(size_t memory_budget)
+    : stats_membership(&get_global_perfmon_collection(), &stats, "query_cache"),
+      pm_members(&stats,
+                 &pm_hits, "hits",
+                 &pm_misses, "misses",
+                 &pm_bytes, "bytes",
+                 NULLPTR),
+      caches(memory_budget / get_num_threads(), &pm_bytes)
+{ }
+
+bool query_cache_t::is_cacheable(const Query &q, std::vector<TableRef> *tables_out) {
+    tables_out->clear();
+    if (q.type() != Query::READ || !q.read_query().use_cache()) {
+        return false;
+    }
+    return collect_tables(q.read_query(), tables_out);
+}
+
+bool query_cache_t::get(const Query &q, const versions_t &versions, Response *res_out) {
+    const Response *res = caches.get()->find(normalize(q), versions);
+    if (res == NULL) {
+        ++pm_misses;
+        return false;
+    }
+    ++pm_hits;
+    *res_out = *res;
+    res_out->set_token(q.token());
+    return true;
+}
+
+void query_cache_t::put(const Query &q, const versions_t &versions, const Response &res) {
+    // A partial response leaves the rest of the stream in the connection's
+    // stream cache, and an error may not happen again.
+    if (res.status_code() != Response::SUCCESS_JSON && res.status_code() != Response::SUCCESS_STREAM) {
+        return;
+    }
+    entry_t entry;
+    entry.key = normalize(q);
+    entry.versions = versions;
+    entry.response = res;
+    entry.response.set_token(0);
+    entry.size = sizeof(entry_t) + entry.key.size() + versions_size(versions) + entry.response.SpaceUsed();
+    caches.get()->insert(entry);
+}
+
+/* The query, minus what doesn't change its response. */
+std::string query_cache_t::normalize(const Query &q) {
+    Query normalized(q);
+    normalized.set_token(0);
+    normalized.mutable_read_query()->clear_use_cache();
+    return normalized.SerializeAsString();
+}
+
+query_cache_t::thread_cache_t::thread_cache_t(size_t _memory_budget, perfmon_counter_t *_pm_bytes)
+    : memory_budget(_memory_budget), size(0), pm_bytes(_pm_bytes) { }
+
+query_cache_t::thread_cache_t::~thread_cache_t() {
+    *pm_bytes -= size;
+}
+
+const Response *query_cache_t::thread_cache_t::find(const std::string &key, const versions_t &versions) {
+    boost::unordered_map<std::string, std::list<entry_t>::iterator>::iterator it = index.find(key);
+    if (it == index.end()) {
+        return NULL;
+    }
+    if (it->second->versions != versions) {
+        erase(it->second);
+        return NULL;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    return &entries.front().response;
+}
+
+void query_cache_t::thread_cache_t::insert(const entry_t &entry) {
+    boost::unordered_map<std::string, std::list<entry_t>::iterator>::iterator it = index.find(entry.key);
+    if (it != index.end()) {
+        erase(it->second);
+    }
+    if (entry.size > memory_budget) {
+        return;
+    }
+    while (size + entry.size > memory_budget) {
+        guarantee(!entries.empty());
+        erase(--entries.end());
+    }
+    entries.push_front(entry);
+    index[entry.key] = entries.begin();
+    size += entry.size;
+    *pm_bytes += entry.size;
+}
+
+void query_cache_t::thread_cache_t::erase(std::list<entry_t>::iterator it) {
+    size -= it->size;
+    *pm_bytes -= it->size;
+    index.erase(it->key);
+    entries.erase(it);
+}
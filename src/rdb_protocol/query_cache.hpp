@@ -0,0 +1,87 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_QUERY_CACHE_HPP_
+#define RDB_PROTOCOL_QUERY_CACHE_HPP_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include <boost/unordered_map.hpp>
+
+#include "concurrency/one_per_thread.hpp"
+#include "perfmon/perfmon.hpp"
+#include "rdb_protocol/query_language.pb.h"
+
+/* Remembers the responses to the read queries that ask for it (with
+`ReadQuery::use_cache`), along with the version of each table the query read
+when it ran. The same query gets the same response for as long as all of those
+tables are still at those versions. Each thread has a cache of its own, which
+throws out the least recently used responses to stay within its share of the
+memory budget. */
+class query_cache_t {
+public:
+    // The version of each table a query reads, in the order `is_cacheable()`
+    // lists them.
+    typedef std::vector<std::map<std::string, std::string> > versions_t;
+
+    explicit query_cache_t(size_t memory_budget);
+
+    /* Whether the response to `q` can come from the cache: `q` has to be a
+    read that asks for it, and apart from the tables it reads, the response
+    can't depend on anything but the query (so no javascript). If so, lists the
+    tables it reads in `tables_out`. */
+    static bool is_cacheable(const Query &q, std::vector<TableRef> *tables_out);
+
+    /* If there's a response to `q` from when its tables were at `versions`,
+    puts it in `res_out` (with `q`'s token) and returns true. */
+    bool get(const Query &q, const versions_t &versions, Response *res_out);
+
+    /* Remembers `res` as the response to `q` when its tables are at
+    `versions`, if it's a complete response. */
+    void put(const Query &q, const versions_t &versions, const Response &res);
+
+private:
+    struct entry_t {
+        std::string key;
+        versions_t versions;
+        Response response;
+        size_t size;
+    };
+
+    class thread_cache_t {
+    public:
+        thread_cache_t(size_t _memory_budget, perfmon_counter_t *_pm_bytes);
+        ~thread_cache_t();
+
+        /* The response stored under `key`, if it was computed at `versions`.
+        A response computed at other versions is thrown out. */
+        const Response *find(const std::string &key, const versions_t &versions);
+        void insert(const entry_t &entry);
+
+    private:
+        void erase(std::list<entry_t>::iterator it);
+
+        size_t memory_budget, size;
+        perfmon_counter_t *pm_bytes;
+        // Most recently used first.
+        std::list<entry_t> entries;
+        boost::unordered_map<std::string, std::list<entry_t>::iterator> index;
+
+        DISABLE_COPYING(thread_cache_t);
+    };
+
+    static std::string normalize(const Query &q);
+
+    perfmon_collection_t stats;
+    perfmon_membership_t stats_membership;
+    perfmon_counter_t pm_hits, pm_misses, pm_bytes;
+    perfmon_multi_membership_t pm_members;
+
+    one_per_thread_t<thread_cache_t> caches;
+
+    DISABLE_COPYING(query_cache_t);
+};
+
+#endif  // RDB_PROTOCOL_QUERY_CACHE_HPP_
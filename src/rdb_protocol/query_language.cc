@@ -3,15 +3,24 @@
 
 #include <math.h>
 
+#include <algorithm>
+#include <deque>
+#include <set>
+
 #include "errors.hpp"
 #include <boost/make_shared.hpp>
 #include <boost/variant.hpp>
 
 #include "clustering/administration/main/ports.hpp"
 #include "clustering/administration/suggester.hpp"
+#include "concurrency/auto_drainer.hpp"
+#include "concurrency/cond_var.hpp"
+#include "concurrency/wait_any.hpp"
 #include "http/json.hpp"
 #include "rdb_protocol/internal_extensions.pb.h"
 #include "rdb_protocol/js.hpp"
+#include "rdb_protocol/point_get_cache.hpp"
+#include "rdb_protocol/sindex_cache.hpp"
 #include "rpc/directory/read_manager.hpp"
 #include "rdb_protocol/proto_utils.hpp"
 #include "query_measure.hpp"
@@ -744,6 +753,12 @@ void check_write_query_type(WriteQuery *w, type_checking_environment_t *env, boo
     }
 }
 
+static void check_no_index_fields(MetaQuery *t) {
+    check_protobuf(!t->has_create_index());
+    check_protobuf(!t->has_drop_index());
+    check_protobuf(!t->has_list_indexes());
+}
+
 void check_meta_query_type(MetaQuery *t, const backtrace_t &backtrace) {
     check_protobuf(MetaQuery::MetaQueryType_IsValid(t->type()));
     switch(t->type()) {
@@ -752,17 +767,20 @@ void check_meta_query_type(MetaQuery *t, const backtrace_t &backtrace) {
         check_name_string(t->db_name(), backtrace);
         check_protobuf(!t->has_create_table());
         check_protobuf(!t->has_drop_table());
+        check_no_index_fields(t);
         break;
     case MetaQuery::DROP_DB:
         check_protobuf(t->has_db_name());
         check_name_string(t->db_name(), backtrace);
         check_protobuf(!t->has_create_table());
         check_protobuf(!t->has_drop_table());
+        check_no_index_fields(t);
         break;
     case MetaQuery::LIST_DBS:
         check_protobuf(!t->has_db_name());
         check_protobuf(!t->has_create_table());
         check_protobuf(!t->has_drop_table());
+        check_no_index_fields(t);
         break;
     case MetaQuery::CREATE_TABLE: {
         check_protobuf(!t->has_db_name());
@@ -772,18 +790,48 @@ void check_meta_query_type(MetaQuery *t, const backtrace_t &backtrace) {
         }
         check_table_ref(t->create_table().table_ref(), backtrace.with("table_ref"));
         check_protobuf(!t->has_drop_table());
+        check_no_index_fields(t);
     } break;
     case MetaQuery::DROP_TABLE:
         check_protobuf(!t->has_db_name());
         check_protobuf(!t->has_create_table());
         check_protobuf(t->has_drop_table());
         check_table_ref(t->drop_table(), backtrace);
+        check_no_index_fields(t);
         break;
     case MetaQuery::LIST_TABLES:
         check_protobuf(t->has_db_name());
         check_name_string(t->db_name(), backtrace);
         check_protobuf(!t->has_create_table());
         check_protobuf(!t->has_drop_table());
+        check_no_index_fields(t);
+        break;
+    case MetaQuery::CREATE_INDEX:
+        check_protobuf(!t->has_db_name());
+        check_protobuf(!t->has_create_table());
+        check_protobuf(!t->has_drop_table());
+        check_protobuf(t->has_create_index());
+        check_protobuf(!t->has_drop_index());
+        check_protobuf(!t->has_list_indexes());
+        check_table_ref(t->create_index().table_ref(), backtrace.with("table_ref"));
+        break;
+    case MetaQuery::DROP_INDEX:
+        check_protobuf(!t->has_db_name());
+        check_protobuf(!t->has_create_table());
+        check_protobuf(!t->has_drop_table());
+        check_protobuf(!t->has_create_index());
+        check_protobuf(t->has_drop_index());
+        check_protobuf(!t->has_list_indexes());
+        check_table_ref(t->drop_index().table_ref(), backtrace.with("table_ref"));
+        break;
+    case MetaQuery::LIST_INDEXES:
+        check_protobuf(!t->has_db_name());
+        check_protobuf(!t->has_create_table());
+        check_protobuf(!t->has_drop_table());
+        check_protobuf(!t->has_create_index());
+        check_protobuf(!t->has_drop_index());
+        check_protobuf(t->has_list_indexes());
+        check_table_ref(t->list_indexes(), backtrace);
         break;
     default: unreachable("Unhandled MetaQuery.");
     }
@@ -884,7 +932,17 @@ void assign_dc_name(const std::string &dc_name_str, const backtrace_t& bt, name_
 }
 
 
+void execute_index_meta(MetaQuery *m, runtime_environment_t *env, Response *res, const backtrace_t &bt) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t);
+
 void execute_meta(MetaQuery *m, runtime_environment_t *env, Response *res, const backtrace_t &bt) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
+    // Index operations are ordinary reads and writes on the table, so they go
+    // through the namespace interface on this thread.
+    if (m->type() == MetaQuery::CREATE_INDEX || m->type() == MetaQuery::DROP_INDEX
+        || m->type() == MetaQuery::LIST_INDEXES) {
+        execute_index_meta(m, env, res, bt);
+        return;
+    }
+
     // This must be performed on the semilattice_metadata's home thread,
     int original_thread = get_thread_id();
     int metadata_home_thread = env->semilattice_metadata->home_thread();
@@ -1070,6 +1128,9 @@ void execute_meta(MetaQuery *m, runtime_environment_t *env, Response *res, const
         }
         res->set_status_code(Response::SUCCESS_STREAM);
     } break;
+    case MetaQuery::CREATE_INDEX:
+    case MetaQuery::DROP_INDEX:
+    case MetaQuery::LIST_INDEXES:
     default: crash("unreachable");
     }
 }
@@ -1105,6 +1166,124 @@ std::string get_primary_key(TableRef *t, runtime_environment_t *env,
     return ns_metadata_it->second.get().primary_key.get();
 }
 
+/* Returns the names of the attributes that have a secondary index on every
+shard of the table. */
+std::vector<std::string> list_sindexes(namespace_repo_t<rdb_protocol_t>::access_t ns_access, runtime_environment_t *env,
+                                       bool use_outdated, const backtrace_t &bt) {
+    rdb_protocol_t::read_t read((rdb_protocol_t::sindex_list_t()));
+    rdb_protocol_t::read_response_t res;
+    try {
+        if (use_outdated) {
+            ns_access.get_namespace_if()->read_outdated(read, &res, env->interruptor);
+        } else {
+            ns_access.get_namespace_if()->read(read, &res, order_token_t::ignore, env->interruptor);
+        }
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform read: " + std::string(e.what()), bt);
+    }
+    rdb_protocol_t::sindex_list_response_t *l_res = boost::get<rdb_protocol_t::sindex_list_response_t>(&res.response);
+    guarantee(l_res);
+    return l_res->attrnames;
+}
+
+std::map<std::string, std::string> read_table_version(namespace_repo_t<rdb_protocol_t>::access_t ns_access,
+                                                                   runtime_environment_t *env, bool use_outdated,
+                                                                   const backtrace_t &bt) {
+    rdb_protocol_t::read_t read((rdb_protocol_t::version_read_t()));
+    rdb_protocol_t::read_response_t res;
+    try {
+        if (use_outdated) {
+            ns_access.get_namespace_if()->read_outdated(read, &res, env->interruptor);
+        } else {
+            ns_access.get_namespace_if()->read(read, &res, order_token_t::ignore, env->interruptor);
+        }
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform read: " + std::string(e.what()), bt);
+    }
+    rdb_protocol_t::version_read_response_t *v_res = boost::get<rdb_protocol_t::version_read_response_t>(&res.response);
+    guarantee(v_res);
+    return v_res->metainfo;
+}
+
+/* Whether `attrname` has an index on the table `table_ref` names, which
+`ns_access` reads. The answer comes out of `env->sindex_cache` if it's there. */
+bool has_sindex(const TableRef &table_ref, namespace_repo_t<rdb_protocol_t>::access_t ns_access, const std::string &attrname,
+                runtime_environment_t *env, const backtrace_t &bt) {
+    std::vector<std::string> attrnames;
+    if (!env->sindex_cache || !env->sindex_cache->find(table_ref, &attrnames)) {
+        int64_t generation = env->sindex_cache ? env->sindex_cache->generation() : 0;
+        attrnames = list_sindexes(ns_access, env, table_ref.use_outdated(), bt);
+        if (env->sindex_cache) {
+            env->sindex_cache->insert(table_ref, attrnames, generation);
+        }
+    }
+    return std::find(attrnames.begin(), attrnames.end(), attrname) != attrnames.end();
+}
+
+void execute_index_meta(MetaQuery *m, runtime_environment_t *env, Response *res, const backtrace_t &bt) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
+    switch (m->type()) {
+    case MetaQuery::CREATE_INDEX: {
+        MetaQuery::Index *index = m->mutable_create_index();
+        std::string pk = get_primary_key(index->mutable_table_ref(), env, bt);
+        if (index->attrname() == pk) {
+            throw runtime_exc_t(strprintf("Attribute %s is the primary key and can't have a secondary index.",
+                                          index->attrname().c_str()), bt.with("attrname"));
+        }
+        namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(index->mutable_table_ref(), env, bt);
+        rdb_protocol_t::write_t write(rdb_protocol_t::sindex_create_t(index->attrname(), pk));
+        rdb_protocol_t::write_response_t response;
+        try {
+            ns_access.get_namespace_if()->write(write, &response, order_token_t::ignore, env->interruptor);
+        } catch (cannot_perform_query_exc_t e) {
+            throw runtime_exc_t("cannot perform write: " + std::string(e.what()), bt);
+        }
+        if (env->sindex_cache) {
+            env->sindex_cache->clear();
+        }
+        if (!boost::get<rdb_protocol_t::sindex_create_response_t>(response.response).success) {
+            throw runtime_exc_t(strprintf("Error during operation `CREATE_INDEX %s`: Entry already exists.",
+                                          index->attrname().c_str()), bt);
+        }
+        res->set_status_code(Response::SUCCESS_EMPTY);
+    } break;
+    case MetaQuery::DROP_INDEX: {
+        MetaQuery::Index *index = m->mutable_drop_index();
+        namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(index->mutable_table_ref(), env, bt);
+        rdb_protocol_t::write_t write(rdb_protocol_t::sindex_drop_t(index->attrname()));
+        rdb_protocol_t::write_response_t response;
+        try {
+            ns_access.get_namespace_if()->write(write, &response, order_token_t::ignore, env->interruptor);
+        } catch (cannot_perform_query_exc_t e) {
+            throw runtime_exc_t("cannot perform write: " + std::string(e.what()), bt);
+        }
+        if (env->sindex_cache) {
+            env->sindex_cache->clear();
+        }
+        if (!boost::get<rdb_protocol_t::sindex_drop_response_t>(response.response).success) {
+            throw runtime_exc_t(strprintf("Error during operation `DROP_INDEX %s`: No entry with that name.",
+                                          index->attrname().c_str()), bt);
+        }
+        res->set_status_code(Response::SUCCESS_EMPTY);
+    } break;
+    case MetaQuery::LIST_INDEXES: {
+        namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(m->mutable_list_indexes(), env, bt);
+        std::vector<std::string> attrnames = list_sindexes(ns_access, env, m->list_indexes().use_outdated(), bt);
+        for (std::vector<std::string>::iterator it = attrnames.begin(); it != attrnames.end(); ++it) {
+            scoped_cJSON_t json(cJSON_CreateString(it->c_str()));
+            res->add_response(json.PrintUnformatted());
+        }
+        res->set_status_code(Response::SUCCESS_STREAM);
+    } break;
+    case MetaQuery::CREATE_DB:
+    case MetaQuery::DROP_DB:
+    case MetaQuery::LIST_DBS:
+    case MetaQuery::CREATE_TABLE:
+    case MetaQuery::DROP_TABLE:
+    case MetaQuery::LIST_TABLES:
+    default: crash("unreachable");
+    }
+}
+
 void execute_query(Query *q, runtime_environment_t *env, Response *res, const scopes_t &scopes, const backtrace_t &backtrace, stream_cache_t *stream_cache) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
     guarantee_debug_throw_release(q->token() == res->token(), backtrace);
     switch(q->type()) {
@@ -1168,11 +1347,12 @@ void execute_read_query(ReadQuery *r, runtime_environment_t *env, Response *res,
     }
 }
 
-void throwing_insert(namespace_repo_t<rdb_protocol_t>::access_t ns_access, const std::string &pk,
-                     boost::shared_ptr<scoped_cJSON_t> data, runtime_environment_t *env,
-                     const backtrace_t &backtrace, bool overwrite,
-                     boost::optional<std::string> *generated_pk_out) {
-    bool generated_key = false;
+/* Checks that `data` can be inserted into a table whose primary key is `pk`,
+gives it a generated primary key if it needs one, and returns the key it goes
+under. */
+static store_key_t prepare_insert(const std::string &pk, boost::shared_ptr<scoped_cJSON_t> data,
+                                  const backtrace_t &backtrace, bool overwrite,
+                                  boost::optional<std::string> *generated_pk_out) {
     if (data->type() != cJSON_Object) {
         throw runtime_exc_t(strprintf("Cannot insert non-object %s", data->Print().c_str()), backtrace);
     }
@@ -1183,7 +1363,6 @@ void throwing_insert(namespace_repo_t<rdb_protocol_t>::access_t ns_access, const
         std::string generated_pk = uuid_to_str(generate_uuid());
         *generated_pk_out = generated_pk;
         data->AddItemToObject(pk.c_str(), cJSON_CreateString(generated_pk.c_str()));
-        generated_key = true;
     }
 
     cJSON *primary_key = data->GetObjectItem(pk.c_str());
@@ -1192,45 +1371,196 @@ void throwing_insert(namespace_repo_t<rdb_protocol_t>::access_t ns_access, const
                                       data->Print().c_str(), cJSON_print_std_string(primary_key).c_str()), backtrace);
     }
 
+    return store_key_t(cJSON_print_primary(primary_key, backtrace));
+}
+
+/* Throws if writing `data` had result `result`. */
+static void check_insert_result(point_write_result_t result, const std::string &pk, boost::shared_ptr<scoped_cJSON_t> data,
+                                const backtrace_t &backtrace, bool overwrite, bool generated_key) {
+    if (generated_key && result == DUPLICATE) {
+        throw runtime_exc_t("Generated key was a duplicate either you've " \
+                "won the uuid lottery or you've intentionally tried to " \
+                "predict the keys rdb would generate... in which case well " \
+                "done.", backtrace);
+    }
+
+    if (!overwrite && result == DUPLICATE) {
+        throw runtime_exc_t(strprintf("Duplicate primary key %s in %s", pk.c_str(), data->Print().c_str()), backtrace);
+    }
+}
+
+void throwing_insert(namespace_repo_t<rdb_protocol_t>::access_t ns_access, const std::string &pk,
+                     boost::shared_ptr<scoped_cJSON_t> data, runtime_environment_t *env,
+                     const backtrace_t &backtrace, bool overwrite,
+                     boost::optional<std::string> *generated_pk_out) {
+    store_key_t key = prepare_insert(pk, data, backtrace, overwrite, generated_pk_out);
+
     try {
-        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(store_key_t(cJSON_print_primary(data->GetObjectItem(pk.c_str()), backtrace)), data, overwrite));
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(key, data, overwrite));
         rdb_protocol_t::write_response_t response;
         ns_access.get_namespace_if()->write(write, &response, order_token_t::ignore, env->interruptor);
 
-        if (generated_key && boost::get<rdb_protocol_t::point_write_response_t>(response.response).result == DUPLICATE) {
-            throw runtime_exc_t("Generated key was a duplicate either you've " \
-                    "won the uuid lottery or you've intentionally tried to " \
-                    "predict the keys rdb would generate... in which case well " \
-                    "done.", backtrace);
-        }
-
-        if (!overwrite && boost::get<rdb_protocol_t::point_write_response_t>(response.response).result == DUPLICATE) {
-            throw runtime_exc_t(strprintf("Duplicate primary key %s in %s", pk.c_str(), data->Print().c_str()), backtrace);
-        }
+        check_insert_result(boost::get<rdb_protocol_t::point_write_response_t>(response.response).result,
+                            pk, data, backtrace, overwrite, static_cast<bool>(*generated_pk_out));
     } catch (cannot_perform_query_exc_t e) {
         throw runtime_exc_t("cannot perform write: " + std::string(e.what()), backtrace);
     }
 }
 
-void nonthrowing_insert(namespace_repo_t<rdb_protocol_t>::access_t ns_access, const std::string &pk,
-                        boost::shared_ptr<scoped_cJSON_t> data, runtime_environment_t *env,
-                        const backtrace_t &backtrace, bool overwrite,
-                        std::vector<std::string> *generated_keys,
-                        int *inserted, int *errors, std::string *first_error) {
-    boost::optional<std::string> generated_key;
-    try {
-        throwing_insert(ns_access, pk, data, env, backtrace, overwrite, &generated_key);
-        *inserted += 1;
-    } catch (const runtime_exc_t &e) {
-        *errors += 1;
-        if (*first_error == "") *first_error = e.as_str();
+/* Inserts rows `RDB_INSERT_BATCH_SIZE` at a time, with up to
+`RDB_INSERT_WINDOW` batches in flight at once. Counts what happened to each
+row, in the order the rows came in, the way inserting them one at a time did:
+a row that can't be inserted is an error, and doesn't stop the others. Rows
+with the same key are never in flight in different batches at once, so they're
+written in the order they came in. */
+class batched_inserter_t {
+public:
+    batched_inserter_t(namespace_repo_t<rdb_protocol_t>::access_t _ns_access, const std::string &_pk, bool _overwrite,
+                       runtime_environment_t *_env, std::vector<std::string> *_generated_keys,
+                       int *_inserted, int *_errors, std::string *_first_error)
+        : ns_access(_ns_access), pk(_pk), overwrite(_overwrite), env(_env), generated_keys(_generated_keys),
+          inserted(_inserted), errors(_errors), first_error(_first_error), current(new batch_t) { }
+
+    void insert(boost::shared_ptr<scoped_cJSON_t> data, const backtrace_t &backtrace) {
+        row_t row;
+        row.data = data;
+        row.backtrace = backtrace;
+        try {
+            row.key = prepare_insert(pk, data, backtrace, overwrite, &row.generated_key);
+            if (in_flight_keys.count(row.key) > 0) {
+                retire(0);
+            }
+        } catch (const runtime_exc_t &e) {
+            row.error = e.as_str();
+        }
+
+        current->rows.push_back(row);
+        if (current->rows.size() >= RDB_INSERT_BATCH_SIZE) {
+            send();
+        }
     }
-    if (generated_key) generated_keys->push_back(*generated_key);
-}
+
+    /* Waits for everything to be written. */
+    void finish() {
+        if (!current->rows.empty()) {
+            send();
+        }
+        retire(0);
+    }
+
+private:
+    struct row_t {
+        store_key_t key;
+        boost::shared_ptr<scoped_cJSON_t> data;
+        backtrace_t backtrace;
+        boost::optional<std::string> generated_key;
+        boost::optional<std::string> error;     // If it was never sent.
+    };
+
+    struct batch_t {
+        batch_t() : interrupted(false) { }
+        std::vector<row_t> rows;
+        cond_t done;
+        rdb_protocol_t::write_response_t response;
+        boost::optional<std::string> write_error;
+        bool interrupted;
+    };
+
+    void send() {
+        boost::shared_ptr<batch_t> batch = current;
+        current.reset(new batch_t);
+
+        rdb_protocol_t::batched_insert_t write(overwrite);
+        for (size_t i = 0; i < batch->rows.size(); ++i) {
+            if (!batch->rows[i].error) {
+                write.rows.push_back(std::make_pair(batch->rows[i].key, batch->rows[i].data));
+                in_flight_keys.insert(batch->rows[i].key);
+            }
+        }
+
+        in_flight.push_back(batch);
+        if (write.rows.empty()) {
+            batch->done.pulse();
+        } else {
+            coro_t::spawn_sometime(boost::bind(&batched_inserter_t::write_batch, this, batch, write,
+                                               auto_drainer_t::lock_t(&drainer)));
+        }
+        retire(RDB_INSERT_WINDOW);
+    }
+
+    void write_batch(boost::shared_ptr<batch_t> batch, const rdb_protocol_t::batched_insert_t &write,
+                     auto_drainer_t::lock_t lock) {
+        try {
+            wait_any_t interruptor(env->interruptor, lock.get_drain_signal());
+            ns_access.get_namespace_if()->write(rdb_protocol_t::write_t(write), &batch->response, order_token_t::ignore, &interruptor);
+        } catch (const cannot_perform_query_exc_t &e) {
+            batch->write_error = "cannot perform write: " + std::string(e.what());
+        } catch (const interrupted_exc_t &) {
+            batch->interrupted = true;
+        }
+        batch->done.pulse();
+    }
+
+    /* Waits for the oldest batches to be written until there are only `keep`
+    in flight, and counts what happened to their rows. */
+    void retire(size_t keep) {
+        while (in_flight.size() > keep) {
+            boost::shared_ptr<batch_t> batch = in_flight.front();
+            in_flight.pop_front();
+            batch->done.wait_lazily_unordered();
+            if (batch->interrupted) {
+                throw interrupted_exc_t();
+            }
+
+            const rdb_protocol_t::batched_insert_response_t *res = NULL;
+            if (!batch->write_error) {
+                res = boost::get<rdb_protocol_t::batched_insert_response_t>(&batch->response.response);
+                guarantee(res);
+            }
+            size_t written = 0;
+            for (size_t i = 0; i < batch->rows.size(); ++i) {
+                const row_t &row = batch->rows[i];
+                try {
+                    if (row.error) {
+                        throw runtime_exc_t(*row.error, row.backtrace);
+                    }
+                    in_flight_keys.erase(in_flight_keys.find(row.key));
+                    if (batch->write_error) {
+                        throw runtime_exc_t(*batch->write_error, row.backtrace);
+                    }
+                    guarantee(written < res->results.size());
+                    check_insert_result(res->results[written++].second, pk, row.data, row.backtrace,
+                                        overwrite, static_cast<bool>(row.generated_key));
+                    *inserted += 1;
+                } catch (const runtime_exc_t &e) {
+                    *errors += 1;
+                    if (*first_error == "") *first_error = row.error ? *row.error : e.as_str();
+                }
+                if (row.generated_key) generated_keys->push_back(*row.generated_key);
+            }
+        }
+    }
+
+    namespace_repo_t<rdb_protocol_t>::access_t ns_access;
+    std::string pk;
+    bool overwrite;
+    runtime_environment_t *env;
+
+    std::vector<std::string> *generated_keys;
+    int *inserted, *errors;
+    std::string *first_error;
+
+    boost::shared_ptr<batch_t> current;
+    std::deque<boost::shared_ptr<batch_t> > in_flight;
+    std::multiset<store_key_t> in_flight_keys;
+
+    auto_drainer_t drainer;
+};
 
 rdb_protocol_t::point_read_response_t read_by_key(namespace_repo_t<rdb_protocol_t>::access_t ns_access, runtime_environment_t *env,
-                                            cJSON *key, bool use_outdated, const backtrace_t &backtrace) {
-    rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(store_key_t(cJSON_print_primary(key, backtrace))));
+                                            cJSON *key, const rdb_protocol_details::transform_t &transform,
+                                            bool use_outdated, const backtrace_t &backtrace) {
+    rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(store_key_t(cJSON_print_primary(key, backtrace)), transform));
     rdb_protocol_t::read_response_t res;
     if (use_outdated) {
         ns_access.get_namespace_if()->read_outdated(read, &res, env->interruptor);
@@ -1242,6 +1572,26 @@ rdb_protocol_t::point_read_response_t read_by_key(namespace_repo_t<rdb_protocol_
     return *p_res;
 }
 
+/* Like `read_by_key()` for each of `keys`, but with one read. */
+std::vector<rdb_protocol_t::point_read_response_t> read_by_keys(namespace_interface_t<rdb_protocol_t> *ns_if, signal_t *interruptor,
+                                                                const std::vector<store_key_t> &keys,
+                                                                const rdb_protocol_details::transform_t &transform, bool use_outdated) {
+    rdb_protocol_t::read_t read(rdb_protocol_t::multi_point_read_t(keys, transform));
+    rdb_protocol_t::read_response_t res;
+    if (use_outdated) {
+        ns_if->read_outdated(read, &res, interruptor);
+    } else {
+        ns_if->read(read, &res, order_token_t::ignore, interruptor);
+    }
+    rdb_protocol_t::multi_point_read_response_t *mp_res = boost::get<rdb_protocol_t::multi_point_read_response_t>(&res.response);
+    guarantee(mp_res && mp_res->rows.size() == keys.size());
+    std::vector<rdb_protocol_t::point_read_response_t> rows;
+    for (size_t i = 0; i < mp_res->rows.size(); ++i) {
+        rows.push_back(mp_res->rows[i].second);
+    }
+    return rows;
+}
+
 /* Returns number of rows deleted. */
 int point_delete(namespace_repo_t<rdb_protocol_t>::access_t ns_access, cJSON *id, runtime_environment_t *env, const backtrace_t &backtrace) {
     try {
@@ -1256,7 +1606,8 @@ int point_delete(namespace_repo_t<rdb_protocol_t>::access_t ns_access, cJSON *id
 
 point_modify_ns::result_t calculate_modify(boost::shared_ptr<scoped_cJSON_t> lhs, const std::string &primary_key, point_modify_ns::op_t op,
                                            const Mapping &mapping, runtime_environment_t *env, const scopes_t &scopes,
-                                           const backtrace_t &backtrace, boost::shared_ptr<scoped_cJSON_t> *json_out,
+                                           const backtrace_t &backtrace, json_arena_t *arena,
+                                           boost::shared_ptr<scoped_cJSON_t> *json_out, const json_value_t **merged_out,
                                            std::string *new_key_out) THROWS_ONLY(runtime_exc_t) {
     guarantee(lhs);
     //CASE 1: UPDATE skips nonexistant entries
@@ -1308,6 +1659,12 @@ point_modify_ns::result_t calculate_modify(boost::shared_ptr<scoped_cJSON_t> lhs
         return point_modify_ns::INSERTED;
     } else { //CASE 5: a normal UPDATE
         guarantee(op == point_modify_ns::UPDATE && lhs->type() == cJSON_Object);
+        if (arena) {
+            // CHECK 1 already made sure the merge keeps the primary key.
+            *merged_out = json_value_t::merge(arena, json_value_t::from_cjson(arena, lhs->get()),
+                                              json_value_t::from_cjson(arena, rhs->get()));
+            return point_modify_ns::MODIFIED;
+        }
         json_out->reset(new scoped_cJSON_t(cJSON_merge(lhs->get(), rhs->get())));
         guarantee_debug_throw_release(cJSON_Equal((*json_out)->GetObjectItem(primary_key.c_str()),
                                                   lhs->GetObjectItem(primary_key.c_str())), backtrace);
@@ -1335,13 +1692,13 @@ point_modify_ns::result_t point_modify(namespace_repo_t<rdb_protocol_t>::access_
                                               opname.c_str(), opname.c_str(), opname.c_str()), backtrace);
             }
             if (!row) { // Get the row if we don't already know it.
-                rdb_protocol_t::point_read_response_t row_read = read_by_key(ns_access, env, id, false, backtrace);
+                rdb_protocol_t::point_read_response_t row_read = read_by_key(ns_access, env, id, rdb_protocol_details::transform_t(), false, backtrace);
                 //TODO: Is it OK to never do an outdated read here?                              ^^^^^
                 row = row_read.data;
             }
             boost::shared_ptr<scoped_cJSON_t> new_row;
             std::string new_key;
-            res = calculate_modify(row, pk, op, m, env, scopes, backtrace, &new_row, &new_key);
+            res = calculate_modify(row, pk, op, m, env, scopes, backtrace, NULL, &new_row, NULL, &new_key);
             switch (res) {
             case point_modify_ns::INSERTED:
                 if (!cJSON_Equal(new_row->GetObjectItem(pk.c_str()), id)) {
@@ -1383,6 +1740,30 @@ int point_delete(namespace_repo_t<rdb_protocol_t>::access_t ns_access, boost::sh
     return point_delete(ns_access, id->get(), env, backtrace);
 }
 
+/* Has the shards modify the rows of `view` themselves, without sending them
+here and back, if the mapping is deterministic and the shards can find the
+view's rows on their own. Otherwise returns nothing. */
+static boost::optional<rdb_protocol_t::range_modify_response_t> range_modify(const view_t &view, range_modify_ns::op_t op,
+                                                                             const boost::optional<Mapping> &mapping,
+                                                                             const scopes_t &scopes, const backtrace_t &backtrace) {
+    if (mapping) {
+        guarantee_debug_throw_release(mapping->body().HasExtension(extension::deterministic), backtrace);
+        if (!mapping->body().GetExtension(extension::deterministic)) {
+            return boost::optional<rdb_protocol_t::range_modify_response_t>();
+        }
+    }
+    return view.stream->apply_modify(rdb_protocol_t::range_modify_t(view.primary_key, key_range_t::universe(),
+                                                                    rdb_protocol_details::transform_t(), op,
+                                                                    scopes, backtrace, mapping));
+}
+
+/* The error to report for `range_res`. If the view's filters threw, the write
+stopped there, which matters more than any row it couldn't modify before. */
+static std::string range_modify_reported_error(const rdb_protocol_t::range_modify_response_t &range_res) {
+    const boost::optional<runtime_exc_t> &e = range_res.exc ? range_res.exc : range_res.first_error;
+    return e ? e->message + "\nBacktrace:\n" + e->backtrace.print() : "";
+}
+
 void execute_write_query(WriteQuery *w, runtime_environment_t *env, Response *res, const scopes_t &scopes, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
     res->set_status_code(Response::SUCCESS_JSON);
     switch (w->type()) {
@@ -1391,23 +1772,31 @@ void execute_write_query(WriteQuery *w, runtime_environment_t *env, Response *re
         std::string reported_error = "";
 
         int updated = 0, errors = 0, skipped = 0;
-        while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
-            guarantee_debug_throw_release(json && json->type() == cJSON_Object, backtrace);
-            try {
-                std::string pk = view.primary_key;
-                cJSON *id = json->GetObjectItem(pk.c_str());
-                point_modify_ns::result_t mres =
-                    point_modify(view.access, pk, id, point_modify_ns::UPDATE, env, w->update().mapping(), scopes,
-                                 w->atomic(), json, backtrace.with("modify_map"));
-                guarantee(mres == point_modify_ns::MODIFIED || mres == point_modify_ns::SKIPPED);
-                updated += (mres == point_modify_ns::MODIFIED);
-                skipped += (mres == point_modify_ns::SKIPPED);
-            } catch (const query_language::broken_client_exc_t &e) {
-                ++errors;
-                if (reported_error == "") reported_error = e.message;
-            } catch (const query_language::runtime_exc_t &e) {
-                ++errors;
-                if (reported_error == "") reported_error = e.message + "\nBacktrace:\n" + e.backtrace.print();
+        if (boost::optional<rdb_protocol_t::range_modify_response_t> range_res =
+                range_modify(view, range_modify_ns::UPDATE, w->update().mapping(), scopes, backtrace.with("modify_map"))) {
+            updated = range_res->modified;
+            skipped = range_res->skipped;
+            errors = range_res->errors + (range_res->exc ? 1 : 0);
+            reported_error = range_modify_reported_error(*range_res);
+        } else {
+            while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
+                guarantee_debug_throw_release(json && json->type() == cJSON_Object, backtrace);
+                try {
+                    std::string pk = view.primary_key;
+                    cJSON *id = json->GetObjectItem(pk.c_str());
+                    point_modify_ns::result_t mres =
+                        point_modify(view.access, pk, id, point_modify_ns::UPDATE, env, w->update().mapping(), scopes,
+                                     w->atomic(), json, backtrace.with("modify_map"));
+                    guarantee(mres == point_modify_ns::MODIFIED || mres == point_modify_ns::SKIPPED);
+                    updated += (mres == point_modify_ns::MODIFIED);
+                    skipped += (mres == point_modify_ns::SKIPPED);
+                } catch (const query_language::broken_client_exc_t &e) {
+                    ++errors;
+                    if (reported_error == "") reported_error = e.message;
+                } catch (const query_language::runtime_exc_t &e) {
+                    ++errors;
+                    if (reported_error == "") reported_error = e.message + "\nBacktrace:\n" + e.backtrace.print();
+                }
             }
         }
         std::string res_list = strprintf("\"updated\": %d, \"skipped\": %d, \"errors\": %d", updated, skipped, errors);
@@ -1422,31 +1811,40 @@ void execute_write_query(WriteQuery *w, runtime_environment_t *env, Response *re
 
         int modified = 0, deleted = 0, errors = 0;
         std::string reported_error = "";
-        while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
-            guarantee_debug_throw_release(json && json->type() == cJSON_Object, backtrace);
-            try {
-                std::string pk = view.primary_key;
-                cJSON *id = json->GetObjectItem(pk.c_str());
-                point_modify_ns::result_t mres =
-                    point_modify(view.access, pk, id, point_modify_ns::MUTATE,
-                                 env, w->mutate().mapping(), scopes,
-                                 w->atomic(), json, backtrace.with("modify_map"));
-                switch(mres) {
-                case point_modify_ns::INSERTED: //if non-atomic (fallthrough)
-                case point_modify_ns::MODIFIED: modified += 1; break;
-                case point_modify_ns::NOP: //if non-atomic (fallthrough)
-                case point_modify_ns::DELETED: deleted += 1; break;
-
-                case point_modify_ns::SKIPPED:
-                case point_modify_ns::ERROR:
-                default: unreachable("bad return value from `point_modify`");
+        if (boost::optional<rdb_protocol_t::range_modify_response_t> range_res =
+                range_modify(view, range_modify_ns::MUTATE, w->mutate().mapping(), scopes, backtrace.with("modify_map"))) {
+            guarantee(range_res->skipped == 0);
+            modified = range_res->modified;
+            deleted = range_res->deleted;
+            errors = range_res->errors + (range_res->exc ? 1 : 0);
+            reported_error = range_modify_reported_error(*range_res);
+        } else {
+            while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
+                guarantee_debug_throw_release(json && json->type() == cJSON_Object, backtrace);
+                try {
+                    std::string pk = view.primary_key;
+                    cJSON *id = json->GetObjectItem(pk.c_str());
+                    point_modify_ns::result_t mres =
+                        point_modify(view.access, pk, id, point_modify_ns::MUTATE,
+                                     env, w->mutate().mapping(), scopes,
+                                     w->atomic(), json, backtrace.with("modify_map"));
+                    switch(mres) {
+                    case point_modify_ns::INSERTED: //if non-atomic (fallthrough)
+                    case point_modify_ns::MODIFIED: modified += 1; break;
+                    case point_modify_ns::NOP: //if non-atomic (fallthrough)
+                    case point_modify_ns::DELETED: deleted += 1; break;
+
+                    case point_modify_ns::SKIPPED:
+                    case point_modify_ns::ERROR:
+                    default: unreachable("bad return value from `point_modify`");
+                    }
+                } catch (const query_language::broken_client_exc_t &e) {
+                    ++errors;
+                    if (reported_error == "") reported_error = e.message;
+                } catch (const query_language::runtime_exc_t &e) {
+                    ++errors;
+                    if (reported_error == "") reported_error = e.message + "\nBacktrace:\n" + e.backtrace.print();
                 }
-            } catch (const query_language::broken_client_exc_t &e) {
-                ++errors;
-                if (reported_error == "") reported_error = e.message;
-            } catch (const query_language::runtime_exc_t &e) {
-                ++errors;
-                if (reported_error == "") reported_error = e.message + "\nBacktrace:\n" + e.backtrace.print();
             }
         }
         std::string res_list = strprintf("\"modified\": %d, \"inserted\": %d, \"deleted\": %d, \"errors\": %d",
@@ -1461,11 +1859,23 @@ void execute_write_query(WriteQuery *w, runtime_environment_t *env, Response *re
         view_t view = eval_term_as_view(w->mutable_delete_()->mutable_view(), env, scopes, backtrace.with("view"));
 
         int deleted = 0;
-        while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
-            deleted += point_delete(view.access, json->GetObjectItem(view.primary_key.c_str()), env, backtrace);
+        std::string reported_error = "";
+        if (boost::optional<rdb_protocol_t::range_modify_response_t> range_res =
+                range_modify(view, range_modify_ns::DELETE, boost::optional<Mapping>(), scopes, backtrace)) {
+            deleted = range_res->deleted;
+            reported_error = range_modify_reported_error(*range_res);
+        } else {
+            while (boost::shared_ptr<scoped_cJSON_t> json = view.stream->next()) {
+                deleted += point_delete(view.access, json->GetObjectItem(view.primary_key.c_str()), env, backtrace);
+            }
         }
 
-        res->add_response(strprintf("{\"deleted\": %d}", deleted));
+        std::string res_list = strprintf("\"deleted\": %d", deleted);
+        if (reported_error != "") {
+            res_list = strprintf("%s, \"errors\": 1, \"first_error\": %s", res_list.c_str(),
+                                 scoped_cJSON_t(cJSON_CreateString(reported_error.c_str())).Print().c_str());
+        }
+        res->add_response("{" + res_list + "}");
     } break;
     case WriteQuery::INSERT: {
         std::string pk = get_primary_key(w->mutable_insert()->mutable_table_ref(), env, backtrace);
@@ -1477,36 +1887,43 @@ void execute_write_query(WriteQuery *w, runtime_environment_t *env, Response *re
         int errors = 0;
         int inserted = 0;
         std::vector<std::string> generated_keys;
-        if (w->insert().terms_size() == 1) {
-            Term *t = w->mutable_insert()->mutable_terms(0);
-            int32_t t_type = t->GetExtension(extension::inferred_type);
-            boost::shared_ptr<json_stream_t> stream;
-            if (t_type == TERM_TYPE_JSON) {
-                boost::shared_ptr<scoped_cJSON_t> data = eval_term_as_json(t, env, scopes, backtrace.with("term:0"));
-                if (data->type() == cJSON_Array) {
-                    stream.reset(new in_memory_stream_t(json_array_iterator_t(data->get())));
-                } else {
-                    nonthrowing_insert(ns_access, pk, data, env, backtrace.with("term:0"), overwrite, &generated_keys,
-                                       &inserted, &errors, &first_error);
+        batched_inserter_t inserter(ns_access, pk, overwrite, env, &generated_keys, &inserted, &errors, &first_error);
+        try {
+            if (w->insert().terms_size() == 1) {
+                Term *t = w->mutable_insert()->mutable_terms(0);
+                int32_t t_type = t->GetExtension(extension::inferred_type);
+                boost::shared_ptr<json_stream_t> stream;
+                if (t_type == TERM_TYPE_JSON) {
+                    boost::shared_ptr<scoped_cJSON_t> data = eval_term_as_json(t, env, scopes, backtrace.with("term:0"));
+                    if (data->type() == cJSON_Array) {
+                        stream.reset(new in_memory_stream_t(json_array_iterator_t(data->get())));
+                    } else {
+                        inserter.insert(data, backtrace.with("term:0"));
+                    }
+                } else if (t_type == TERM_TYPE_STREAM || t_type == TERM_TYPE_VIEW) {
+                    stream = eval_term_as_stream(w->mutable_insert()->mutable_terms(0), env, scopes, backtrace.with("term:0"));
+                } else { unreachable("bad term type"); }
+                if (stream) {
+                    while (boost::shared_ptr<scoped_cJSON_t> data = stream->next()) {
+                        inserter.insert(data, backtrace.with("term:0"));
+                    }
                 }
-            } else if (t_type == TERM_TYPE_STREAM || t_type == TERM_TYPE_VIEW) {
-                stream = eval_term_as_stream(w->mutable_insert()->mutable_terms(0), env, scopes, backtrace.with("term:0"));
-            } else { unreachable("bad term type"); }
-            if (stream) {
-                while (boost::shared_ptr<scoped_cJSON_t> data = stream->next()) {
-                    nonthrowing_insert(ns_access, pk, data, env, backtrace.with("term:0"), overwrite, &generated_keys,
-                                       &inserted, &errors, &first_error);
+            } else {
+                for (int i = 0; i < w->insert().terms_size(); ++i) {
+                    boost::shared_ptr<scoped_cJSON_t> data =
+                        eval_term_as_json(w->mutable_insert()->mutable_terms(i), env, scopes, backtrace.with(strprintf("term:%d", i)));
+                    inserter.insert(data, backtrace.with(strprintf("term:%d", i)));
                 }
             }
-        } else {
-            for (int i = 0; i < w->insert().terms_size(); ++i) {
-                boost::shared_ptr<scoped_cJSON_t> data =
-                    eval_term_as_json(w->mutable_insert()->mutable_terms(i), env, scopes, backtrace.with(strprintf("term:%d", i)));
-                nonthrowing_insert(ns_access, pk, data, env, backtrace.with(strprintf("term:%d", i)), overwrite, &generated_keys,
-                                   &inserted, &errors, &first_error);
-            }
+        } catch (const runtime_exc_t &) {
+            /* The rows before the one that threw get written, the way they
+            were when rows were inserted one at a time. */
+            inserter.finish();
+            throw;
         }
 
+        inserter.finish();
+
         /* Construct a response. */
         boost::shared_ptr<scoped_cJSON_t> res_json(new scoped_cJSON_t(cJSON_CreateObject()));
         res_json->AddItemToObject("inserted", safe_cJSON_CreateNumber(inserted, backtrace));
@@ -1666,6 +2083,341 @@ boost::shared_ptr<scoped_cJSON_t> eval_term_as_json_and_check_either(Term *t, ru
 }
 
 
+/* Compiles a javascript term, unless it's been compiled already. It gets
+every value in scope as an argument. */
+static js::id_t compile_javascript(Term *t, js::runner_t *js, const scopes_t &scopes, const backtrace_t &backtrace) {
+    // TODO(rntz): set up a js::runner_t::req_config_t with an
+    // appropriately-chosen timeout.
+
+    // Check whether the function has been compiled already.
+    if (t->HasExtension(extension::js_id)) {
+        return t->GetExtension(extension::js_id);
+    }
+
+    // Not compiled yet. Compile it and add the extension.
+    std::vector<std::string> argnames;
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > argvals;
+    scopes.scope.dump(&argnames, &argvals);
+    std::string errmsg;
+    js::id_t id = js->compile(argnames, t->javascript(), &errmsg);
+    if (js::INVALID_ID == id) {
+        throw runtime_exc_t("failed to compile javascript: " + errmsg, backtrace);
+    }
+    t->SetExtension(extension::js_id, (int32_t) id);
+    return id;
+}
+
+/* The arguments for a call to a javascript term compiled with
+`compile_javascript()`. */
+static void get_javascript_args(const scopes_t &scopes, std::vector<boost::shared_ptr<scoped_cJSON_t> > *argvals_out,
+                                boost::shared_ptr<scoped_cJSON_t> *object_out) {
+    // We give all values in scope as arguments.
+    // TODO(rntz): this is wasteful double-copying.
+    scopes.scope.dump(NULL, argvals_out);
+
+    // Figure out whether to bind "this" to the implicit object.
+    object_out->reset();
+    if (scopes.implicit_attribute_value.has_value()) {
+        *object_out = scopes.implicit_attribute_value.get_value();
+        if ((*object_out)->type() != cJSON_Object) {
+            // If it's not a JSON object, we have to ignore it ("this"
+            // can't be bound to a non-object).
+            object_out->reset();
+        }
+    }
+}
+
+void eval_javascript_batch(Term *t, const std::string &arg, const std::vector<boost::shared_ptr<scoped_cJSON_t> > &vals,
+                           runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
+                           std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out) {
+    guarantee(t->type() == Term::JAVASCRIPT);
+    results_out->clear();
+    if (vals.empty()) {
+        return;
+    }
+
+    boost::shared_ptr<js::runner_t> js = env->get_js_runner();
+    js::id_t id = js::INVALID_ID;
+
+    for (size_t begin = 0; begin < vals.size(); begin += RDB_JS_BATCH_SIZE) {
+        size_t end = std::min(vals.size(), begin + RDB_JS_BATCH_SIZE);
+        std::vector<js::runner_t::call_args_t> calls(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            scopes_t scopes_copy = scopes;
+            variable_val_scope_t::new_scope_t scope_maker(&scopes_copy.scope, arg, vals[i]);
+            implicit_value_setter_t impliciter(&scopes_copy.implicit_attribute_value, vals[i]);
+            if (id == js::INVALID_ID) {
+                id = compile_javascript(t, js.get(), scopes_copy, backtrace);
+            }
+            get_javascript_args(scopes_copy, &calls[i - begin].args, &calls[i - begin].object);
+        }
+
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > results;
+        std::string errmsg;
+        if (!js->call_batch(id, calls, &results, &errmsg)) {
+            throw runtime_exc_t("failed to evaluate javascript: " + errmsg, backtrace);
+        }
+        results_out->insert(results_out->end(), results.begin(), results.end());
+    }
+}
+
+/* If `c` picks attributes out of a row that a GETBYKEY looks up, as in
+`PICKATTRS(GETBYKEY(...))`, makes it into a mapping of the row. The point read
+carries the mapping to the shard that has the row, which sends back only the
+attributes. */
+static bool get_by_key_projection(const Term::Call &c, Mapping *projection_out) {
+    Builtin::BuiltinType type = c.builtin().type();
+    if (type != Builtin::GETATTR && type != Builtin::HASATTR &&
+        type != Builtin::PICKATTRS && type != Builtin::WITHOUT) {
+        return false;
+    }
+    if (c.args_size() != 1 || c.args(0).type() != Term::GETBYKEY) {
+        return false;
+    }
+
+    projection_out->set_arg("row");
+    Term *body = projection_out->mutable_body();
+    body->set_type(Term::CALL);
+    *body->mutable_call()->mutable_builtin() = c.builtin();
+    Term *row = body->mutable_call()->add_args();
+    row->set_type(Term::VAR);
+    row->set_var("row");
+    return true;
+}
+
+/* Reads the row `get_by_key` looks up. The shard that has it applies
+`transform` to it, if it's there. */
+static rdb_protocol_t::point_read_response_t eval_get_by_key(Term::GetByKey *get_by_key, const rdb_protocol_details::transform_t &transform,
+                                                             runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) {
+    std::string pk = get_primary_key(get_by_key->mutable_table_ref(), env, backtrace);
+
+    if (get_by_key->attrname() != pk) {
+        throw runtime_exc_t(strprintf("Attribute: %s is not the primary key (%s) and thus cannot be selected upon.",
+                                      get_by_key->attrname().c_str(), pk.c_str()), backtrace.with("attrname"));
+    }
+
+    namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(get_by_key->mutable_table_ref(), env, backtrace);
+
+    boost::shared_ptr<scoped_cJSON_t> key = eval_term_as_json(get_by_key->mutable_key(), env, scopes, backtrace.with("key"));
+
+    try {
+        return read_by_key(ns_access, env, key->get(), transform, get_by_key->table_ref().use_outdated(), backtrace);
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform read: " + std::string(e.what()), backtrace);
+    }
+}
+
+/* What the projection a point read carried turned the row into, or NULL if
+the row isn't there or the projection threw. */
+static boost::shared_ptr<scoped_cJSON_t> get_projected_row(const rdb_protocol_t::point_read_response_t &res) {
+    if (!res.transformed) {
+        return boost::shared_ptr<scoped_cJSON_t>();
+    }
+    const std::vector<boost::shared_ptr<scoped_cJSON_t> > *rows =
+        boost::get<std::vector<boost::shared_ptr<scoped_cJSON_t> > >(&*res.transformed);
+    if (!rows) {
+        return boost::shared_ptr<scoped_cJSON_t>();
+    }
+    guarantee(rows->size() == 1);
+    return (*rows)[0];
+}
+
+/* Evaluates a projection of a GETBYKEY (see `get_by_key_projection()`) on the
+shard that has the row. */
+static boost::shared_ptr<scoped_cJSON_t> eval_projected_get_by_key(Term::Call *c, const Mapping &projection, runtime_environment_t *env,
+                                                                   const scopes_t &scopes, const backtrace_t &backtrace) {
+    rdb_protocol_details::transform_t transform(1, rdb_protocol_details::transform_atom_t(projection, scopes, backtrace));
+    rdb_protocol_t::point_read_response_t res =
+        eval_get_by_key(c->mutable_args(0)->mutable_get_by_key(), transform, env, scopes, backtrace.with("arg:0"));
+
+    if (boost::shared_ptr<scoped_cJSON_t> projected = get_projected_row(res)) {
+        return projected;
+    } else if (res.transformed) {
+        throw boost::get<runtime_exc_t>(*res.transformed);
+    } else {
+        // There's no such row, so the shard had nothing to project. Projecting
+        // the null here fails the same way it always has.
+        return eval_mapping(projection, env, scopes, backtrace, res.data);
+    }
+}
+
+/* Evaluates an ARRAY of GETBYKEYs, like `[GETBYKEY(t, 1), GETBYKEY(t, 2)]`,
+with one read, if they all look in the same table and they either all pick
+the same attributes out of their rows or none of them do. Returns NULL if they
+don't. */
+static boost::shared_ptr<scoped_cJSON_t> eval_get_by_keys(Term *t, runtime_environment_t *env, const scopes_t &scopes,
+                                                          const backtrace_t &backtrace) {
+    std::vector<Term::GetByKey *> gets;
+    std::vector<backtrace_t> get_backtraces;
+    boost::optional<Mapping> projection;
+    for (int i = 0; i < t->array_size(); ++i) {
+        Term *elem = t->mutable_array(i);
+        backtrace_t elem_backtrace = backtrace.with(strprintf("elem:%d", i));
+        Mapping elem_projection;
+        bool projected = elem->type() == Term::CALL && get_by_key_projection(elem->call(), &elem_projection);
+        if (projected) {
+            elem = elem->mutable_call()->mutable_args(0);
+            elem_backtrace = elem_backtrace.with("arg:0");
+        } else if (elem->type() != Term::GETBYKEY) {
+            return boost::shared_ptr<scoped_cJSON_t>();
+        }
+
+        if (i == 0) {
+            if (projected) {
+                projection = elem_projection;
+            }
+        } else if (projected != static_cast<bool>(projection) ||
+                   (projected && elem_projection.SerializeAsString() != projection->SerializeAsString()) ||
+                   elem->get_by_key().table_ref().SerializeAsString() != gets[0]->table_ref().SerializeAsString() ||
+                   elem->get_by_key().attrname() != gets[0]->attrname()) {
+            return boost::shared_ptr<scoped_cJSON_t>();
+        }
+        gets.push_back(elem->mutable_get_by_key());
+        get_backtraces.push_back(elem_backtrace);
+    }
+
+    std::string pk = get_primary_key(gets[0]->mutable_table_ref(), env, get_backtraces[0]);
+    if (gets[0]->attrname() != pk) {
+        throw runtime_exc_t(strprintf("Attribute: %s is not the primary key (%s) and thus cannot be selected upon.",
+                                      gets[0]->attrname().c_str(), pk.c_str()), get_backtraces[0].with("attrname"));
+    }
+
+    namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(gets[0]->mutable_table_ref(), env, get_backtraces[0]);
+
+    std::vector<store_key_t> keys;
+    for (size_t i = 0; i < gets.size(); ++i) {
+        boost::shared_ptr<scoped_cJSON_t> key = eval_term_as_json(gets[i]->mutable_key(), env, scopes, get_backtraces[i].with("key"));
+        keys.push_back(store_key_t(cJSON_print_primary(key->get(), get_backtraces[i])));
+    }
+
+    rdb_protocol_details::transform_t transform;
+    if (projection) {
+        transform.push_back(rdb_protocol_details::transform_atom_t(*projection, scopes, backtrace));
+    }
+
+    std::vector<rdb_protocol_t::point_read_response_t> rows;
+    try {
+        rows = read_by_keys(ns_access.get_namespace_if(), env->interruptor, keys, transform, gets[0]->table_ref().use_outdated());
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform read: " + std::string(e.what()), get_backtraces[0]);
+    }
+
+    boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(cJSON_CreateArray()));
+    for (int i = 0; i < t->array_size(); ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row = projection ? get_projected_row(rows[i]) : rows[i].data;
+        if (!row) {
+            // The row isn't there or the projection threw. Evaluating the
+            // element by itself throws the error with the right backtrace.
+            row = eval_term_as_json(t->mutable_array(i), env, scopes, backtrace.with(strprintf("elem:%d", i)));
+        }
+        res->AddItemToArray(row->DeepCopy());
+    }
+    return res;
+}
+
+static int num_fields(const google::protobuf::Message &m) {
+    std::vector<const google::protobuf::FieldDescriptor *> fields;
+    m.GetReflection()->ListFields(m, &fields);
+    return fields.size();
+}
+
+bool get_point_gets(Term *t, std::vector<Term::GetByKey *> *gets_out) {
+    std::vector<Term *> terms;
+    if (t->type() == Term::ARRAY) {
+        if (t->array_size() == 0 || num_fields(*t) != 2) {
+            return false;
+        }
+        for (int i = 0; i < t->array_size(); ++i) {
+            terms.push_back(t->mutable_array(i));
+        }
+    } else {
+        terms.push_back(t);
+    }
+
+    for (size_t i = 0; i < terms.size(); ++i) {
+        if (terms[i]->type() != Term::GETBYKEY || !terms[i]->has_get_by_key() || num_fields(*terms[i]) != 2) {
+            return false;
+        }
+        Term::GetByKey *get = terms[i]->mutable_get_by_key();
+        const Term &key = get->key();
+        bool literal_key = (key.type() == Term::NUMBER && key.has_number()) ||
+                           (key.type() == Term::STRING && key.has_valuestring());
+        if (!literal_key || num_fields(key) != 2) {
+            return false;
+        }
+        if (i != 0 && (get->table_ref().SerializeAsString() != (*gets_out)[0]->table_ref().SerializeAsString() ||
+                       get->attrname() != (*gets_out)[0]->attrname())) {
+            return false;
+        }
+        gets_out->push_back(get);
+    }
+    return true;
+}
+
+bool execute_point_get(Query *q, runtime_environment_t *env, point_get_cache_t *point_get_cache, const backtrace_t &root_backtrace, Response *res) THROWS_ONLY(interrupted_exc_t, runtime_exc_t) {
+    if (q->type() != Query::READ || !q->has_read_query() || q->has_write_query() || q->has_meta_query()) {
+        return false;
+    }
+    Term *t = q->mutable_read_query()->mutable_term();
+    std::vector<Term::GetByKey *> gets;
+    if (!get_point_gets(t, &gets)) {
+        return false;
+    }
+    // Where the errors of the first GETBYKEY would come from if it were evaluated.
+    backtrace_t backtrace = t->type() == Term::ARRAY ? root_backtrace.with("elem:0") : root_backtrace;
+
+    point_get_cache_t::table_t table;
+    if (!point_get_cache->find(gets[0]->table_ref(), &table)) {
+        int64_t generation = point_get_cache->generation();
+        try {
+            table.primary_key = get_primary_key(gets[0]->mutable_table_ref(), env, backtrace);
+            table.ns_access = eval_table_ref(gets[0]->mutable_table_ref(), env, backtrace);
+        } catch (const runtime_exc_t &) {
+            return false;
+        }
+        point_get_cache->insert(gets[0]->table_ref(), table, generation);
+    }
+    return read_point_gets(t, gets, table.primary_key, table.ns_access.get_namespace_if(), env->interruptor, backtrace, res);
+}
+
+bool read_point_gets(Term *t, const std::vector<Term::GetByKey *> &gets, const std::string &primary_key,
+                     namespace_interface_t<rdb_protocol_t> *ns_if, signal_t *interruptor,
+                     const backtrace_t &backtrace, Response *res) THROWS_ONLY(interrupted_exc_t, runtime_exc_t) {
+    if (gets[0]->attrname() != primary_key) {
+        return false;
+    }
+
+    std::vector<store_key_t> keys;
+    try {
+        for (size_t i = 0; i < gets.size(); ++i) {
+            // The keys are literals, which don't need an environment.
+            boost::shared_ptr<scoped_cJSON_t> key = eval_term_as_json(gets[i]->mutable_key(), NULL, scopes_t(), backtrace);
+            keys.push_back(store_key_t(cJSON_print_primary(key->get(), backtrace)));
+        }
+    } catch (const runtime_exc_t &) {
+        return false;
+    }
+
+    std::vector<rdb_protocol_t::point_read_response_t> rows;
+    try {
+        rows = read_by_keys(ns_if, interruptor, keys, rdb_protocol_details::transform_t(), gets[0]->table_ref().use_outdated());
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform read: " + std::string(e.what()), backtrace);
+    }
+
+    if (t->type() == Term::ARRAY) {
+        scoped_cJSON_t array(cJSON_CreateArray());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            array.AddItemToArray(rows[i].data->DeepCopy());
+        }
+        res->add_response(array.PrintUnformatted());
+    } else {
+        res->add_response(rows[0].data->PrintUnformatted());
+    }
+    res->set_status_code(Response::SUCCESS_JSON);
+    return true;
+}
+
 boost::shared_ptr<scoped_cJSON_t> eval_term_as_json(Term *t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
     switch (t->type()) {
     case Term::IMPLICIT_VAR:
@@ -1737,6 +2489,12 @@ boost::shared_ptr<scoped_cJSON_t> eval_term_as_json(Term *t, runtime_environment
         break;
     case Term::ARRAY:
         {
+            if (t->array_size() > 1) {
+                if (boost::shared_ptr<scoped_cJSON_t> rows = eval_get_by_keys(t, env, scopes, backtrace)) {
+                    return rows;
+                }
+            }
+
             boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(cJSON_CreateArray()));
             for (int i = 0; i < t->array_size(); ++i) {
                 res->AddItemToArray(eval_term_as_json(t->mutable_array(i), env, scopes, backtrace.with(strprintf("elem:%d", i)))->DeepCopy());
@@ -1755,38 +2513,15 @@ boost::shared_ptr<scoped_cJSON_t> eval_term_as_json(Term *t, runtime_environment
         }
         break;
     case Term::GETBYKEY:
-        {
-            std::string pk = get_primary_key(t->mutable_get_by_key()->mutable_table_ref(), env, backtrace);
-
-            if (t->get_by_key().attrname() != pk) {
-                throw runtime_exc_t(strprintf("Attribute: %s is not the primary key (%s) and thus cannot be selected upon.",
-                                              t->get_by_key().attrname().c_str(), pk.c_str()), backtrace.with("attrname"));
-            }
-
-            namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(t->mutable_get_by_key()->mutable_table_ref(), env, backtrace);
-
-            boost::shared_ptr<scoped_cJSON_t> key = eval_term_as_json(t->mutable_get_by_key()->mutable_key(), env, scopes, backtrace.with("key"));
-
-            try {
-                rdb_protocol_t::point_read_response_t p_res =
-                    read_by_key(ns_access, env, key->get(), t->get_by_key().table_ref().use_outdated(), backtrace);
-                return p_res.data;
-            } catch (cannot_perform_query_exc_t e) {
-                throw runtime_exc_t("cannot perform read: " + std::string(e.what()), backtrace);
-            }
-            break;
-        }
+        return eval_get_by_key(t->mutable_get_by_key(), rdb_protocol_details::transform_t(), env, scopes, backtrace).data;
     case Term::TABLE:
         crash("Term::TABLE must be evaluated with eval_stream or eval_view");
 
     case Term::JAVASCRIPT: {
-        // TODO(rntz): optimize map/reduce/filter queries whose
-        // mappings/reductions/predicates are just javascript terms by
-        // streaming arguments to them and streaming results back. Should
-        // wait to do this until it's established it's a bottleneck, but
-        // it's a reasonably good bet that it is. Putting this comment here
-        // not because the changes will need to be made here but because
-        // it's the most logical place to put it.
+        // Mappings, predicates and concat-maps that are just javascript
+        // terms don't come through here; `transform_rows()` sends them a
+        // batch of rows at a time with `eval_javascript_batch()`.
+        // TODO(rntz): do the same for reductions.
 
         // TODO (rntz): implicitly bound argument should become receiver
         // ("this") object on javascript side.
@@ -1795,40 +2530,11 @@ boost::shared_ptr<scoped_cJSON_t> eval_term_as_json(Term *t, runtime_environment
         std::string errmsg;
         boost::shared_ptr<scoped_cJSON_t> result;
 
-        // TODO(rntz): set up a js::runner_t::req_config_t with an
-        // appropriately-chosen timeout.
-
-        // Check whether the function has been compiled already.
-        bool compiled = t->HasExtension(extension::js_id);
+        js::id_t id = compile_javascript(t, js.get(), scopes, backtrace);
 
-        // We give all values in scope as arguments.
-        // TODO(rntz): this is wasteful double-copying.
-        std::vector<std::string> argnames; // only used if (!compiled)
         std::vector<boost::shared_ptr<scoped_cJSON_t> > argvals;
-        scopes.scope.dump(compiled ? NULL : &argnames, &argvals);
-
-        js::id_t id;
-        if (compiled) {
-            id = t->GetExtension(extension::js_id);
-        } else {
-            // Not compiled yet. Compile it and add the extension.
-            id = js->compile(argnames, t->javascript(), &errmsg);
-            if (js::INVALID_ID == id) {
-                throw runtime_exc_t("failed to compile javascript: " + errmsg, backtrace);
-            }
-            t->SetExtension(extension::js_id, (int32_t) id);
-        }
-
-        // Figure out whether to bind "this" to the implicit object.
         boost::shared_ptr<scoped_cJSON_t> object;
-        if (scopes.implicit_attribute_value.has_value()) {
-            object = scopes.implicit_attribute_value.get_value();
-            if (object->type() != cJSON_Object) {
-                // If it's not a JSON object, we have to ignore it ("this"
-                // can't be bound to a non-object).
-                object.reset();
-            }
-        }
+        get_javascript_args(scopes, &argvals, &object);
 
         // Evaluate the source.
         result = js->call(id, object, argvals, &errmsg);
@@ -1901,7 +2607,24 @@ boost::shared_ptr<json_stream_t> eval_term_as_stream(Term *t, runtime_environmen
     unreachable();
 }
 
+/* Orders the groups of a GROUPEDMAPREDUCE by group. */
+class group_less_t {
+public:
+    explicit group_less_t(const backtrace_t &_backtrace) : backtrace(_backtrace) { }
+    bool operator()(const std::pair<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t> > &x,
+                    const std::pair<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t> > &y) const {
+        return cJSON_cmp(x.first->get(), y.first->get(), backtrace) < 0;
+    }
+private:
+    backtrace_t backtrace;
+};
+
 boost::shared_ptr<scoped_cJSON_t> eval_call_as_json(Term::Call *c, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
+    Mapping projection;
+    if (get_by_key_projection(*c, &projection)) {
+        return eval_projected_get_by_key(c, projection, env, scopes, backtrace);
+    }
+
     switch (c->builtin().type()) {
         //JSON -> JSON
         case Builtin::NOT:
@@ -2271,10 +2994,11 @@ boost::shared_ptr<scoped_cJSON_t> eval_call_as_json(Term::Call *c, runtime_envir
                     boost::shared_ptr<scoped_cJSON_t> array = eval_term_as_json_and_check(c->mutable_args(0), env, scopes, backtrace.with("arg:0"), cJSON_Array, "LENGTH argument must be an array.");
                     length = array->GetArraySize();
                 } else {
+                    // The stream counts its rows without holding on to them,
+                    // or has the shards count them.
                     boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
-                    while (boost::shared_ptr<scoped_cJSON_t> json = stream->next()) {
-                        ++length;
-                    }
+                    rdb_protocol_t::rget_read_response_t::result_t res = stream->apply_terminal(rdb_protocol_details::Length(), env, scopes, backtrace.with("arg:0"));
+                    length = boost::get<rdb_protocol_t::rget_read_response_t::length_t>(res).length;
                 }
 
                 return boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(safe_cJSON_CreateNumber(length, backtrace)));
@@ -2356,12 +3080,16 @@ boost::shared_ptr<scoped_cJSON_t> eval_call_as_json(Term::Call *c, runtime_envir
                 try {
                     rdb_protocol_t::rget_read_response_t::result_t result = stream->apply_terminal(c->builtin().grouped_map_reduce(), env, scopes, backtrace);
                     rdb_protocol_t::rget_read_response_t::groups_t *groups = boost::get<rdb_protocol_t::rget_read_response_t::groups_t>(&result);
+                    // The groups come back from the shards in no particular
+                    // order, but we always return them sorted by group.
+                    std::vector<std::pair<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t> > > sorted_groups(groups->begin(), groups->end());
+                    std::sort(sorted_groups.begin(), sorted_groups.end(), group_less_t(backtrace));
+
                     boost::shared_ptr<scoped_cJSON_t> res(new scoped_cJSON_t(cJSON_CreateArray()));
-                    std::map<boost::shared_ptr<scoped_cJSON_t>, boost::shared_ptr<scoped_cJSON_t>, shared_scoped_less_t>::iterator it;
-                    for (it = groups->begin(); it != groups->end(); ++it) {
+                    for (size_t i = 0; i < sorted_groups.size(); ++i) {
                         scoped_cJSON_t obj(cJSON_CreateObject());
-                        obj.AddItemToObject("group", it->first->release());
-                        obj.AddItemToObject("reduction", it->second->release());
+                        obj.AddItemToObject("group", sorted_groups[i].first->release());
+                        obj.AddItemToObject("reduction", sorted_groups[i].second->release());
                         res->AddItemToArray(obj.release());
                     }
                     return res;
@@ -2436,48 +3164,44 @@ bool predicate_t::operator()(boost::shared_ptr<scoped_cJSON_t> json) {
     }
 }
 
-class ordering_t {
-public:
-    ordering_t(const google::protobuf::RepeatedPtrField<Builtin::OrderBy> &_order, const backtrace_t &bt)
-        : order(_order), backtrace(bt)
-    { }
+ordering_t::ordering_t(const google::protobuf::RepeatedPtrField<Builtin::OrderBy> &_order, const backtrace_t &bt)
+    : order(_order.begin(), _order.end()), backtrace(bt)
+{ }
 
-    //returns true if x < y according to the ordering
-    bool operator()(const boost::shared_ptr<scoped_cJSON_t> &x, const boost::shared_ptr<scoped_cJSON_t> &y) const {
-        if (x->type() != cJSON_Object) {
-            throw runtime_exc_t(
-                strprintf("Orderby encountered a non-object %s.\n", x->Print().c_str()),
-                backtrace);
-        } else if (y->type() != cJSON_Object) {
-            throw runtime_exc_t(
-                strprintf("Orderby encountered a non-object %s.\n", y->Print().c_str()),
-                backtrace);
-        }
-        for (int i = 0; i < order.size(); ++i) {
-            const Builtin::OrderBy& cur = order.Get(i);
+ordering_t::ordering_t(const std::vector<Builtin::OrderBy> &_order, const backtrace_t &bt)
+    : order(_order), backtrace(bt)
+{ }
 
-            cJSON *a = cJSON_GetObjectItem(x->get(), cur.attr().c_str());
-            cJSON *b = cJSON_GetObjectItem(y->get(), cur.attr().c_str());
+bool ordering_t::operator()(const boost::shared_ptr<scoped_cJSON_t> &x, const boost::shared_ptr<scoped_cJSON_t> &y) const {
+    if (x->type() != cJSON_Object) {
+        throw runtime_exc_t(
+            strprintf("Orderby encountered a non-object %s.\n", x->Print().c_str()),
+            backtrace);
+    } else if (y->type() != cJSON_Object) {
+        throw runtime_exc_t(
+            strprintf("Orderby encountered a non-object %s.\n", y->Print().c_str()),
+            backtrace);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Builtin::OrderBy& cur = order[i];
 
-            if (a == NULL || b == NULL) {
-                std::string str = strprintf("ORDERBY encountered a row missing attr '%s': %s\n", cur.attr().c_str(),
-                                            (a == NULL ? x->Print().c_str() : y->Print().c_str()));
-                throw runtime_exc_t(str, backtrace);
-            }
+        cJSON *a = cJSON_GetObjectItem(x->get(), cur.attr().c_str());
+        cJSON *b = cJSON_GetObjectItem(y->get(), cur.attr().c_str());
 
-            int cmp = cJSON_cmp(a, b, backtrace);
-            if (cmp) {
-                return (cmp > 0) ^ cur.ascending();
-            }
+        if (a == NULL || b == NULL) {
+            std::string str = strprintf("ORDERBY encountered a row missing attr '%s': %s\n", cur.attr().c_str(),
+                                        (a == NULL ? x->Print().c_str() : y->Print().c_str()));
+            throw runtime_exc_t(str, backtrace);
         }
 
-        return false;
+        int cmp = cJSON_cmp(a, b, backtrace);
+        if (cmp) {
+            return (cmp > 0) ^ cur.ascending();
+        }
     }
 
-private:
-    const google::protobuf::RepeatedPtrField<Builtin::OrderBy> &order;
-    backtrace_t backtrace;
-};
+    return false;
+}
 
 /* Renaming map here because otherwise it conflicts with std::map. */
 boost::shared_ptr<scoped_cJSON_t> map_rdb(std::string arg, Term *term, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace, boost::shared_ptr<scoped_cJSON_t> val) {
@@ -2506,6 +3230,199 @@ boost::shared_ptr<json_stream_t> concatmap(std::string arg, Term *term, runtime_
     return eval_term_as_stream(term, env, scopes_copy, backtrace);
 }
 
+/* If the body of `predicate` is an equality between an attribute of its
+argument and a number or string constant, possibly as one conjunct of an ALL,
+finds the attribute and the constant. */
+bool get_equality_constraint(const Predicate &predicate, std::string *attrname_out,
+                             boost::shared_ptr<scoped_cJSON_t> *value_out, const backtrace_t &backtrace) {
+    const Term &body = predicate.body();
+    if (body.type() != Term::CALL) {
+        return false;
+    }
+    const Term::Call &call = body.call();
+    if (call.builtin().type() == Builtin::ALL) {
+        for (int i = 0; i < call.args_size(); ++i) {
+            Predicate conjunct;
+            conjunct.set_arg(predicate.arg());
+            *conjunct.mutable_body() = call.args(i);
+            if (get_equality_constraint(conjunct, attrname_out, value_out, backtrace)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (call.builtin().type() != Builtin::COMPARE || call.builtin().comparison() != Builtin::EQ
+        || call.args_size() != 2) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        const Term &attr = call.args(i);
+        const Term &constant = call.args(1 - i);
+        if (attr.type() != Term::CALL) {
+            continue;
+        }
+        const Builtin &getattr = attr.call().builtin();
+        bool of_argument = (getattr.type() == Builtin::IMPLICIT_GETATTR && attr.call().args_size() == 0)
+            || (getattr.type() == Builtin::GETATTR && attr.call().args_size() == 1
+                && attr.call().args(0).type() == Term::VAR && attr.call().args(0).var() == predicate.arg());
+        if (!of_argument) {
+            continue;
+        }
+        if (constant.type() == Term::NUMBER) {
+            value_out->reset(new scoped_cJSON_t(safe_cJSON_CreateNumber(constant.number(), backtrace)));
+        } else if (constant.type() == Term::STRING) {
+            value_out->reset(new scoped_cJSON_t(cJSON_CreateString(constant.valuestring().c_str())));
+        } else {
+            continue;
+        }
+        *attrname_out = getattr.attr();
+        return true;
+    }
+    return false;
+}
+
+/* Reads the rows of a table whose `attrname` lies between `lowerbound` and
+`upperbound` (closed, either may be NULL) from the primary btree if `attrname`
+is the primary key, or from the secondary index on it if there is one. Sets
+`*index_ordered_out` if the rows come back in ascending order of `attrname`.
+Returns an empty pointer if there's no index to use. The caller still has to
+check the rows against the bounds. */
+boost::shared_ptr<json_stream_t> eval_table_range_as_stream(Term::Table *t, const std::string &attrname,
+                                                            cJSON *lowerbound, cJSON *upperbound,
+                                                            runtime_environment_t *env, const backtrace_t &backtrace,
+                                                            bool *index_ordered_out) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
+    *index_ordered_out = false;
+    if (!lowerbound && !upperbound) {
+        return boost::shared_ptr<json_stream_t>();
+    }
+
+    boost::optional<std::string> lower, upper;
+    if (lowerbound) {
+        lower = cJSON_print_lexicographic(lowerbound);
+    }
+    if (upperbound) {
+        upper = cJSON_print_lexicographic(upperbound);
+    }
+    if ((lower && lower->size() > MAX_KEY_SIZE) || (upper && upper->size() > MAX_KEY_SIZE)) {
+        return boost::shared_ptr<json_stream_t>();
+    }
+
+    bool use_outdated = t->table_ref().use_outdated();
+    namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(t->mutable_table_ref(), env, backtrace);
+    if (attrname == get_primary_key(t->mutable_table_ref(), env, backtrace)) {
+        key_range_t range(lower ? key_range_t::closed : key_range_t::none, store_key_t(lower ? *lower : std::string()),
+                          upper ? key_range_t::closed : key_range_t::none, store_key_t(upper ? *upper : std::string()));
+        return boost::shared_ptr<json_stream_t>(
+            new batched_rget_stream_t(ns_access, env->interruptor, range, 100, env->prefetch_depth,
+                                      env->prefetch_memory_budget, backtrace, use_outdated));
+    }
+
+    if (!has_sindex(t->table_ref(), ns_access, attrname, env, backtrace)) {
+        return boost::shared_ptr<json_stream_t>();
+    }
+    *index_ordered_out = true;
+    return boost::shared_ptr<json_stream_t>(
+        new batched_rget_stream_t(ns_access, env->interruptor, rdb_protocol_details::sindex_range_t(attrname, lower, upper),
+                                  100, env->prefetch_depth, env->prefetch_memory_budget, backtrace, use_outdated));
+}
+
+boost::shared_ptr<json_stream_t> eval_range_as_stream(Term::Call *c, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
+                                                      bool *index_ordered_out) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
+    boost::shared_ptr<scoped_cJSON_t> lowerbound, upperbound;
+
+    Builtin::Range *r = c->mutable_builtin()->mutable_range();
+
+    key_range_t range;
+
+    if (r->has_lowerbound()) {
+        lowerbound = eval_term_as_json(r->mutable_lowerbound(), env, scopes, backtrace.with("lowerbound"));
+        if (lowerbound->type() != cJSON_Number && lowerbound->type() != cJSON_String) {
+            throw runtime_exc_t(strprintf("Lower bound of RANGE must be a string or a number, not %s.",
+                                          lowerbound->Print().c_str()), backtrace.with("lowerbound"));
+        }
+    }
+
+    if (r->has_upperbound()) {
+        upperbound = eval_term_as_json(r->mutable_upperbound(), env, scopes, backtrace.with("upperbound"));
+        if (upperbound->type() != cJSON_Number && upperbound->type() != cJSON_String) {
+            throw runtime_exc_t(strprintf("Lower bound of RANGE must be a string or a number, not %s.",
+                                          upperbound->Print().c_str()), backtrace.with("upperbound"));
+        }
+    }
+
+    if (lowerbound && upperbound) {
+        if (cJSON_cmp(lowerbound->get(), upperbound->get(), backtrace) >= 0) {
+            throw runtime_exc_t(strprintf("Lower bound of RANGE must be <= upper bound (%s vs. %s).",
+                                          lowerbound->Print().c_str(), upperbound->Print().c_str()),
+                                backtrace.with("lowerbound"));
+        }
+
+        range = key_range_t(key_range_t::closed, store_key_t(cJSON_print_primary(lowerbound->get(), backtrace)),
+                            key_range_t::closed, store_key_t(cJSON_print_primary(upperbound->get(), backtrace)));
+    } else if (lowerbound) {
+        range = key_range_t(key_range_t::closed, store_key_t(cJSON_print_primary(lowerbound->get(), backtrace)),
+                            key_range_t::none, store_key_t());
+    } else if (upperbound) {
+        range = key_range_t(key_range_t::none, store_key_t(),
+                            key_range_t::closed, store_key_t(cJSON_print_primary(upperbound->get(), backtrace)));
+    }
+
+    // A RANGE directly on a table reads only the matching part of the primary
+    // btree or of a secondary index, instead of the whole table. Rows that
+    // don't have the attribute aren't in the index, and `range_stream_t` skips
+    // them too, so it doesn't matter which way the rows come.
+    boost::shared_ptr<json_stream_t> stream;
+    *index_ordered_out = false;
+    if (c->args(0).type() == Term::TABLE) {
+        stream = eval_table_range_as_stream(c->mutable_args(0)->mutable_table(), r->attrname(),
+                                            lowerbound ? lowerbound->get() : NULL, upperbound ? upperbound->get() : NULL,
+                                            env, backtrace.with("arg:0"), index_ordered_out);
+    }
+    if (!stream) {
+        stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
+    }
+
+    return boost::shared_ptr<json_stream_t>(
+        new range_stream_t(stream, range, r->attrname(), backtrace));
+}
+
+/* Evaluates an ORDERBY. If `limit` is set only that many rows from the front of
+the result will be read, which saves keeping the rest around. */
+boost::shared_ptr<json_stream_t> eval_orderby_as_stream(Term::Call *c, runtime_environment_t *env, const scopes_t &scopes,
+                                                        const backtrace_t &backtrace, boost::optional<size_t> limit) {
+    ordering_t o(c->builtin().order_by(), backtrace.with("order_by"));
+
+    // A secondary index already returns a RANGE in ascending order of its
+    // attribute, so there's nothing to sort.
+    Term *arg = c->mutable_args(0);
+    boost::shared_ptr<json_stream_t> stream;
+    if (c->builtin().order_by_size() == 1 && c->builtin().order_by(0).ascending()
+        && arg->type() == Term::CALL && arg->call().builtin().type() == Builtin::RANGE
+        && arg->call().builtin().range().attrname() == c->builtin().order_by(0).attr()) {
+        bool index_ordered;
+        stream = eval_range_as_stream(arg->mutable_call(), env, scopes, backtrace.with("arg:0"), &index_ordered);
+        if (index_ordered) {
+            return stream;
+        }
+    } else {
+        stream = eval_term_as_stream(arg, env, scopes, backtrace.with("arg:0"));
+    }
+
+    if (limit && *limit <= RDB_SORT_PUSHDOWN_LIMIT) {
+        // Reading a table, the shards can each sort their part and send back
+        // only the first `limit` rows. They send them all at once, so it's
+        // only worth it for a few.
+        rdb_protocol_details::sorting_t sorting(o.get_order(), *limit, backtrace.with("order_by"));
+        if (boost::shared_ptr<json_stream_t> sorted_stream = stream->add_sorting(sorting)) {
+            return sorted_stream;
+        }
+    }
+
+    return boost::shared_ptr<json_stream_t>(new sort_stream_t<ordering_t>(stream, o, limit, env->io_backender,
+                                                                          env->temp_directory, env->sort_memory_budget));
+}
+
 boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
     switch (c->builtin().type()) {
         //JSON -> JSON
@@ -2540,7 +3457,21 @@ boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_envi
         } break;
         case Builtin::FILTER:
             {
-                boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
+                // If the predicate pins an indexed attribute to a constant,
+                // only read the rows with that value. The predicate still
+                // has to be applied to them.
+                boost::shared_ptr<json_stream_t> stream;
+                std::string attrname;
+                boost::shared_ptr<scoped_cJSON_t> value;
+                if (c->args(0).type() == Term::TABLE
+                    && get_equality_constraint(c->builtin().filter().predicate(), &attrname, &value, backtrace.with("predicate"))) {
+                    bool index_ordered;
+                    stream = eval_table_range_as_stream(c->mutable_args(0)->mutable_table(), attrname, value->get(), value->get(),
+                                                        env, backtrace.with("arg:0"), &index_ordered);
+                }
+                if (!stream) {
+                    stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
+                }
                 return stream->add_transformation(c->builtin().filter(), env, scopes, backtrace.with("predicate"));
             }
             break;
@@ -2556,28 +3487,19 @@ boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_envi
                 return stream->add_transformation(c->builtin().concat_map(), env, scopes, backtrace.with("mapping"));
             }
             break;
-        case Builtin::ORDERBY: {
-            ordering_t o(c->builtin().order_by(), backtrace.with("order_by"));
-            boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
-
-            boost::shared_ptr<in_memory_stream_t> sorted_stream(new in_memory_stream_t(stream));
-            sorted_stream->sort(o);
-            return sorted_stream;
-        }
+        case Builtin::ORDERBY:
+            return eval_orderby_as_stream(c, env, scopes, backtrace, boost::optional<size_t>());
             break;
         case Builtin::DISTINCT:
             {
                 boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
 
-                shared_scoped_less_t comparator(backtrace);
-
-                return boost::shared_ptr<json_stream_t>(new distinct_stream_t<shared_scoped_less_t>(stream, comparator));
+                return boost::shared_ptr<json_stream_t>(new hash_distinct_stream_t(stream, env->io_backender, env->temp_directory,
+                                                                                   env->hash_memory_budget));
             }
             break;
         case Builtin::SLICE:
             {
-                boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
-
                 int start, stop;
                 bool stop_unbounded = false;
 
@@ -2613,6 +3535,16 @@ boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_envi
                     throw runtime_exc_t("Slice stop cannot be before slice start", backtrace.with("arg:2"));
                 }
 
+                // Only the first `stop` rows of a sorted stream get read, so
+                // there's no need to sort the rest.
+                boost::shared_ptr<json_stream_t> stream;
+                Term *arg = c->mutable_args(0);
+                if (!stop_unbounded && arg->type() == Term::CALL && arg->call().builtin().type() == Builtin::ORDERBY) {
+                    stream = eval_orderby_as_stream(arg->mutable_call(), env, scopes, backtrace.with("arg:0"), size_t(stop));
+                } else {
+                    stream = eval_term_as_stream(arg, env, scopes, backtrace.with("arg:0"));
+                }
+
                 return boost::shared_ptr<json_stream_t>(new slice_stream_t(stream, start, stop_unbounded, stop));
             }
         case Builtin::UNION:
@@ -2637,50 +3569,8 @@ boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_envi
             break;
         case Builtin::RANGE:
             {
-                // TODO: ***use an index***
-                boost::shared_ptr<json_stream_t> stream = eval_term_as_stream(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
-
-                boost::shared_ptr<scoped_cJSON_t> lowerbound, upperbound;
-
-                Builtin::Range *r = c->mutable_builtin()->mutable_range();
-
-                key_range_t range;
-
-                if (r->has_lowerbound()) {
-                    lowerbound = eval_term_as_json(r->mutable_lowerbound(), env, scopes, backtrace.with("lowerbound"));
-                    if (lowerbound->type() != cJSON_Number && lowerbound->type() != cJSON_String) {
-                        throw runtime_exc_t(strprintf("Lower bound of RANGE must be a string or a number, not %s.",
-                                                      lowerbound->Print().c_str()), backtrace.with("lowerbound"));
-                    }
-                }
-
-                if (r->has_upperbound()) {
-                    upperbound = eval_term_as_json(r->mutable_upperbound(), env, scopes, backtrace.with("upperbound"));
-                    if (upperbound->type() != cJSON_Number && upperbound->type() != cJSON_String) {
-                        throw runtime_exc_t(strprintf("Lower bound of RANGE must be a string or a number, not %s.",
-                                                      upperbound->Print().c_str()), backtrace.with("upperbound"));
-                    }
-                }
-
-                if (lowerbound && upperbound) {
-                    if (cJSON_cmp(lowerbound->get(), upperbound->get(), backtrace) >= 0) {
-                        throw runtime_exc_t(strprintf("Lower bound of RANGE must be <= upper bound (%s vs. %s).",
-                                                      lowerbound->Print().c_str(), upperbound->Print().c_str()),
-                                            backtrace.with("lowerbound"));
-                    }
-
-                    range = key_range_t(key_range_t::closed, store_key_t(cJSON_print_primary(lowerbound->get(), backtrace)),
-                                        key_range_t::closed, store_key_t(cJSON_print_primary(upperbound->get(), backtrace)));
-                } else if (lowerbound) {
-                    range = key_range_t(key_range_t::closed, store_key_t(cJSON_print_primary(lowerbound->get(), backtrace)),
-                                        key_range_t::none, store_key_t());
-                } else if (upperbound) {
-                    range = key_range_t(key_range_t::none, store_key_t(),
-                                        key_range_t::closed, store_key_t(cJSON_print_primary(upperbound->get(), backtrace)));
-                }
-
-                return boost::shared_ptr<json_stream_t>(
-                    new range_stream_t(stream, range, r->attrname(), backtrace));
+                bool index_ordered;
+                return eval_range_as_stream(c, env, scopes, backtrace, &index_ordered);
             } break;
         default:
             crash("unreachable");
@@ -2761,8 +3651,9 @@ view_t eval_call_as_view(Term::Call *c, runtime_environment_t *env, const scopes
                 ordering_t o(c->builtin().order_by(), backtrace.with("order_by"));
                 view_t view = eval_term_as_view(c->mutable_args(0), env, scopes, backtrace.with("arg:0"));
 
-                boost::shared_ptr<in_memory_stream_t> sorted_stream(new in_memory_stream_t(view.stream));
-                sorted_stream->sort(o);
+                boost::shared_ptr<json_stream_t> sorted_stream(
+                    new sort_stream_t<ordering_t>(view.stream, o, boost::optional<size_t>(), env->io_backender,
+                                                  env->temp_directory, env->sort_memory_budget));
                 return view_t(view.access, view.primary_key, sorted_stream);
             }
             break;
@@ -2864,7 +3755,8 @@ view_t eval_term_as_view(Term *t, runtime_environment_t *env, const scopes_t &sc
 view_t eval_table_as_view(Term::Table *t, runtime_environment_t *env, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t) {
     namespace_repo_t<rdb_protocol_t>::access_t ns_access = eval_table_ref(t->mutable_table_ref(), env, backtrace);
     std::string pk = get_primary_key(t->mutable_table_ref(), env, backtrace);
-    boost::shared_ptr<json_stream_t> stream(new batched_rget_stream_t(ns_access, env->interruptor, key_range_t::universe(), 100, backtrace, t->table_ref().use_outdated()));
+    boost::shared_ptr<json_stream_t> stream(new batched_rget_stream_t(ns_access, env->interruptor, key_range_t::universe(), 100, env->prefetch_depth,
+                                                                      env->prefetch_memory_budget, backtrace, t->table_ref().use_outdated()));
     return view_t(ns_access, pk, stream);
 }
 
@@ -22,16 +22,24 @@
 #include "rdb_protocol/backtrace.hpp"
 #include "rdb_protocol/exceptions.hpp"
 #include "rdb_protocol/js.hpp"
+#include "rdb_protocol/json_value.hpp"
 #include "rdb_protocol/protocol.hpp"
 #include "rdb_protocol/query_language.pb.h"
 #include "rdb_protocol/scope.hpp"
 #include "rdb_protocol/stream.hpp"
 #include "rdb_protocol/environment.hpp"
 
+class point_get_cache_t;
+
 void wait_for_rdb_table_readiness(namespace_repo_t<rdb_protocol_t> *ns_repo, namespace_id_t namespace_id, signal_t *interruptor, boost::shared_ptr<semilattice_readwrite_view_t<cluster_semilattice_metadata_t> > semilattice_metadata) THROWS_ONLY(interrupted_exc_t);
 
 namespace query_language {
 
+/* Throws if `d` is infinite or NaN, which JSON can't represent. */
+cJSON *safe_cJSON_CreateNumber(double d, const backtrace_t &backtrace);
+
+boost::shared_ptr<scoped_cJSON_t> shared_scoped_json(cJSON *json);
+
 /* These functions throw exceptions if their inputs aren't well defined or
 fail type-checking. (A well-defined input has the correct fields filled in.) */
 
@@ -45,9 +53,14 @@ void check_read_query_type(ReadQuery *rq, type_checking_environment_t *env, bool
 void check_write_query_type(WriteQuery *wq, type_checking_environment_t *env, bool *is_det_out, const backtrace_t &backtrace);
 void check_query_type(Query *q, type_checking_environment_t *env, bool *is_det_out, const backtrace_t &backtrace);
 
+/* Works out what a modify does to the row `lhs`, which is null if there's no
+row. If `arena` isn't NULL, an UPDATE builds the new row there, sharing what
+didn't change with `lhs`, and returns it in `*merged_out` instead of
+`*json_out`. */
 point_modify_ns::result_t calculate_modify(boost::shared_ptr<scoped_cJSON_t> lhs, const std::string &primary_key, point_modify_ns::op_t op,
                                            const Mapping &mapping, runtime_environment_t *env, const scopes_t &scopes,
-                                           const backtrace_t &backtrace, boost::shared_ptr<scoped_cJSON_t> *json_out,
+                                           const backtrace_t &backtrace, json_arena_t *arena,
+                                           boost::shared_ptr<scoped_cJSON_t> *json_out, const json_value_t **merged_out,
                                            std::string *new_key_out) THROWS_ONLY(runtime_exc_t);
 
 /* functions to evaluate the queries */
@@ -56,6 +69,24 @@ point_modify_ns::result_t calculate_modify(boost::shared_ptr<scoped_cJSON_t> lhs
 
 void execute_query(Query *q, runtime_environment_t *, Response *res, const scopes_t &scopes, const backtrace_t &backtrace, stream_cache_t *stream_cache) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t);
 
+/* Picks out the GETBYKEYs of a point get, if `t` is one and is put together so
+that type checking it couldn't fail. */
+bool get_point_gets(Term *t, std::vector<Term::GetByKey *> *gets_out);
+
+/* Answers `q` without type checking or evaluating it, if it's a point get: a
+GETBYKEY of a number or string, or an ARRAY of them that look in the same
+table. The table is looked up in `point_get_cache`, and remembered there if it
+isn't already. Returns false if `q` has to be run the usual way, which includes
+anything it could be wrong about, so that the usual errors come out. */
+bool execute_point_get(Query *q, runtime_environment_t *, point_get_cache_t *point_get_cache, const backtrace_t &backtrace, Response *res) THROWS_ONLY(interrupted_exc_t, runtime_exc_t);
+
+/* The rest of `execute_point_get()` once it has found the table: reads the
+rows that `gets`, the GETBYKEYs of `t`, look up from `ns_if`, and puts them in
+`res`. Returns false if they don't look up `primary_key`. */
+bool read_point_gets(Term *t, const std::vector<Term::GetByKey *> &gets, const std::string &primary_key,
+                     namespace_interface_t<rdb_protocol_t> *ns_if, signal_t *interruptor,
+                     const backtrace_t &backtrace, Response *res) THROWS_ONLY(interrupted_exc_t, runtime_exc_t);
+
 void execute_read_query(ReadQuery *r, runtime_environment_t *, Response *res, const scopes_t &scopes, const backtrace_t &backtrace, stream_cache_t *stream_cache) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t);
 
 void execute_write_query(WriteQuery *r, runtime_environment_t *, Response *res, const scopes_t &scopes, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t);
@@ -70,6 +101,11 @@ boost::shared_ptr<json_stream_t> eval_call_as_stream(Term::Call *c, runtime_envi
 
 namespace_repo_t<rdb_protocol_t>::access_t eval_table_ref(TableRef *t, runtime_environment_t *, const backtrace_t &backtrace) THROWS_ONLY(interrupted_exc_t, runtime_exc_t, broken_client_exc_t);
 
+/* The version of every shard of the table; any write to the table changes it. */
+std::map<std::string, std::string> read_table_version(namespace_repo_t<rdb_protocol_t>::access_t ns_access,
+                                                                   runtime_environment_t *env, bool use_outdated,
+                                                                   const backtrace_t &bt);
+
 class view_t {
 public:
     view_t(const namespace_repo_t<rdb_protocol_t>::access_t &_access,
@@ -100,6 +136,22 @@ private:
     backtrace_t backtrace;
 };
 
+class ordering_t {
+public:
+    ordering_t(const google::protobuf::RepeatedPtrField<Builtin::OrderBy> &_order, const backtrace_t &bt);
+    ordering_t(const std::vector<Builtin::OrderBy> &_order, const backtrace_t &bt);
+
+    //returns true if x < y according to the ordering
+    bool operator()(const boost::shared_ptr<scoped_cJSON_t> &x, const boost::shared_ptr<scoped_cJSON_t> &y) const;
+
+    const std::vector<Builtin::OrderBy> &get_order() const { return order; }
+
+private:
+    // A copy, since a sorted stream may outlive the query.
+    std::vector<Builtin::OrderBy> order;
+    backtrace_t backtrace;
+};
+
 boost::shared_ptr<scoped_cJSON_t> eval_mapping(Mapping m, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
                                                boost::shared_ptr<scoped_cJSON_t> val);
 
@@ -107,6 +159,13 @@ boost::shared_ptr<scoped_cJSON_t> map_rdb(std::string arg, Term *term, runtime_e
 
 boost::shared_ptr<json_stream_t> concatmap(std::string arg, Term *term, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace, boost::shared_ptr<scoped_cJSON_t> val);
 
+/* Evaluates the javascript term `t` once for each of `vals`, with `arg` (and
+the implicit variable) bound to it, in as few round trips to the javascript
+process as possible. */
+void eval_javascript_batch(Term *t, const std::string &arg, const std::vector<boost::shared_ptr<scoped_cJSON_t> > &vals,
+                           runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace,
+                           std::vector<boost::shared_ptr<scoped_cJSON_t> > *results_out);
+
 } //namespace query_language
 
 #endif /* RDB_PROTOCOL_QUERY_LANGUAGE_HPP_ */
@@ -1,6 +1,9 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
 #include <string.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "rdb_protocol/exceptions.hpp"
 #include "rdb_protocol/rdb_protocol_json.hpp"
 #include "utils.hpp"
@@ -106,6 +109,131 @@ int cJSON_cmp(cJSON *l, cJSON *r, const backtrace_t &backtrace) {
     unreachable();
 }
 
+namespace cJSON_hashing {
+// 64-bit FNV-1a.
+const uint64_t offset_basis = 14695981039346656037ULL;
+const uint64_t prime = 1099511628211ULL;
+
+uint64_t add_bytes(uint64_t h, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ bytes[i]) * prime;
+    }
+    return h;
+}
+
+uint64_t add_uint64(uint64_t h, uint64_t x) {
+    uint8_t bytes[sizeof(x)];
+    for (size_t i = 0; i < sizeof(x); ++i) {
+        bytes[i] = x >> (8 * i);
+    }
+    return add_bytes(h, bytes, sizeof(bytes));
+}
+
+class member_name_less_t {
+public:
+    bool operator()(const cJSON *x, const cJSON *y) const {
+        return strcmp(x->string, y->string) < 0;
+    }
+};
+
+/* An object's members, sorted by name. Members of the same name stay in the
+order they're in. */
+std::vector<cJSON *> sorted_members(cJSON *json) {
+    std::vector<cJSON *> members;
+    for (cJSON *child = json->child; child; child = child->next) {
+        members.push_back(child);
+    }
+    std::stable_sort(members.begin(), members.end(), member_name_less_t());
+    return members;
+}
+
+uint64_t hash(cJSON *json, uint64_t h) {
+    h = add_uint64(h, json->type);
+    switch (json->type) {
+        case cJSON_False:
+        case cJSON_True:
+        case cJSON_NULL:
+            return h;
+        case cJSON_Number: {
+            // 0.0 and -0.0 compare equal, so they had better hash the same.
+            double d = json->valuedouble == 0 ? 0.0 : json->valuedouble;
+            uint64_t bits;
+            CT_ASSERT(sizeof(bits) == sizeof(d));
+            memcpy(&bits, &d, sizeof(bits));
+            return add_uint64(h, bits);
+        }
+        case cJSON_String:
+            return add_bytes(h, json->valuestring, strlen(json->valuestring));
+        case cJSON_Array: {
+            int size = cJSON_GetArraySize(json);
+            h = add_uint64(h, size);
+            for (cJSON *child = json->child; child; child = child->next) {
+                h = hash(child, h);
+            }
+            return h;
+        }
+        case cJSON_Object: {
+            // Members in a different order make the same object.
+            std::vector<cJSON *> members = sorted_members(json);
+            h = add_uint64(h, members.size());
+            for (size_t i = 0; i < members.size(); ++i) {
+                h = add_bytes(h, members[i]->string, strlen(members[i]->string) + 1);
+                h = hash(members[i], h);
+            }
+            return h;
+        }
+        default:
+            unreachable();
+    }
+}
+}
+
+uint64_t cJSON_hash(cJSON *json, uint64_t seed) {
+    return cJSON_hashing::hash(json, cJSON_hashing::add_uint64(cJSON_hashing::offset_basis, seed));
+}
+
+bool cJSON_equal(cJSON *l, cJSON *r) {
+    if (l->type != r->type) {
+        return false;
+    }
+    switch (l->type) {
+        case cJSON_False:
+        case cJSON_True:
+        case cJSON_NULL:
+            return true;
+        case cJSON_Number:
+            return !(l->valuedouble < r->valuedouble) && !(l->valuedouble > r->valuedouble);
+        case cJSON_String:
+            return strcmp(l->valuestring, r->valuestring) == 0;
+        case cJSON_Array: {
+            cJSON *lchild = l->child, *rchild = r->child;
+            for (; lchild && rchild; lchild = lchild->next, rchild = rchild->next) {
+                if (!cJSON_equal(lchild, rchild)) {
+                    return false;
+                }
+            }
+            return !lchild && !rchild;
+        }
+        case cJSON_Object: {
+            std::vector<cJSON *> lmembers = cJSON_hashing::sorted_members(l),
+                                 rmembers = cJSON_hashing::sorted_members(r);
+            if (lmembers.size() != rmembers.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < lmembers.size(); ++i) {
+                if (strcmp(lmembers[i]->string, rmembers[i]->string) != 0 ||
+                    !cJSON_equal(lmembers[i], rmembers[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            unreachable();
+    }
+}
+
 void require_type(const cJSON *json, int type, const backtrace_t &b) {
     if (json->type != type) {
         throw runtime_exc_t(strprintf("Required type: %s but found %s.",
@@ -30,6 +30,31 @@ private:
     backtrace_t backtrace;
 };
 
+/* Whether `l` and `r` are the same value. It agrees with `cJSON_cmp()` where
+that's defined, and goes on to compare objects member by member, in any order,
+rather than throwing. */
+bool cJSON_equal(cJSON *l, cJSON *r);
+
+/* A hash that agrees with `cJSON_equal()`: equal values hash the same. It only
+depends on the value, so it's the same on every machine and from one run to the
+next; different `seed`s give unrelated hashes. */
+uint64_t cJSON_hash(cJSON *json, uint64_t seed = 0);
+
+class shared_scoped_hash_t {
+public:
+    size_t operator()(const boost::shared_ptr<scoped_cJSON_t> &a) const {
+        return cJSON_hash(a->get());
+    }
+};
+
+class shared_scoped_equal_t {
+public:
+    bool operator()(const boost::shared_ptr<scoped_cJSON_t> &a,
+                    const boost::shared_ptr<scoped_cJSON_t> &b) const {
+        return cJSON_equal(a->get(), b->get());
+    }
+};
+
 void require_type(const cJSON *, int type, const backtrace_t &);
 
 } //namespace query_language
@@ -0,0 +1,77 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/sindex_cache.hpp"
+
+#include "errors.hpp"
+#include <boost/bind.hpp>
+
+#include "arch/runtime/runtime.hpp"
+#include "concurrency/cross_thread_watchable.hpp"
+#include "concurrency/pmap.hpp"
+#include "config/args.hpp"
+
+namespace {
+
+std::pair<std::string, std::string> table_name(const TableRef &table_ref) {
+    return std::make_pair(table_ref.db_name(), table_ref.table_name());
+}
+
+}  // anonymous namespace
+
+sindex_cache_t::sindex_cache_t(rdb_protocol_t::context_t *ctx)
+    : caches(ctx) { }
+
+bool sindex_cache_t::find(const TableRef &table_ref, std::vector<std::string> *attrnames_out) {
+    return caches.get()->find(table_name(table_ref), attrnames_out);
+}
+
+int64_t sindex_cache_t::generation() {
+    return caches.get()->generation();
+}
+
+void sindex_cache_t::insert(const TableRef &table_ref, const std::vector<std::string> &attrnames, int64_t generation) {
+    caches.get()->insert(table_name(table_ref), attrnames, generation);
+}
+
+void sindex_cache_t::clear() {
+    pmap(get_num_threads(), boost::bind(&sindex_cache_t::clear_on_thread, this, _1));
+}
+
+void sindex_cache_t::clear_on_thread(int thread) {
+    on_thread_t th(thread);
+    caches.get()->clear();
+}
+
+sindex_cache_t::thread_cache_t::thread_cache_t(rdb_protocol_t::context_t *ctx)
+    : generation_(0),
+      namespaces_subscription(boost::bind(&sindex_cache_t::thread_cache_t::clear, this)) {
+    clone_ptr_t<watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > > > namespaces =
+        ctx->cross_thread_namespace_watchables[get_thread_id()]->get_watchable();
+    watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > >::freeze_t freeze(namespaces);
+    namespaces_subscription.reset(namespaces, &freeze);
+}
+
+bool sindex_cache_t::thread_cache_t::find(const std::pair<std::string, std::string> &name, std::vector<std::string> *attrnames_out) {
+    std::map<std::pair<std::string, std::string>, entry_t>::iterator it = tables.find(name);
+    if (it == tables.end()) {
+        return false;
+    }
+    if (get_ticks() - it->second.time > secs_to_ticks(RDB_SINDEX_CACHE_TIMEOUT_MS / 1000.0)) {
+        tables.erase(it);
+        return false;
+    }
+    *attrnames_out = it->second.attrnames;
+    return true;
+}
+
+void sindex_cache_t::thread_cache_t::insert(const std::pair<std::string, std::string> &name, const std::vector<std::string> &attrnames, int64_t generation) {
+    if (generation == generation_) {
+        entry_t *entry = &tables[name];
+        entry->attrnames = attrnames;
+        entry->time = get_ticks();
+    }
+}
+
+void sindex_cache_t::thread_cache_t::clear() {
+    tables.clear();
+    ++generation_;
+}
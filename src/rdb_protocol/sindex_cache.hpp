@@ -0,0 +1,73 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#ifndef RDB_PROTOCOL_SINDEX_CACHE_HPP_
+#define RDB_PROTOCOL_SINDEX_CACHE_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "errors.hpp"
+
+#include "clustering/administration/namespace_metadata.hpp"
+#include "concurrency/one_per_thread.hpp"
+#include "concurrency/watchable.hpp"
+#include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/query_language.pb.h"
+#include "utils.hpp"
+
+/* Remembers which attributes of each table have a secondary index, so that a
+RANGE or an equality FILTER doesn't have to ask every shard of its table each
+time. Like `point_get_cache_t`, each thread has entries of its own, which it
+forgets whenever its copy of the namespace metadata changes. Creating or
+dropping an index through this server forgets them on every thread; one created
+or dropped through another server is noticed once the entry is
+`RDB_SINDEX_CACHE_TIMEOUT_MS` old. */
+class sindex_cache_t {
+public:
+    explicit sindex_cache_t(rdb_protocol_t::context_t *ctx);
+
+    /* Copies out the attributes that have an index on the table `table_ref`
+    names, if they're known. */
+    bool find(const TableRef &table_ref, std::vector<std::string> *attrnames_out);
+
+    /* As for `point_get_cache_t`: a list read while it was `generation` can
+    be remembered with `insert()`, which ignores it if the entries have been
+    forgotten since. */
+    int64_t generation();
+    void insert(const TableRef &table_ref, const std::vector<std::string> &attrnames, int64_t generation);
+
+    /* Forgets everything, on every thread, so that an index created or
+    dropped through this server is used or not from now on. */
+    void clear();
+
+private:
+    class thread_cache_t {
+    public:
+        explicit thread_cache_t(rdb_protocol_t::context_t *ctx);
+
+        bool find(const std::pair<std::string, std::string> &name, std::vector<std::string> *attrnames_out);
+        int64_t generation() const { return generation_; }
+        void insert(const std::pair<std::string, std::string> &name, const std::vector<std::string> &attrnames, int64_t generation);
+        void clear();
+
+    private:
+        struct entry_t {
+            std::vector<std::string> attrnames;
+            ticks_t time;
+        };
+
+        std::map<std::pair<std::string, std::string>, entry_t> tables;
+        int64_t generation_;
+
+        watchable_t<cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> > >::subscription_t namespaces_subscription;
+
+        DISABLE_COPYING(thread_cache_t);
+    };
+
+    void clear_on_thread(int thread);
+
+    one_per_thread_t<thread_cache_t> caches;
+};
+
+#endif  // RDB_PROTOCOL_SINDEX_CACHE_HPP_
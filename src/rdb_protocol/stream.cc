@@ -1,6 +1,17 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
 #include "rdb_protocol/stream.hpp"
+
+#include <algorithm>
+#include <deque>
+
+#include "errors.hpp"
+#include <boost/bind.hpp>
+
+#include "arch/runtime/coroutines.hpp"
+#include "concurrency/pmap.hpp"
+#include "concurrency/wait_any.hpp"
 #include "rdb_protocol/environment.hpp"
+#include "rdb_protocol/internal_extensions.pb.h"
 #include "rdb_protocol/transform_visitors.hpp"
 
 namespace query_language {
@@ -19,15 +30,17 @@ result_t json_stream_t::apply_terminal(const rdb_protocol_details::terminal_vari
     return res;
 }
 
-in_memory_stream_t::in_memory_stream_t(json_array_iterator_t it) {
+in_memory_stream_t::in_memory_stream_t(json_array_iterator_t it) : data_size(0) {
     while (cJSON *json = it.next()) {
         data.push_back(boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_DeepCopy(json))));
+        data_size += estimate_json_size(json);
     }
 }
 
-in_memory_stream_t::in_memory_stream_t(boost::shared_ptr<json_stream_t> stream) {
+in_memory_stream_t::in_memory_stream_t(boost::shared_ptr<json_stream_t> stream) : data_size(0) {
     while (boost::shared_ptr<scoped_cJSON_t> json = stream->next()) {
         data.push_back(json);
+        data_size += estimate_json_size(json->get());
     }
 }
 
@@ -37,92 +50,264 @@ boost::shared_ptr<scoped_cJSON_t> in_memory_stream_t::next() {
     } else {
         boost::shared_ptr<scoped_cJSON_t> res = data.front();
         data.pop_front();
+        data_size -= std::min(data_size, estimate_json_size(res->get()));
         return res;
     }
 }
 
+size_t estimate_json_size(const cJSON *json) {
+    size_t res = sizeof(cJSON);
+    if (json->string) {
+        res += strlen(json->string) + 1;
+    }
+    if (json->type == cJSON_String) {
+        res += strlen(json->valuestring) + 1;
+    }
+    for (const cJSON *child = json->child; child; child = child->next) {
+        res += estimate_json_size(child);
+    }
+    return res;
+}
+
+/* Reads back the rows that were written to a partition. */
+class hash_distinct_stream_t::partition_stream_t : public json_stream_t {
+public:
+    explicit partition_stream_t(const boost::shared_ptr<partition_file_t> &_file) : file(_file) { }
+
+    boost::shared_ptr<scoped_cJSON_t> next() {
+        row_t row;
+        if (!file->empty()) {
+            file->pop(&row);
+        }
+        return row;
+    }
+
+private:
+    boost::shared_ptr<partition_file_t> file;
+};
+
+hash_distinct_stream_t::hash_distinct_stream_t(boost::shared_ptr<json_stream_t> _stream,
+                                               io_backender_t *_io_backender, const std::string &_temp_directory,
+                                               size_t _memory_budget, int _depth)
+    : stream(_stream), io_backender(_io_backender),
+      temp_directory(_temp_directory), memory_budget(_memory_budget), depth(_depth), seen_size(0),
+      next_partition(0) { }
+
+boost::shared_ptr<scoped_cJSON_t> hash_distinct_stream_t::next() {
+    while (stream) {
+        row_t row = stream->next();
+        if (!row) {
+            // What's left is in the partitions, and none of it is in `seen`.
+            stream.reset();
+            row_set_t().swap(seen);
+            seen_size = 0;
+        } else if (partitions.empty()) {
+            if (seen.insert(row).second) {
+                seen_size += estimate_json_size(row->get());
+                if (io_backender && depth < max_depth && seen_size >= memory_budget) {
+                    start_partitioning();
+                }
+                return row;
+            }
+        } else if (seen.find(row) == seen.end()) {
+            partitions[cJSON_hash(row->get(), depth + 1) % num_partitions]->push(row);
+        }
+    }
+
+    while (partition_stream || next_partition < partitions.size()) {
+        if (!partition_stream) {
+            partition_stream = boost::make_shared<hash_distinct_stream_t>(
+                boost::make_shared<partition_stream_t>(partitions[next_partition]),
+                io_backender, temp_directory, memory_budget, depth + 1);
+            partitions[next_partition].reset();
+            ++next_partition;
+        }
+        if (row_t row = partition_stream->next()) {
+            return row;
+        }
+        partition_stream.reset();
+    }
+    return row_t();
+}
+
+size_t hash_distinct_stream_t::memory_usage() const {
+    size_t res = seen_size;
+    if (stream) {
+        res += stream->memory_usage();
+    }
+    if (partition_stream) {
+        res += partition_stream->memory_usage();
+    }
+    return res;
+}
+
+void hash_distinct_stream_t::start_partitioning() {
+    for (size_t i = 0; i < num_partitions; ++i) {
+        partitions.push_back(boost::make_shared<partition_file_t>(
+            io_backender, temp_directory + "/distinct-partition-" + uuid_to_str(generate_uuid()), &partition_stats));
+    }
+}
+
 transform_stream_t::transform_stream_t(boost::shared_ptr<json_stream_t> stream_, runtime_environment_t *env_, const rdb_protocol_details::transform_t &tr)
-    : stream(stream_), env(env_), transform(tr) { }
+    : stream(stream_), env(env_), transform(tr), data_size(0) { }
 
 boost::shared_ptr<scoped_cJSON_t> transform_stream_t::next() {
     while (data.empty()) {
-        boost::shared_ptr<scoped_cJSON_t> input = stream->next();
-        if (!input) {
+        // Javascript is much cheaper a batch of rows at a time.
+        size_t batch_size = transform_has_javascript(transform) ? RDB_JS_BATCH_SIZE : 1;
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > inputs;
+        while (inputs.size() < batch_size) {
+            boost::shared_ptr<scoped_cJSON_t> input = stream->next();
+            if (!input) {
+                break;
+            }
+            inputs.push_back(input);
+        }
+        if (inputs.empty()) {
             return boost::shared_ptr<scoped_cJSON_t>();
         }
 
-        json_list_t accumulator;
-        accumulator.push_back(input);
-
-        //Apply transforms to the data
-        typedef rdb_protocol_details::transform_t::iterator tit_t;
-        for (tit_t it  = transform.begin();
-                   it != transform.end();
-                   ++it) {
-            json_list_t tmp;
-            for (json_list_t::iterator jt  = accumulator.begin();
-                                       jt != accumulator.end();
-                                       ++jt) {
-                boost::apply_visitor(transform_visitor_t(*jt, &tmp, env, it->scopes, it->backtrace), it->variant);
+        if (!compiled_transform.has()) {
+            compiled_transform.init(new compiled_transform_t(transform));
+        }
+        std::vector<json_list_t> outputs;
+        transform_rows(*compiled_transform.get(), inputs, &outputs, env);
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            for (json_list_t::const_iterator it = outputs[i].begin(); it != outputs[i].end(); ++it) {
+                data_size += estimate_json_size((*it)->get());
             }
-
-            /* Equivalent to `accumulator = tmp`, but without the extra copying */
-            std::swap(accumulator, tmp);
+            data.splice(data.end(), outputs[i]);
         }
-
-        /* Equivalent to `data = accumulator`, but without the extra copying */
-        std::swap(data, accumulator);
     }
 
     boost::shared_ptr<scoped_cJSON_t> res = data.front();
     data.pop_front();
+    data_size -= std::min(data_size, estimate_json_size(res->get()));
     return res;
 }
 
+size_t transform_stream_t::memory_usage() const {
+    return stream->memory_usage() + data_size;
+}
+
 boost::shared_ptr<json_stream_t> transform_stream_t::add_transformation(const rdb_protocol_details::transform_variant_t &t, UNUSED runtime_environment_t *env2, const scopes_t &scopes, const backtrace_t &backtrace) {
     transform.push_back(rdb_protocol_details::transform_atom_t(t, scopes, backtrace));
+    compiled_transform.reset();
     return shared_from_this();
 }
 
 batched_rget_stream_t::batched_rget_stream_t(const namespace_repo_t<rdb_protocol_t>::access_t &_ns_access,
                       signal_t *_interruptor, key_range_t _range,
-                      int _batch_size, const backtrace_t &_table_scan_backtrace,
-                      bool _use_outdated)
+                      int _batch_size, int _prefetch_depth, size_t _prefetch_memory_budget,
+                      const backtrace_t &_table_scan_backtrace, bool _use_outdated)
+    : ns_access(_ns_access), interruptor(_interruptor),
+      range(_range), batch_size(_batch_size),
+      prefetch_depth(_prefetch_depth), prefetch_memory_budget(_prefetch_memory_budget),
+      batches_size(0), finished(false), started(false), use_outdated(_use_outdated),
+      reading(false), table_scan_backtrace(_table_scan_backtrace)
+{ }
+
+batched_rget_stream_t::batched_rget_stream_t(const namespace_repo_t<rdb_protocol_t>::access_t &_ns_access,
+                      signal_t *_interruptor, const rdb_protocol_details::sindex_range_t &_sindex_range,
+                      int _batch_size, int _prefetch_depth, size_t _prefetch_memory_budget,
+                      const backtrace_t &_table_scan_backtrace, bool _use_outdated)
     : ns_access(_ns_access), interruptor(_interruptor),
-      range(_range), batch_size(_batch_size), index(0),
-      finished(false), started(false), use_outdated(_use_outdated),
-      table_scan_backtrace(_table_scan_backtrace)
+      range(key_range_t::universe()), sindex_range(_sindex_range),
+      batch_size(_batch_size),
+      prefetch_depth(_prefetch_depth), prefetch_memory_budget(_prefetch_memory_budget),
+      batches_size(0), finished(false), started(false), use_outdated(_use_outdated),
+      reading(false), table_scan_backtrace(_table_scan_backtrace)
 { }
 
 boost::shared_ptr<scoped_cJSON_t> batched_rget_stream_t::next() {
     started = true;
-    if (data.empty()) {
-        if (finished) {
-            return boost::shared_ptr<scoped_cJSON_t>();
-        }
-        read_more();
-        if (data.empty()) {
+    while (batches.empty()) {
+        if (reading) {
+            wait_interruptible(read_done.get(), interruptor);
+        } else if (read_error) {
+            runtime_exc_t e = *read_error;
+            read_error.reset();
             finished = true;
+            throw e;
+        } else if (finished) {
             return boost::shared_ptr<scoped_cJSON_t>();
+        } else {
+            start_read();
         }
     }
-    boost::shared_ptr<scoped_cJSON_t> ret = data.front();
-    data.pop_front();
 
+    batch_t *batch = &batches.front();
+    boost::shared_ptr<scoped_cJSON_t> ret = batch->rows.front();
+    batch->rows.pop_front();
+    if (batch->rows.empty()) {
+        batches_size -= batch->size;
+        batches.pop_front();
+    }
+
+    maybe_prefetch();
     return ret;
 }
 
+void batched_rget_stream_t::maybe_prefetch() {
+    // `batches` includes the batch the client is on.
+    if (!reading && !finished && !read_error &&
+        batches.size() <= static_cast<size_t>(prefetch_depth) &&
+        batches_size < prefetch_memory_budget) {
+        start_read();
+    }
+}
+
+void batched_rget_stream_t::start_read() {
+    guarantee(!reading);
+    reading = true;
+    read_done.init(new cond_t);
+    coro_t::spawn_sometime(boost::bind(&batched_rget_stream_t::read_in_background, this, auto_drainer_t::lock_t(&drainer)));
+}
+
+/* The read belongs to the stream rather than to whichever query happens to be
+using it, so it's only interrupted if the stream goes away. */
+void batched_rget_stream_t::read_in_background(auto_drainer_t::lock_t keepalive) {
+    batch_t batch;
+    try {
+        read_more(&batch.rows, keepalive.get_drain_signal());
+    } catch (const interrupted_exc_t &) {
+        return;
+    } catch (const runtime_exc_t &e) {
+        read_error = e;
+    }
+
+    if (batch.rows.empty()) {
+        finished = true;
+    } else {
+        batch.size = 0;
+        for (json_list_t::iterator it = batch.rows.begin(); it != batch.rows.end(); ++it) {
+            batch.size += estimate_json_size((*it)->get());
+        }
+        batches_size += batch.size;
+        batches.push_back(batch);
+    }
+
+    reading = false;
+    read_done->pulse();
+}
+
 boost::shared_ptr<json_stream_t> batched_rget_stream_t::add_transformation(const rdb_protocol_details::transform_variant_t &t, UNUSED runtime_environment_t *env2, const scopes_t &scopes, const backtrace_t &per_op_backtrace) {
     guarantee(!started);
     transform.push_back(rdb_protocol_details::transform_atom_t(t, scopes, per_op_backtrace));
     return shared_from_this();
 }
 
-result_t batched_rget_stream_t::apply_terminal(const rdb_protocol_details::terminal_variant_t &t, UNUSED runtime_environment_t *env2, const scopes_t &scopes, const backtrace_t &per_op_backtrace) {
+result_t batched_rget_stream_t::apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env2, const scopes_t &scopes, const backtrace_t &per_op_backtrace) {
+    // The shards would apply it to the whole range: to rows the client has
+    // read already, and past the limit of a sort.
+    if (started || sorting) {
+        return json_stream_t::apply_terminal(t, env2, scopes, per_op_backtrace);
+    }
     rdb_protocol_t::region_t region(range);
     rdb_protocol_t::rget_read_t rget_read(region);
     rget_read.transform = transform;
     rget_read.terminal = rdb_protocol_details::terminal_t(t, scopes, per_op_backtrace);
+    rget_read.sindex = sindex_range;
     rdb_protocol_t::read_t read(rget_read);
     try {
         rdb_protocol_t::read_response_t res;
@@ -145,16 +330,75 @@ result_t batched_rget_stream_t::apply_terminal(const rdb_protocol_details::termi
     }
 }
 
-void batched_rget_stream_t::read_more() {
+boost::shared_ptr<json_stream_t> batched_rget_stream_t::add_sorting(const rdb_protocol_details::sorting_t &_sorting) {
+    guarantee(!started);
+    guarantee(!sorting);
+    sorting = _sorting;
+    return shared_from_this();
+}
+
+boost::optional<rdb_protocol_t::range_modify_response_t> batched_rget_stream_t::apply_modify(const rdb_protocol_t::range_modify_t &modify) {
+    if (started || sindex_range || sorting) {
+        return boost::optional<rdb_protocol_t::range_modify_response_t>();
+    }
+    for (rdb_protocol_details::transform_t::iterator it = transform.begin(); it != transform.end(); ++it) {
+        if (const Builtin_Filter *filter = boost::get<Builtin_Filter>(&it->variant)) {
+            const Term &body = filter->predicate().body();
+            if (!body.HasExtension(extension::deterministic) || !body.GetExtension(extension::deterministic)) {
+                return boost::optional<rdb_protocol_t::range_modify_response_t>();
+            }
+        } else if (!boost::get<Builtin_Range>(&it->variant)) {
+            return boost::optional<rdb_protocol_t::range_modify_response_t>();
+        }
+    }
+
+    /* Each write only gets through a batch of rows on each shard, so we keep
+    sending writes for whatever the shards didn't get to. */
+    rdb_protocol_t::range_modify_response_t total;
+    std::deque<rdb_protocol_t::region_t> regions;
+    regions.push_back(rdb_protocol_t::region_t(range));
+    try {
+        while (!regions.empty()) {
+            rdb_protocol_t::range_modify_t _modify(modify);
+            _modify.region = regions.front();
+            _modify.transform = transform;
+            regions.pop_front();
+
+            guarantee(ns_access.get_namespace_if());
+            rdb_protocol_t::write_t write(_modify);
+            rdb_protocol_t::write_response_t res;
+            ns_access.get_namespace_if()->write(write, &res, order_token_t::ignore, interruptor);
+            rdb_protocol_t::range_modify_response_t *p_res = boost::get<rdb_protocol_t::range_modify_response_t>(&res.response);
+            guarantee(p_res);
+
+            regions.insert(regions.end(), p_res->remaining.begin(), p_res->remaining.end());
+            p_res->remaining.clear();
+            total.add(*p_res);
+
+            /* The batches before this one are committed, so we stop here and
+            hand their counts back along with the error. */
+            if (total.exc) {
+                break;
+            }
+        }
+        return total;
+    } catch (cannot_perform_query_exc_t e) {
+        throw runtime_exc_t("cannot perform write: " + std::string(e.what()), table_scan_backtrace);
+    }
+}
+
+void batched_rget_stream_t::read_more(json_list_t *rows_out, signal_t *read_interruptor) {
     rdb_protocol_t::rget_read_t rget_read(rdb_protocol_t::region_t(range), transform);
+    rget_read.sindex = sindex_range;
+    rget_read.sorting = sorting;
     rdb_protocol_t::read_t read(rget_read);
     try {
         guarantee(ns_access.get_namespace_if());
         rdb_protocol_t::read_response_t res;
         if (use_outdated) {
-            ns_access.get_namespace_if()->read_outdated(read, &res, interruptor);
+            ns_access.get_namespace_if()->read_outdated(read, &res, read_interruptor);
         } else {
-            ns_access.get_namespace_if()->read(read, &res, order_token_t::ignore, interruptor);
+            ns_access.get_namespace_if()->read(read, &res, order_token_t::ignore, read_interruptor);
         }
         rdb_protocol_t::rget_read_response_t *p_res = boost::get<rdb_protocol_t::rget_read_response_t>(&res.response);
         guarantee(p_res);
@@ -171,12 +415,20 @@ void batched_rget_stream_t::read_more() {
 
         for (stream_t::iterator i = stream->begin(); i != stream->end(); ++i) {
             guarantee(i->second);
-            data.push_back(i->second);
+            rows_out->push_back(i->second);
         }
 
-        range.left = p_res->last_considered_key;
+        if (sorting) {
+            // That was everything.
+            finished = true;
+            return;
+        }
+
+        /* When reading an index, `last_considered_key` is an index key. */
+        store_key_t *left = sindex_range ? &sindex_range->index_range.left : &range.left;
+        *left = p_res->last_considered_key;
 
-        if (!range.left.increment()) {
+        if (!left->increment()) {
             finished = true;
         }
     } catch (cannot_perform_query_exc_t e) {
@@ -185,21 +437,172 @@ void batched_rget_stream_t::read_more() {
 }
 
 union_stream_t::union_stream_t(const stream_list_t &_streams)
-    : streams(_streams), hd(streams.begin())
+    : streams(_streams), hd(streams.begin()), started(false), next_child(0), interrupted(false)
 { }
 
 boost::shared_ptr<scoped_cJSON_t> union_stream_t::next() {
-    while (hd != streams.end()) {
-        if (boost::shared_ptr<scoped_cJSON_t> json = (*hd)->next()) {
-            return json;
-        } else {
-            ++hd;
+    if (!started) {
+        started = true;
+        children.init(std::distance(hd, streams.end()));
+        for (size_t i = 0; hd != streams.end(); ++hd, ++i) {
+            children[i].stream = *hd;
+        }
+    }
+    for (;;) {
+        // Take turns, so that a fast stream doesn't keep the others waiting.
+        size_t num_children = children.size();
+        bool reading = false;
+        for (size_t i = 0; i < num_children; ++i) {
+            child_t *child = &children[(next_child + i) % num_children];
+            if (child->row) {
+                next_child = (next_child + i + 1) % num_children;
+                boost::shared_ptr<scoped_cJSON_t> json;
+                json.swap(child->row);
+                return json;
+            }
+            reading = reading || !child->finished;
+        }
+
+        if (read_error) {
+            runtime_exc_t e = *read_error;
+            read_error.reset();
+            throw e;
+        } else if (interrupted) {
+            throw interrupted_exc_t();
+        } else if (!reading) {
+            return boost::shared_ptr<scoped_cJSON_t>();
+        }
+
+        read_children();
+    }
+}
+
+/* Reads a row from one of the union's streams, for `pmap()`. Exceptions can't
+leave a coroutine, so they're kept for `next()` to throw. */
+class union_stream_t::read_child_t {
+public:
+    read_child_t(union_stream_t *_parent, const std::vector<child_t *> *_reading)
+        : parent(_parent), reading(_reading) { }
+
+    void operator()(int i) const {
+        child_t *child = (*reading)[i];
+        try {
+            child->row = child->stream->next();
+            child->finished = !child->row;
+        } catch (const interrupted_exc_t &) {
+            parent->interrupted = true;
+        } catch (const runtime_exc_t &e) {
+            // The first error is the one the client hears about.
+            if (!parent->read_error) {
+                parent->read_error = e;
+            }
+            child->finished = true;
+        }
+    }
+
+private:
+    union_stream_t *parent;
+    const std::vector<child_t *> *reading;
+};
+
+void union_stream_t::read_children() {
+    std::vector<child_t *> reading;
+    for (ssize_t i = 0; i < children.size(); ++i) {
+        if (!children[i].finished && !children[i].row) {
+            reading.push_back(&children[i]);
+        }
+    }
+    pmap(reading.size(), read_child_t(this, &reading));
+}
+
+void union_stream_t::reset_interruptor(signal_t *new_interruptor) {
+    // The read that was interrupted gets tried again, under the new
+    // interruptor, the next time the client asks for a row.
+    interrupted = false;
+    for (stream_list_t::iterator it = streams.begin(); it != streams.end(); ++it) {
+        (*it)->reset_interruptor(new_interruptor);
+    }
+}
+
+size_t union_stream_t::memory_usage() const {
+    size_t res = 0;
+    for (stream_list_t::const_iterator it = streams.begin(); it != streams.end(); ++it) {
+        res += (*it)->memory_usage();
+    }
+    for (ssize_t i = 0; i < children.size(); ++i) {
+        if (children[i].row) {
+            res += estimate_json_size(children[i].row->get());
         }
     }
-    return boost::shared_ptr<scoped_cJSON_t>();
+    return res;
+}
+
+/* Applies a terminal to one of a list of streams, for `pmap()`. Exceptions
+can't leave a coroutine, so they're kept for the caller to rethrow. */
+class apply_terminal_to_stream_t {
+public:
+    apply_terminal_to_stream_t(const rdb_protocol_details::terminal_variant_t *_t, runtime_environment_t *_env,
+                               const scopes_t *_scopes, const backtrace_t *_backtrace,
+                               const std::vector<boost::shared_ptr<json_stream_t> > *_streams,
+                               std::vector<result_t> *_results,
+                               std::vector<boost::optional<runtime_exc_t> > *_errors,
+                               bool *_interrupted)
+        : t(_t), env(_env), scopes(_scopes), backtrace(_backtrace), streams(_streams),
+          results(_results), errors(_errors), interrupted(_interrupted) { }
+
+    void operator()(int i) const {
+        try {
+            (*results)[i] = (*streams)[i]->apply_terminal(*t, env, *scopes, *backtrace);
+        } catch (const runtime_exc_t &e) {
+            (*errors)[i] = e;
+        } catch (const interrupted_exc_t &) {
+            *interrupted = true;
+        }
+    }
+
+private:
+    const rdb_protocol_details::terminal_variant_t *t;
+    runtime_environment_t *env;
+    const scopes_t *scopes;
+    const backtrace_t *backtrace;
+    const std::vector<boost::shared_ptr<json_stream_t> > *streams;
+    std::vector<result_t> *results;
+    std::vector<boost::optional<runtime_exc_t> > *errors;
+    bool *interrupted;
+};
+
+result_t union_stream_t::apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) {
+    if (started) {
+        // Some of the streams' rows are waiting in `children` now.
+        return json_stream_t::apply_terminal(t, env, scopes, backtrace);
+    }
+
+    std::vector<boost::shared_ptr<json_stream_t> > rest(hd, streams.end());
+    hd = streams.end();
+    std::vector<result_t> results(rest.size());
+    std::vector<boost::optional<runtime_exc_t> > errors(rest.size());
+    bool terminal_interrupted = false;
+    pmap(rest.size(), apply_terminal_to_stream_t(&t, env, &scopes, &backtrace, &rest,
+                                                 &results, &errors, &terminal_interrupted));
+
+    result_t res;
+    boost::apply_visitor(terminal_initializer_visitor_t(&res, env, scopes, backtrace), t);
+    for (size_t i = 0; i < rest.size(); ++i) {
+        if (errors[i]) {
+            throw *errors[i];
+        }
+    }
+    if (terminal_interrupted) {
+        throw interrupted_exc_t();
+    }
+    for (size_t i = 0; i < rest.size(); ++i) {
+        boost::apply_visitor(terminal_merge_visitor_t(results[i], env, scopes, backtrace, &res), t);
+    }
+    return res;
 }
 
 boost::shared_ptr<json_stream_t> union_stream_t::add_transformation(const rdb_protocol_details::transform_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) {
+    guarantee(!started);
     for (stream_list_t::iterator it  = streams.begin();
                                  it != streams.end();
                                  ++it) {
@@ -208,4 +611,22 @@ boost::shared_ptr<json_stream_t> union_stream_t::add_transformation(const rdb_pr
     return shared_from_this();
 }
 
+result_t slice_stream_t::apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace) {
+    if (!boost::get<rdb_protocol_details::Length>(&t)) {
+        return json_stream_t::apply_terminal(t, env, scopes, backtrace);
+    }
+    result_t res = stream->apply_terminal(t, env, scopes, backtrace);
+    rdb_protocol_t::rget_read_response_t::length_t *length = boost::get<rdb_protocol_t::rget_read_response_t::length_t>(&res);
+    guarantee(length);
+    length->length = std::max(length->length - start, 0);
+    if (!unbounded) {
+        length->length = std::min(length->length, stop);
+    }
+    // Like reading the rest of the rows, this uses up the stream.
+    start = 0;
+    unbounded = false;
+    stop = 0;
+    return res;
+}
+
 } //namespace query_language 
@@ -11,11 +11,21 @@
 #include "errors.hpp"
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/optional.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/variant/get.hpp>
 
 #include "clustering/administration/namespace_interface_repository.hpp"
+#include "concurrency/auto_drainer.hpp"
+#include "concurrency/cond_var.hpp"
+#include "containers/disk_backed_queue.hpp"
+#include "containers/scoped.hpp"
+#include "containers/uuid.hpp"
+#include "perfmon/core.hpp"
+#include "rdb_protocol/compiled_term.hpp"
 #include "rdb_protocol/exceptions.hpp"
 #include "rdb_protocol/protocol.hpp"
 #include "rdb_protocol/stream_cache.hpp"
@@ -36,6 +46,29 @@ public:
     virtual MUST_USE boost::shared_ptr<json_stream_t> add_transformation(const rdb_protocol_details::transform_variant_t &, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
     virtual result_t apply_terminal(const rdb_protocol_details::terminal_variant_t &, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
 
+    /* Returns a stream of the first `sorting.limit` rows of this one in sorted
+    order, if this stream can sort itself more cheaply than reading everything
+    and sorting it would be. Otherwise returns NULL. */
+    virtual MUST_USE boost::shared_ptr<json_stream_t> add_sorting(UNUSED const rdb_protocol_details::sorting_t &sorting) {
+        return boost::shared_ptr<json_stream_t>();
+    }
+
+    /* Has the shards apply `modify` to the rows of this stream themselves, and
+    returns what they did, if this stream is a scan of a table whose rows they
+    can pick out deterministically. `modify`'s region and transform are filled
+    in from the stream. Otherwise returns nothing, and the caller has to
+    modify the rows one at a time. If the stream's filters throw partway
+    through, the rows modified before that stay modified; the response counts
+    them and has the error in `exc`. */
+    virtual boost::optional<rdb_protocol_t::range_modify_response_t> apply_modify(UNUSED const rdb_protocol_t::range_modify_t &modify) {
+        return boost::optional<rdb_protocol_t::range_modify_response_t>();
+    }
+
+    /* A rough count of the bytes of rows that this stream (along with the
+    streams it reads from) is holding on to, which is what it costs to keep it
+    open in the stream cache. */
+    virtual size_t memory_usage() const { return 0; }
+
     virtual ~json_stream_t() { }
 
     virtual void reset_interruptor(UNUSED signal_t *new_interruptor) { }
@@ -61,10 +94,13 @@ public:
 
     boost::shared_ptr<scoped_cJSON_t> next();
 
+    size_t memory_usage() const { return data_size; }
+
     /* Use default implementation of `add_transformation()` and `apply_terminal()` */
 
 private:
     json_list_t data;
+    size_t data_size;
 };
 
 class transform_stream_t : public json_stream_t {
@@ -74,46 +110,106 @@ public:
     boost::shared_ptr<scoped_cJSON_t> next();
     boost::shared_ptr<json_stream_t> add_transformation(const rdb_protocol_details::transform_variant_t &, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
 
+    size_t memory_usage() const;
+
 private:
     boost::shared_ptr<json_stream_t> stream;
     runtime_environment_t *env;
     rdb_protocol_details::transform_t transform;
+    // `transform` compiled, once `next()` is first called after it changes.
+    scoped_ptr_t<compiled_transform_t> compiled_transform;
     json_list_t data;
+    // What `estimate_json_size()` makes of the rows in `data`, all together.
+    size_t data_size;
 };
 
+/* Reads a table in batches of `batch_size` rows. Once the client starts on a
+batch, the next one is read in the background, and so on until there are
+`prefetch_depth` batches waiting behind the one being read or they take up
+about `prefetch_memory_budget` bytes. So the client only waits on the cluster
+when it reads faster than the cluster can answer. */
 class batched_rget_stream_t : public json_stream_t {
 public:
-    batched_rget_stream_t(const namespace_repo_t<rdb_protocol_t>::access_t &_ns_access, 
-                          signal_t *_interruptor, key_range_t _range, 
-                          int _batch_size, const backtrace_t &_table_scan_backtrace,
-                          bool _use_outdated);
+    batched_rget_stream_t(const namespace_repo_t<rdb_protocol_t>::access_t &_ns_access,
+                          signal_t *_interruptor, key_range_t _range,
+                          int _batch_size, int _prefetch_depth, size_t _prefetch_memory_budget,
+                          const backtrace_t &_table_scan_backtrace, bool _use_outdated);
+
+    /* Reads the rows in a range of a secondary index, in index order. */
+    batched_rget_stream_t(const namespace_repo_t<rdb_protocol_t>::access_t &_ns_access,
+                          signal_t *_interruptor, const rdb_protocol_details::sindex_range_t &_sindex_range,
+                          int _batch_size, int _prefetch_depth, size_t _prefetch_memory_budget,
+                          const backtrace_t &_table_scan_backtrace, bool _use_outdated);
 
     boost::shared_ptr<scoped_cJSON_t> next();
 
     boost::shared_ptr<json_stream_t> add_transformation(const rdb_protocol_details::transform_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
     result_t apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
 
+    /* The shards sort their rows, so only `sorting.limit` rows from each one
+    cross the network. */
+    boost::shared_ptr<json_stream_t> add_sorting(const rdb_protocol_details::sorting_t &sorting);
+
+    /* Works if the stream hasn't been read yet, isn't reading an index or
+    sorting, and its transforms are all deterministic filters. */
+    boost::optional<rdb_protocol_t::range_modify_response_t> apply_modify(const rdb_protocol_t::range_modify_t &modify);
+
     virtual void reset_interruptor(signal_t *new_interruptor) {
         interruptor = new_interruptor;
     };
 
+    size_t memory_usage() const { return batches_size; }
+
 private:
-    void read_more();
+    struct batch_t {
+        json_list_t rows;
+        size_t size;
+    };
+
+    /* Starts reading the next batch, unless enough are waiting already. */
+    void maybe_prefetch();
+    void start_read();
+    void read_in_background(auto_drainer_t::lock_t keepalive);
+
+    /* Virtual so that the unittests can read from something other than a
+    table. It sets `finished` once it has read the last of the rows. */
+    virtual void read_more(json_list_t *rows_out, signal_t *read_interruptor);
 
     rdb_protocol_details::transform_t transform;
     namespace_repo_t<rdb_protocol_t>::access_t ns_access;
     signal_t *interruptor;
     key_range_t range;
+    boost::optional<rdb_protocol_details::sindex_range_t> sindex_range;
+    boost::optional<rdb_protocol_details::sorting_t> sorting;
     int batch_size;
+    int prefetch_depth;
+    size_t prefetch_memory_budget;
 
-    json_list_t data;
-    int index;
+    std::list<batch_t> batches;
+    size_t batches_size;
     bool finished, started;
     bool use_outdated;
 
+    /* `reading` is true while a background read is running; it pulses
+    `read_done` when it's done. If it failed, the error is in `read_error`,
+    and comes out of `next()` once the rows read before it are used up. */
+    bool reading;
+    scoped_ptr_t<cond_t> read_done;
+    boost::optional<runtime_exc_t> read_error;
+
     backtrace_t table_scan_backtrace;
+
+    auto_drainer_t drainer;
 };
 
+/* Reads all of its streams at once, so a union of several tables waits on the
+slowest of them rather than on all of them in turn. When `next()` has no rows
+left over, it reads a row from each of the streams that isn't used up, each in
+a coroutine of its own, and waits for all of them; nothing reads from the
+streams once it returns, so they only ever run with the client's environment
+and interruptor. The client takes rows from whichever streams had them, so
+they come out in no particular order. An error from one of the streams comes
+out of `next()` once the rows read before it are used up. */
 class union_stream_t : public json_stream_t {
 public:
     typedef std::list<boost::shared_ptr<json_stream_t> > stream_list_t;
@@ -124,33 +220,306 @@ public:
 
     boost::shared_ptr<json_stream_t> add_transformation(const rdb_protocol_details::transform_variant_t &, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
 
-    /* TODO: Maybe we can optimize `apply_terminal()`. */
+    /* Applies the terminal to each stream by itself, all at once, so the ones
+    that can push it down to the shards do, and puts the results together. */
+    result_t apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
+
+    size_t memory_usage() const;
+
+    virtual void reset_interruptor(signal_t *new_interruptor);
 
 private:
+    /* One of the streams, and the row read from it that the client hasn't
+    taken yet, if there is one. */
+    struct child_t {
+        child_t() : finished(false) { }
+
+        boost::shared_ptr<json_stream_t> stream;
+        boost::shared_ptr<scoped_cJSON_t> row;
+        bool finished;
+    };
+
+    class read_child_t;
+
+    void read_children();
+
     stream_list_t streams;
+    // The streams that haven't been used up by `apply_terminal()`.
     stream_list_t::iterator hd;
+
+    bool started;
+    scoped_array_t<child_t> children;
+    // The child the client takes a row from next, if it has one.
+    size_t next_child;
+
+    // Errors from the streams, which wait for the rows read before them.
+    boost::optional<runtime_exc_t> read_error;
+    bool interrupted;
 };
 
-template <class C>
-class distinct_stream_t : public json_stream_t {
+/* A rough count of the bytes of memory that `json` takes up. */
+size_t estimate_json_size(const cJSON *json);
+
+/* Drops rows that are equal to earlier ones. The rows seen so far are kept in
+a hash set until they take up about `memory_budget` bytes. After that, new rows
+that aren't in the set are written out to one of `num_partitions` files, picked
+by hash, instead of being passed on. Equal rows always land in the same file,
+so once the input is used up, each file is deduplicated by itself, by another
+of these streams partitioning on a different hash. Past `max_depth` levels, or
+if `io_backender` is NULL, everything stays in memory.
+
+Rows that fit in memory come out in input order, as soon as they're read; the
+rest come out one partition at a time. */
+class hash_distinct_stream_t : public json_stream_t {
 public:
-    typedef boost::function<bool(boost::shared_ptr<scoped_cJSON_t>)> predicate;  // NOLINT
-    distinct_stream_t(boost::shared_ptr<json_stream_t> _stream, const C &_c)
-        : stream(_stream), seen(_c)
-    { }
+    static const size_t num_partitions = 16;
+    static const int max_depth = 4;
+
+    hash_distinct_stream_t(boost::shared_ptr<json_stream_t> _stream,
+                           io_backender_t *_io_backender, const std::string &_temp_directory,
+                           size_t _memory_budget, int _depth = 0);
+
+    boost::shared_ptr<scoped_cJSON_t> next();
+
+    size_t memory_usage() const;
+
+private:
+    typedef boost::shared_ptr<scoped_cJSON_t> row_t;
+    typedef boost::unordered_set<row_t, shared_scoped_hash_t, shared_scoped_equal_t> row_set_t;
+    typedef disk_backed_queue_t<row_t> partition_file_t;
+    class partition_stream_t;
+
+    void start_partitioning();
+
+    boost::shared_ptr<json_stream_t> stream;
+    io_backender_t *io_backender;
+    std::string temp_directory;
+    size_t memory_budget;
+    int depth;
+
+    row_set_t seen;
+    size_t seen_size;
+
+    perfmon_collection_t partition_stats;
+    std::vector<boost::shared_ptr<partition_file_t> > partitions;
+    size_t next_partition;
+    boost::shared_ptr<json_stream_t> partition_stream;
+};
+
+/* Sorts a stream that may not fit in memory. Rows are gathered until they take
+up about `memory_budget` bytes, then sorted and written out to a run file.
+Runs are merged in levels: new runs are on level 0, and once a level has
+`max_runs` runs they're merged into one run on the next level up, so each row
+is rewritten once per level rather than once per merge. Once the input is used
+up, `next()` merges whatever runs are left. If `io_backender` is NULL there's
+nowhere to put runs, and everything is sorted in memory.
+
+If `limit` is set, only that many rows from the front of the result are
+wanted, so only that many are ever kept.
+
+The sort is stable. The input is read and sorted by the constructor, so any
+exceptions from the ordering come out of there. */
+template <class Ordering>
+class sort_stream_t : public json_stream_t {
+public:
+    static const size_t max_runs = 16;
+
+    sort_stream_t(boost::shared_ptr<json_stream_t> stream, const Ordering &_ordering,
+                  boost::optional<size_t> limit, io_backender_t *_io_backender,
+                  const std::string &_temp_directory, size_t _memory_budget)
+        : ordering(_ordering), io_backender(_io_backender), temp_directory(_temp_directory),
+          memory_budget(_memory_budget), rows_size(0), position(0) {
+        if (limit) {
+            take_first(stream, *limit);
+        } else {
+            sort_all(stream);
+        }
+    }
 
     boost::shared_ptr<scoped_cJSON_t> next() {
-        while (boost::shared_ptr<scoped_cJSON_t> json = stream->next()) {
-            if (seen.insert(json).second) { // was this not already present?
-                return json;
-            }
+        boost::shared_ptr<scoped_cJSON_t> res;
+        size_t run = smallest_run(0);
+        if (position < rows.size() && (run == runs.size() || ordering(rows[position], heads[run]))) {
+            // Ties go to the runs, which hold earlier rows.
+            res = rows[position];
+            rows[position].reset();
+            ++position;
+        } else if (run != runs.size()) {
+            res = heads[run];
+            advance_run(run);
         }
-        return boost::shared_ptr<scoped_cJSON_t>();
+        return res;
     }
 
+    // The rows that were read in are all kept until the end.
+    size_t memory_usage() const { return rows_size; }
+
 private:
-    boost::shared_ptr<json_stream_t> stream;
-    std::set<boost::shared_ptr<scoped_cJSON_t>, C> seen;
+    typedef boost::shared_ptr<scoped_cJSON_t> row_t;
+    typedef disk_backed_queue_t<row_t> run_file_t;
+
+    /* `std::stable_sort()` copies its comparator around, so we hand it one of
+    these rather than the ordering itself. */
+    class row_less_t {
+    public:
+        explicit row_less_t(const Ordering *_ordering) : ordering(_ordering) { }
+        bool operator()(const row_t &x, const row_t &y) const { return (*ordering)(x, y); }
+    private:
+        const Ordering *ordering;
+    };
+
+    /* Orders rows by the ordering, then by when they were read. */
+    class numbered_row_less_t {
+    public:
+        explicit numbered_row_less_t(const Ordering *_ordering) : ordering(_ordering) { }
+        bool operator()(const std::pair<row_t, size_t> &x, const std::pair<row_t, size_t> &y) const {
+            if ((*ordering)(x.first, y.first)) {
+                return true;
+            } else if ((*ordering)(y.first, x.first)) {
+                return false;
+            } else {
+                return x.second < y.second;
+            }
+        }
+    private:
+        const Ordering *ordering;
+    };
+
+    void sort_all(const boost::shared_ptr<json_stream_t> &stream) {
+        while (row_t row = stream->next()) {
+            rows_size += estimate_json_size(row->get());
+            rows.push_back(row);
+            if (io_backender && rows_size >= memory_budget) {
+                spill();
+            }
+        }
+        sort_rows();
+        for (size_t i = 0; i < runs.size(); ++i) {
+            advance_run(i);
+        }
+    }
+
+    /* Keeps the first `limit` rows seen so far in a heap whose top is the
+    last of them. */
+    void take_first(const boost::shared_ptr<json_stream_t> &stream, size_t limit) {
+        numbered_row_less_t less(&ordering);
+        std::vector<std::pair<row_t, size_t> > heap;
+        size_t count = 0;
+        while (row_t row = stream->next()) {
+            if (count == 0) {
+                // We want to do this so that we trigger exceptions consistently.
+                ordering(row, row);
+            }
+            heap.push_back(std::make_pair(row, count++));
+            std::push_heap(heap.begin(), heap.end(), less);
+            if (heap.size() > limit) {
+                std::pop_heap(heap.begin(), heap.end(), less);
+                heap.pop_back();
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), less);
+        for (size_t i = 0; i < heap.size(); ++i) {
+            rows_size += estimate_json_size(heap[i].first->get());
+            rows.push_back(heap[i].first);
+        }
+    }
+
+    void sort_rows() {
+        if (rows.size() == 1) {
+            // We want to do this so that we trigger exceptions consistently.
+            ordering(rows[0], rows[0]);
+        } else {
+            std::stable_sort(rows.begin(), rows.end(), row_less_t(&ordering));
+        }
+    }
+
+    boost::shared_ptr<run_file_t> new_run() {
+        return boost::make_shared<run_file_t>(io_backender,
+                                              temp_directory + "/sort-run-" + uuid_to_str(generate_uuid()),
+                                              &run_stats);
+    }
+
+    void spill() {
+        sort_rows();
+        boost::shared_ptr<run_file_t> run = new_run();
+        for (size_t i = 0; i < rows.size(); ++i) {
+            run->push(rows[i]);
+        }
+        runs.push_back(run);
+        heads.push_back(row_t());
+        levels.push_back(0);
+        rows.clear();
+        rows_size = 0;
+
+        // The runs are oldest first, so the levels only go down, and the runs
+        // of the lowest level are the last ones. A merge can fill up the next
+        // level, too.
+        for (;;) {
+            size_t first = runs.size();
+            while (first > 0 && levels[first - 1] == levels.back()) {
+                --first;
+            }
+            if (runs.size() - first < max_runs) {
+                break;
+            }
+            merge_runs(first);
+        }
+    }
+
+    /* Replaces the runs from `first` on, which are all on the same level,
+    with a single run on the level above. */
+    void merge_runs(size_t first) {
+        boost::shared_ptr<run_file_t> merged = new_run();
+        for (size_t i = first; i < runs.size(); ++i) {
+            advance_run(i);
+        }
+        for (size_t run = smallest_run(first); run != runs.size(); run = smallest_run(first)) {
+            merged->push(heads[run]);
+            advance_run(run);
+        }
+        size_t level = levels.back() + 1;
+        runs.resize(first);
+        heads.resize(first);
+        levels.resize(first);
+        runs.push_back(merged);
+        heads.push_back(row_t());
+        levels.push_back(level);
+    }
+
+    /* The run from `first` on with the smallest head. Ties go to the earlier
+    run, which holds earlier rows. Returns `runs.size()` if every run is used
+    up. */
+    size_t smallest_run(size_t first) {
+        size_t res = runs.size();
+        for (size_t i = first; i < runs.size(); ++i) {
+            if (heads[i] && (res == runs.size() || ordering(heads[i], heads[res]))) {
+                res = i;
+            }
+        }
+        return res;
+    }
+
+    void advance_run(size_t i) {
+        if (runs[i]->empty()) {
+            heads[i].reset();
+        } else {
+            runs[i]->pop(&heads[i]);
+        }
+    }
+
+    Ordering ordering;
+    io_backender_t *io_backender;
+    std::string temp_directory;
+    size_t memory_budget;
+
+    perfmon_collection_t run_stats;
+    std::vector<boost::shared_ptr<run_file_t> > runs;
+    std::vector<row_t> heads;
+    std::vector<size_t> levels;
+
+    std::vector<row_t> rows;
+    size_t rows_size;
+    size_t position;
 };
 
 class slice_stream_t : public json_stream_t {
@@ -176,6 +545,12 @@ public:
         return boost::shared_ptr<scoped_cJSON_t>();
     }
 
+    /* A LENGTH is worked out from the LENGTH of the input, which the input
+    may be able to push down. */
+    result_t apply_terminal(const rdb_protocol_details::terminal_variant_t &t, runtime_environment_t *env, const scopes_t &scopes, const backtrace_t &backtrace);
+
+    size_t memory_usage() const { return stream->memory_usage(); }
+
 private:
     boost::shared_ptr<json_stream_t> stream;
     int start;
@@ -195,6 +570,8 @@ public:
         return stream->next();
     }
 
+    size_t memory_usage() const { return stream->memory_usage(); }
+
 private:
     boost::shared_ptr<json_stream_t> stream;
     int offset;
@@ -217,18 +594,21 @@ public:
             if (json->type() != cJSON_Object) {
                 throw runtime_exc_t(strprintf("Got non-object in RANGE query: %s.", json->Print().c_str()), backtrace);
             }
-            scoped_cJSON_t val(cJSON_DeepCopy(json->GetObjectItem(attrname.c_str())));
-            if (!val.get()) {
-                throw runtime_exc_t(strprintf("Object %s has no attribute %s.", json->Print().c_str(), attrname.c_str()), backtrace);
-            } else if (val.type() != cJSON_Number && val.type() != cJSON_String) {
-                throw runtime_exc_t(strprintf("Primary key must be a number or string, not %s.", val.Print().c_str()), backtrace);
-            } else if (range.contains_key(store_key_t(cJSON_print_primary(val.get(), backtrace)))) {
+            // Borrowed from `json`, which outlives it; there's no need to copy it.
+            cJSON *val = json->GetObjectItem(attrname.c_str());
+            // Like a secondary index, which has no place for them, a RANGE
+            // leaves out the rows whose attribute can't be in a range.
+            if (!val || (val->type != cJSON_Number && val->type != cJSON_String)) {
+                continue;
+            } else if (range.contains_key(store_key_t(cJSON_print_primary(val, backtrace)))) {
                 return json;
             }
         }
         return boost::shared_ptr<scoped_cJSON_t>();
     }
 
+    size_t memory_usage() const { return stream->memory_usage(); }
+
 private:
     boost::shared_ptr<json_stream_t> stream;
     key_range_t range;
@@ -1,7 +1,34 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
+#include "rdb_protocol/stream_cache.hpp"
+
+#include <vector>
+
+#include "arch/runtime/runtime.hpp"
+#include "config/args.hpp"
+#include "perfmon/perfmon.hpp"
 #include "rdb_protocol/exceptions.hpp"
 #include "rdb_protocol/stream.hpp"
-#include "rdb_protocol/stream_cache.hpp"
+
+static perfmon_counter_t pm_cached_streams, pm_cached_stream_bytes;
+static perfmon_multi_membership_t pm_stream_cache_membership(&get_global_perfmon_collection(),
+    &pm_cached_streams, "cached_streams",
+    &pm_cached_stream_bytes, "cached_stream_bytes",
+    NULLPTR);
+
+stream_cache_t::stream_cache_t()
+    : memory_budget(RDB_STREAM_CACHE_MEMORY_BUDGET),
+      thread_memory_budget(RDB_STREAM_CACHE_GLOBAL_MEMORY_BUDGET / get_num_threads()),
+      size(0), thread_streams(get_thread_streams()) { }
+
+stream_cache_t::stream_cache_t(size_t _memory_budget, size_t _thread_memory_budget)
+    : memory_budget(_memory_budget), thread_memory_budget(_thread_memory_budget),
+      size(0), thread_streams(get_thread_streams()) { }
+
+stream_cache_t::~stream_cache_t() {
+    while (!streams.empty()) {
+        remove(streams.begin()->second.get());
+    }
+}
 
 bool stream_cache_t::contains(int64_t key) {
     return streams.find(key) != streams.end();
@@ -10,20 +37,31 @@ bool stream_cache_t::contains(int64_t key) {
 void stream_cache_t::insert(ReadQuery *r, int64_t key,
                             boost::shared_ptr<query_language::json_stream_t> val) {
     maybe_evict();
-    std::pair<std::map<int64_t, entry_t>::iterator, bool> res = streams.insert(std::pair<int64_t, entry_t>(key, entry_t(time(0), val, r)));
+    boost::shared_ptr<entry_t> entry(new entry_t(this, key, time(0), val, r));
+    // Closing streams below, or for another connection, can block; until the
+    // caller serves the new one, nothing may close it.
+    entry->in_use = true;
+    std::pair<std::map<int64_t, boost::shared_ptr<entry_t> >::iterator, bool> res = streams.insert(std::make_pair(key, entry));
     guarantee(res.second);
+    lru.push_back(entry.get());
+    thread_streams->lru.push_back(&entry->thread_node);
+    ++pm_cached_streams;
+    update_size(entry.get());
+    evict_to_fit(entry.get());
 }
 
 void stream_cache_t::erase(int64_t key) {
-    size_t num_erased = streams.erase(key);
-    guarantee(num_erased == 1);
+    std::map<int64_t, boost::shared_ptr<entry_t> >::iterator it = streams.find(key);
+    guarantee(it != streams.end());
+    remove(it->second.get());
 }
 
 bool stream_cache_t::serve(int64_t key, Response *res, signal_t *interruptor) {
-    std::map<int64_t, entry_t>::iterator it = streams.find(key);
+    std::map<int64_t, boost::shared_ptr<entry_t> >::iterator it = streams.find(key);
     if (it == streams.end()) return false;
-    entry_t *entry = &it->second;
-    entry->last_activity = time(0);
+    boost::shared_ptr<entry_t> entry = it->second;
+    touch(entry.get());
+    entry->in_use = true;
     try {
         int chunk_size = 0;
         // This is a hack.  Some streams have an interruptor that is invalid by
@@ -32,31 +70,103 @@ bool stream_cache_t::serve(int64_t key, Response *res, signal_t *interruptor) {
         while (boost::shared_ptr<scoped_cJSON_t> json = entry->stream->next()) {
             res->add_response(json->PrintUnformatted());
             if (entry->max_chunk_size && ++chunk_size >= entry->max_chunk_size) {
+                entry->in_use = false;
+                update_size(entry.get());
+                evict_to_fit(entry.get());
                 res->set_status_code(Response::SUCCESS_PARTIAL);
                 return true;
             }
         }
     } catch (const std::exception &e) {
+        entry->in_use = false;
         erase(key);
         throw;
     }
+    entry->in_use = false;
     erase(key);
     res->set_status_code(Response::SUCCESS_STREAM);
     return true;
 }
 
+size_t stream_cache_t::thread_memory_usage() {
+    return get_thread_streams()->size;
+}
+
+stream_cache_t::thread_streams_t *stream_cache_t::get_thread_streams() {
+    static thread_streams_t thread_streams[MAX_THREADS];
+    return &thread_streams[get_thread_id()];
+}
+
 void stream_cache_t::maybe_evict() {
     time_t cur_time = time(0);
-    std::map<int64_t, entry_t>::iterator it_old, it = streams.begin();
-    while (it != streams.end()) {
-        it_old = it++;
-        entry_t *entry = &it_old->second;
-        if (entry->max_age && cur_time - entry->last_activity > entry->max_age) {
-            streams.erase(it_old);
+    std::vector<entry_t *> expired;
+    for (entry_t *entry = lru.head(); entry; entry = lru.next(entry)) {
+        if (!entry->in_use && entry->max_age && cur_time - entry->last_activity > entry->max_age) {
+            expired.push_back(entry);
+        }
+    }
+    // Closing a stream can block, so we can't walk the list while we do it.
+    for (size_t i = 0; i < expired.size(); ++i) {
+        std::map<int64_t, boost::shared_ptr<entry_t> >::iterator it = streams.find(expired[i]->key);
+        if (it != streams.end() && it->second.get() == expired[i]) {
+            remove(expired[i]);
+        }
+    }
+}
+
+void stream_cache_t::evict_to_fit(const entry_t *keep) {
+    while (size > memory_budget) {
+        entry_t *victim = lru.head();
+        while (victim && (victim == keep || victim->in_use)) {
+            victim = lru.next(victim);
+        }
+        if (!victim) {
+            break;
+        }
+        remove(victim);
+    }
+    while (thread_streams->size > thread_memory_budget) {
+        thread_node_t *victim = thread_streams->lru.head();
+        while (victim && (victim->entry == keep || victim->entry->in_use)) {
+            victim = thread_streams->lru.next(victim);
         }
+        if (!victim) {
+            break;
+        }
+        victim->entry->parent->remove(victim->entry);
     }
 }
 
+void stream_cache_t::remove(entry_t *entry) {
+    std::map<int64_t, boost::shared_ptr<entry_t> >::iterator it = streams.find(entry->key);
+    guarantee(it != streams.end() && it->second.get() == entry);
+    // The stream is destroyed (which can block) once the books are straight.
+    boost::shared_ptr<entry_t> doomed = it->second;
+    streams.erase(it);
+    lru.remove(entry);
+    thread_streams->lru.remove(&entry->thread_node);
+    size -= entry->size;
+    thread_streams->size -= entry->size;
+    pm_cached_stream_bytes -= entry->size;
+    --pm_cached_streams;
+}
+
+void stream_cache_t::update_size(entry_t *entry) {
+    size_t new_size = entry->stream->memory_usage();
+    size = size - entry->size + new_size;
+    thread_streams->size = thread_streams->size - entry->size + new_size;
+    pm_cached_stream_bytes += static_cast<int64_t>(new_size) - static_cast<int64_t>(entry->size);
+    entry->size = new_size;
+}
+
+void stream_cache_t::touch(entry_t *entry) {
+    entry->last_activity = time(0);
+    lru.remove(entry);
+    lru.push_back(entry);
+    thread_streams->lru.remove(&entry->thread_node);
+    thread_streams->lru.push_back(&entry->thread_node);
+}
+
 /*******************************************************************************
                                     ENTRY_T
 *******************************************************************************/
@@ -64,11 +174,12 @@ bool valid_chunk_size(int64_t chunk_size) {
     return 0 <= chunk_size && chunk_size <= INT_MAX;
 }
 bool valid_age(int64_t age) { return 0 <= age; }
-stream_cache_t::entry_t::entry_t(time_t _last_activity,
+stream_cache_t::entry_t::entry_t(stream_cache_t *_parent, int64_t _key, time_t _last_activity,
                                  boost::shared_ptr<query_language::json_stream_t> _stream,
                                  ReadQuery *r)
-    : last_activity(_last_activity), stream(_stream),
-      max_chunk_size(DEFAULT_MAX_CHUNK_SIZE), max_age(DEFAULT_MAX_AGE) {
+    : parent(_parent), key(_key), last_activity(_last_activity), stream(_stream),
+      max_chunk_size(DEFAULT_MAX_CHUNK_SIZE), max_age(DEFAULT_MAX_AGE),
+      size(0), in_use(false), thread_node(this) {
     if (r) {
         if (r->has_max_chunk_size() && valid_chunk_size(r->max_chunk_size())) {
             max_chunk_size = r->max_chunk_size();
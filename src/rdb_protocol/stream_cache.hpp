@@ -9,35 +9,96 @@
 #include "utils.hpp"
 #include <boost/shared_ptr.hpp>
 
+#include "containers/intrusive_list.hpp"
 #include "rdb_protocol/rdb_protocol_json.hpp"
 #include "rdb_protocol/query_language.pb.h"
 
+class signal_t;
+
 namespace query_language {
 class json_stream_t;
 }
 
+/* The streams a connection has open, so the client can CONTINUE them. A
+stream holds on to whatever rows it has read ahead, so the streams of a
+connection are held to `memory_budget` bytes, and the streams of all the
+connections on a thread to `thread_memory_budget`; the least recently used
+streams are closed to make room. A stream that a query is reading from is never
+closed that way. */
 class stream_cache_t {
 public:
+    stream_cache_t();
+    stream_cache_t(size_t _memory_budget, size_t _thread_memory_budget);
+    ~stream_cache_t();
+
     // TODO: Uses of contains can all just try insert or erase and look at return codes.
     bool contains(int64_t key);
+    /* The new stream isn't closed to make room for others until it has been
+    served once. */
     void insert(ReadQuery *r, int64_t key, boost::shared_ptr<query_language::json_stream_t> val);
     void erase(int64_t key);
     bool serve(int64_t key, Response *res, signal_t *interruptor);
+
+    // The bytes held by this connection's streams.
+    size_t memory_usage() const { return size; }
+    // The bytes held by the streams of every connection on this thread.
+    static size_t thread_memory_usage();
+
 private:
+    struct entry_t;
+
+    /* Links an entry into its thread's list of all the open streams. */
+    struct thread_node_t : public intrusive_list_node_t<thread_node_t> {
+        explicit thread_node_t(entry_t *_entry) : entry(_entry) { }
+        entry_t *const entry;
+    };
+
+    /* The open streams of every connection on a thread. */
+    struct thread_streams_t {
+        thread_streams_t() : size(0) { }
+        // Least recently used first.
+        intrusive_list_t<thread_node_t> lru;
+        size_t size;
+    };
+    static thread_streams_t *get_thread_streams();
+
     void maybe_evict();
+    /* Closes streams other than `keep` until the budgets are met, or only
+    streams in use are left. */
+    void evict_to_fit(const entry_t *keep);
+    void remove(entry_t *entry);
+    void update_size(entry_t *entry);
+    void touch(entry_t *entry);
 
-    struct entry_t {
+    struct entry_t : public intrusive_list_node_t<entry_t> {
         static const int DEFAULT_MAX_CHUNK_SIZE = 1000; // 0 = unbounded
         static const time_t DEFAULT_MAX_AGE = 0; // 0 = never evict
-        entry_t(time_t _last_activity,
+        entry_t(stream_cache_t *_parent, int64_t _key, time_t _last_activity,
                 boost::shared_ptr<query_language::json_stream_t> _stream,
                 ReadQuery *r);
+        stream_cache_t *parent;
+        int64_t key;
         time_t last_activity;
         boost::shared_ptr<query_language::json_stream_t> stream;
         int max_chunk_size; //Size of 0 = unlimited
         time_t max_age;
+        // What the stream held the last time it was read from.
+        size_t size;
+        // Whether a query is reading from the stream, or has just inserted it
+        // and is about to.
+        bool in_use;
+        thread_node_t thread_node;
     };
-    std::map<int64_t, entry_t> streams;
+    std::map<int64_t, boost::shared_ptr<entry_t> > streams;
+    // Least recently used first.
+    intrusive_list_t<entry_t> lru;
+
+    size_t memory_budget, thread_memory_budget;
+    size_t size;
+    // Those of the thread this cache was made on.
+    thread_streams_t *thread_streams;
+
+    DISABLE_COPYING(stream_cache_t);
 };
 
 #endif  // RDB_PROTOCOL_STREAM_CACHE_HPP_
@@ -5,17 +5,29 @@
 
 namespace query_language {
 
-transform_visitor_t::transform_visitor_t(boost::shared_ptr<scoped_cJSON_t> _json, json_list_t *_out, query_language::runtime_environment_t *_env, const scopes_t &_scopes, const backtrace_t &_backtrace)
-    : json(_json), out(_out), env(_env), scopes(_scopes), backtrace(_backtrace)
+transform_visitor_t::transform_visitor_t(boost::shared_ptr<scoped_cJSON_t> _json, json_list_t *_out, query_language::runtime_environment_t *_env, const scopes_t &_scopes, const backtrace_t &_backtrace,
+                                         const compiled_lambda_t *_compiled)
+    : json(_json), out(_out), env(_env), scopes(_scopes), backtrace(_backtrace), compiled(_compiled)
 { }
 
 void transform_visitor_t::operator()(const Builtin_Filter &filter) const {
-    if (query_language::predicate_t(filter.predicate(), env, scopes, backtrace)(json)) {
+    if (compiled) {
+        boost::shared_ptr<scoped_cJSON_t> a_bool = (*compiled)(json);
+        if (a_bool->type() == cJSON_True) {
+            out->push_back(json);
+        } else if (a_bool->type() != cJSON_False) {
+            throw runtime_exc_t("Predicate failed to evaluate to a bool", backtrace);
+        }
+    } else if (query_language::predicate_t(filter.predicate(), env, scopes, backtrace)(json)) {
         out->push_back(json);
     }
 }
 
 void transform_visitor_t::operator()(const Mapping &mapping) const {
+    if (compiled) {
+        out->push_back((*compiled)(json));
+        return;
+    }
     Term t = mapping.body();
     out->push_back(query_language::map_rdb(mapping.arg(), &t, env, scopes, backtrace, json));
 }
@@ -62,6 +74,269 @@ void transform_visitor_t::operator()(Builtin_Range range) const {
     }
 }
 
+/* If `t` is a mapping, predicate or concat-map whose body is just a javascript
+term, finds the name of its argument and the term. */
+static bool get_javascript_body(const rdb_protocol_details::transform_variant_t &t, std::string *arg_out, const Term **body_out) {
+    if (const Builtin_Filter *filter = boost::get<Builtin_Filter>(&t)) {
+        *arg_out = filter->predicate().arg();
+        *body_out = &filter->predicate().body();
+    } else if (const Mapping *mapping = boost::get<Mapping>(&t)) {
+        *arg_out = mapping->arg();
+        *body_out = &mapping->body();
+    } else if (const Builtin_ConcatMap *concatmap = boost::get<Builtin_ConcatMap>(&t)) {
+        *arg_out = concatmap->mapping().arg();
+        *body_out = &concatmap->mapping().body();
+    } else {
+        return false;
+    }
+    return (*body_out)->type() == Term::JAVASCRIPT;
+}
+
+bool transform_has_javascript(const rdb_protocol_details::transform_t &transform) {
+    for (rdb_protocol_details::transform_t::const_iterator it = transform.begin(); it != transform.end(); ++it) {
+        std::string arg;
+        const Term *body;
+        if (get_javascript_body(it->variant, &arg, &body)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Does to `out` what `transform_visitor_t` would, given that `result` is what
+the body of `t` came to for `json`. */
+static void apply_javascript_result(const rdb_protocol_details::transform_variant_t &t,
+                                    const boost::shared_ptr<scoped_cJSON_t> &json,
+                                    const boost::shared_ptr<scoped_cJSON_t> &result,
+                                    json_list_t *out, const backtrace_t &backtrace) {
+    if (boost::get<Builtin_Filter>(&t)) {
+        if (result->type() == cJSON_True) {
+            out->push_back(json);
+        } else if (result->type() != cJSON_False) {
+            throw runtime_exc_t("Predicate failed to evaluate to a bool", backtrace);
+        }
+    } else if (boost::get<Mapping>(&t)) {
+        out->push_back(result);
+    } else if (boost::get<Builtin_ConcatMap>(&t)) {
+        require_type(result->get(), cJSON_Array, backtrace);
+        json_array_iterator_t it(result->get());
+        while (cJSON *item = it.next()) {
+            out->push_back(boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_DeepCopy(item))));
+        }
+    } else {
+        unreachable();
+    }
+}
+
+/* `compiled` is `NULL`, or `transform` compiled. */
+static void transform_rows(const rdb_protocol_details::transform_t &transform, const compiled_transform_t *compiled,
+                           const std::vector<boost::shared_ptr<scoped_cJSON_t> > &rows,
+                           std::vector<json_list_t> *out, runtime_environment_t *env) {
+    out->clear();
+    out->resize(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        (*out)[i].push_back(rows[i]);
+    }
+
+    size_t step = 0;
+    for (rdb_protocol_details::transform_t::const_iterator it = transform.begin(); it != transform.end(); ++it, ++step) {
+        std::string arg;
+        const Term *body;
+        if (get_javascript_body(it->variant, &arg, &body)) {
+            std::vector<boost::shared_ptr<scoped_cJSON_t> > vals, results;
+            for (size_t i = 0; i < out->size(); ++i) {
+                vals.insert(vals.end(), (*out)[i].begin(), (*out)[i].end());
+            }
+            Term t = *body;
+            eval_javascript_batch(&t, arg, vals, env, it->scopes, it->backtrace, &results);
+
+            std::vector<boost::shared_ptr<scoped_cJSON_t> >::iterator result = results.begin();
+            for (size_t i = 0; i < out->size(); ++i) {
+                json_list_t tmp;
+                for (json_list_t::iterator jt = (*out)[i].begin(); jt != (*out)[i].end(); ++jt, ++result) {
+                    apply_javascript_result(it->variant, *jt, *result, &tmp, it->backtrace);
+                }
+                (*out)[i].swap(tmp);
+            }
+        } else {
+            const compiled_lambda_t *compiled_step = compiled ? compiled->get_step(step) : NULL;
+            for (size_t i = 0; i < out->size(); ++i) {
+                json_list_t tmp;
+                for (json_list_t::iterator jt = (*out)[i].begin(); jt != (*out)[i].end(); ++jt) {
+                    boost::apply_visitor(transform_visitor_t(*jt, &tmp, env, it->scopes, it->backtrace, compiled_step), it->variant);
+                }
+                (*out)[i].swap(tmp);
+            }
+        }
+    }
+}
+
+void transform_rows(const rdb_protocol_details::transform_t &transform,
+                    const std::vector<boost::shared_ptr<scoped_cJSON_t> > &rows,
+                    std::vector<json_list_t> *out, runtime_environment_t *env) {
+    transform_rows(transform, NULL, rows, out, env);
+}
+
+void transform_rows(const compiled_transform_t &transform,
+                    const std::vector<boost::shared_ptr<scoped_cJSON_t> > &rows,
+                    std::vector<json_list_t> *out, runtime_environment_t *env) {
+    transform_rows(transform.get_transform(), &transform, rows, out, env);
+}
+
+static bool collect_mapping_attrs(const Mapping &m, const std::string &var, std::set<std::string> *attrs_out) {
+    return collect_row_attrs(m.body(), var, attrs_out);
+}
+
+/* Looks inside the lambdas that some builtins carry. Inside them `var` may be
+shadowed, in which case we collect the attributes of whatever it's bound to
+there too, which is wasteful but not wrong. */
+static bool collect_builtin_attrs(const Builtin &b, const std::string &var, std::set<std::string> *attrs_out) {
+    if (b.has_filter() && !collect_row_attrs(b.filter().predicate().body(), var, attrs_out)) {
+        return false;
+    }
+    if (b.has_map() && !collect_mapping_attrs(b.map().mapping(), var, attrs_out)) {
+        return false;
+    }
+    if (b.has_concat_map() && !collect_mapping_attrs(b.concat_map().mapping(), var, attrs_out)) {
+        return false;
+    }
+    if (b.has_reduce() && (!collect_row_attrs(b.reduce().base(), var, attrs_out) ||
+                           !collect_row_attrs(b.reduce().body(), var, attrs_out))) {
+        return false;
+    }
+    if (b.has_grouped_map_reduce()) {
+        const Builtin::GroupedMapReduce &gmr = b.grouped_map_reduce();
+        if (!collect_mapping_attrs(gmr.group_mapping(), var, attrs_out) ||
+            !collect_mapping_attrs(gmr.value_mapping(), var, attrs_out) ||
+            !collect_row_attrs(gmr.reduction().base(), var, attrs_out) ||
+            !collect_row_attrs(gmr.reduction().body(), var, attrs_out)) {
+            return false;
+        }
+    }
+    if (b.has_range()) {
+        if ((b.range().has_lowerbound() && !collect_row_attrs(b.range().lowerbound(), var, attrs_out)) ||
+            (b.range().has_upperbound() && !collect_row_attrs(b.range().upperbound(), var, attrs_out))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool collect_row_attrs(const Term &t, const std::string &var, std::set<std::string> *attrs_out) {
+    switch (t.type()) {
+    case Term::VAR:
+        return t.var() != var;
+    case Term::IMPLICIT_VAR:
+    case Term::JAVASCRIPT:
+        return false;
+    case Term::LET:
+        for (int i = 0; i < t.let().binds_size(); ++i) {
+            if (!collect_row_attrs(t.let().binds(i).term(), var, attrs_out)) {
+                return false;
+            }
+        }
+        return collect_row_attrs(t.let().expr(), var, attrs_out);
+    case Term::CALL: {
+        const Term::Call &c = t.call();
+        const Builtin &b = c.builtin();
+        bool on_row = c.args_size() > 0 && c.args(0).type() == Term::VAR && c.args(0).var() == var;
+        int first_arg = 0;
+        switch (b.type()) {
+        case Builtin::GETATTR:
+        case Builtin::HASATTR:
+            if (on_row) {
+                attrs_out->insert(b.attr());
+                first_arg = 1;
+            }
+            break;
+        case Builtin::PICKATTRS:
+            if (on_row) {
+                attrs_out->insert(b.attrs().begin(), b.attrs().end());
+                first_arg = 1;
+            }
+            break;
+        case Builtin::IMPLICIT_GETATTR:
+        case Builtin::IMPLICIT_HASATTR:
+            attrs_out->insert(b.attr());
+            break;
+        case Builtin::IMPLICIT_PICKATTRS:
+            attrs_out->insert(b.attrs().begin(), b.attrs().end());
+            break;
+        case Builtin::IMPLICIT_WITHOUT:
+            return false;
+        case Builtin::NOT:
+        case Builtin::WITHOUT:
+        case Builtin::MAPMERGE:
+        case Builtin::ARRAYAPPEND:
+        case Builtin::SLICE:
+        case Builtin::ADD:
+        case Builtin::SUBTRACT:
+        case Builtin::MULTIPLY:
+        case Builtin::DIVIDE:
+        case Builtin::MODULO:
+        case Builtin::COMPARE:
+        case Builtin::FILTER:
+        case Builtin::MAP:
+        case Builtin::CONCATMAP:
+        case Builtin::ORDERBY:
+        case Builtin::DISTINCT:
+        case Builtin::LENGTH:
+        case Builtin::UNION:
+        case Builtin::NTH:
+        case Builtin::STREAMTOARRAY:
+        case Builtin::ARRAYTOSTREAM:
+        case Builtin::REDUCE:
+        case Builtin::GROUPEDMAPREDUCE:
+        case Builtin::ANY:
+        case Builtin::ALL:
+        case Builtin::RANGE:
+            break;
+        default:
+            unreachable();
+        }
+        if (!collect_builtin_attrs(b, var, attrs_out)) {
+            return false;
+        }
+        for (int i = first_arg; i < c.args_size(); ++i) {
+            if (!collect_row_attrs(c.args(i), var, attrs_out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case Term::IF:
+        return collect_row_attrs(t.if_().test(), var, attrs_out) &&
+               collect_row_attrs(t.if_().true_branch(), var, attrs_out) &&
+               collect_row_attrs(t.if_().false_branch(), var, attrs_out);
+    case Term::ARRAY:
+        for (int i = 0; i < t.array_size(); ++i) {
+            if (!collect_row_attrs(t.array(i), var, attrs_out)) {
+                return false;
+            }
+        }
+        return true;
+    case Term::OBJECT:
+        for (int i = 0; i < t.object_size(); ++i) {
+            if (!collect_row_attrs(t.object(i).term(), var, attrs_out)) {
+                return false;
+            }
+        }
+        return true;
+    case Term::GETBYKEY:
+        return collect_row_attrs(t.get_by_key().key(), var, attrs_out);
+    case Term::JSON_NULL:
+    case Term::ERROR:
+    case Term::NUMBER:
+    case Term::STRING:
+    case Term::JSON:
+    case Term::BOOL:
+    case Term::TABLE:
+        return true;
+    default:
+        unreachable();
+    }
+}
+
 terminal_initializer_visitor_t::terminal_initializer_visitor_t(rget_read_response_t::result_t *_out,
                                                                query_language::runtime_environment_t *_env,
                                                                const scopes_t &_scopes,
@@ -120,11 +395,16 @@ void terminal_visitor_t::operator()(const Builtin_GroupedMapReduce &gmr) const {
         Term base = gmr.reduction().base(),
              body = gmr.reduction().body();
 
+        rget_read_response_t::groups_t::iterator group = res_groups->find(grouping);
+        if (group == res_groups->end()) {
+            group = res_groups->insert(std::make_pair(grouping, eval_term_as_json(&base, env, scopes, backtrace.with("reduction").with("base")))).first;
+        }
+
         scopes_t scopes_copy = scopes;
         new_val_scope_t inner_scope(&scopes_copy.scope);
-        scopes_copy.scope.put_in_scope(gmr.reduction().var1(), res_groups->insert(std::make_pair(grouping, eval_term_as_json(&base, env, scopes, backtrace.with("reduction").with("base")))).first->second);
+        scopes_copy.scope.put_in_scope(gmr.reduction().var1(), group->second);
         scopes_copy.scope.put_in_scope(gmr.reduction().var2(), mapped_value);
-        (*res_groups)[grouping] = eval_term_as_json(&body, env, scopes_copy, backtrace.with("reduction").with("body"));
+        group->second = eval_term_as_json(&body, env, scopes_copy, backtrace.with("reduction").with("body"));
     }
 }
 
@@ -160,4 +440,65 @@ void terminal_visitor_t::operator()(const WriteQuery_ForEach &w) const {
     }
 }
 
+terminal_merge_visitor_t::terminal_merge_visitor_t(const rget_read_response_t::result_t &_in,
+                                                   query_language::runtime_environment_t *_env,
+                                                   const scopes_t &_scopes,
+                                                   const backtrace_t &_backtrace,
+                                                   rget_read_response_t::result_t *_out)
+    : in(&_in), env(_env), scopes(_scopes), backtrace(_backtrace), out(_out)
+{ }
+
+void terminal_merge_visitor_t::operator()(const Builtin_GroupedMapReduce &gmr) const {
+    rget_read_response_t::groups_t *res_groups = boost::get<rget_read_response_t::groups_t>(out);
+    guarantee(res_groups);
+    const rget_read_response_t::groups_t *groups = boost::get<rget_read_response_t::groups_t>(in);
+    guarantee(groups);
+
+    for (rget_read_response_t::groups_t::const_iterator it = groups->begin(); it != groups->end(); ++it) {
+        Term base = gmr.reduction().base(),
+             body = gmr.reduction().body();
+
+        rget_read_response_t::groups_t::iterator group = res_groups->find(it->first);
+        if (group == res_groups->end()) {
+            group = res_groups->insert(std::make_pair(it->first, eval_term_as_json(&base, env, scopes, backtrace.with("reduction").with("base")))).first;
+        }
+
+        scopes_t scopes_copy = scopes;
+        new_val_scope_t inner_scope(&scopes_copy.scope);
+        scopes_copy.scope.put_in_scope(gmr.reduction().var1(), group->second);
+        scopes_copy.scope.put_in_scope(gmr.reduction().var2(), it->second);
+        group->second = eval_term_as_json(&body, env, scopes_copy, backtrace.with("reduction").with("body"));
+    }
+}
+
+void terminal_merge_visitor_t::operator()(const Reduction &r) const {
+    rget_read_response_t::atom_t *res_atom = boost::get<rget_read_response_t::atom_t>(out);
+    guarantee(res_atom);
+    const rget_read_response_t::atom_t *atom = boost::get<rget_read_response_t::atom_t>(in);
+    guarantee(atom);
+
+    scopes_t scopes_copy = scopes;
+    new_val_scope_t inner_scope(&scopes_copy.scope);
+    scopes_copy.scope.put_in_scope(r.var1(), *res_atom);
+    scopes_copy.scope.put_in_scope(r.var2(), *atom);
+    Term body = r.body();
+    *res_atom = eval_term_as_json(&body, env, scopes_copy, backtrace.with("body"));
+}
+
+void terminal_merge_visitor_t::operator()(const rdb_protocol_details::Length &) const {
+    rget_read_response_t::length_t *res_length = boost::get<rget_read_response_t::length_t>(out);
+    guarantee(res_length);
+    const rget_read_response_t::length_t *length = boost::get<rget_read_response_t::length_t>(in);
+    guarantee(length);
+    res_length->length += length->length;
+}
+
+void terminal_merge_visitor_t::operator()(const WriteQuery_ForEach &) const {
+    rget_read_response_t::inserted_t *res_inserted = boost::get<rget_read_response_t::inserted_t>(out);
+    guarantee(res_inserted);
+    const rget_read_response_t::inserted_t *inserted = boost::get<rget_read_response_t::inserted_t>(in);
+    guarantee(inserted);
+    res_inserted->inserted += inserted->inserted;
+}
+
 } //namespace query_language
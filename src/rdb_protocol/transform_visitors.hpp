@@ -3,12 +3,16 @@
 #define RDB_PROTOCOL_TRANSFORM_VISITORS_HPP_
 
 #include <list>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "errors.hpp"
 #include <boost/shared_ptr.hpp>
 #include <boost/variant.hpp>
 
 #include "http/json.hpp"
+#include "rdb_protocol/compiled_term.hpp"
 #include "rdb_protocol/protocol.hpp"
 #include "rdb_protocol/query_language.pb.h"
 
@@ -20,10 +24,13 @@ class runtime_environment_t;
 
 typedef std::list<boost::shared_ptr<scoped_cJSON_t> > json_list_t;
 
-/* A visitor for applying a transformation to a bit of json. */
+/* A visitor for applying a transformation to a bit of json. If `_compiled` is
+given, it's the compiled body of the filter or mapping, and it's run instead of
+interpreting the body. */
 class transform_visitor_t : public boost::static_visitor<void> {
 public:
-    transform_visitor_t(boost::shared_ptr<scoped_cJSON_t> _json, json_list_t *_out, query_language::runtime_environment_t *_env, const scopes_t &_scopes, const backtrace_t &_backtrace);
+    transform_visitor_t(boost::shared_ptr<scoped_cJSON_t> _json, json_list_t *_out, query_language::runtime_environment_t *_env, const scopes_t &_scopes, const backtrace_t &_backtrace,
+                        const compiled_lambda_t *_compiled = NULL);
 
     void operator()(const Builtin_Filter &filter) const;
 
@@ -39,8 +46,34 @@ private:
     query_language::runtime_environment_t *env;
     scopes_t scopes;
     backtrace_t backtrace;
+    const compiled_lambda_t *compiled;
 };
 
+/* Whether any step of `transform` is a mapping, predicate or concat-map whose
+body is just a javascript term. Those are worth running on batches of rows. */
+bool transform_has_javascript(const rdb_protocol_details::transform_t &transform);
+
+/* Applies `transform` to each of `rows`; `(*out)[i]` gets what `rows[i]` turns
+into. Steps that are just javascript are run on all the rows at once, with
+`eval_javascript_batch()`; the rest are run a row at a time with
+`transform_visitor_t`. */
+void transform_rows(const rdb_protocol_details::transform_t &transform,
+                    const std::vector<boost::shared_ptr<scoped_cJSON_t> > &rows,
+                    std::vector<json_list_t> *out, runtime_environment_t *env);
+
+/* The same, but with the filters and mappings that could be compiled run
+compiled. Compiling pays for itself once a transform is run on more than a
+few rows. */
+void transform_rows(const compiled_transform_t &transform,
+                    const std::vector<boost::shared_ptr<scoped_cJSON_t> > &rows,
+                    std::vector<json_list_t> *out, runtime_environment_t *env);
+
+/* Adds to `*attrs_out` every top-level attribute of the row bound to `var`
+(which is also the implicit variable) that `t` might look at. Returns false if
+`t` might use the row as a whole, in which case `*attrs_out` means nothing.
+The answer errs on the side of more attributes, never fewer. */
+bool collect_row_attrs(const Term &t, const std::string &var, std::set<std::string> *attrs_out);
+
 /* A visitor for setting the result type based on a terminal. */
 class terminal_initializer_visitor_t : public boost::static_visitor<void> {
 public:
@@ -88,6 +121,34 @@ private:
     rget_read_response_t::result_t *out;
 };
 
+/* A visitor for folding `in`, the result of applying a terminal to some of
+the rows, into `*out`, the result for other rows. That's how the results of
+the shards of a table, or of the streams of a union, are put together. `*out`
+starts out as `terminal_initializer_visitor_t` leaves it. */
+class terminal_merge_visitor_t : public boost::static_visitor<void> {
+public:
+    terminal_merge_visitor_t(const rget_read_response_t::result_t &_in,
+                             query_language::runtime_environment_t *_env,
+                             const scopes_t &_scopes,
+                             const backtrace_t &_backtrace,
+                             rget_read_response_t::result_t *_out);
+
+    void operator()(const Builtin_GroupedMapReduce &gmr) const;
+
+    void operator()(const Reduction &r) const;
+
+    void operator()(const rdb_protocol_details::Length &) const;
+
+    void operator()(const WriteQuery_ForEach &) const;
+
+private:
+    const rget_read_response_t::result_t *in;
+    query_language::runtime_environment_t *env;
+    scopes_t scopes;
+    backtrace_t backtrace;
+    rget_read_response_t::result_t *out;
+};
+
 }  // namespace query_language
 
 #endif  // RDB_PROTOCOL_TRANSFORM_VISITORS_HPP_
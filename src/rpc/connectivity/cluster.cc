@@ -3,6 +3,7 @@
 
 #include "errors.hpp"
 #include <boost/optional.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include "arch/io/network.hpp"
 #include "arch/timing.hpp"
@@ -10,6 +11,7 @@
 #include "concurrency/cross_thread_signal.hpp"
 #include "concurrency/pmap.hpp"
 #include "concurrency/semaphore.hpp"
+#include "concurrency/wait_any.hpp"
 #include "containers/archive/vector_stream.hpp"
 #include "containers/object_buffer.hpp"
 #include "containers/uuid.hpp"
@@ -20,6 +22,9 @@
 const char *const cluster_proto_header = CLUSTER_PROTO_HEADER;
 
 const int connectivity_cluster_t::run_t::default_user_timeout(12000);
+const int connectivity_cluster_t::run_t::default_connections_per_peer(4);
+const int connectivity_cluster_t::run_t::max_connections_per_peer(64);
+const int connectivity_cluster_t::run_t::lane_setup_timeout_ms(5000);
 
 void debug_print(append_only_printf_buffer_t *buf, const peer_address_t &address) {
     buf->appendf("peer_address{ips=[");
@@ -36,7 +41,8 @@ void debug_print(append_only_printf_buffer_t *buf, const peer_address_t &address
 connectivity_cluster_t::run_t::run_t(connectivity_cluster_t *p,
         int port,
         message_handler_t *mh,
-        int client_port) THROWS_ONLY(address_in_use_exc_t) :
+        int client_port,
+        int conns_per_peer) THROWS_ONLY(address_in_use_exc_t) :
     parent(p),
     message_handler(mh),
 
@@ -47,6 +53,10 @@ connectivity_cluster_t::run_t::run_t(connectivity_cluster_t *p,
     /* The local port to use when connecting to the cluster port of peers */
     cluster_client_port(client_port),
 
+    /* If all of our outgoing connections come from the same local port, we
+    can't open a second one to the same peer. */
+    connections_per_peer(client_port == 0 ? std::max(1, std::min(conns_per_peer, max_connections_per_peer)) : 1),
+
     /* This sets `parent->current_run` to `this`. It's necessary to do it in the
     constructor of a subfield rather than in the body of the `run_t` constructor
     because `parent->current_run` needs to be set before `connection_to_ourself`
@@ -63,7 +73,7 @@ connectivity_cluster_t::run_t::run_t(connectivity_cluster_t *p,
     `connection_map` on each thread and notifying any listeners that we're now
     connected to ourself. The destructor will remove us from the
     `connection_map` and again notify any listeners. */
-    connection_to_ourself(this, parent->me, NULL, routing_table[parent->me]),
+    connection_to_ourself(this, parent->me, std::vector<tcp_conn_stream_t *>(), routing_table[parent->me]),
 
     listener(new tcp_listener_t(cluster_listener_socket.get(),
                                 boost::bind(&connectivity_cluster_t::run_t::on_new_connection,
@@ -89,15 +99,24 @@ void connectivity_cluster_t::run_t::join(peer_address_t address) THROWS_NOTHING
         auto_drainer_t::lock_t(&drainer)));
 }
 
-connectivity_cluster_t::run_t::connection_entry_t::connection_entry_t(run_t *p, peer_id_t id, tcp_conn_stream_t *c, peer_address_t a) THROWS_NOTHING :
-    conn(c), address(a), session_id(generate_uuid()),
+connectivity_cluster_t::run_t::connection_entry_t::connection_entry_t(run_t *p, peer_id_t id, const std::vector<tcp_conn_stream_t *> &c, peer_address_t a) THROWS_NOTHING :
+    conns(c), address(a), session_id(generate_uuid()),
     pm_collection(),
     pm_bytes_sent(secs_to_ticks(1), true),
     pm_collection_membership(&p->parent->connectivity_collection, &pm_collection, uuid_to_str(id.get_uuid())),
     pm_bytes_sent_membership(&pm_collection, &pm_bytes_sent, "bytes_sent"),
-    parent(p), peer(id),
-    entries(new one_per_thread_t<entry_installation_t>(this)) {
+    parent(p), peer(id) {
+    if (!conns.empty()) {
+        send_mutexes.init(conns.size());
+#ifndef NDEBUG
+        for (size_t i = 1; i < conns.size(); ++i) {
+            rassert(conns[i]->home_thread() == conns[0]->home_thread());
+        }
+#endif
+    }
 
+    /* This must come last, because it makes us visible to `send_message()`. */
+    entries.init(new one_per_thread_t<entry_installation_t>(this));
 }
 
 connectivity_cluster_t::run_t::connection_entry_t::~connection_entry_t() THROWS_NOTHING {
@@ -105,8 +124,23 @@ connectivity_cluster_t::run_t::connection_entry_t::~connection_entry_t() THROWS_
     entries.reset();
 
     /* `~entry_installation_t` destroys the `auto_drainer_t`'s in entries,
-    so nothing can be holding the `send_mutex`. */
-    guarantee(!send_mutex.is_locked());
+    so nothing can be holding the `send_mutexes`. */
+    for (size_t i = 0; i < conns.size(); ++i) {
+        guarantee(!send_mutexes[i].is_locked());
+    }
+}
+
+size_t connectivity_cluster_t::run_t::connection_entry_t::choose_conn(uint64_t stripe) const {
+    rassert(!conns.empty());
+    if (stripe == 0 || conns.size() == 1) {
+        return 0;
+    }
+    /* The stripe is all that decides the connection, so that messages on the
+    same stripe keep their order whichever `message_multiplexer_t` client sent
+    them. Mailbox IDs, which are the most common stripes, go up in even steps,
+    so we scramble the stripe before reducing it. */
+    uint64_t scrambled = (stripe * 0x9E3779B97F4A7C15ULL) >> 32;
+    return 1 + scrambled % (conns.size() - 1);
 }
 
 static void ping_connection_watcher(peer_id_t peer, peers_list_callback_t *connect_disconnect_cb) THROWS_NOTHING {
@@ -148,6 +182,36 @@ connectivity_cluster_t::run_t::connection_entry_t::entry_installation_t::~entry_
     }
 }
 
+bool connectivity_cluster_t::run_t::lane_rendezvous_t::add_lane(int32_t lane, tcp_conn_stream_t *conn) {
+    if (lane <= 0 || lane >= max_connections_per_peer || lanes.count(lane) != 0) {
+        return false;
+    }
+    if (expected_lanes != -1 && lane > expected_lanes) {
+        return false;
+    }
+    lanes[lane] = conn;
+    check_if_done();
+    return true;
+}
+
+void connectivity_cluster_t::run_t::lane_rendezvous_t::set_expected_lanes(int32_t count) {
+    guarantee(expected_lanes == -1);
+    expected_lanes = count;
+    check_if_done();
+}
+
+void connectivity_cluster_t::run_t::lane_rendezvous_t::check_if_done() {
+    if (expected_lanes == -1 || all_lanes_arrived.is_pulsed()) {
+        return;
+    }
+    for (int32_t i = 1; i <= expected_lanes; ++i) {
+        if (lanes.find(i) == lanes.end()) {
+            return;
+        }
+    }
+    all_lanes_arrived.pulse();
+}
+
 void connectivity_cluster_t::run_t::on_new_connection(const scoped_ptr_t<tcp_conn_descriptor_t> &nconn, auto_drainer_t::lock_t lock) THROWS_NOTHING {
     parent->assert_thread();
 
@@ -258,6 +322,114 @@ static bool deserialize_and_check(tcp_conn_stream_t *c, T *p, const char *peer)
     }
 }
 
+// Sends our half of the handshake: the header, our ID and address, and which
+// lane this connection is. Returns true if handle() should return.
+static bool send_handshake(tcp_conn_stream_t *c, peer_id_t me, const peer_address_t &address, int32_t lane) {
+    write_message_t msg;
+    msg.append(cluster_proto_header, sizeof CLUSTER_PROTO_HEADER - 1);
+    msg << me;
+    msg << address;
+    msg << lane;
+    return send_write_message(c, &msg) != 0;
+}
+
+// Receives and checks the other side's header, then reads its ID, address, and
+// lane. Returns true if handle() should return.
+static bool receive_handshake(tcp_conn_stream_t *c, const char *peer,
+                              peer_id_t *other_id, peer_address_t *other_address, int32_t *other_lane) {
+    const int64_t header_size = sizeof CLUSTER_PROTO_HEADER - 1;
+    char data[header_size];
+    int64_t r;
+    for (int64_t i = 0; i < header_size; i += r) {
+        r = c->read(data, header_size - i);
+        if (-1 == r)
+            return true;        // network error.
+        rassert(r >= 0);
+        // If EOF or data does not match header, terminate connection.
+        if (0 == r || memcmp(cluster_proto_header + i, data, r)) {
+            // Wrong header.
+            logWRN("received invalid clustering header from %s, closing connection", peer);
+            return true;
+        }
+    }
+
+    return deserialize_and_check(c, other_id, peer) ||
+        deserialize_and_check(c, other_address, peer) ||
+        deserialize_and_check(c, other_lane, peer);
+}
+
+tcp_conn_stream_t *connectivity_cluster_t::run_t::open_lane(
+        const ip_address_t &ip, int port,
+        peer_id_t expected_id, int32_t lane,
+        auto_drainer_t::lock_t drainer_lock) THROWS_NOTHING {
+    parent->assert_thread();
+    scoped_ptr_t<tcp_conn_stream_t> lane_conn;
+    try {
+        lane_conn.init(new tcp_conn_stream_t(ip, port, drainer_lock.get_drain_signal(), cluster_client_port));
+    } catch (tcp_conn_t::connect_failed_exc_t) {
+        return NULL;
+    } catch (interrupted_exc_t) {
+        return NULL;
+    }
+
+    std::string peerstr = ip.as_dotted_decimal();
+    cluster_conn_closing_subscription_t conn_closer(lane_conn.get());
+    conn_closer.reset(drainer_lock.get_drain_signal());
+
+    lane_conn->get_underlying_conn()->set_keepalive(3, 3, 3);
+
+    peer_id_t other_id;
+    peer_address_t other_address;
+    int32_t other_lane;
+    if (send_handshake(lane_conn.get(), parent->me, routing_table[parent->me], lane) ||
+        receive_handshake(lane_conn.get(), peerstr.c_str(), &other_id, &other_address, &other_lane)) {
+        return NULL;
+    }
+    if (other_id != expected_id || other_lane != 0) {
+        logERR("received inconsistent routing information while opening a connection to %s, closing connection", peerstr.c_str());
+        return NULL;
+    }
+
+    conn_closer.reset();
+    return lane_conn.release();
+}
+
+void connectivity_cluster_t::run_t::handle_messages(
+        tcp_conn_stream_t *c, peer_id_t other_id, std::string peername,
+        cond_t *teardown, UNUSED auto_drainer_t::lock_t lanes_lock) THROWS_NOTHING {
+    /* Read messages off the connection until it's closed, which may be due to
+    network events, or the other end shutting down, or us shutting down, or
+    another connection to the same peer dying. */
+    try {
+        while (true) {
+            /* For now, we use `std::string` for messages on the wire: it's
+            just a length and a byte vector. This is obviously slow and we
+            should change it when we care about performance. */
+            std::string message;
+            if (deserialize_and_check(c, &message, peername.c_str()))
+                break;
+
+            std::vector<char> vec(message.begin(), message.end());
+            vector_read_stream_t stream(&vec);
+            message_handler->on_message(other_id, &stream); // might raise fake_archive_exc_t
+        }
+    } catch (fake_archive_exc_t) {
+        /* The exception broke us out of the loop, and that's what we
+        wanted. This could either be because we lost contact with the peer
+        or because the cluster is shutting down and `close_conn()` got
+        called. */
+    }
+
+    /* If one connection to a peer dies, we take down all of them; otherwise
+    messages on the dead connection's stripes would be silently lost while
+    the peer still looks connected. */
+    teardown->pulse_if_not_already_pulsed();
+
+    guarantee(!c->is_read_open(), "the connection is still open for "
+        "read, which means we had a problem other than the TCP "
+        "connection closing or dying");
+}
+
 // We log error conditions as follows:
 // - silent: network error; conflict between parallel connections
 // - warning: invalid header
@@ -277,7 +449,8 @@ void connectivity_cluster_t::run_t::handle(
     // Get the name of our peer, for error reporting.
     ip_address_t peer_addr;
     std::string peerstr = "(unknown)";
-    if (!conn->get_underlying_conn()->getpeername(&peer_addr))
+    bool have_peer_addr = !conn->get_underlying_conn()->getpeername(&peer_addr);
+    if (have_peer_addr)
         peerstr = peer_addr.as_dotted_decimal();
     const char *peername = peerstr.c_str();
 
@@ -291,43 +464,17 @@ void connectivity_cluster_t::run_t::handle(
     seconds total. */
     conn->get_underlying_conn()->set_keepalive(3, 3, 3);
 
-    // Each side sends a header followed by its own ID and address, then receives and checks the
-    // other side's.
-    const int64_t header_size = sizeof CLUSTER_PROTO_HEADER - 1;
+    // Each side sends a header followed by its own ID, address and lane
+    // number, then receives and checks the other side's. Connections that
+    // `handle()` is responsible for are always lane 0 from our point of view;
+    // only `open_lane()` sends a nonzero lane number.
+    if (send_handshake(conn, parent->me, routing_table[parent->me], 0))
+        return;                 // network error.
 
-    // Send header, id, address.
-    {
-        write_message_t msg;
-        msg.append(cluster_proto_header, header_size);
-        msg << parent->me;
-        msg << routing_table[parent->me];
-        if (send_write_message(conn, &msg))
-            return;             // network error.
-    }
-
-    // Receive & check header.
-    {
-        char data[header_size];
-        int64_t r;
-        for (int64_t i = 0; i < header_size; i += r) {
-            r = conn->read(data, header_size - i);
-            if (-1 == r)
-                return;         // network error.
-            rassert(r >= 0);
-            // If EOF or data does not match header, terminate connection.
-            if (0 == r || memcmp(cluster_proto_header + i, data, r)) {
-                // Wrong header.
-                logWRN("received invalid clustering header from %s, closing connection", peername);
-                return;
-            }
-        }
-    }
-
-    // Receive id, address.
     peer_id_t other_id;
     peer_address_t other_address;
-    if (deserialize_and_check(conn, &other_id, peername) ||
-        deserialize_and_check(conn, &other_address, peername))
+    int32_t other_lane;
+    if (receive_handshake(conn, peername, &other_id, &other_address, &other_lane))
         return;
 
     /* Sanity checks */
@@ -358,6 +505,29 @@ void connectivity_cluster_t::run_t::handle(
     // Just saying that we're still on the rpc listener thread.
     parent->assert_thread();
 
+    if (other_lane != 0) {
+        /* This is an additional connection from a peer we're already
+        connected to, and we're the follower. Hand it over to the first
+        connection and keep it alive until that connection is done with it. */
+        std::map<peer_id_t, lane_rendezvous_t *>::iterator it =
+            lane_rendezvous_table.find(other_id);
+        if (it == lane_rendezvous_table.end()) {
+            return;
+        }
+        auto_drainer_t::lock_t lane_keepalive(&it->second->drainer);
+        if (!it->second->add_lane(other_lane, conn)) {
+            logERR("received unexpected connection number %d from %s, closing connection", static_cast<int>(other_lane), peername);
+            return;
+        }
+
+        /* From now on, the first connection is responsible for closing this
+        one. It may also move it to a different thread, so we mustn't touch it
+        until it's done. */
+        conn_closer_1.reset();
+        lane_keepalive.get_drain_signal()->wait_lazily_unordered();
+        return;
+    }
+
     /* The trickiest case is when there are two or more parallel connections
     that are trying to be established between the same two machines. We can get
     this when e.g. machine A and machine B try to connect to each other at the
@@ -382,6 +552,14 @@ void connectivity_cluster_t::run_t::handle(
     parent->assert_thread();
     std::map<peer_id_t, peer_address_t> other_routing_table;
 
+    /* The leader opens the extra connections and owns them; the follower
+    accepts them through `lane_rendezvous`. Either way they end up in
+    `lane_conns`, with `conn` itself in `lane_conns[0]`. */
+    std::vector<tcp_conn_stream_t *> lane_conns(1, conn);
+    boost::ptr_vector<tcp_conn_stream_t> leader_lanes;
+    lane_rendezvous_t lane_rendezvous;
+    map_insertion_sentry_t<peer_id_t, lane_rendezvous_t *> lane_rendezvous_sentry;
+
     if (we_are_leader) {
 
         std::map<peer_id_t, peer_address_t> routing_table_to_send;
@@ -422,6 +600,25 @@ void connectivity_cluster_t::run_t::handle(
         if (deserialize_and_check(conn, &other_routing_table, peername))
             return;
 
+        /* Open the remaining connections, stopping at the first one that
+        fails; then tell the follower how many to expect. */
+        if (have_peer_addr) {
+            for (int32_t lane = 1; lane < connections_per_peer; ++lane) {
+                tcp_conn_stream_t *lane_conn = open_lane(peer_addr, other_address.port, other_id, lane, drainer_lock);
+                if (lane_conn == NULL) {
+                    break;
+                }
+                leader_lanes.push_back(lane_conn);
+                lane_conns.push_back(lane_conn);
+            }
+        }
+        {
+            write_message_t msg;
+            msg << static_cast<int32_t>(leader_lanes.size());
+            if (send_write_message(conn, &msg))
+                return;         // network error
+        }
+
     } else {
 
         /* Receive the leader's routing table. (If our connection has lost a
@@ -458,6 +655,10 @@ void connectivity_cluster_t::run_t::handle(
             /* Register ourselves while in the critical section, so that whoever
             comes next will see us */
             routing_table_entry_sentry.create(&routing_table, other_id, other_address);
+
+            /* The leader opens its extra connections as soon as it gets our
+            routing table, so we must be ready for them before we send it. */
+            lane_rendezvous_sentry.reset(&lane_rendezvous_table, other_id, &lane_rendezvous);
         }
 
         /* Send our routing table to the leader */
@@ -467,6 +668,29 @@ void connectivity_cluster_t::run_t::handle(
             if (send_write_message(conn, &msg))
                 return;         // network error
         }
+
+        /* Find out how many extra connections the leader managed to open, and
+        wait for all of them to get through their handshakes. */
+        int32_t num_lanes;
+        if (deserialize_and_check(conn, &num_lanes, peername))
+            return;
+        if (num_lanes < 0 || num_lanes >= max_connections_per_peer) {
+            logERR("received invalid connection count from %s, closing connection", peername);
+            return;
+        }
+        lane_rendezvous.set_expected_lanes(num_lanes);
+        {
+            signal_timer_t lane_timeout(lane_setup_timeout_ms);
+            wait_any_t waiter(&lane_rendezvous.all_lanes_arrived, &lane_timeout, drainer_lock.get_drain_signal());
+            waiter.wait_lazily_unordered();
+        }
+        if (!lane_rendezvous.all_lanes_arrived.is_pulsed()) {
+            return;
+        }
+        lane_rendezvous_sentry.reset();
+        for (int32_t lane = 1; lane <= num_lanes; ++lane) {
+            lane_conns.push_back(lane_rendezvous.lanes[lane]);
+        }
     }
 
     // Just saying: We haven't left the RPC listener thread.
@@ -511,47 +735,50 @@ void connectivity_cluster_t::run_t::handle(
 
     cross_thread_signal_t connection_thread_drain_signal(drainer_lock.get_drain_signal(), chosen_thread);
 
-    rethread_tcp_conn_stream_t unregister_conn(conn, INVALID_THREAD);
+    boost::ptr_vector<rethread_tcp_conn_stream_t> unregister_conns;
+    for (size_t i = 0; i < lane_conns.size(); ++i) {
+        unregister_conns.push_back(new rethread_tcp_conn_stream_t(lane_conns[i], INVALID_THREAD));
+    }
     on_thread_t conn_threader(chosen_thread);
-    rethread_tcp_conn_stream_t reregister_conn(conn, get_thread_id());
+    boost::ptr_vector<rethread_tcp_conn_stream_t> reregister_conns;
+    for (size_t i = 0; i < lane_conns.size(); ++i) {
+        reregister_conns.push_back(new rethread_tcp_conn_stream_t(lane_conns[i], get_thread_id()));
+    }
 
     // Make sure that if we're ordered to shut down, any pending read
     // or write gets interrupted.
     cluster_conn_closing_subscription_t conn_closer_2(conn);
     conn_closer_2.reset(&connection_thread_drain_signal);
 
+    /* `teardown` is pulsed as soon as any of the connections to this peer
+    stops; then we close the rest of them. */
+    cond_t teardown;
+    boost::ptr_vector<cluster_conn_closing_subscription_t> teardown_closers;
+    for (size_t i = 0; i < lane_conns.size(); ++i) {
+        teardown_closers.push_back(new cluster_conn_closing_subscription_t(lane_conns[i]));
+        teardown_closers.back().reset(&teardown);
+    }
+
+    /* Must be destroyed after `conn_structure`, so that nothing is still
+    sending on the extra connections when we stop reading from them. */
+    auto_drainer_t lanes_drainer;
+
     {
         /* `connection_entry_t` is the public interface of this coroutine. Its
         constructor registers it in the `connectivity_cluster_t`'s connection
         map and notifies any connect listeners. */
-        connection_entry_t conn_structure(this, other_id, conn, other_address);
-
-        /* Main message-handling loop: read messages off the connection until
-        it's closed, which may be due to network events, or the other end
-        shutting down, or us shutting down. */
-        try {
-            while (true) {
-                /* For now, we use `std::string` for messages on the wire: it's
-                just a length and a byte vector. This is obviously slow and we
-                should change it when we care about performance. */
-                std::string message;
-                if (deserialize_and_check(conn, &message, peername))
-                    break;
+        connection_entry_t conn_structure(this, other_id, lane_conns, other_address);
 
-                std::vector<char> vec(message.begin(), message.end());
-                vector_read_stream_t stream(&vec);
-                message_handler->on_message(other_id, &stream); // might raise fake_archive_exc_t
-            }
-        } catch (fake_archive_exc_t) {
-            /* The exception broke us out of the loop, and that's what we
-            wanted. This could either be because we lost contact with the peer
-            or because the cluster is shutting down and `close_conn()` got
-            called. */
+        for (size_t i = 1; i < lane_conns.size(); ++i) {
+            coro_t::spawn_sometime(boost::bind(
+                &connectivity_cluster_t::run_t::handle_messages, this,
+                lane_conns[i], other_id, peerstr, &teardown,
+                auto_drainer_t::lock_t(&lanes_drainer)));
         }
 
-        guarantee(!conn->is_read_open(), "the connection is still open for "
-            "read, which means we had a problem other than the TCP "
-            "connection closing or dying");
+        /* Main message-handling loop; the other connections get their own
+        coroutines. */
+        handle_messages(conn, other_id, peerstr, &teardown, auto_drainer_t::lock_t(&lanes_drainer));
 
         /* The `conn_structure` destructor removes us from the connection map
         and notifies any disconnect listeners. */
@@ -657,7 +884,7 @@ void connectivity_cluster_t::send_message(peer_id_t dest, send_message_write_cal
         conn_structure_lock = (*it).second.second;
     }
 
-    if (conn_structure->conn == NULL) {
+    if (conn_structure->conns.empty()) {
         // We're sending a message to ourself
         guarantee(dest == me);
         // We could be on any thread here! Oh no!
@@ -667,24 +894,26 @@ void connectivity_cluster_t::send_message(peer_id_t dest, send_message_write_cal
 
     } else {
         guarantee(dest != me);
-        on_thread_t threader(conn_structure->conn->home_thread());
+        size_t conn_index = conn_structure->choose_conn(callback->get_stripe());
+        tcp_conn_stream_t *conn = conn_structure->conns[conn_index];
+        on_thread_t threader(conn->home_thread());
 
         /* Acquire the send-mutex so we don't collide with other things trying
         to send on the same connection. */
-        mutex_t::acq_t acq(&conn_structure->send_mutex);
+        mutex_t::acq_t acq(&conn_structure->send_mutexes[conn_index]);
 
         {
             write_message_t msg;
             std::string buffer_str(buffer.vector().begin(), buffer.vector().end());
             msg << buffer_str;
-            int res = send_write_message(conn_structure->conn, &msg);
+            int res = send_write_message(conn, &msg);
             conn_structure->pm_bytes_sent.record(buffer.vector().size());
             if (res) {
                 /* Close the other half of the connection to make sure that
-                   `connectivity_cluster_t::run_t::handle()` notices that something is
-                   up */
-                if (conn_structure->conn->is_read_open()) {
-                    conn_structure->conn->shutdown_read();
+                   `connectivity_cluster_t::run_t::handle_messages()` notices
+                   that something is up */
+                if (conn->is_read_open()) {
+                    conn->shutdown_read();
                 }
             }
         }
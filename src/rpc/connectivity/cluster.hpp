@@ -4,15 +4,18 @@
 
 #include <map>
 #include <set>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "arch/types.hpp"
 #include "concurrency/auto_drainer.hpp"
+#include "concurrency/cond_var.hpp"
 #include "concurrency/one_per_thread.hpp"
 #include "concurrency/semaphore.hpp"
 #include "containers/archive/tcp_conn_stream.hpp"
 #include "containers/map_sentries.hpp"
+#include "containers/scoped.hpp"
 #include "perfmon/perfmon.hpp"
 #include "rpc/connectivity/connectivity.hpp"
 #include "rpc/connectivity/messages.hpp"
@@ -96,10 +99,16 @@ class connectivity_cluster_t :
 public:
     class run_t {
     public:
+        /* `connections_per_peer` is the number of TCP connections we try to
+        keep open to each peer. The first one carries the control stripe; the
+        others carry striped traffic. If `client_port` is nonzero, we can only
+        make one connection to each peer, so `connections_per_peer` is ignored.
+        */
         run_t(connectivity_cluster_t *parent,
             int port,
             message_handler_t *message_handler,
-            int client_port = 0) THROWS_ONLY(address_in_use_exc_t);
+            int client_port = 0,
+            int connections_per_peer = default_connections_per_peer) THROWS_ONLY(address_in_use_exc_t);
 
         ~run_t();
 
@@ -115,20 +124,27 @@ public:
         class connection_entry_t : public home_thread_mixin_debug_only_t {
         public:
             /* The constructor registers us in every thread's `connection_map`;
-            the destructor deregisters us. Both also notify all subscribers. */
-            connection_entry_t(run_t *, peer_id_t, tcp_conn_stream_t *, peer_address_t) THROWS_NOTHING;
+            the destructor deregisters us. Both also notify all subscribers.
+            `conns` is empty for our "connection" to ourself. All of `conns`
+            must be on the same thread. */
+            connection_entry_t(run_t *, peer_id_t, const std::vector<tcp_conn_stream_t *> &conns, peer_address_t) THROWS_NOTHING;
             ~connection_entry_t() THROWS_NOTHING;
 
-            /* NULL for our "connection" to ourself */
-            tcp_conn_stream_t *conn;
+            /* Picks which of `conns` a message with the given stripe goes out
+            on. The control stripe always gets `conns[0]`. */
+            size_t choose_conn(uint64_t stripe) const;
+
+            /* Empty for our "connection" to ourself. `conns[0]` is the
+            connection the handshake happened over. */
+            std::vector<tcp_conn_stream_t *> conns;
 
             /* `connection_t` contains a `peer_address_t` so that we can call
             `get_peers_list()` on any thread. Otherwise, we would have to go
             cross-thread to access the routing table. */
             peer_address_t address;
 
-            /* Unused for our connection to ourself */
-            mutex_t send_mutex;
+            /* One per entry in `conns`; unused for our connection to ourself */
+            scoped_array_t<mutex_t> send_mutexes;
 
             uuid_t session_id;
 
@@ -177,6 +193,35 @@ public:
             DISABLE_COPYING(variable_setter_t);
         };
 
+        /* When we are the follower of a newly-established connection, the
+        leader opens the remaining `connections_per_peer - 1` connections
+        (which we call "lanes") to us. `handle()` for each incoming lane finds
+        the `lane_rendezvous_t` for its peer in `lane_rendezvous_table`, hands
+        over its connection, and then waits until the first connection is done
+        with it. */
+        class lane_rendezvous_t {
+        public:
+            lane_rendezvous_t() : expected_lanes(-1) { }
+
+            /* Returns false if the lane is a duplicate or out of range. */
+            bool add_lane(int32_t lane, tcp_conn_stream_t *conn);
+            void set_expected_lanes(int32_t count);
+
+            std::map<int32_t, tcp_conn_stream_t *> lanes;
+            int32_t expected_lanes;
+
+            /* Pulsed once all of lanes `1` through `expected_lanes` have
+            shown up. */
+            cond_t all_lanes_arrived;
+
+            /* Lane connections hold a lock on this until the first connection
+            is done using them. */
+            auto_drainer_t drainer;
+        private:
+            void check_if_done();
+            DISABLE_COPYING(lane_rendezvous_t);
+        };
+
         void on_new_connection(const scoped_ptr_t<tcp_conn_descriptor_t> &nconn, auto_drainer_t::lock_t lock) THROWS_NOTHING;
 
         /* `connectivity_cluster_t::connect_to_peer` is spawned for each known
@@ -208,6 +253,18 @@ public:
             auto_drainer_t::lock_t,
             bool *successful_join) THROWS_NOTHING;
 
+        /* Opens lane number `lane` to a peer we are already connected to and
+        runs the handshake on it. Returns NULL on failure. */
+        tcp_conn_stream_t *open_lane(const ip_address_t &ip, int port,
+            peer_id_t expected_id, int32_t lane,
+            auto_drainer_t::lock_t drainer_lock) THROWS_NOTHING;
+
+        /* Reads messages off `c` and passes them to `message_handler` until the
+        connection is closed, then pulses `teardown`. */
+        void handle_messages(tcp_conn_stream_t *c, peer_id_t other_id,
+            std::string peername, cond_t *teardown,
+            auto_drainer_t::lock_t lanes_lock) THROWS_NOTHING;
+
         connectivity_cluster_t *parent;
 
         message_handler_t *message_handler;
@@ -234,6 +291,11 @@ public:
         scoped_ptr_t<tcp_bound_socket_t> cluster_listener_socket;
         int cluster_listener_port;
         int cluster_client_port;
+        int connections_per_peer;
+
+        /* Only present for peers that we are the follower for and that are
+        still opening lanes to us. */
+        std::map<peer_id_t, lane_rendezvous_t *> lane_rendezvous_table;
 
         variable_setter_t register_us_with_parent;
 
@@ -249,6 +311,9 @@ public:
         scoped_ptr_t<tcp_listener_t> listener;
 
         static const int default_user_timeout;
+        static const int default_connections_per_peer;
+        static const int max_connections_per_peer;
+        static const int lane_setup_timeout_ms;
 
         /* A place to put our stats */
     };
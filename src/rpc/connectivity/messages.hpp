@@ -2,6 +2,8 @@
 #ifndef RPC_CONNECTIVITY_MESSAGES_HPP_
 #define RPC_CONNECTIVITY_MESSAGES_HPP_
 
+#include <stdint.h>
+
 class connectivity_service_t;
 class peer_id_t;
 class read_stream_t;
@@ -49,6 +51,24 @@ class send_message_write_callback_t {
 public:
     virtual ~send_message_write_callback_t() { }
     virtual void write(write_stream_t *stream) = 0;
+
+    /* Two messages to the same peer with the same stripe are delivered in the
+    order they were sent. Messages with different stripes may overtake each
+    other, which lets the `message_service_t` spread them over several
+    connections. Stripe 0 is the control stripe; it is reserved for small,
+    latency-sensitive traffic and never shares a connection with bulk data.
+
+    Nothing else orders messages: not the `message_multiplexer_t` tag they're
+    sent under, nor the order their senders' calls happened in. So the
+    directory's and the semilattice metadata's messages, which all go on the
+    control stripe, stay in order with each other, but a mailbox message can
+    overtake a directory update sent before it, and messages to different
+    mailboxes can overtake each other. Before there were several connections
+    per peer, all of them kept the order they were sent in. Nothing relies on
+    that: typed mailboxes handle each message in a coroutine of its own anyway,
+    and the protocols that need an order across messages put it back with
+    `fifo_enforcer_t`. */
+    virtual uint64_t get_stripe() { return 0; }
 };
 
 class message_service_t  {
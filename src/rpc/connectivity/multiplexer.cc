@@ -80,6 +80,10 @@ public:
         subwriter->write(os);
     }
 
+    uint64_t get_stripe() {
+        return subwriter->get_stripe();
+    }
+
 private:
     message_multiplexer_t::tag_t tag;
     send_message_write_callback_t *subwriter;
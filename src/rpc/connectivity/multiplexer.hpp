@@ -25,6 +25,11 @@
 
     // destructors take care of shutting everything down
 
+Each message keeps the stripe its client gave it (see
+`send_message_write_callback_t::get_stripe()`); the tag doesn't change which
+connection it goes on. So messages from different clients are in order with
+each other only if they're on the same stripe.
+
 */
 
 class message_multiplexer_t {
@@ -76,6 +76,13 @@ public:
 
         subwriter->write(stream);
     }
+
+    /* Messages to one mailbox must stay in order, but messages to different
+    mailboxes need not; giving each mailbox its own stripe keeps a backfill
+    stream from holding up replication traffic to some other mailbox. */
+    uint64_t get_stripe() {
+        return dest_mailbox_id + 1;
+    }
 private:
     int32_t dest_thread;
     raw_mailbox_t::id_t dest_mailbox_id;
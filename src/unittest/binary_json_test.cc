@@ -0,0 +1,136 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "unittest/gtest.hpp"
+
+#include "containers/archive/vector_stream.hpp"
+#include "rdb_protocol/binary_json.hpp"
+
+namespace unittest {
+
+void expect_round_trip(const char *json_text) {
+    scoped_cJSON_t json(cJSON_Parse(json_text));
+    ASSERT_TRUE(json.get() != NULL);
+
+    std::string encoded;
+    binary_json_encode(json.get(), &encoded);
+    ASSERT_TRUE(binary_json_is_encoded(encoded.data(), encoded.size()));
+
+    scoped_cJSON_t decoded(binary_json_decode(encoded.data(), encoded.size()));
+    EXPECT_TRUE(cJSON_Equal(json.get(), decoded.get())) << json_text;
+
+    // Fields come back in document order.
+    EXPECT_EQ(json.PrintUnformatted(), decoded.PrintUnformatted());
+
+    // A `json_value_t` encodes to the same bytes.
+    query_language::json_arena_t arena;
+    std::string encoded_value;
+    binary_json_encode(query_language::json_value_t::from_cjson(&arena, json.get()), &encoded_value);
+    EXPECT_EQ(encoded, encoded_value) << json_text;
+}
+
+TEST(BinaryJsonTest, RoundTrip) {
+    expect_round_trip("null");
+    expect_round_trip("true");
+    expect_round_trip("false");
+    expect_round_trip("-12.5");
+    expect_round_trip("\"\"");
+    expect_round_trip("\"hello\"");
+    expect_round_trip("[]");
+    expect_round_trip("{}");
+    expect_round_trip("[1, \"two\", [3], {\"four\": 4}, null]");
+    expect_round_trip("{\"zebra\": 1, \"apple\": [true, false], \"mango\": {\"b\": \"x\", \"a\": {}}}");
+}
+
+TEST(BinaryJsonTest, FieldLookup) {
+    scoped_cJSON_t json(cJSON_Parse("{\"zebra\": 1, \"Apple\": \"a\", \"mango\": [10, 20, 30], \"apple\": \"b\"}"));
+    std::string encoded;
+    binary_json_encode(json.get(), &encoded);
+
+    binary_json_view_t view(encoded.data(), encoded.size());
+    ASSERT_EQ(cJSON_Object, view.type());
+    EXPECT_EQ(4u, view.count());
+
+    binary_json_view_t field;
+    ASSERT_TRUE(view.field("zebra", &field));
+    EXPECT_EQ(1, field.number());
+
+    // Names are case insensitive and the first match wins, as with
+    // `cJSON_GetObjectItem()`.
+    ASSERT_TRUE(view.field("APPLE", &field));
+    EXPECT_EQ("a", field.str());
+
+    ASSERT_TRUE(view.field("mango", &field));
+    ASSERT_EQ(cJSON_Array, field.type());
+    EXPECT_EQ(3u, field.count());
+    EXPECT_EQ(20, field.element(1).number());
+
+    EXPECT_FALSE(view.field("banana", &field));
+    EXPECT_FALSE(view.field("zebras", &field));
+}
+
+/* Reads from a string and remembers how many bytes it handed out. */
+class string_source_t : public binary_json_source_t {
+public:
+    explicit string_source_t(const std::string &data) : data_(data), bytes_read(0) { }
+    size_t size() { return data_.size(); }
+    void read(size_t offset, size_t size, char *out) {
+        ASSERT_LE(offset + size, data_.size());
+        memcpy(out, data_.data() + offset, size);
+        bytes_read += size;
+    }
+
+private:
+    const std::string &data_;
+
+public:
+    size_t bytes_read;
+};
+
+TEST(BinaryJsonTest, Project) {
+    std::string big(100000, 'x');
+    scoped_cJSON_t json(cJSON_Parse(("{\"id\": 7, \"body\": \"" + big + "\", \"Tags\": [\"a\", {\"b\": null}]}").c_str()));
+    ASSERT_TRUE(json.get() != NULL);
+    std::string encoded;
+    binary_json_encode(json.get(), &encoded);
+
+    std::set<std::string> fields;
+    fields.insert("id");
+    fields.insert("tags");
+    fields.insert("missing");
+
+    string_source_t source(encoded);
+    scoped_cJSON_t projected(binary_json_project(&source, fields));
+    ASSERT_TRUE(projected.get() != NULL);
+    EXPECT_EQ("{\"id\":7,\"Tags\":[\"a\",{\"b\":null}]}", projected.PrintUnformatted());
+
+    // The big field was never read.
+    EXPECT_LT(source.bytes_read, 1000u);
+
+    // Documents that aren't objects can't be projected.
+    scoped_cJSON_t array(cJSON_Parse("[1, 2, 3]"));
+    std::string encoded_array;
+    binary_json_encode(array.get(), &encoded_array);
+    string_source_t array_source(encoded_array);
+    EXPECT_TRUE(binary_json_project(&array_source, fields) == NULL);
+}
+
+TEST(BinaryJsonTest, LegacyFormatIsNotEncoded) {
+    // Rows written before the binary format are serialized cJSON trees, which
+    // start with the type.
+    const char *docs[] = { "null", "true", "false", "1", "\"s\"", "[1]", "{\"a\": 1}" };
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+        scoped_cJSON_t json(cJSON_Parse(docs[i]));
+        write_message_t wm;
+        wm << *json.get();
+        vector_stream_t stream;
+        ASSERT_EQ(0, send_write_message(&stream, &wm));
+        EXPECT_FALSE(binary_json_is_encoded(stream.vector().data(), stream.vector().size())) << docs[i];
+    }
+}
+
+}  // namespace unittest
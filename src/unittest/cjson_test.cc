@@ -0,0 +1,67 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+
+#include "http/json.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+const char *const test_document =
+    "{\"id\":1,\"name\":\"a \\\"q\\\" \\\\ \\n\\t\\u0001\\u00e9\","
+    "\"list\":[1,2.5,-3,1e+30,null,true,false,[],{}],\"nested\":{\"k\":\"v\"}}";
+
+TEST(CJSONTest, PrintsUnformatted) {
+    scoped_cJSON_t json(cJSON_Parse(test_document));
+    ASSERT_TRUE(json.get());
+    EXPECT_EQ("{\"id\":1,\"name\":\"a \\\"q\\\" \\\\ \\n\\t\\u0001\xc3\xa9\","
+              "\"list\":[1,2.5,-3,1000000000000000019884624838656,null,true,false,[],{}],"
+              "\"nested\":{\"k\":\"v\"}}",
+              json.PrintUnformatted());
+}
+
+TEST(CJSONTest, PrintsFormatted) {
+    scoped_cJSON_t json(cJSON_Parse(test_document));
+    ASSERT_TRUE(json.get());
+    EXPECT_EQ("{\n"
+              "\t\"id\":\t1,\n"
+              "\t\"name\":\t\"a \\\"q\\\" \\\\ \\n\\t\\u0001\xc3\xa9\",\n"
+              "\t\"list\":\t[1, 2.5, -3, 1000000000000000019884624838656, null, true, false, [], {\n"
+              "\t\t}],\n"
+              "\t\"nested\":\t{\n"
+              "\t\t\"k\":\t\"v\"\n"
+              "\t}\n"
+              "}",
+              json.Print());
+}
+
+TEST(CJSONTest, UnicodeEscapes) {
+    scoped_cJSON_t json(cJSON_Parse("\"\\u00e9\\ud83d\\ude00\\/\""));
+    ASSERT_TRUE(json.get());
+    EXPECT_EQ("\xc3\xa9\xf0\x9f\x98\x80/", std::string(json.get()->valuestring));
+
+    // Escapes too short to be read used to run past the end of the string.
+    EXPECT_TRUE(cJSON_Parse("\"\\u12\"") == NULL);
+    EXPECT_TRUE(cJSON_Parse("\"\\ud83d\\u\"") == NULL);
+}
+
+/* Strings are scanned a block at a time, so put the characters that have to be
+escaped at every offset in and around a block. */
+TEST(CJSONTest, EscapesAtEveryOffset) {
+    const char specials[] = { '"', '\\', '\n', '\x1f', '\x7f', '\xe9' };
+    for (size_t i = 0; i < sizeof(specials); ++i) {
+        for (int offset = 0; offset < 40; ++offset) {
+            std::string str(offset, 'x');
+            str.push_back(specials[i]);
+            str.append(40 - offset, 'y');
+
+            scoped_cJSON_t json(cJSON_CreateString(str.c_str()));
+            std::string printed = json.PrintUnformatted();
+            scoped_cJSON_t parsed(cJSON_Parse(printed.c_str()));
+            ASSERT_TRUE(parsed.get()) << printed;
+            EXPECT_EQ(str, std::string(parsed.get()->valuestring));
+            EXPECT_EQ(printed, parsed.PrintUnformatted());
+        }
+    }
+}
+
+}  // namespace unittest
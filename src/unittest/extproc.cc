@@ -1,9 +1,14 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <algorithm>
+
 #include "errors.hpp"
 #include <boost/bind.hpp>
 
 #include "mock/unittest_utils.hpp"
 
+#include "arch/runtime/runtime_utils.hpp"
+#include "arch/timing.hpp"
+#include "concurrency/pmap.hpp"
 #include "containers/archive/archive.hpp"
 #include "extproc/job.hpp"
 #include "extproc/pool.hpp"
@@ -40,6 +45,17 @@ int collatz(int n) {
     return (n & 1) ? 3 * n + 1 : n / 2;
 }
 
+// Total number of collatz steps taken to reach 1 from each of [1, n].
+uint64_t collatz_steps(int n) {
+    uint64_t steps = 0;
+    for (int i = 1; i <= n; ++i) {
+        for (uint64_t x = i; x != 1; x = (x & 1) ? 3 * x + 1 : x / 2) {
+            ++steps;
+        }
+    }
+    return steps;
+}
+
 // ----- Jobs
 struct fib_job_t : extproc::auto_job_t<fib_job_t> {
     // Calculates the nth fibonacci number.
@@ -88,6 +104,22 @@ struct collatz_job_t : extproc::auto_job_t<collatz_job_t> {
     }
 };
 
+struct collatz_steps_job_t : extproc::auto_job_t<collatz_steps_job_t> {
+    // Burns some CPU calculating collatz_steps(n).
+    collatz_steps_job_t() {}
+    explicit collatz_steps_job_t(int n) : n_(n) {}
+
+    int n_;
+    RDB_MAKE_ME_SERIALIZABLE_1(n_);
+
+    void run_job(control_t *control, UNUSED void *extra) {
+        uint64_t res = collatz_steps(n_);
+        write_message_t msg;
+        msg << res;
+        guarantee(0 == send_write_message(control, &msg));
+    }
+};
+
 struct job_loop_t : extproc::auto_job_t<job_loop_t> {
     // Receives a job and runs it.
     job_loop_t() {}
@@ -244,3 +276,84 @@ TEST(ExtProc, MultiJob) {
     extproc::spawner_t::create(&spawner_info);
     mock::run_in_thread_pool(boost::bind(run_multijob_test, &spawner_info));
 }
+
+// Runs a collatz_steps_job_t to completion; for use with pmap().
+void run_collatz_steps_job(extproc::pool_t *pool, int n, uint64_t expect, UNUSED int i) {
+    extproc::job_handle_t handle;
+    ASSERT_EQ(0, handle.begin(pool, collatz_steps_job_t(n)));
+
+    uint64_t result;
+    ASSERT_EQ(ARCHIVE_SUCCESS, deserialize(&handle, &result));
+    ASSERT_EQ(expect, result);
+    handle.release();
+}
+
+void run_idleworkers_test(extproc::spawner_t::info_t *spawner_info) {
+    extproc::pool_group_t::config_t config;
+    config.min_workers = 1;
+    config.max_workers = 3;
+    config.idle_timeout_ms = 100;
+
+    extproc::pool_group_t pool_group(spawner_info, config);
+    extproc::pool_t *pool = pool_group.get();
+    ASSERT_EQ(config.min_workers, pool->num_workers());
+
+    // Grow the pool to its maximum, let the extra workers time out, and check
+    // that it grows again when it needs to.
+    const int n = 1000;
+    const uint64_t expect = collatz_steps(n);
+    for (int round = 0; round < 3; ++round) {
+        pmap(config.max_workers, boost::bind(run_collatz_steps_job, pool, n, expect, _1));
+        ASSERT_EQ(config.max_workers, pool->num_workers());
+        nap(5 * config.idle_timeout_ms);
+        ASSERT_EQ(config.min_workers, pool->num_workers());
+    }
+}
+
+TEST(ExtProc, IdleWorkers) {
+    extproc::spawner_t::info_t spawner_info;
+    extproc::spawner_t::create(&spawner_info);
+    mock::run_in_thread_pool(boost::bind(run_idleworkers_test, &spawner_info));
+}
+
+void run_stress_test(extproc::spawner_t::info_t *spawner_info) {
+    // Only as many jobs as there are CPUs to run them on, so that the jobs
+    // themselves could all run at once.
+    const int njobs = std::min(get_cpu_count(), 4);
+    if (njobs < 2) {
+        return;
+    }
+
+    extproc::pool_group_t::config_t config;
+    config.min_workers = njobs;
+    config.max_workers = njobs;
+    extproc::pool_group_t pool_group(spawner_info, config);
+    extproc::pool_t *pool = pool_group.get();
+
+    const int n = 100000;
+    const uint64_t expect = collatz_steps(n);
+    // Get every worker running first, so neither timing includes starting one.
+    pmap(njobs, boost::bind(run_collatz_steps_job, pool, n, expect, _1));
+
+    ticks_t start = get_ticks();
+    for (int i = 0; i < njobs; ++i) {
+        run_collatz_steps_job(pool, n, expect, i);
+    }
+    double serial_secs = ticks_to_secs(get_ticks() - start);
+
+    start = get_ticks();
+    pmap(njobs, boost::bind(run_collatz_steps_job, pool, n, expect, _1));
+    double parallel_secs = ticks_to_secs(get_ticks() - start);
+
+    // The jobs run in separate processes, so running them at once has to be
+    // clearly faster than running them one after another, even on a busy
+    // machine.
+    EXPECT_LT(parallel_secs, 0.75 * serial_secs)
+        << njobs << " jobs took " << serial_secs << "s one at a time and " << parallel_secs << "s at once";
+}
+
+TEST(ExtProc, Stress) {
+    extproc::spawner_t::info_t spawner_info;
+    extproc::spawner_t::create(&spawner_info);
+    mock::run_in_thread_pool(boost::bind(run_stress_test, &spawner_info));
+}
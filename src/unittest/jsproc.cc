@@ -59,3 +59,66 @@ void run_timeout_test(js::runner_t *runner) {
 }
 
 TEST(JSProc, Timeout) { main_jsproc_test(run_timeout_test); }
+
+void run_call_batch_test(js::runner_t *runner) {
+    std::vector<std::string> args(1, "x");
+    std::string errmsg;
+    id_t id = runner->compile(args, "if (x < 0) { throw 'negative'; } return x * 2;", &errmsg);
+    ASSERT_NE(js::INVALID_ID, id);
+
+    // Compiling it again is free.
+    ASSERT_EQ(id, runner->compile(args, "if (x < 0) { throw 'negative'; } return x * 2;", &errmsg));
+
+    std::vector<js::runner_t::call_args_t> calls(10);
+    for (size_t i = 0; i < calls.size(); ++i) {
+        calls[i].args.push_back(boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_CreateNumber(i))));
+    }
+    std::vector<boost::shared_ptr<scoped_cJSON_t> > results;
+    ASSERT_TRUE(runner->call_batch(id, calls, &results, &errmsg)) << errmsg;
+    ASSERT_EQ(calls.size(), results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        ASSERT_EQ(cJSON_Number, results[i]->type());
+        EXPECT_EQ(static_cast<int>(i * 2), results[i]->get()->valueint);
+    }
+
+    calls[5].args[0].reset(new scoped_cJSON_t(cJSON_CreateNumber(-1)));
+    EXPECT_FALSE(runner->call_batch(id, calls, &results, &errmsg));
+}
+
+TEST(JSProc, CallBatch) { main_jsproc_test(run_call_batch_test); }
+
+// The worker keeps the scripts it compiles, so a second runner that gets the
+// same worker doesn't compile the same function again.
+static void run_script_cache_test(extproc::spawner_t::info_t *spawner_info) {
+    extproc::pool_group_t::config_t config;
+    config.min_workers = 1;
+    config.max_workers = 1;
+    extproc::pool_group_t pool_group(spawner_info, config);
+
+    std::vector<std::string> args(1, "x");
+    // Nothing else in this process compiles this.
+    const std::string source = "return x + 'script cache test';";
+
+    for (int i = 0; i < 2; ++i) {
+        js::runner_t runner;
+        runner.begin(pool_group.get());
+        std::string errmsg;
+        id_t id = runner.compile(args, source, &errmsg);
+        ASSERT_NE(js::INVALID_ID, id) << errmsg;
+        EXPECT_EQ(i, runner.num_script_cache_hits());
+
+        // The cached script still makes a function that works.
+        std::vector<boost::shared_ptr<scoped_cJSON_t> > call_args;
+        call_args.push_back(boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_CreateString("a "))));
+        boost::shared_ptr<scoped_cJSON_t> res = runner.call(id, boost::shared_ptr<scoped_cJSON_t>(), call_args, &errmsg);
+        ASSERT_TRUE(res) << errmsg;
+        EXPECT_EQ("a script cache test", std::string(res->get()->valuestring));
+        runner.finish();
+    }
+}
+
+TEST(JSProc, ScriptCache) {
+    extproc::spawner_t::info_t spawner_info;
+    extproc::spawner_t::create(&spawner_info);
+    mock::run_in_thread_pool(boost::bind(run_script_cache_test, &spawner_info));
+}
@@ -139,5 +139,54 @@ TEST(MemcachedProtocol, GetSet) {
     run_in_thread_pool_with_namespace_interface(&run_get_set_test);
 }
 
+/* `MultiGet` checks that a `multi_get_query_t` whose keys span both shards
+comes back with exactly the keys that exist, in order */
+void run_multi_get_test(namespace_interface_t<memcached_protocol_t> *nsi, order_source_t *order_source) {
+    const char *keys_to_set[] = { "a", "c", "x" };
+    for (size_t i = 0; i < sizeof(keys_to_set) / sizeof(keys_to_set[0]); ++i) {
+        sarc_mutation_t set;
+        set.key = store_key_t(keys_to_set[i]);
+        set.data = data_buffer_t::create(1);
+        set.data->buf()[0] = keys_to_set[i][0];
+        set.flags = i;
+        set.exptime = 0;
+        set.add_policy = add_policy_yes;
+        set.replace_policy = replace_policy_yes;
+        memcached_protocol_t::write_t write(set, time(NULL), 12345);
+
+        cond_t interruptor;
+        memcached_protocol_t::write_response_t result;
+        nsi->write(write, &result, order_source->check_in("unittest::run_multi_get_test(memcached_protocol.cc-A)"), &interruptor);
+        EXPECT_EQ(sr_stored, boost::get<set_result_t>(result.result));
+    }
+
+    std::vector<store_key_t> keys;
+    keys.push_back(store_key_t("a"));
+    keys.push_back(store_key_t("b"));
+    keys.push_back(store_key_t("m"));
+    keys.push_back(store_key_t("x"));
+    keys.push_back(store_key_t("z"));
+    memcached_protocol_t::read_t read(multi_get_query_t(keys), time(NULL));
+
+    cond_t interruptor;
+    memcached_protocol_t::read_response_t result;
+    nsi->read(read, &result, order_source->check_in("unittest::run_multi_get_test(memcached_protocol.cc-B)").with_read_mode(), &interruptor);
+
+    if (multi_get_result_t *maybe_multi_get_result = boost::get<multi_get_result_t>(&result.result)) {
+        ASSERT_EQ(2, maybe_multi_get_result->pairs.size());
+        EXPECT_EQ(std::string("a"), key_to_unescaped_str(maybe_multi_get_result->pairs[0].key));
+        EXPECT_EQ('a', maybe_multi_get_result->pairs[0].value_provider->buf()[0]);
+        EXPECT_EQ(0, maybe_multi_get_result->pairs[0].mcflags);
+        EXPECT_EQ(std::string("x"), key_to_unescaped_str(maybe_multi_get_result->pairs[1].key));
+        EXPECT_EQ('x', maybe_multi_get_result->pairs[1].value_provider->buf()[0]);
+        EXPECT_EQ(2, maybe_multi_get_result->pairs[1].mcflags);
+    } else {
+        ADD_FAILURE() << "got wrong type of result back";
+    }
+}
+TEST(MemcachedProtocol, MultiGet) {
+    run_in_thread_pool_with_namespace_interface(&run_multi_get_test);
+}
+
 }   /* namespace unittest */
 
@@ -0,0 +1,143 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "rdb_protocol/compiled_term.hpp"
+#include "rdb_protocol/query_language.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::compiled_lambda_t;
+using query_language::map_rdb;
+
+Term number_term(double d) {
+    Term t;
+    t.set_type(Term::NUMBER);
+    t.set_number(d);
+    return t;
+}
+
+Term var_term(const std::string &var) {
+    Term t;
+    t.set_type(Term::VAR);
+    t.set_var(var);
+    return t;
+}
+
+Term call_term(Builtin::BuiltinType type, const std::vector<Term> &args) {
+    Term t;
+    t.set_type(Term::CALL);
+    t.mutable_call()->mutable_builtin()->set_type(type);
+    for (size_t i = 0; i < args.size(); ++i) {
+        *t.mutable_call()->add_args() = args[i];
+    }
+    return t;
+}
+
+Term call_term(Builtin::BuiltinType type, const Term &arg) {
+    return call_term(type, std::vector<Term>(1, arg));
+}
+
+Term call_term(Builtin::BuiltinType type, const Term &arg1, const Term &arg2) {
+    std::vector<Term> args;
+    args.push_back(arg1);
+    args.push_back(arg2);
+    return call_term(type, args);
+}
+
+Term getattr_term(const Term &arg, const std::string &attr) {
+    Term t = call_term(Builtin::GETATTR, arg);
+    t.mutable_call()->mutable_builtin()->set_attr(attr);
+    return t;
+}
+
+Term compare_term(Builtin::Comparison comparison, const Term &lhs, const Term &rhs) {
+    Term t = call_term(Builtin::COMPARE, lhs, rhs);
+    t.mutable_call()->mutable_builtin()->set_comparison(comparison);
+    return t;
+}
+
+/* `row.age > 30 && row.age < 40 + limit`, with `limit` bound outside. */
+Term age_predicate() {
+    return call_term(Builtin::ALL,
+                     compare_term(Builtin_Comparison_GT, getattr_term(var_term("row"), "age"), number_term(30)),
+                     compare_term(Builtin_Comparison_LT, getattr_term(var_term("row"), "age"),
+                                  call_term(Builtin::ADD, number_term(40), var_term("limit"))));
+}
+
+/* `let score = row.points * 2 in {"score": score - 1, "name": row.name}`. */
+Term score_mapping() {
+    Term t;
+    t.set_type(Term::LET);
+    VarTermTuple *bind = t.mutable_let()->add_binds();
+    bind->set_var("score");
+    *bind->mutable_term() = call_term(Builtin::MULTIPLY, getattr_term(var_term("row"), "points"), number_term(2));
+    Term *expr = t.mutable_let()->mutable_expr();
+    expr->set_type(Term::OBJECT);
+    VarTermTuple *score = expr->add_object();
+    score->set_var("score");
+    *score->mutable_term() = call_term(Builtin::SUBTRACT, var_term("score"), number_term(1));
+    VarTermTuple *name = expr->add_object();
+    name->set_var("name");
+    *name->mutable_term() = getattr_term(var_term("row"), "name");
+    return t;
+}
+
+scopes_t make_scopes() {
+    scopes_t scopes;
+    scopes.scope.push();
+    scopes.scope.put_in_scope("limit", boost::shared_ptr<scoped_cJSON_t>(new scoped_cJSON_t(cJSON_Parse("5"))));
+    return scopes;
+}
+
+/* What `body` comes to for `row_text`, or the error it throws. */
+std::string interpret(const Term &body, const scopes_t &scopes, const char *row_text) {
+    Term t = body;
+    boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_Parse(row_text)));
+    try {
+        return map_rdb("row", &t, NULL, scopes, backtrace_t(), row)->Print();
+    } catch (const runtime_exc_t &e) {
+        return e.as_str();
+    }
+}
+
+std::string run_compiled(const compiled_lambda_t &compiled, const char *row_text) {
+    boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_Parse(row_text)));
+    try {
+        return compiled(row)->Print();
+    } catch (const runtime_exc_t &e) {
+        return e.as_str();
+    }
+}
+
+TEST(RDBCompiled, AgreesWithInterpreter) {
+    scopes_t scopes = make_scopes();
+    const char *rows[] = { "{\"age\": 35, \"points\": 4, \"name\": \"a\"}",
+                           "{\"age\": 50, \"points\": 1.5, \"name\": \"b\"}",
+                           "{\"age\": \"old\", \"points\": 1, \"name\": \"c\"}",
+                           "{\"points\": \"many\"}",
+                           "[1, 2]",
+                           "null" };
+    std::vector<Term> bodies;
+    bodies.push_back(age_predicate());
+    bodies.push_back(score_mapping());
+    bodies.push_back(call_term(Builtin::NOT, compare_term(Builtin_Comparison_EQ, var_term("row"), var_term("row"))));
+    bodies.push_back(call_term(Builtin::MODULO, number_term(7), number_term(3)));
+    bodies.push_back(call_term(Builtin::DIVIDE, number_term(1), number_term(0)));
+
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        compiled_lambda_t compiled("row", bodies[i], scopes, backtrace_t());
+        ASSERT_TRUE(compiled.compiled());
+        for (size_t j = 0; j < sizeof(rows) / sizeof(rows[0]); ++j) {
+            EXPECT_EQ(interpret(bodies[i], scopes, rows[j]), run_compiled(compiled, rows[j]));
+        }
+    }
+
+    Term javascript;
+    javascript.set_type(Term::JAVASCRIPT);
+    javascript.set_javascript("return 1;");
+    EXPECT_FALSE(compiled_lambda_t("row", javascript, scopes, backtrace_t()).compiled());
+}
+
+}  // namespace unittest
@@ -0,0 +1,98 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <set>
+#include <string>
+
+#include "arch/io/disk.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/stream.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::cJSON_equal;
+using query_language::cJSON_hash;
+using query_language::hash_distinct_stream_t;
+using query_language::in_memory_stream_t;
+using query_language::json_stream_t;
+
+uint64_t hash_of(const char *json_text) {
+    scoped_cJSON_t json(cJSON_Parse(json_text));
+    return cJSON_hash(json.get());
+}
+
+TEST(RDBHash, AgreesWithCmp) {
+    EXPECT_EQ(hash_of("1"), hash_of("1.0"));
+    EXPECT_EQ(hash_of("0"), hash_of("-0"));
+    EXPECT_EQ(hash_of("[1, \"a\", [null, true]]"), hash_of("[1.0, \"a\", [null, true]]"));
+
+    EXPECT_NE(hash_of("1"), hash_of("\"1\""));
+    EXPECT_NE(hash_of("true"), hash_of("false"));
+    EXPECT_NE(hash_of("[1, 2]"), hash_of("[2, 1]"));
+    EXPECT_NE(hash_of("[[1], 2]"), hash_of("[1, [2]]"));
+
+    scoped_cJSON_t json(cJSON_Parse("[1, 2]"));
+    EXPECT_NE(cJSON_hash(json.get(), 0), cJSON_hash(json.get(), 1));
+}
+
+bool equal(const char *x, const char *y) {
+    scoped_cJSON_t xjson(cJSON_Parse(x)), yjson(cJSON_Parse(y));
+    return cJSON_equal(xjson.get(), yjson.get());
+}
+
+/* `cJSON_cmp()` throws on objects, but rows and group keys are often objects,
+so they're hashed and compared member by member. */
+TEST(RDBHash, Objects) {
+    EXPECT_TRUE(equal("{\"a\": 1, \"b\": [2]}", "{\"b\": [2.0], \"a\": 1}"));
+    EXPECT_EQ(hash_of("{\"a\": 1, \"b\": [2]}"), hash_of("{\"b\": [2.0], \"a\": 1}"));
+    EXPECT_TRUE(equal("[{}, {\"x\": {\"y\": null}}]", "[{}, {\"x\": {\"y\": null}}]"));
+    EXPECT_EQ(hash_of("[{}, {\"x\": {\"y\": null}}]"), hash_of("[{}, {\"x\": {\"y\": null}}]"));
+
+    EXPECT_FALSE(equal("{\"a\": 1}", "{\"a\": 2}"));
+    EXPECT_FALSE(equal("{\"a\": 1}", "{\"b\": 1}"));
+    EXPECT_FALSE(equal("{\"a\": 1}", "{\"a\": 1, \"b\": 1}"));
+    EXPECT_FALSE(equal("{}", "[]"));
+    EXPECT_NE(hash_of("{\"a\": 1}"), hash_of("{\"a\": 2}"));
+    EXPECT_NE(hash_of("{\"a\": 1}"), hash_of("{\"b\": 1}"));
+    EXPECT_NE(hash_of("{\"ab\": \"c\"}"), hash_of("{\"a\": \"bc\"}"));
+}
+
+static const int NUM_ROWS = 2000;
+static const int NUM_DISTINCT = 300;
+
+void run_distinct_test(size_t memory_budget) {
+    scoped_ptr_t<io_backender_t> io_backender;
+    make_io_backender(aio_default, &io_backender);
+
+    scoped_cJSON_t array(cJSON_CreateArray());
+    for (int i = 0; i < NUM_ROWS; ++i) {
+        array.AddItemToArray(cJSON_Parse(strprintf("[%d, \"row\"]", (i * 7) % NUM_DISTINCT).c_str()));
+    }
+    boost::shared_ptr<json_stream_t> stream(new in_memory_stream_t(json_array_iterator_t(array.get())));
+    hash_distinct_stream_t distinct(stream, io_backender.get(), ".", memory_budget);
+
+    std::set<int> seen;
+    while (boost::shared_ptr<scoped_cJSON_t> row = distinct.next()) {
+        EXPECT_TRUE(seen.insert(cJSON_GetArrayItem(row->get(), 0)->valueint).second);
+    }
+    EXPECT_EQ(static_cast<size_t>(NUM_DISTINCT), seen.size());
+}
+
+void run_in_memory_test() {
+    run_distinct_test(GIGABYTE);
+}
+
+TEST(RDBHash, DistinctInMemory) {
+    mock::run_in_thread_pool(&run_in_memory_test);
+}
+
+void run_partition_test() {
+    // Small enough that the partitions get partitioned again.
+    run_distinct_test(1000);
+}
+
+TEST(RDBHash, DistinctPartitions) {
+    mock::run_in_thread_pool(&run_partition_test);
+}
+
+}  // namespace unittest
@@ -0,0 +1,106 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "rdb_protocol/json_value.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::json_arena_t;
+using query_language::json_value_t;
+
+const char *const test_documents[] = {
+    "null",
+    "true",
+    "[false,true,null]",
+    "[0,-1,2147483647,-2147483648,2147483648,0.5,-1.25e-07,1e+300,3.1415926535897931]",
+    "\"a \\\"quoted\\\" \\\\ string\\n\\twith\\r\\b\\f \\u0001 escapes\"",
+    "{}",
+    "[]",
+    "{\"id\":1,\"name\":\"bob\",\"tags\":[\"x\",\"y\"],\"nested\":{\"a\":[{\"b\":{}}],\"Z\":null}}",
+    "{\"a\":1,\"A\":2,\"b\":3,\"a\":4}",
+};
+
+TEST(RDBJsonValue, PrintsLikeCJSON) {
+    for (size_t i = 0; i < sizeof(test_documents) / sizeof(test_documents[0]); ++i) {
+        scoped_cJSON_t json(cJSON_Parse(test_documents[i]));
+        ASSERT_TRUE(json.get()) << test_documents[i];
+        json_arena_t arena;
+        const json_value_t *value = json_value_t::from_cjson(&arena, json.get());
+        EXPECT_EQ(json.PrintUnformatted(), value->print_unformatted());
+
+        scoped_cJSON_t back(value->to_cjson());
+        EXPECT_EQ(json.PrintUnformatted(), back.PrintUnformatted());
+    }
+}
+
+TEST(RDBJsonValue, GetsMembersLikeCJSON) {
+    scoped_cJSON_t json(cJSON_Parse("{\"a\":1,\"A\":2,\"b\":3,\"a\":4,\"Bc\":5,\"ab\":6}"));
+    json_arena_t arena;
+    const json_value_t *value = json_value_t::from_cjson(&arena, json.get());
+
+    const char *names[] = { "a", "A", "b", "B", "bc", "BC", "ab", "c", "", "abc" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        cJSON *expected = json.GetObjectItem(names[i]);
+        const json_value_t *actual = value->get(names[i]);
+        if (!expected) {
+            EXPECT_TRUE(actual == NULL) << names[i];
+        } else {
+            ASSERT_TRUE(actual != NULL) << names[i];
+            EXPECT_EQ(expected->valuedouble, actual->as_number()) << names[i];
+        }
+    }
+}
+
+TEST(RDBJsonValue, CopiesShareUnchangedValues) {
+    json_arena_t arena;
+    std::vector<std::pair<std::string, const json_value_t *> > members;
+    members.push_back(std::make_pair("id", json_value_t::make_number(&arena, 1)));
+    members.push_back(std::make_pair("tags", json_value_t::make_array(&arena, std::vector<const json_value_t *>())));
+    const json_value_t *row = json_value_t::make_object(&arena, members);
+
+    const json_value_t *replaced = json_value_t::set_member(&arena, row, "ID", json_value_t::make_number(&arena, 2));
+    const json_value_t *added = json_value_t::set_member(&arena, row, "name", json_value_t::make_string(&arena, "bob"));
+    const json_value_t *tags = json_value_t::append(&arena, row->get("tags"), json_value_t::make_bool(&arena, true));
+
+    EXPECT_EQ("{\"id\":1,\"tags\":[]}", row->print_unformatted());
+    EXPECT_EQ("{\"id\":2,\"tags\":[]}", replaced->print_unformatted());
+    EXPECT_EQ("{\"id\":1,\"tags\":[],\"name\":\"bob\"}", added->print_unformatted());
+    EXPECT_EQ("[true]", tags->print_unformatted());
+    EXPECT_EQ(row->get("tags"), replaced->get("tags"));
+    EXPECT_EQ(row->get("tags"), added->get("tags"));
+    EXPECT_EQ(row->get("id"), added->get("id"));
+    EXPECT_EQ("bob", std::string(added->get("NAME")->as_string()));
+}
+
+TEST(RDBJsonValue, MergesLikeCJSON) {
+    const char *merges[][2] = {
+        { "{\"id\":1,\"a\":2,\"b\":3}", "{\"a\":4}" },
+        { "{\"id\":1,\"a\":2}", "{\"c\":[5],\"A\":null}" },
+        { "{\"a\":1,\"A\":2,\"b\":3}", "{\"a\":4,\"a\":5,\"a\":6}" },
+        { "{}", "{\"x\":{\"y\":1}}" },
+        { "{\"x\":1}", "{}" },
+    };
+    for (size_t i = 0; i < sizeof(merges) / sizeof(merges[0]); ++i) {
+        scoped_cJSON_t lhs(cJSON_Parse(merges[i][0]));
+        scoped_cJSON_t rhs(cJSON_Parse(merges[i][1]));
+        scoped_cJSON_t expected(cJSON_merge(lhs.get(), rhs.get()));
+
+        json_arena_t arena;
+        const json_value_t *merged = json_value_t::merge(&arena, json_value_t::from_cjson(&arena, lhs.get()),
+                                                         json_value_t::from_cjson(&arena, rhs.get()));
+        EXPECT_EQ(expected.PrintUnformatted(), merged->print_unformatted()) << merges[i][0] << " " << merges[i][1];
+    }
+
+    // What the update didn't touch is shared with the old row.
+    scoped_cJSON_t row(cJSON_Parse("{\"id\":1,\"tags\":[\"x\"],\"score\":2}"));
+    scoped_cJSON_t update(cJSON_Parse("{\"score\":3}"));
+    json_arena_t arena;
+    const json_value_t *old_row = json_value_t::from_cjson(&arena, row.get());
+    const json_value_t *new_row = json_value_t::merge(&arena, old_row, json_value_t::from_cjson(&arena, update.get()));
+    EXPECT_EQ(old_row->get("tags"), new_row->get("tags"));
+    EXPECT_EQ(3, new_row->get("score")->as_number());
+}
+
+}  // namespace unittest
@@ -0,0 +1,128 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "clustering/administration/metadata.hpp"
+#include "containers/uuid.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/point_get_cache.hpp"
+#include "rdb_protocol/query_language.hpp"
+#include "unittest/dummy_metadata_controller.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+void make_point_get(Term *t, const std::string &table_name, const Term &key) {
+    t->set_type(Term::GETBYKEY);
+    Term::GetByKey *get = t->mutable_get_by_key();
+    get->mutable_table_ref()->set_db_name("test");
+    get->mutable_table_ref()->set_table_name(table_name);
+    get->set_attrname("id");
+    *get->mutable_key() = key;
+}
+
+Term number_key(double n) {
+    Term key;
+    key.set_type(Term::NUMBER);
+    key.set_number(n);
+    return key;
+}
+
+Term string_key(const std::string &s) {
+    Term key;
+    key.set_type(Term::STRING);
+    key.set_valuestring(s);
+    return key;
+}
+
+bool is_point_get(Term *t) {
+    std::vector<Term::GetByKey *> gets;
+    return query_language::get_point_gets(t, &gets);
+}
+
+TEST(RDBPointGet, RecognizesPointGets) {
+    Term by_number;
+    make_point_get(&by_number, "foo", number_key(1));
+    EXPECT_TRUE(is_point_get(&by_number));
+
+    Term by_string;
+    make_point_get(&by_string, "foo", string_key("a"));
+    EXPECT_TRUE(is_point_get(&by_string));
+
+    Term array;
+    array.set_type(Term::ARRAY);
+    for (int i = 0; i < 3; ++i) {
+        make_point_get(array.add_array(), "foo", number_key(i));
+    }
+    std::vector<Term::GetByKey *> gets;
+    ASSERT_TRUE(query_language::get_point_gets(&array, &gets));
+    ASSERT_EQ(3u, gets.size());
+    EXPECT_EQ(2, gets[2]->key().number());
+
+    // Anything the fast path can't vouch for goes the usual way.
+    make_point_get(array.add_array(), "bar", number_key(3));
+    EXPECT_FALSE(is_point_get(&array));
+
+    Term computed_key;
+    Term call;
+    call.set_type(Term::CALL);
+    call.mutable_call()->mutable_builtin()->set_type(Builtin::ADD);
+    make_point_get(&computed_key, "foo", call);
+    EXPECT_FALSE(is_point_get(&computed_key));
+
+    Term empty;
+    empty.set_type(Term::ARRAY);
+    EXPECT_FALSE(is_point_get(&empty));
+
+    Term table;
+    table.set_type(Term::TABLE);
+    table.mutable_table()->mutable_table_ref()->set_db_name("test");
+    table.mutable_table()->mutable_table_ref()->set_table_name("foo");
+    EXPECT_FALSE(is_point_get(&table));
+
+    Term extra_field;
+    make_point_get(&extra_field, "foo", number_key(1));
+    extra_field.set_number(5);
+    EXPECT_FALSE(is_point_get(&extra_field));
+}
+
+void run_cache_invalidation_test() {
+    dummy_semilattice_controller_t<cluster_semilattice_metadata_t> metadata((cluster_semilattice_metadata_t()));
+    rdb_protocol_t::context_t ctx(NULL, NULL, metadata.get_view(), NULL, generate_uuid(), NULL, "");
+    point_get_cache_t cache(&ctx);
+
+    TableRef table_ref;
+    table_ref.set_db_name("test");
+    table_ref.set_table_name("foo");
+    point_get_cache_t::table_t table;
+    table.primary_key = "id";
+
+    point_get_cache_t::table_t found;
+    EXPECT_FALSE(cache.find(table_ref, &found));
+    cache.insert(table_ref, table, cache.generation());
+    ASSERT_TRUE(cache.find(table_ref, &found));
+    EXPECT_EQ("id", found.primary_key);
+    int64_t generation = cache.generation();
+
+    // Creating a table forgets what the cache knew...
+    cluster_semilattice_metadata_t change = metadata.get_view()->get();
+    {
+        cow_ptr_t<namespaces_semilattice_metadata_t<rdb_protocol_t> >::change_t namespaces(&change.rdb_namespaces);
+        namespaces.get()->namespaces[generate_uuid()] = deletable_t<namespace_semilattice_metadata_t<rdb_protocol_t> >();
+    }
+    metadata.get_view()->join(change);
+    mock::let_stuff_happen();
+    EXPECT_FALSE(cache.find(table_ref, &found));
+
+    // ... and a table that was looked up before it isn't remembered.
+    cache.insert(table_ref, table, generation);
+    EXPECT_FALSE(cache.find(table_ref, &found));
+    cache.insert(table_ref, table, cache.generation());
+    EXPECT_TRUE(cache.find(table_ref, &found));
+}
+
+TEST(RDBPointGet, CacheInvalidation) {
+    mock::run_in_thread_pool(&run_cache_invalidation_test);
+}
+
+}  // namespace unittest
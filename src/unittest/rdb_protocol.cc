@@ -1,4 +1,8 @@
 // Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <map>
+#include <string>
+#include <vector>
+
 #include "errors.hpp"
 #include <boost/make_shared.hpp>
 
@@ -6,6 +10,7 @@
 #include "containers/iterators.hpp"
 #include "memcached/protocol.hpp"
 #include "rdb_protocol/protocol.hpp"
+#include "rdb_protocol/query_language.hpp"
 #include "serializer/config.hpp"
 #include "serializer/translator.hpp"
 #include "unittest/gtest.hpp"
@@ -14,14 +19,25 @@
 namespace unittest {
 namespace {
 
+/* The two shards split the rows with string primary keys at "n", so "a" to "m"
+are on the first shard and "n" to "z" on the second. Keys are encoded with
+`cJSON_print_lexicographic()`, so the split has to be too. Rows with number
+primary keys are all on the first shard. */
+std::vector<rdb_protocol_t::region_t> test_shards() {
+    scoped_cJSON_t split(cJSON_CreateString("n"));
+    store_key_t split_key(cJSON_print_lexicographic(split.get()));
+    std::vector<rdb_protocol_t::region_t> shards;
+    shards.push_back(rdb_protocol_t::region_t(key_range_t(key_range_t::none,   store_key_t(), key_range_t::open, split_key)));
+    shards.push_back(rdb_protocol_t::region_t(key_range_t(key_range_t::closed, split_key,     key_range_t::none, store_key_t())));
+    return shards;
+}
+
 void run_with_namespace_interface(boost::function<void(namespace_interface_t<rdb_protocol_t> *, order_source_t *)> fun) {
 
     order_source_t order_source;
 
     /* Pick shards */
-    std::vector<rdb_protocol_t::region_t> shards;
-    shards.push_back(rdb_protocol_t::region_t(key_range_t(key_range_t::none,   store_key_t(),  key_range_t::open, store_key_t("n"))));
-    shards.push_back(rdb_protocol_t::region_t(key_range_t(key_range_t::closed, store_key_t("n"), key_range_t::none, store_key_t() )));
+    std::vector<rdb_protocol_t::region_t> shards = test_shards();
 
     boost::ptr_vector<mock::temp_file_t> temp_files;
     for (size_t i = 0; i < shards.size(); ++i) {
@@ -63,6 +79,35 @@ void run_in_thread_pool_with_namespace_interface(boost::function<void(namespace_
     mock::run_in_thread_pool(boost::bind(&run_with_namespace_interface, fun));
 }
 
+/* How many rows each shard has, so a test can check that its rows really are
+on both of them. */
+std::vector<int> count_rows_on_shards(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    std::vector<rdb_protocol_t::region_t> shards = test_shards();
+    std::vector<int> counts;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        cond_t interruptor;
+        rdb_protocol_t::rget_read_t rget(shards[i], rdb_protocol_details::terminal_t(rdb_protocol_details::Length(), scopes_t(), backtrace_t()));
+        rdb_protocol_t::read_t read(rget);
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::count_rows_on_shards(rdb_protocol.cc)"), &interruptor);
+
+        rdb_protocol_t::rget_read_response_t *res = boost::get<rdb_protocol_t::rget_read_response_t>(&response.response);
+        guarantee(res);
+        rdb_protocol_t::rget_read_response_t::length_t *length = boost::get<rdb_protocol_t::rget_read_response_t::length_t>(&res->result);
+        guarantee(length);
+        counts.push_back(length->length);
+    }
+    return counts;
+}
+
+/* Checks that the first shard has `first` rows and the second `second`. */
+void expect_rows_on_shards(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource, int first, int second) {
+    std::vector<int> counts = count_rows_on_shards(nsi, osource);
+    ASSERT_EQ(2u, counts.size());
+    EXPECT_EQ(first, counts[0]);
+    EXPECT_EQ(second, counts[1]);
+}
+
 }   /* anonymous namespace */
 
 /* `SetupTeardown` makes sure that it can start and stop without anything going
@@ -111,5 +156,640 @@ void run_get_set_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t
 //    run_in_thread_pool_with_namespace_interface(&run_get_set_test);
 //}
 
+/* `Sindex` creates a secondary index, reads rows through it, and drops it */
+void run_sindex_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+    {
+        rdb_protocol_t::write_t write(rdb_protocol_t::sindex_create_t("sid", "id"));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-A)"), &interruptor);
+
+        if (rdb_protocol_t::sindex_create_response_t *res = boost::get<rdb_protocol_t::sindex_create_response_t>(&response.response)) {
+            EXPECT_TRUE(res->success);
+        } else {
+            ADD_FAILURE() << "got wrong type of result back";
+        }
+    }
+
+    /* The rows land on both shards; their index values are in the opposite
+    order from their primary keys. */
+    const char *ids[] = { "a", "m", "p", "z" };
+    for (int i = 0; i < 4; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("sid", cJSON_CreateNumber(4 - i));
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(store_key_t(cJSON_print_lexicographic(id.get())), row));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-B)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, 2, 2);
+
+    {
+        rdb_protocol_t::read_t read((rdb_protocol_t::sindex_list_t()));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-C)"), &interruptor);
+
+        if (rdb_protocol_t::sindex_list_response_t *res = boost::get<rdb_protocol_t::sindex_list_response_t>(&response.response)) {
+            ASSERT_EQ(1u, res->attrnames.size());
+            EXPECT_EQ("sid", res->attrnames[0]);
+        } else {
+            ADD_FAILURE() << "got wrong type of result back";
+        }
+    }
+
+    {
+        /* Rows with 2 <= sid <= 3, which should come back as "p" from the
+        second shard, then "m" from the first. */
+        scoped_cJSON_t lower(cJSON_CreateNumber(2)), upper(cJSON_CreateNumber(3));
+        rdb_protocol_t::rget_read_t rget(rdb_protocol_t::region_t::universe());
+        rget.sindex = rdb_protocol_details::sindex_range_t("sid",
+                                                           cJSON_print_lexicographic(lower.get()),
+                                                           cJSON_print_lexicographic(upper.get()));
+        rdb_protocol_t::read_t read(rget);
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-D)"), &interruptor);
+
+        rdb_protocol_t::rget_read_response_t *rget_res = boost::get<rdb_protocol_t::rget_read_response_t>(&response.response);
+        ASSERT_TRUE(rget_res != NULL);
+        rdb_protocol_t::rget_read_response_t::stream_t *stream = boost::get<rdb_protocol_t::rget_read_response_t::stream_t>(&rget_res->result);
+        ASSERT_TRUE(stream != NULL);
+        ASSERT_EQ(2u, stream->size());
+        EXPECT_EQ(std::string("p"), (*stream)[0].second->GetObjectItem("id")->valuestring);
+        EXPECT_EQ(std::string("m"), (*stream)[1].second->GetObjectItem("id")->valuestring);
+    }
+
+    {
+        rdb_protocol_t::write_t write(rdb_protocol_t::sindex_drop_t("sid"));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-E)"), &interruptor);
+
+        if (rdb_protocol_t::sindex_drop_response_t *res = boost::get<rdb_protocol_t::sindex_drop_response_t>(&response.response)) {
+            EXPECT_TRUE(res->success);
+        } else {
+            ADD_FAILURE() << "got wrong type of result back";
+        }
+    }
+
+    {
+        rdb_protocol_t::read_t read((rdb_protocol_t::sindex_list_t()));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_sindex_test(rdb_protocol.cc-F)"), &interruptor);
+
+        rdb_protocol_t::sindex_list_response_t *res = boost::get<rdb_protocol_t::sindex_list_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_TRUE(res->attrnames.empty());
+    }
+}
+
+TEST(RDBProtocol, Sindex) {
+    run_in_thread_pool_with_namespace_interface(&run_sindex_test);
+}
+
+/* `SortedRget` pushes an ORDERBY with a limit down to the shards */
+void run_sorted_rget_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* Three rows land on each shard, and their "n"s are out of key order, so
+    the first rows of the sort alternate between the shards. */
+    const char *ids[] = { "a", "c", "m", "p", "r", "z" };
+    const int ns[] = { 5, 1, 4, 6, 2, 3 };
+    for (int i = 0; i < 6; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("n", cJSON_CreateNumber(ns[i]));
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(store_key_t(cJSON_print_lexicographic(id.get())), row));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_sorted_rget_test(rdb_protocol.cc-A)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, 3, 3);
+
+    Builtin_OrderBy order_by;
+    order_by.set_attr("n");
+    order_by.set_ascending(false);
+    rdb_protocol_t::rget_read_t rget(rdb_protocol_t::region_t::universe());
+    rget.sorting = rdb_protocol_details::sorting_t(std::vector<Builtin_OrderBy>(1, order_by), 4, backtrace_t());
+    rdb_protocol_t::read_t read(rget);
+    rdb_protocol_t::read_response_t response;
+    nsi->read(read, &response, osource->check_in("unittest::run_sorted_rget_test(rdb_protocol.cc-B)"), &interruptor);
+
+    rdb_protocol_t::rget_read_response_t *rget_res = boost::get<rdb_protocol_t::rget_read_response_t>(&response.response);
+    ASSERT_TRUE(rget_res != NULL);
+    rdb_protocol_t::rget_read_response_t::stream_t *stream = boost::get<rdb_protocol_t::rget_read_response_t::stream_t>(&rget_res->result);
+    ASSERT_TRUE(stream != NULL);
+    ASSERT_EQ(4u, stream->size());
+    /* "p" and "z" come from the second shard, "a" and "m" from the first. */
+    const char *expected[] = { "p", "a", "m", "z" };
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(std::string(expected[i]), (*stream)[i].second->GetObjectItem("id")->valuestring);
+        if (i > 0) {
+            EXPECT_GT((*stream)[i - 1].second->GetObjectItem("n")->valuedouble,
+                      (*stream)[i].second->GetObjectItem("n")->valuedouble);
+        }
+    }
+}
+
+TEST(RDBProtocol, SortedRget) {
+    run_in_thread_pool_with_namespace_interface(&run_sorted_rget_test);
+}
+
+/* Makes a mapping that applies `builtin` to its argument, like
+`GETATTR(row)`. */
+Mapping make_projection(const Builtin &builtin) {
+    Mapping mapping;
+    mapping.set_arg("row");
+    Term *body = mapping.mutable_body();
+    body->set_type(Term::CALL);
+    *body->mutable_call()->mutable_builtin() = builtin;
+    Term *row = body->mutable_call()->add_args();
+    row->set_type(Term::VAR);
+    row->set_var("row");
+    return mapping;
+}
+
+/* `MultiPointRead` reads rows on both shards, applying a projection to each
+one on the shard */
+void run_multi_point_read_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* "a" and "m" are on the first shard, "p" and "z" on the second. */
+    const char *ids[] = { "a", "m", "p", "z" };
+    std::vector<store_key_t> stored_keys;
+    for (int i = 0; i < 4; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("n", cJSON_CreateNumber(i));
+        row->AddItemToObject("big", cJSON_CreateString(std::string(1000, 'x').c_str()));
+        if (i == 1) {
+            row->AddItemToObject("extra", cJSON_CreateNumber(7));
+        }
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+        stored_keys.push_back(store_key_t(cJSON_print_lexicographic(id.get())));
+
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(stored_keys.back(), row));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_multi_point_read_test(rdb_protocol.cc-A)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, 2, 2);
+
+    /* The keys go back and forth between the shards, and "q" isn't there. */
+    scoped_cJSON_t missing_id(cJSON_CreateString("q"));
+    std::vector<store_key_t> keys;
+    keys.push_back(stored_keys[3]);
+    keys.push_back(stored_keys[0]);
+    keys.push_back(store_key_t(cJSON_print_lexicographic(missing_id.get())));
+    keys.push_back(stored_keys[1]);
+    keys.push_back(stored_keys[2]);
+
+    {
+        /* Picks "n" out of "z", "a", "q", "m" and "p", in that order. */
+        Builtin pick;
+        pick.set_type(Builtin::PICKATTRS);
+        pick.add_attrs("n");
+        rdb_protocol_details::transform_t transform;
+        transform.push_back(rdb_protocol_details::transform_atom_t(make_projection(pick), scopes_t(), backtrace_t()));
+        rdb_protocol_t::read_t read(rdb_protocol_t::multi_point_read_t(keys, transform));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_multi_point_read_test(rdb_protocol.cc-B)"), &interruptor);
+
+        rdb_protocol_t::multi_point_read_response_t *res = boost::get<rdb_protocol_t::multi_point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        ASSERT_EQ(5u, res->rows.size());
+        const int expected[] = { 3, 0, -1, 1, 2 };
+        for (int i = 0; i < 5; ++i) {
+            EXPECT_TRUE(res->rows[i].first == keys[i]);
+            const rdb_protocol_t::point_read_response_t &row = res->rows[i].second;
+            if (expected[i] == -1) {
+                EXPECT_FALSE(row.transformed);
+                EXPECT_EQ(cJSON_NULL, row.data->type());
+                continue;
+            }
+            ASSERT_TRUE(row.transformed);
+            const std::vector<boost::shared_ptr<scoped_cJSON_t> > *values =
+                boost::get<std::vector<boost::shared_ptr<scoped_cJSON_t> > >(&*row.transformed);
+            ASSERT_TRUE(values != NULL);
+            ASSERT_EQ(1u, values->size());
+            EXPECT_EQ(1, (*values)[0]->GetArraySize());
+            EXPECT_EQ(expected[i], (*values)[0]->GetObjectItem("n")->valueint);
+        }
+    }
+
+    {
+        /* A projection that throws sends back the error. */
+        Builtin getattr;
+        getattr.set_type(Builtin::GETATTR);
+        getattr.set_attr("nonexistent");
+        rdb_protocol_details::transform_t transform;
+        transform.push_back(rdb_protocol_details::transform_atom_t(make_projection(getattr), scopes_t(), backtrace_t()));
+        rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(keys[0], transform));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_multi_point_read_test(rdb_protocol.cc-C)"), &interruptor);
+
+        rdb_protocol_t::point_read_response_t *res = boost::get<rdb_protocol_t::point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        ASSERT_TRUE(res->transformed);
+        EXPECT_TRUE(boost::get<query_language::runtime_exc_t>(&*res->transformed) != NULL);
+    }
+
+    {
+        /* Only "m" has "extra", so only the other rows get an error. */
+        Builtin getattr;
+        getattr.set_type(Builtin::GETATTR);
+        getattr.set_attr("extra");
+        rdb_protocol_details::transform_t transform;
+        transform.push_back(rdb_protocol_details::transform_atom_t(make_projection(getattr), scopes_t(), backtrace_t()));
+        rdb_protocol_t::read_t read(rdb_protocol_t::multi_point_read_t(keys, transform));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_multi_point_read_test(rdb_protocol.cc-D)"), &interruptor);
+
+        rdb_protocol_t::multi_point_read_response_t *res = boost::get<rdb_protocol_t::multi_point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        ASSERT_EQ(5u, res->rows.size());
+        for (int i = 0; i < 5; ++i) {
+            EXPECT_TRUE(res->rows[i].first == keys[i]);
+            const rdb_protocol_t::point_read_response_t &row = res->rows[i].second;
+            if (i == 2) {
+                EXPECT_FALSE(row.transformed);
+                continue;
+            }
+            ASSERT_TRUE(row.transformed);
+            const std::vector<boost::shared_ptr<scoped_cJSON_t> > *values =
+                boost::get<std::vector<boost::shared_ptr<scoped_cJSON_t> > >(&*row.transformed);
+            if (i == 3) {
+                ASSERT_TRUE(values != NULL);
+                ASSERT_EQ(1u, values->size());
+                EXPECT_EQ(7, (*values)[0]->get()->valueint);
+            } else {
+                EXPECT_TRUE(values == NULL);
+                EXPECT_TRUE(boost::get<query_language::runtime_exc_t>(&*row.transformed) != NULL);
+            }
+        }
+    }
+}
+
+TEST(RDBProtocol, MultiPointRead) {
+    run_in_thread_pool_with_namespace_interface(&run_multi_point_read_test);
+}
+
+/* Makes a GETBYKEY of the row of the table whose `attrname` is `id`. */
+void make_get_by_key(Term *t, const std::string &attrname, const std::string &id) {
+    t->set_type(Term::GETBYKEY);
+    Term::GetByKey *get = t->mutable_get_by_key();
+    get->mutable_table_ref()->set_db_name("test");
+    get->mutable_table_ref()->set_table_name("foo");
+    get->set_attrname(attrname);
+    get->mutable_key()->set_type(Term::STRING);
+    get->mutable_key()->set_valuestring(id);
+}
+
+/* Answers `t` the way `execute_point_get()` does once it has found the table,
+whose primary key is "id". */
+bool read_point_get(Term *t, namespace_interface_t<rdb_protocol_t> *nsi, Response *res) {
+    std::vector<Term::GetByKey *> gets;
+    guarantee(query_language::get_point_gets(t, &gets));
+    cond_t interruptor;
+    return query_language::read_point_gets(t, gets, "id", nsi, &interruptor, backtrace_t(), res);
+}
+
+/* `PointGet` answers queries that are nothing but point gets with the rows
+they'd evaluate to. */
+void run_point_get_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* "a" is on the first shard and "z" on the second. */
+    const char *ids[] = { "a", "z" };
+    for (int i = 0; i < 2; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("n", cJSON_CreateNumber(i));
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(store_key_t(cJSON_print_lexicographic(id.get())), row));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_point_get_test(rdb_protocol.cc)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, 1, 1);
+
+    {
+        /* A single key gets the row by itself. */
+        Term t;
+        make_get_by_key(&t, "id", "z");
+        Response res;
+        ASSERT_TRUE(read_point_get(&t, nsi, &res));
+        EXPECT_EQ(Response::SUCCESS_JSON, res.status_code());
+        ASSERT_EQ(1, res.response_size());
+        scoped_cJSON_t row(cJSON_Parse(res.response(0).c_str()));
+        ASSERT_EQ(cJSON_Object, row.type());
+        EXPECT_EQ(1, row.GetObjectItem("n")->valueint);
+    }
+
+    {
+        /* A row that isn't there is null. */
+        Term t;
+        make_get_by_key(&t, "id", "q");
+        Response res;
+        ASSERT_TRUE(read_point_get(&t, nsi, &res));
+        EXPECT_EQ(Response::SUCCESS_JSON, res.status_code());
+        ASSERT_EQ(1, res.response_size());
+        EXPECT_EQ("null", res.response(0));
+    }
+
+    {
+        /* An array of keys gets an array of rows, in the same order. */
+        Term t;
+        t.set_type(Term::ARRAY);
+        make_get_by_key(t.add_array(), "id", "z");
+        make_get_by_key(t.add_array(), "id", "q");
+        make_get_by_key(t.add_array(), "id", "a");
+        Response res;
+        ASSERT_TRUE(read_point_get(&t, nsi, &res));
+        EXPECT_EQ(Response::SUCCESS_JSON, res.status_code());
+        ASSERT_EQ(1, res.response_size());
+        scoped_cJSON_t rows(cJSON_Parse(res.response(0).c_str()));
+        ASSERT_EQ(cJSON_Array, rows.type());
+        ASSERT_EQ(3, rows.GetArraySize());
+        EXPECT_EQ(1, cJSON_GetObjectItem(rows.GetArrayItem(0), "n")->valueint);
+        EXPECT_EQ(cJSON_NULL, rows.GetArrayItem(1)->type);
+        EXPECT_EQ(0, cJSON_GetObjectItem(rows.GetArrayItem(2), "n")->valueint);
+    }
+
+    {
+        /* Looking up anything but the primary key is left to the scan. */
+        Term t;
+        make_get_by_key(&t, "n", "a");
+        Response res;
+        EXPECT_FALSE(read_point_get(&t, nsi, &res));
+        EXPECT_EQ(0, res.response_size());
+        EXPECT_FALSE(res.has_status_code());
+    }
+}
+
+TEST(RDBProtocol, PointGet) {
+    run_in_thread_pool_with_namespace_interface(&run_point_get_test);
+}
+
+/* `BatchedInsert` inserts rows on both shards in one write, and gets back what
+happened to each of them in the order they were sent. */
+void run_batched_insert_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* "a" goes to the first shard, and "z" and "q" to the second. */
+    const char *ids[] = { "z", "a", "q", "a" };
+    rdb_protocol_t::batched_insert_t insert(false);
+    for (int i = 0; i < 4; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("n", cJSON_CreateNumber(i));
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+        insert.rows.push_back(std::make_pair(store_key_t(cJSON_print_lexicographic(id.get())), row));
+    }
+
+    {
+        rdb_protocol_t::write_t write(insert);
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_batched_insert_test(rdb_protocol.cc-A)"), &interruptor);
+
+        rdb_protocol_t::batched_insert_response_t *res = boost::get<rdb_protocol_t::batched_insert_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        ASSERT_EQ(4u, res->results.size());
+        const point_write_result_t expected[] = { STORED, STORED, STORED, DUPLICATE };
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_TRUE(res->results[i].first == insert.rows[i].first);
+            EXPECT_EQ(expected[i], res->results[i].second);
+        }
+    }
+
+    expect_rows_on_shards(nsi, osource, 1, 2);
+
+    /* Every row is there, and the duplicate didn't overwrite the first "a". */
+    for (int i = 0; i < 3; ++i) {
+        rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(insert.rows[i].first));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_batched_insert_test(rdb_protocol.cc-B)"), &interruptor);
+
+        rdb_protocol_t::point_read_response_t *res = boost::get<rdb_protocol_t::point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        ASSERT_EQ(cJSON_Object, res->data->type());
+        EXPECT_EQ(i, res->data->GetObjectItem("n")->valueint);
+    }
+}
+
+TEST(RDBProtocol, BatchedInsert) {
+    run_in_thread_pool_with_namespace_interface(&run_batched_insert_test);
+}
+
+/* `RangeModify` updates, mutates and deletes the rows on both shards that pass
+a filter, without reading them out. */
+void run_range_modify_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* "a" and "m" are on the first shard and "p" and "z" on the second; the
+    filter keeps "a" and "z". */
+    const char *ids[] = { "a", "m", "p", "z" };
+    std::vector<store_key_t> keys;
+    for (int i = 0; i < 4; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(ids[i]));
+        row->AddItemToObject("n", cJSON_CreateNumber(i));
+        if (i == 0 || i == 3) {
+            row->AddItemToObject("keep", cJSON_CreateTrue());
+        }
+        scoped_cJSON_t id(cJSON_CreateString(ids[i]));
+        keys.push_back(store_key_t(cJSON_print_lexicographic(id.get())));
+
+        rdb_protocol_t::write_t write(rdb_protocol_t::point_write_t(keys.back(), row));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_range_modify_test(rdb_protocol.cc-A)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, 2, 2);
+
+    Builtin_Filter filter;
+    filter.mutable_predicate()->set_arg("row");
+    Term *body = filter.mutable_predicate()->mutable_body();
+    body->set_type(Term::CALL);
+    body->mutable_call()->mutable_builtin()->set_type(Builtin::HASATTR);
+    body->mutable_call()->mutable_builtin()->set_attr("keep");
+    Term *row = body->mutable_call()->add_args();
+    row->set_type(Term::VAR);
+    row->set_var("row");
+    rdb_protocol_details::transform_t filtered;
+    filtered.push_back(rdb_protocol_details::transform_atom_t(filter, scopes_t(), backtrace_t()));
+
+    {
+        Builtin pick;
+        pick.set_type(Builtin::PICKATTRS);
+        pick.add_attrs("n");
+        rdb_protocol_t::write_t write(rdb_protocol_t::range_modify_t("id", key_range_t::universe(), filtered, range_modify_ns::UPDATE,
+                                                                     scopes_t(), backtrace_t(), make_projection(pick)));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_range_modify_test(rdb_protocol.cc-B)"), &interruptor);
+
+        rdb_protocol_t::range_modify_response_t *res = boost::get<rdb_protocol_t::range_modify_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_FALSE(res->exc);
+        EXPECT_EQ(2, res->modified);
+        EXPECT_EQ(0, res->errors);
+    }
+
+    {
+        /* Every row's mapping throws, and each one counts as an error. */
+        Builtin getattr;
+        getattr.set_type(Builtin::GETATTR);
+        getattr.set_attr("nonexistent");
+        rdb_protocol_t::write_t write(rdb_protocol_t::range_modify_t("id", key_range_t::universe(), rdb_protocol_details::transform_t(),
+                                                                     range_modify_ns::MUTATE, scopes_t(), backtrace_t(),
+                                                                     make_projection(getattr)));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_range_modify_test(rdb_protocol.cc-C)"), &interruptor);
+
+        rdb_protocol_t::range_modify_response_t *res = boost::get<rdb_protocol_t::range_modify_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_EQ(0, res->modified);
+        EXPECT_EQ(4, res->errors);
+        EXPECT_TRUE(res->first_error);
+    }
+
+    {
+        rdb_protocol_t::write_t write(rdb_protocol_t::range_modify_t("id", key_range_t::universe(), filtered, range_modify_ns::DELETE,
+                                                                     scopes_t(), backtrace_t(), boost::optional<Mapping>()));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_range_modify_test(rdb_protocol.cc-D)"), &interruptor);
+
+        rdb_protocol_t::range_modify_response_t *res = boost::get<rdb_protocol_t::range_modify_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_EQ(2, res->deleted);
+    }
+    expect_rows_on_shards(nsi, osource, 1, 1);
+
+    for (int i = 0; i < 4; ++i) {
+        rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(keys[i]));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_range_modify_test(rdb_protocol.cc-E)"), &interruptor);
+
+        rdb_protocol_t::point_read_response_t *res = boost::get<rdb_protocol_t::point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_EQ(i == 0 || i == 3 ? cJSON_NULL : cJSON_Object, res->data->type());
+    }
+}
+
+TEST(RDBProtocol, RangeModify) {
+    run_in_thread_pool_with_namespace_interface(&run_range_modify_test);
+}
+
+/* `VersionRead` reads the shards' metainfo, which a read leaves alone and a
+write changes, so the query cache can tell when a table's data has changed. */
+std::map<std::string, std::string> read_versions(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+    rdb_protocol_t::read_t read((rdb_protocol_t::version_read_t()));
+    rdb_protocol_t::read_response_t response;
+    nsi->read(read, &response, osource->check_in("unittest::read_versions(rdb_protocol.cc)"), &interruptor);
+
+    rdb_protocol_t::version_read_response_t *res = boost::get<rdb_protocol_t::version_read_response_t>(&response.response);
+    guarantee(res);
+    return res->metainfo;
+}
+
+void run_version_read_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    std::map<std::string, std::string> before = read_versions(nsi, osource);
+    EXPECT_FALSE(before.empty());
+
+    scoped_cJSON_t id(cJSON_CreateString("a"));
+    store_key_t key(cJSON_print_lexicographic(id.get()));
+    {
+        rdb_protocol_t::read_t read((rdb_protocol_t::point_read_t(key)));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_version_read_test(rdb_protocol.cc-A)"), &interruptor);
+    }
+    EXPECT_TRUE(before == read_versions(nsi, osource));
+
+    {
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString("a"));
+        rdb_protocol_t::write_t write((rdb_protocol_t::point_write_t(key, row)));
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_version_read_test(rdb_protocol.cc-B)"), &interruptor);
+    }
+    std::map<std::string, std::string> after = read_versions(nsi, osource);
+    EXPECT_FALSE(before == after);
+    EXPECT_TRUE(after == read_versions(nsi, osource));
+}
+
+TEST(RDBProtocol, VersionRead) {
+    run_in_thread_pool_with_namespace_interface(&run_version_read_test);
+}
+
+/* A shard only gets through a batch of rows per `range_modify_t`, and says
+which part of its region is left. */
+void run_batched_range_modify_test(namespace_interface_t<rdb_protocol_t> *nsi, order_source_t *osource) {
+    cond_t interruptor;
+
+    /* Half of the rows start with "a" and are on the first shard, and half
+    start with "z" and are on the second. */
+    const int num_rows = 4 * RDB_RANGE_MODIFY_BATCH_SIZE;
+    rdb_protocol_t::batched_insert_t insert(false);
+    for (int i = 0; i < num_rows; ++i) {
+        std::string id_str = strprintf("%c%d", i % 2 == 0 ? 'a' : 'z', i);
+        boost::shared_ptr<scoped_cJSON_t> row(new scoped_cJSON_t(cJSON_CreateObject()));
+        row->AddItemToObject("id", cJSON_CreateString(id_str.c_str()));
+        scoped_cJSON_t id(cJSON_CreateString(id_str.c_str()));
+        insert.rows.push_back(std::make_pair(store_key_t(cJSON_print_lexicographic(id.get())), row));
+    }
+    {
+        rdb_protocol_t::write_t write(insert);
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_batched_range_modify_test(rdb_protocol.cc-A)"), &interruptor);
+    }
+    expect_rows_on_shards(nsi, osource, num_rows / 2, num_rows / 2);
+
+    int deleted = 0;
+    int num_writes = 0;
+    std::vector<rdb_protocol_t::region_t> regions(1, rdb_protocol_t::region_t::universe());
+    while (!regions.empty()) {
+        rdb_protocol_t::range_modify_t modify("id", key_range_t::universe(), rdb_protocol_details::transform_t(), range_modify_ns::DELETE,
+                                              scopes_t(), backtrace_t(), boost::optional<Mapping>());
+        modify.region = regions.back();
+        regions.pop_back();
+        rdb_protocol_t::write_t write(modify);
+        rdb_protocol_t::write_response_t response;
+        nsi->write(write, &response, osource->check_in("unittest::run_batched_range_modify_test(rdb_protocol.cc-B)"), &interruptor);
+
+        rdb_protocol_t::range_modify_response_t *res = boost::get<rdb_protocol_t::range_modify_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_FALSE(res->exc);
+        if (num_writes == 0) {
+            /* The first write goes to both shards, and each has more than a
+            batch. */
+            EXPECT_EQ(2 * RDB_RANGE_MODIFY_BATCH_SIZE, res->deleted);
+            EXPECT_EQ(2u, res->remaining.size());
+        }
+        /* At most a batch from each of the two shards. */
+        EXPECT_GE(2 * RDB_RANGE_MODIFY_BATCH_SIZE, res->deleted);
+        deleted += res->deleted;
+        regions.insert(regions.end(), res->remaining.begin(), res->remaining.end());
+        ++num_writes;
+    }
+    EXPECT_EQ(num_rows, deleted);
+    expect_rows_on_shards(nsi, osource, 0, 0);
+
+    for (int i = 0; i < num_rows; ++i) {
+        rdb_protocol_t::read_t read(rdb_protocol_t::point_read_t(insert.rows[i].first));
+        rdb_protocol_t::read_response_t response;
+        nsi->read(read, &response, osource->check_in("unittest::run_batched_range_modify_test(rdb_protocol.cc-C)"), &interruptor);
+
+        rdb_protocol_t::point_read_response_t *res = boost::get<rdb_protocol_t::point_read_response_t>(&response.response);
+        ASSERT_TRUE(res != NULL);
+        EXPECT_EQ(cJSON_NULL, res->data->type());
+    }
+}
+
+TEST(RDBProtocol, BatchedRangeModify) {
+    run_in_thread_pool_with_namespace_interface(&run_batched_range_modify_test);
+}
+
 }   /* namespace unittest */
 
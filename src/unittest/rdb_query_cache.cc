@@ -0,0 +1,87 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/query_cache.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+/* A read of `table` that asks to be cached. */
+Query table_query(const std::string &table, int64_t token) {
+    Query q;
+    q.set_type(Query::READ);
+    q.set_token(token);
+    q.mutable_read_query()->set_use_cache(true);
+    Term *t = q.mutable_read_query()->mutable_term();
+    t->set_type(Term::TABLE);
+    t->mutable_table()->mutable_table_ref()->set_db_name("test");
+    t->mutable_table()->mutable_table_ref()->set_table_name(table);
+    return q;
+}
+
+Response json_response(const std::string &json) {
+    Response res;
+    res.set_status_code(Response::SUCCESS_JSON);
+    res.set_token(0);
+    res.add_response(json);
+    return res;
+}
+
+query_cache_t::versions_t versions_at(const std::string &version) {
+    query_cache_t::versions_t versions(1);
+    versions[0]["shard"] = version;
+    return versions;
+}
+
+void run_cache_test() {
+    query_cache_t cache(1000 * get_num_threads());
+
+    Query q = table_query("foo", 1);
+    std::vector<TableRef> tables;
+    ASSERT_TRUE(query_cache_t::is_cacheable(q, &tables));
+    ASSERT_EQ(1u, tables.size());
+    EXPECT_EQ("foo", tables[0].table_name());
+
+    Response res;
+    EXPECT_FALSE(cache.get(q, versions_at("1"), &res));
+    cache.put(q, versions_at("1"), json_response("[1]"));
+
+    // The token doesn't matter, but the versions do.
+    ASSERT_TRUE(cache.get(table_query("foo", 2), versions_at("1"), &res));
+    EXPECT_EQ(2, res.token());
+    EXPECT_EQ("[1]", res.response(0));
+    EXPECT_FALSE(cache.get(q, versions_at("2"), &res));
+    EXPECT_FALSE(cache.get(q, versions_at("1"), &res));
+
+    // Partial responses and errors aren't kept.
+    Response partial = json_response("[1]");
+    partial.set_status_code(Response::SUCCESS_PARTIAL);
+    cache.put(q, versions_at("1"), partial);
+    EXPECT_FALSE(cache.get(q, versions_at("1"), &res));
+
+    // The least recently used responses make way for new ones.
+    const int num_tables = 20;
+    for (int i = 0; i < num_tables; ++i) {
+        cache.put(table_query(strprintf("t%d", i), 1), versions_at("1"), json_response("[1]"));
+    }
+    EXPECT_FALSE(cache.get(table_query("t0", 1), versions_at("1"), &res));
+    EXPECT_TRUE(cache.get(table_query(strprintf("t%d", num_tables - 1), 1), versions_at("1"), &res));
+
+    // A query has to ask to be cached, and can't run javascript.
+    q.mutable_read_query()->set_use_cache(false);
+    EXPECT_FALSE(query_cache_t::is_cacheable(q, &tables));
+    q.mutable_read_query()->set_use_cache(true);
+    Term *js = q.mutable_read_query()->mutable_term();
+    js->Clear();
+    js->set_type(Term::JAVASCRIPT);
+    js->set_javascript("return 1;");
+    EXPECT_FALSE(query_cache_t::is_cacheable(q, &tables));
+}
+
+TEST(RDBQueryCache, KeepsResponsesUntilTablesChange) {
+    mock::run_in_thread_pool(&run_cache_test);
+}
+
+}  // namespace unittest
@@ -0,0 +1,209 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <deque>
+
+#include "errors.hpp"
+#include <boost/make_shared.hpp>
+
+#include "arch/runtime/coroutines.hpp"
+#include "concurrency/cond_var.hpp"
+#include "concurrency/wait_any.hpp"
+#include "containers/scoped.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/stream.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::batched_rget_stream_t;
+using query_language::json_list_t;
+using query_language::runtime_exc_t;
+
+/* Stands in for a table. Each read returns the next response the test has
+pushed, or waits until there is one: a number of rows, or an error if it's
+negative. If `rows_per_read` isn't zero, reads with no response waiting get
+that many rows right away instead. */
+class fake_table_t {
+public:
+    fake_table_t() : rows_per_read(0), num_reads(0), num_interrupted_reads(0), next_row(0) { }
+
+    void push(int num_rows) {
+        responses.push_back(num_rows);
+        if (response_pushed.has()) {
+            response_pushed->pulse_if_not_already_pulsed();
+        }
+    }
+
+    void read(json_list_t *rows_out, signal_t *interruptor) {
+        ++num_reads;
+        while (responses.empty() && rows_per_read == 0) {
+            response_pushed.init(new cond_t);
+            try {
+                wait_interruptible(response_pushed.get(), interruptor);
+            } catch (const interrupted_exc_t &) {
+                ++num_interrupted_reads;
+                throw;
+            }
+        }
+
+        int num_rows = rows_per_read;
+        if (!responses.empty()) {
+            num_rows = responses.front();
+            responses.pop_front();
+        }
+        if (num_rows < 0) {
+            throw runtime_exc_t("fake read error", backtrace_t());
+        }
+        for (int i = 0; i < num_rows; ++i) {
+            boost::shared_ptr<scoped_cJSON_t> row = boost::make_shared<scoped_cJSON_t>(cJSON_CreateObject());
+            row->AddItemToObject("n", cJSON_CreateNumber(next_row++));
+            rows_out->push_back(row);
+        }
+    }
+
+    int rows_per_read;
+    int num_reads;
+    int num_interrupted_reads;
+
+private:
+    std::deque<int> responses;
+    scoped_ptr_t<cond_t> response_pushed;
+    int next_row;
+};
+
+class fake_rget_stream_t : public batched_rget_stream_t {
+public:
+    fake_rget_stream_t(fake_table_t *_table, signal_t *interruptor,
+                       int prefetch_depth, size_t prefetch_memory_budget)
+        : batched_rget_stream_t(namespace_repo_t<rdb_protocol_t>::access_t(), interruptor,
+                                key_range_t::universe(), 100, prefetch_depth, prefetch_memory_budget,
+                                backtrace_t(), false),
+          table(_table) { }
+
+private:
+    /* `table` outlives the stream, so an interrupted read doesn't touch the
+    stream on its way out. */
+    void read_more(json_list_t *rows_out, signal_t *read_interruptor) {
+        table->read(rows_out, read_interruptor);
+    }
+
+    fake_table_t *table;
+};
+
+/* Gives the stream's background reads a chance to run. */
+void let_reads_happen() {
+    for (int i = 0; i < 10; ++i) {
+        coro_t::yield();
+    }
+}
+
+int row_number(const boost::shared_ptr<scoped_cJSON_t> &row) {
+    return row->GetObjectItem("n")->valueint;
+}
+
+void run_prefetch_depth_test() {
+    const int rows_per_read = 10;
+    const int prefetch_depth = 2;
+    fake_table_t table;
+    table.rows_per_read = rows_per_read;
+    cond_t interruptor;
+    fake_rget_stream_t stream(&table, &interruptor, prefetch_depth, GIGABYTE);
+
+    for (int i = 0; i < 10 * rows_per_read; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row = stream.next();
+        ASSERT_TRUE(row);
+        EXPECT_EQ(i, row_number(row));
+        let_reads_happen();
+
+        // The batch the client is on, and `prefetch_depth` more.
+        ASSERT_LE(table.num_reads, (i + 1) / rows_per_read + 1 + prefetch_depth);
+        if (i == rows_per_read / 2) {
+            EXPECT_EQ(1 + prefetch_depth, table.num_reads);
+        }
+    }
+}
+
+TEST(RDBRgetStream, PrefetchDepth) {
+    mock::run_in_thread_pool(&run_prefetch_depth_test);
+}
+
+void run_prefetch_memory_budget_test() {
+    const int rows_per_read = 10;
+    fake_table_t table;
+    table.rows_per_read = rows_per_read;
+    cond_t interruptor;
+    // Any batch at all uses up the budget, so there's never one waiting.
+    fake_rget_stream_t stream(&table, &interruptor, 100, 1);
+
+    size_t batch_size = 0;
+    for (int i = 0; i < 10 * rows_per_read; ++i) {
+        boost::shared_ptr<scoped_cJSON_t> row = stream.next();
+        ASSERT_TRUE(row);
+        EXPECT_EQ(i, row_number(row));
+        let_reads_happen();
+
+        ASSERT_LE(table.num_reads, (i + 1) / rows_per_read + 1);
+        if (i == 0) {
+            batch_size = stream.memory_usage();
+            EXPECT_GT(batch_size, 0u);
+        }
+        ASSERT_LE(stream.memory_usage(), batch_size);
+    }
+}
+
+TEST(RDBRgetStream, PrefetchMemoryBudget) {
+    mock::run_in_thread_pool(&run_prefetch_memory_budget_test);
+}
+
+void run_error_after_rows_test() {
+    fake_table_t table;
+    table.push(3);
+    table.push(-1);
+    cond_t interruptor;
+    fake_rget_stream_t stream(&table, &interruptor, 2, GIGABYTE);
+
+    // The error comes in while the rows before it are still waiting...
+    ASSERT_EQ(0, row_number(stream.next()));
+    let_reads_happen();
+    EXPECT_EQ(2, table.num_reads);
+
+    // ... but they come out first.
+    EXPECT_EQ(1, row_number(stream.next()));
+    EXPECT_EQ(2, row_number(stream.next()));
+    EXPECT_THROW(stream.next(), runtime_exc_t);
+
+    // And that's the end of the stream.
+    EXPECT_FALSE(stream.next());
+    EXPECT_EQ(2, table.num_reads);
+}
+
+TEST(RDBRgetStream, ErrorAfterRows) {
+    mock::run_in_thread_pool(&run_error_after_rows_test);
+}
+
+void run_destroy_while_reading_test() {
+    fake_table_t table;
+    table.push(3);
+    cond_t interruptor;
+    scoped_ptr_t<fake_rget_stream_t> stream(new fake_rget_stream_t(&table, &interruptor, 2, GIGABYTE));
+
+    ASSERT_EQ(0, row_number(stream->next()));
+    let_reads_happen();
+    ASSERT_EQ(2, table.num_reads);
+    ASSERT_EQ(0, table.num_interrupted_reads);
+
+    // The prefetch is still waiting on the table. Destroying the stream
+    // interrupts it, and waits for it to be done.
+    stream.reset();
+    EXPECT_EQ(1, table.num_interrupted_reads);
+
+    // Nothing is listening any more.
+    table.push(3);
+    let_reads_happen();
+    EXPECT_EQ(2, table.num_reads);
+}
+
+TEST(RDBRgetStream, DestroyWhileReading) {
+    mock::run_in_thread_pool(&run_destroy_while_reading_test);
+}
+
+}  // namespace unittest
@@ -0,0 +1,97 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "arch/io/disk.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/stream.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::json_stream_t;
+using query_language::in_memory_stream_t;
+using query_language::sort_stream_t;
+
+/* Orders rows by their "n" attribute. */
+class n_ordering_t {
+public:
+    bool operator()(const boost::shared_ptr<scoped_cJSON_t> &x, const boost::shared_ptr<scoped_cJSON_t> &y) const {
+        return x->GetObjectItem("n")->valueint < y->GetObjectItem("n")->valueint;
+    }
+};
+
+static const int NUM_ROWS = 500;
+
+/* Rows numbered by "i", with lots of ties in "n". */
+boost::shared_ptr<json_stream_t> make_rows(scoped_cJSON_t *array) {
+    for (int i = 0; i < NUM_ROWS; ++i) {
+        array->AddItemToArray(cJSON_Parse(strprintf("{\"n\": %d, \"i\": %d}", (i * 37) % 50, i).c_str()));
+    }
+    return boost::shared_ptr<json_stream_t>(new in_memory_stream_t(json_array_iterator_t(array->get())));
+}
+
+void check_sorted(boost::shared_ptr<json_stream_t> stream, int expected_count) {
+    int count = 0;
+    boost::shared_ptr<scoped_cJSON_t> prev;
+    while (boost::shared_ptr<scoped_cJSON_t> row = stream->next()) {
+        if (prev) {
+            int prev_n = prev->GetObjectItem("n")->valueint, n = row->GetObjectItem("n")->valueint;
+            ASSERT_LE(prev_n, n);
+            if (prev_n == n) {
+                // The sort is stable.
+                ASSERT_LT(prev->GetObjectItem("i")->valueint, row->GetObjectItem("i")->valueint);
+            }
+        }
+        prev = row;
+        ++count;
+    }
+    EXPECT_EQ(expected_count, count);
+}
+
+void run_sort_test(size_t memory_budget, boost::optional<size_t> limit, int expected_count) {
+    scoped_ptr_t<io_backender_t> io_backender;
+    make_io_backender(aio_default, &io_backender);
+
+    // The run files go in a directory of their own, which is removed at the
+    // end.
+    mock::temp_directory_t temp_directory("/tmp/rdb_sort_unittest.XXXXXX");
+    scoped_cJSON_t array(cJSON_CreateArray());
+    boost::shared_ptr<json_stream_t> sorted(new sort_stream_t<n_ordering_t>(make_rows(&array), n_ordering_t(), limit,
+                                                                            io_backender.get(), temp_directory.name(),
+                                                                            memory_budget));
+    check_sorted(sorted, expected_count);
+}
+
+void run_in_memory_test() {
+    run_sort_test(GIGABYTE, boost::optional<size_t>(), NUM_ROWS);
+}
+
+TEST(RDBSort, InMemory) {
+    mock::run_in_thread_pool(&run_in_memory_test);
+}
+
+void run_spill_test() {
+    // Every few rows go to their own run, so the runs get merged several
+    // times along the way.
+    run_sort_test(1000, boost::optional<size_t>(), NUM_ROWS);
+    // Every row goes to its own run, so merged runs fill up the levels above,
+    // too.
+    run_sort_test(1, boost::optional<size_t>(), NUM_ROWS);
+}
+
+TEST(RDBSort, Spill) {
+    mock::run_in_thread_pool(&run_spill_test);
+}
+
+void run_limit_test() {
+    run_sort_test(GIGABYTE, size_t(30), 30);
+    run_sort_test(GIGABYTE, size_t(0), 0);
+    run_sort_test(GIGABYTE, size_t(NUM_ROWS * 2), NUM_ROWS);
+}
+
+TEST(RDBSort, Limit) {
+    mock::run_in_thread_pool(&run_limit_test);
+}
+
+}  // namespace unittest
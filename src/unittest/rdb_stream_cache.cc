@@ -0,0 +1,135 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "concurrency/cond_var.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/stream.hpp"
+#include "rdb_protocol/stream_cache.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::in_memory_stream_t;
+using query_language::json_stream_t;
+
+/* A stream of `num_rows` rows of about 200 bytes each. */
+boost::shared_ptr<json_stream_t> fat_stream(int num_rows) {
+    scoped_cJSON_t rows(cJSON_CreateArray());
+    for (int i = 0; i < num_rows; ++i) {
+        cJSON *row = cJSON_CreateObject();
+        cJSON_AddItemToObject(row, "padding", cJSON_CreateString(std::string(200, 'x').c_str()));
+        rows.AddItemToArray(row);
+    }
+    return boost::make_shared<in_memory_stream_t>(json_array_iterator_t(rows.get()));
+}
+
+int count_live(const std::vector<boost::weak_ptr<json_stream_t> > &streams) {
+    int res = 0;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        res += streams[i].expired() ? 0 : 1;
+    }
+    return res;
+}
+
+/* Opens a cursor on `cache` and reads its first row, as the first READ of a
+stream does. */
+void open_cursor(stream_cache_t *cache, int64_t key, std::vector<boost::weak_ptr<json_stream_t> > *streams_out,
+                 int num_rows = 10) {
+    ReadQuery r;
+    r.set_max_chunk_size(1);
+    boost::shared_ptr<json_stream_t> stream = fat_stream(num_rows);
+    streams_out->push_back(stream);
+    cache->insert(&r, key, stream);
+    Response res;
+    cond_t interruptor;
+    ASSERT_TRUE(cache->serve(key, &res, &interruptor));
+    ASSERT_EQ(Response::SUCCESS_PARTIAL, res.status_code());
+}
+
+void run_cursors_test() {
+    const int num_cursors = 5000;
+    const size_t memory_budget = 100 * KILOBYTE;
+    const size_t thread_memory_budget = 250 * KILOBYTE;
+
+    // Abandoned cursors are closed, least recently used first, to stay within
+    // the connection's budget.
+    {
+        stream_cache_t cache(memory_budget, thread_memory_budget);
+        std::vector<boost::weak_ptr<json_stream_t> > streams;
+        for (int i = 0; i < num_cursors; ++i) {
+            open_cursor(&cache, i, &streams);
+            ASSERT_LE(cache.memory_usage(), memory_budget);
+        }
+        EXPECT_GT(count_live(streams), 1);
+        EXPECT_LT(count_live(streams), num_cursors / 10);
+        EXPECT_FALSE(cache.contains(0));
+        EXPECT_TRUE(cache.contains(num_cursors - 1));
+
+        // A cursor that's used stays open.
+        open_cursor(&cache, num_cursors, &streams, 200);
+        for (int i = num_cursors + 1; i < num_cursors + 100; ++i) {
+            Response res;
+            cond_t interruptor;
+            ASSERT_TRUE(cache.serve(num_cursors, &res, &interruptor));
+            open_cursor(&cache, i, &streams);
+        }
+        EXPECT_TRUE(cache.contains(num_cursors));
+    }
+    EXPECT_EQ(0u, stream_cache_t::thread_memory_usage());
+
+    // The cursors of all the connections on a thread share a budget too.
+    {
+        std::vector<boost::shared_ptr<stream_cache_t> > caches;
+        std::vector<boost::weak_ptr<json_stream_t> > streams;
+        for (int i = 0; i < 10; ++i) {
+            caches.push_back(boost::make_shared<stream_cache_t>(memory_budget, thread_memory_budget));
+        }
+        for (int i = 0; i < num_cursors; ++i) {
+            open_cursor(caches[i % caches.size()].get(), i, &streams);
+            ASSERT_LE(stream_cache_t::thread_memory_usage(), thread_memory_budget);
+        }
+        EXPECT_LT(count_live(streams), num_cursors / 10);
+    }
+    EXPECT_EQ(0u, stream_cache_t::thread_memory_usage());
+}
+
+TEST(RDBStreamCache, ThousandsOfCursors) {
+    mock::run_in_thread_pool(&run_cursors_test);
+}
+
+/* A stream that was just inserted survives another connection making room
+before it's served. */
+void run_insert_then_serve_test() {
+    stream_cache_t first(MEGABYTE, 10 * KILOBYTE), second(MEGABYTE, 10 * KILOBYTE);
+    std::vector<boost::weak_ptr<json_stream_t> > streams;
+
+    ReadQuery r;
+    r.set_max_chunk_size(1);
+    boost::shared_ptr<json_stream_t> stream = fat_stream(100);
+    streams.push_back(stream);
+    first.insert(&r, 0, stream);
+    stream.reset();
+
+    open_cursor(&second, 0, &streams, 100);
+    EXPECT_TRUE(first.contains(0));
+
+    Response res;
+    cond_t interruptor;
+    ASSERT_TRUE(first.serve(0, &res, &interruptor));
+    EXPECT_EQ(Response::SUCCESS_PARTIAL, res.status_code());
+
+    // Once it has been served, it's fair game.
+    open_cursor(&second, 1, &streams, 100);
+    EXPECT_FALSE(first.contains(0));
+}
+
+TEST(RDBStreamCache, InsertThenServe) {
+    mock::run_in_thread_pool(&run_insert_then_serve_test);
+}
+
+}  // namespace unittest
@@ -0,0 +1,264 @@
+// Copyright 2010-2012 RethinkDB, all rights reserved.
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "errors.hpp"
+#include <boost/make_shared.hpp>
+
+#include "arch/runtime/coroutines.hpp"
+#include "mock/unittest_utils.hpp"
+#include "rdb_protocol/stream.hpp"
+#include "unittest/gtest.hpp"
+
+namespace unittest {
+
+using query_language::json_stream_t;
+using query_language::result_t;
+using query_language::slice_stream_t;
+using query_language::union_stream_t;
+
+typedef rdb_protocol_t::rget_read_response_t::length_t length_t;
+typedef rdb_protocol_t::rget_read_response_t::atom_t atom_t;
+
+/* Makes `num_rows` rows of about 1KB as they're asked for, and keeps track of
+how many of them are alive at once. If `counts_itself` is set, it works out a
+LENGTH without making any rows, like a table whose shards count their rows. */
+class generated_stream_t : public json_stream_t {
+public:
+    generated_stream_t(int _num_rows, bool _counts_itself)
+        : num_rows(_num_rows), counts_itself(_counts_itself), made(0), live(new int(0)), max_live(0) { }
+
+    boost::shared_ptr<scoped_cJSON_t> next() {
+        if (made == num_rows) {
+            return boost::shared_ptr<scoped_cJSON_t>();
+        }
+        scoped_cJSON_t *row = new scoped_cJSON_t(cJSON_CreateObject());
+        row->AddItemToObject("n", cJSON_CreateNumber(made));
+        row->AddItemToObject("padding", cJSON_CreateString(std::string(1000, 'x').c_str()));
+        ++made;
+        max_live = std::max(max_live, ++*live);
+        return boost::shared_ptr<scoped_cJSON_t>(row, row_deleter_t(live));
+    }
+
+    result_t apply_terminal(const rdb_protocol_details::terminal_variant_t &t, query_language::runtime_environment_t *env,
+                            const scopes_t &scopes, const backtrace_t &backtrace) {
+        if (counts_itself && boost::get<rdb_protocol_details::Length>(&t)) {
+            length_t res;
+            res.length = num_rows - made;
+            made = num_rows;
+            return res;
+        }
+        return json_stream_t::apply_terminal(t, env, scopes, backtrace);
+    }
+
+    int num_rows;
+    bool counts_itself;
+    int made;
+    boost::shared_ptr<int> live;
+    int max_live;
+
+private:
+    class row_deleter_t {
+    public:
+        explicit row_deleter_t(const boost::shared_ptr<int> &_live) : live(_live) { }
+        void operator()(scoped_cJSON_t *row) {
+            --*live;
+            delete row;
+        }
+    private:
+        boost::shared_ptr<int> live;
+    };
+};
+
+int length(json_stream_t *stream) {
+    result_t res = stream->apply_terminal(rdb_protocol_details::Length(), NULL, scopes_t(), backtrace_t());
+    return boost::get<length_t>(res).length;
+}
+
+/* A REDUCE that adds up the `n`s of the rows. */
+Reduction sum_of_n() {
+    Reduction r;
+    r.mutable_base()->set_type(Term::NUMBER);
+    r.mutable_base()->set_number(0);
+    r.set_var1("acc");
+    r.set_var2("row");
+    Term *body = r.mutable_body();
+    body->set_type(Term::CALL);
+    body->mutable_call()->mutable_builtin()->set_type(Builtin::ADD);
+    Term *lhs = body->mutable_call()->add_args();
+    lhs->set_type(Term::VAR);
+    lhs->set_var("acc");
+    Term *rhs = body->mutable_call()->add_args();
+    rhs->set_type(Term::CALL);
+    rhs->mutable_call()->mutable_builtin()->set_type(Builtin::GETATTR);
+    rhs->mutable_call()->mutable_builtin()->set_attr("n");
+    Term *row = rhs->mutable_call()->add_args();
+    row->set_type(Term::VAR);
+    row->set_var("row");
+    return r;
+}
+
+/* Makes `num_rows` numbers, letting the other coroutines go before each one
+the way a stream that waits on the network would. `*reading` counts the streams
+in `next()` at once. */
+class slow_stream_t : public json_stream_t {
+public:
+    slow_stream_t(int _num_rows, int *_reading, int *_max_reading)
+        : num_rows(_num_rows), made(0), reading(_reading), max_reading(_max_reading) { }
+
+    boost::shared_ptr<scoped_cJSON_t> next() {
+        *max_reading = std::max(*max_reading, ++*reading);
+        coro_t::yield();
+        --*reading;
+        if (made == num_rows) {
+            return boost::shared_ptr<scoped_cJSON_t>();
+        }
+        return boost::make_shared<scoped_cJSON_t>(cJSON_CreateNumber(made++));
+    }
+
+    int num_rows;
+    int made;
+
+private:
+    int *reading;
+    int *max_reading;
+};
+
+/* Two million rows of 1KB wouldn't fit in the memory of the machines this
+runs on if they were gathered up; one row at a time, they fit fine. */
+void run_length_of_union_streams_test() {
+    const int num_rows = 1000000;
+    boost::shared_ptr<generated_stream_t> a = boost::make_shared<generated_stream_t>(num_rows, false);
+    boost::shared_ptr<generated_stream_t> b = boost::make_shared<generated_stream_t>(num_rows, false);
+    union_stream_t::stream_list_t streams;
+    streams.push_back(a);
+    streams.push_back(b);
+    union_stream_t u(streams);
+
+    EXPECT_EQ(2 * num_rows, length(&u));
+    EXPECT_EQ(num_rows, a->made);
+    EXPECT_EQ(num_rows, b->made);
+    EXPECT_EQ(1, a->max_live);
+    EXPECT_EQ(1, b->max_live);
+}
+
+TEST(RDBStreamTerminals, LengthOfUnionStreams) {
+    mock::run_in_thread_pool(&run_length_of_union_streams_test);
+}
+
+void run_length_is_pushed_down_test() {
+    union_stream_t::stream_list_t streams;
+    boost::shared_ptr<generated_stream_t> a = boost::make_shared<generated_stream_t>(100, true);
+    boost::shared_ptr<generated_stream_t> b = boost::make_shared<generated_stream_t>(50, true);
+    streams.push_back(a);
+    streams.push_back(b);
+    EXPECT_EQ(150, length(boost::make_shared<union_stream_t>(streams).get()));
+    EXPECT_EQ(0, a->max_live);
+    EXPECT_EQ(0, b->max_live);
+
+    struct { int start; bool unbounded; int stop; int expected; } slices[] = {
+        { 0, true, 0, 100 }, { 30, true, 0, 70 }, { 150, true, 0, 0 },
+        { 10, false, 20, 10 }, { 90, false, 200, 10 }, { 0, false, 0, 0 },
+    };
+    for (size_t i = 0; i < sizeof(slices) / sizeof(slices[0]); ++i) {
+        boost::shared_ptr<generated_stream_t> input = boost::make_shared<generated_stream_t>(100, true);
+        slice_stream_t slice(input, slices[i].start, slices[i].unbounded, slices[i].stop);
+        EXPECT_EQ(slices[i].expected, length(&slice)) << i;
+        EXPECT_EQ(0, input->max_live);
+        EXPECT_FALSE(slice.next().get());
+
+        // Counting the rows one by one agrees.
+        slice_stream_t read_slice(boost::make_shared<generated_stream_t>(100, false),
+                                  slices[i].start, slices[i].unbounded, slices[i].stop);
+        int count = 0;
+        while (read_slice.next()) {
+            ++count;
+        }
+        EXPECT_EQ(slices[i].expected, count) << i;
+    }
+}
+
+TEST(RDBStreamTerminals, LengthIsPushedDown) {
+    mock::run_in_thread_pool(&run_length_is_pushed_down_test);
+}
+
+void run_reduce_of_union_streams_test() {
+    const int num_rows = 100000;
+    boost::shared_ptr<generated_stream_t> a = boost::make_shared<generated_stream_t>(num_rows, false);
+    boost::shared_ptr<generated_stream_t> b = boost::make_shared<generated_stream_t>(num_rows, true);
+    union_stream_t::stream_list_t streams;
+    streams.push_back(a);
+    streams.push_back(b);
+    union_stream_t u(streams);
+
+    result_t res = u.apply_terminal(sum_of_n(), NULL, scopes_t(), backtrace_t());
+    atom_t sum = boost::get<atom_t>(res);
+    EXPECT_EQ(2.0 * num_rows * (num_rows - 1) / 2, sum->get()->valuedouble);
+    EXPECT_EQ(1, a->max_live);
+    EXPECT_EQ(1, b->max_live);
+}
+
+TEST(RDBStreamTerminals, ReduceOfUnionStreams) {
+    mock::run_in_thread_pool(&run_reduce_of_union_streams_test);
+}
+
+void run_union_reads_streams_at_once_test() {
+    const int num_streams = 4;
+    const int num_rows = 1000;
+    int reading = 0, max_reading = 0;
+    union_stream_t::stream_list_t streams;
+    for (int i = 0; i < num_streams; ++i) {
+        streams.push_back(boost::make_shared<slow_stream_t>(num_rows, &reading, &max_reading));
+    }
+    union_stream_t u(streams);
+
+    std::vector<int> counts(num_rows, 0);
+    int total = 0;
+    while (boost::shared_ptr<scoped_cJSON_t> json = u.next()) {
+        ++counts[json->get()->valueint];
+        ++total;
+    }
+    EXPECT_EQ(num_streams * num_rows, total);
+    for (int i = 0; i < num_rows; ++i) {
+        EXPECT_EQ(num_streams, counts[i]) << i;
+    }
+    EXPECT_EQ(num_streams, max_reading);
+}
+
+TEST(RDBStreamTerminals, UnionReadsStreamsAtOnce) {
+    mock::run_in_thread_pool(&run_union_reads_streams_at_once_test);
+}
+
+void run_union_stops_reading_between_calls_test() {
+    int reading = 0, max_reading = 0;
+    boost::shared_ptr<slow_stream_t> a = boost::make_shared<slow_stream_t>(1000, &reading, &max_reading);
+    boost::shared_ptr<slow_stream_t> b = boost::make_shared<slow_stream_t>(1000, &reading, &max_reading);
+    union_stream_t::stream_list_t streams;
+    streams.push_back(a);
+    streams.push_back(b);
+    union_stream_t u(streams);
+
+    ASSERT_TRUE(u.next().get());
+    EXPECT_EQ(0, reading);
+    for (int i = 0; i < 100; ++i) {
+        coro_t::yield();
+    }
+    // The streams may need the query's environment, which is gone until the
+    // next CONTINUE, so nothing reads them until the client asks again.
+    EXPECT_EQ(1, a->made);
+    EXPECT_EQ(1, b->made);
+
+    ASSERT_TRUE(u.next().get());
+    EXPECT_EQ(1, a->made);
+    EXPECT_EQ(1, b->made);
+    ASSERT_TRUE(u.next().get());
+    EXPECT_EQ(2, a->made);
+    EXPECT_EQ(2, b->made);
+}
+
+TEST(RDBStreamTerminals, UnionStopsReadingBetweenCalls) {
+    mock::run_in_thread_pool(&run_union_stops_reading_between_calls_test);
+}
+
+}  // namespace unittest
@@ -13,19 +13,30 @@
 namespace unittest {
 
 /* `recording_test_application_t` sends and receives integers over a
-`message_service_t`. It keeps track of the integers it has received.
+`message_service_t`. It keeps track of the integers it has received. Several
+applications can share one sequence of arrival times, so that the order of
+messages that arrive at different applications can be checked.
 */
 
 class recording_test_application_t : public home_thread_mixin_t, public message_handler_t {
 public:
     explicit recording_test_application_t(message_service_t *s) :
         service(s),
-        sequence_number(0)
+        own_sequence_number(0),
+        sequence_number(&own_sequence_number)
+        { }
+    recording_test_application_t(message_service_t *s, int *shared_sequence_number) :
+        service(s),
+        own_sequence_number(0),
+        sequence_number(shared_sequence_number)
         { }
     void send(int message, peer_id_t peer) {
+        send_on_stripe(message, peer, 0);
+    }
+    void send_on_stripe(int message, peer_id_t peer, uint64_t stripe) {
         class writer_t : public send_message_write_callback_t {
         public:
-            explicit writer_t(int _data) : data(_data) { }
+            writer_t(int _data, uint64_t _stripe) : data(_data), stripe(_stripe) { }
             virtual ~writer_t() { }
             void write(write_stream_t *stream) {
                 write_message_t msg;
@@ -33,8 +44,12 @@ public:
                 int res = send_write_message(stream, &msg);
                 if (res) { throw fake_archive_exc_t(); }
             }
+            uint64_t get_stripe() {
+                return stripe;
+            }
             int32_t data;
-        } writer(message);
+            uint64_t stripe;
+        } writer(message, stripe);
         service->send_message(peer, &writer);
     }
     void expect(int message, peer_id_t peer) {
@@ -56,6 +71,12 @@ public:
         assert_thread();
         EXPECT_LT(timing[first], timing[second]);
     }
+    void expect_order(int first, recording_test_application_t *other, int second) {
+        expect_delivered(first);
+        other->expect_delivered(second);
+        assert_thread();
+        EXPECT_LT(timing[first], other->timing[second]);
+    }
 
 private:
     void on_message(peer_id_t peer, read_stream_t *stream) {
@@ -64,13 +85,14 @@ private:
         if (res) { throw fake_archive_exc_t(); }
         on_thread_t th(home_thread());
         inbox[i] = peer;
-        timing[i] = sequence_number++;
+        timing[i] = (*sequence_number)++;
     }
 
     message_service_t *service;
     std::map<int, peer_id_t> inbox;
     std::map<int, int> timing;
-    int sequence_number;
+    int own_sequence_number;
+    int *sequence_number;
 };
 
 /* `StartStop` starts a cluster of three nodes, then shuts it down again. */
@@ -194,6 +216,44 @@ TEST(RPCConnectivityTest, OrderingMultiThread) {
     mock::run_in_thread_pool(&run_ordering_test, 3);
 }
 
+/* `StripedOrdering` tests that when there are several connections to a peer,
+messages on the same stripe still arrive in the order they were sent in, and
+messages on every stripe get delivered. */
+
+void run_striped_ordering_test() {
+    int port = mock::randport();
+    connectivity_cluster_t c1, c2;
+    recording_test_application_t a1(&c1), a2(&c2);
+    connectivity_cluster_t::run_t cr1(&c1, port, &a1, 0, 4), cr2(&c2, port+1, &a2, 0, 4);
+
+    cr1.join(c2.get_peer_address(c2.get_me()));
+
+    mock::let_stuff_happen();
+
+    const int num_stripes = 7, per_stripe = 20;
+    for (int i = 0; i < per_stripe; i++) {
+        for (int stripe = 0; stripe < num_stripes; stripe++) {
+            a1.send_on_stripe(stripe * per_stripe + i, c2.get_me(), stripe);
+            a2.send_on_stripe(stripe * per_stripe + i, c1.get_me(), stripe);
+        }
+    }
+
+    mock::let_stuff_happen();
+
+    for (int stripe = 0; stripe < num_stripes; stripe++) {
+        for (int i = 0; i < per_stripe - 1; i++) {
+            a1.expect_order(stripe * per_stripe + i, stripe * per_stripe + i + 1);
+            a2.expect_order(stripe * per_stripe + i, stripe * per_stripe + i + 1);
+        }
+    }
+}
+TEST(RPCConnectivityTest, StripedOrdering) {
+    mock::run_in_thread_pool(&run_striped_ordering_test);
+}
+TEST(RPCConnectivityTest, StripedOrderingMultiThread) {
+    mock::run_in_thread_pool(&run_striped_ordering_test, 3);
+}
+
 /* `GetPeersList` confirms that the behavior of `cluster_t::get_peers_list()` is
 correct. */
 
@@ -487,6 +547,57 @@ TEST(RPCConnectivityTest, Multiplexer) {
     mock::run_in_thread_pool(&run_multiplexer_test);
 }
 
+/* `MultiplexerStripedOrdering` checks what ordering the clients of a
+multiplexer get when there are several connections to a peer. The multiplexer
+doesn't order its clients' messages against each other; a message is only held
+behind earlier ones on the same stripe, whichever client sent them. So messages
+on the control stripe stay in order across clients, as the directory's and the
+semilattice metadata's do, and messages on any other stripe stay in order
+across clients too. */
+
+void run_multiplexer_striped_ordering_test() {
+    int port = mock::randport();
+    connectivity_cluster_t c1, c2;
+    message_multiplexer_t c1m(&c1), c2m(&c2);
+    int c2_sequence_number = 0;
+    message_multiplexer_t::client_t c1mcA(&c1m, 'A'), c2mcA(&c2m, 'A');
+    recording_test_application_t c1aA(&c1mcA), c2aA(&c2mcA, &c2_sequence_number);
+    message_multiplexer_t::client_t::run_t c1mcAr(&c1mcA, &c1aA), c2mcAr(&c2mcA, &c2aA);
+    message_multiplexer_t::client_t c1mcB(&c1m, 'B'), c2mcB(&c2m, 'B');
+    recording_test_application_t c1aB(&c1mcB), c2aB(&c2mcB, &c2_sequence_number);
+    message_multiplexer_t::client_t::run_t c1mcBr(&c1mcB, &c1aB), c2mcBr(&c2mcB, &c2aB);
+    message_multiplexer_t::run_t c1mr(&c1m), c2mr(&c2m);
+    connectivity_cluster_t::run_t c1r(&c1, port, &c1mr, 0, 4), c2r(&c2, port+1, &c2mr, 0, 4);
+
+    c1r.join(c2.get_peer_address(c2.get_me()));
+    mock::let_stuff_happen();
+
+    // Client A sends even numbers and client B odd ones, alternating, so
+    // on each stripe the messages should arrive in the order of their numbers.
+    const int num_stripes = 5, per_stripe = 20;
+    for (int i = 0; i < per_stripe; i += 2) {
+        for (int stripe = 0; stripe < num_stripes; stripe++) {
+            c1aA.send_on_stripe(stripe * per_stripe + i, c2.get_me(), stripe);
+            c1aB.send_on_stripe(stripe * per_stripe + i + 1, c2.get_me(), stripe);
+        }
+    }
+
+    mock::let_stuff_happen();
+
+    for (int stripe = 0; stripe < num_stripes; stripe++) {
+        for (int i = 0; i < per_stripe - 2; i += 2) {
+            c2aA.expect_order(stripe * per_stripe + i, &c2aB, stripe * per_stripe + i + 1);
+            c2aB.expect_order(stripe * per_stripe + i + 1, &c2aA, stripe * per_stripe + i + 2);
+        }
+    }
+}
+TEST(RPCConnectivityTest, MultiplexerStripedOrdering) {
+    mock::run_in_thread_pool(&run_multiplexer_striped_ordering_test);
+}
+TEST(RPCConnectivityTest, MultiplexerStripedOrderingMultiThread) {
+    mock::run_in_thread_pool(&run_multiplexer_striped_ordering_test, 3);
+}
+
 /* `BinaryData` makes sure that any octet can be sent over the wire. */
 
 class binary_test_application_t : public message_handler_t {
@@ -0,0 +1,139 @@
+#!/usr/bin/python
+# Copyright 2010-2012 RethinkDB, all rights reserved.
+import sys, os, struct
+sys.path.append(os.path.abspath(os.path.join(os.path.dirname(__file__), os.path.pardir, 'common')))
+import memcached_workload_common
+from vcoptparse import *
+
+HEADER = struct.Struct("!BBHBBHIIQ")
+
+GET, SET, ADD, REPLACE, DELETE, INCREMENT = 0x00, 0x01, 0x02, 0x03, 0x04, 0x05
+QUIT, GETQ, NOOP, VERSION, GETK, GETKQ, APPEND = 0x07, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e
+SETQ, DELETEQ = 0x11, 0x14
+
+OK, KEY_NOT_FOUND, KEY_EXISTS, TOO_LARGE, NOT_STORED, UNKNOWN_COMMAND = 0x00, 0x01, 0x02, 0x03, 0x05, 0x81
+
+def request(opcode, key = "", value = "", extras = "", opaque = 0, cas = 0):
+    body = extras + key + value
+    return HEADER.pack(0x80, opcode, len(key), len(extras), 0, 0, len(body), opaque, cas) + body
+
+def recv_exactly(s, n):
+    data = ""
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            raise ValueError("Connection closed by server")
+        data += chunk
+    return data
+
+def read_response(s):
+    magic, opcode, key_len, extras_len, _, status, body_len, opaque, cas = HEADER.unpack(recv_exactly(s, HEADER.size))
+    if magic != 0x81:
+        raise ValueError("Bad response magic: %#x" % magic)
+    body = recv_exactly(s, body_len)
+    return {"opcode": opcode, "status": status, "opaque": opaque, "cas": cas,
+            "extras": body[:extras_len], "key": body[extras_len:extras_len + key_len],
+            "value": body[extras_len + key_len:]}
+
+def expect(response, opcode, status, value = None):
+    if response["opcode"] != opcode or response["status"] != status:
+        raise ValueError("Expected opcode %#x status %#x, got %r" % (opcode, status, response))
+    if value is not None and response["value"] != value:
+        raise ValueError("Expected value %r, got %r" % (value, response))
+
+def set_extras(flags = 0, exptime = 0):
+    return struct.pack("!II", flags, exptime)
+
+op = memcached_workload_common.option_parser_for_socket()
+op["num_keys"] = IntFlag("--num-keys", 1000)
+opts = op.parse(sys.argv)
+
+with memcached_workload_common.make_socket_connection(opts) as s:
+
+    print "Basic operations"
+
+    s.send(request(SET, "foo", "bar", set_extras(flags = 123)))
+    expect(read_response(s), SET, OK)
+
+    s.send(request(GET, "foo", opaque = 42))
+    response = read_response(s)
+    expect(response, GET, OK, "bar")
+    if struct.unpack("!I", response["extras"])[0] != 123 or response["opaque"] != 42:
+        raise ValueError("Bad flags or opaque in get response: %r" % response)
+
+    s.send(request(GETK, "foo"))
+    response = read_response(s)
+    expect(response, GETK, OK, "bar")
+    if response["key"] != "foo":
+        raise ValueError("getk didn't return the key: %r" % response)
+
+    s.send(request(ADD, "foo", "baz", set_extras()))
+    expect(read_response(s), ADD, KEY_EXISTS)
+
+    s.send(request(REPLACE, "nonexistent", "baz", set_extras()))
+    expect(read_response(s), REPLACE, KEY_NOT_FOUND)
+
+    s.send(request(APPEND, "foo", "baz"))
+    expect(read_response(s), APPEND, OK)
+
+    s.send(request(GET, "foo"))
+    expect(read_response(s), GET, OK, "barbaz")
+
+    s.send(request(SET, "counter", "10", set_extras()))
+    expect(read_response(s), SET, OK)
+
+    s.send(request(INCREMENT, "counter", extras = struct.pack("!QQI", 5, 0, 0xffffffff)))
+    response = read_response(s)
+    expect(response, INCREMENT, OK)
+    if struct.unpack("!Q", response["value"])[0] != 15:
+        raise ValueError("Bad increment result: %r" % response)
+
+    s.send(request(DELETE, "foo"))
+    expect(read_response(s), DELETE, OK)
+
+    s.send(request(GET, "foo"))
+    expect(read_response(s), GET, KEY_NOT_FOUND)
+
+    s.send(request(0x42))
+    expect(read_response(s), 0x42, UNKNOWN_COMMAND)
+
+    s.send(request(VERSION))
+    expect(read_response(s), VERSION, OK)
+
+    # A value over the 10 MB limit is refused, and the connection carries on
+    # with the next request.
+    s.sendall(request(SET, "huge", "x" * (10 * 1024 * 1024 + 1), set_extras()) + request(NOOP))
+    expect(read_response(s), SET, TOO_LARGE)
+    expect(read_response(s), NOOP, OK)
+
+    s.send(request(GET, "huge"))
+    expect(read_response(s), GET, KEY_NOT_FOUND)
+
+    print "Quiet pipelining"
+
+    keys = [str(i) for i in xrange(opts["num_keys"])]
+
+    # Quiet sets produce no responses, so the noop response must be the
+    # very next thing we read.
+    s.send("".join(request(SETQ, key, key, set_extras()) for key in keys) + request(NOOP))
+    expect(read_response(s), NOOP, OK)
+
+    # Every other key is missing; quiet gets only answer the hits.
+    s.send("".join(request(DELETEQ, key) for key in keys[1::2]) + request(NOOP))
+    expect(read_response(s), NOOP, OK)
+
+    s.send("".join(request(GETKQ, key) for key in keys) + request(NOOP))
+    for key in keys[0::2]:
+        response = read_response(s)
+        expect(response, GETKQ, OK, key)
+        if response["key"] != key:
+            raise ValueError("Responses out of order: expected key %r, got %r" % (key, response))
+    expect(read_response(s), NOOP, OK)
+
+    # Errors are still reported for quiet storage commands.
+    s.send(request(GETQ, "missing") + request(DELETEQ, "missing") + request(NOOP))
+    expect(read_response(s), DELETEQ, KEY_NOT_FOUND)
+    expect(read_response(s), NOOP, OK)
+
+    s.send(request(QUIT))
+    expect(read_response(s), QUIT, OK)